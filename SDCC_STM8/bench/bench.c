@@ -0,0 +1,390 @@
+/**
+  ******************************************************************************
+  * @file bench.c
+  * @brief Cycle count and stack benchmark of the ISR/control path (ucsim)
+  * @author Neidermeier
+  * @version
+  * @date
+  ******************************************************************************
+  */
+/*
+ * The real control path modules are linked with the peripherals they reach
+ * through mcu_stm8s.c stubbed out, and run open-loop (no interrupts) in the
+ * ucsim STM8 simulator: each function is called in the order and at about the
+ * relative rate of the firmware (PWM cycle, commutation, control tick) while
+ * the motor starts up on the commanded duty-cycle.
+ *
+ * TIM1 is free-running at fMASTER (prescaler 1) so the counts are CPU cycles,
+ * less the overhead of the counter reads. The stack is painted below the SP
+ * before each call and the high-water mark is the lowest location overwritten.
+ *
+ * The result is a CSV table on UART2, one line per function:
+ *   name,calls,cyc_min,cyc_avg,cyc_max,stack
+ *
+ * The counts are of the simulator, without the interrupt entry/exit and with
+ * the peripherals stubbed, so they compare builds and changes of the code
+ * rather than measure the ISR budget of the target. There are no reference
+ * counts yet (see README.md).
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include "system.h"
+#include "bldc_sm.h"
+#include "driver.h"
+#include "faultm.h"
+#include "mcu_stm8s.h"
+#include "mdata.h"
+#include "pwm_stm8s.h"
+#include "sequence.h"
+
+
+/* Private defines -----------------------------------------------------------*/
+
+#if defined( BENCH_OPT )
+  #define BENCH_FLAGS_NAME  "opt"   // Cosmic-equivalent (static locals, peephole)
+#else
+  #define BENCH_FLAGS_NAME  "sdcc"  // the SDCC_STM8/makefile build flags
+#endif
+
+// STM8S105: 2k RAM, the stack is the top 512 bytes
+#define BENCH_STACK_BOTTOM  0x0600
+#define BENCH_STACK_MARK    0xA5
+#define BENCH_STACK_MARGIN  16   // not painted below the SP, the paint call frame
+
+// PWM cycles of the run, and per commutation and PWM cycles per control tick
+#define BENCH_NR_FRAMES     4096
+#define BENCH_COMM_FRAMES   8
+#define BENCH_CTRL_FRAMES   16
+
+// UART2 115200 baud at 16 MHz, BRR2 holds the MSB and LSB nibbles of the divider
+#define BENCH_UART_BRR1     0x08
+#define BENCH_UART_BRR2     0x0B
+
+// speed command of the run
+#define BENCH_THROTTLE      0x40
+
+
+/* Private types -------------------------------------------------------------*/
+
+typedef enum
+{
+  BENCH_SEQUENCE_STEP = 0,
+  BENCH_DRIVER_STEP,
+  BENCH_DRIVER_UPDATE,
+  BENCH_BLDC_UPDATE,
+  BENCH_ADC_CONV,
+  BENCH_FAULTM_UPD,
+  BENCH_NR_FUNCS
+} bench_ID_t;
+
+typedef struct
+{
+  uint16_t calls;
+  uint16_t cyc_min;
+  uint16_t cyc_max;
+  uint32_t cyc_sum;
+  uint16_t stack;
+} bench_stats_t;
+
+
+/* Private variables ---------------------------------------------------------*/
+
+static const char * const Bench_names[ BENCH_NR_FUNCS ] =
+{
+  "Sequence_Step",
+  "Driver_Step",
+  "Driver_Update",
+  "BLDC_Update",
+  "Driver_on_ADC_conv",
+  "Faultm_upd"
+};
+
+static bench_stats_t Bench_stats[ BENCH_NR_FUNCS ];
+
+static uint16_t Bench_overhead; // cycles of an empty measurement
+
+
+/* Private functions ---------------------------------------------------------*/
+
+/*
+ * reading CNTRH latches CNTRL
+ */
+static uint16_t bench_count(void)
+{
+  uint16_t count = (uint16_t)TIM1->CNTRH << 8;
+
+  return count | TIM1->CNTRL;
+}
+
+/*
+ * SP of the caller (less the return address), the 16-bit result is in X
+ */
+static uint16_t bench_sp(void) __naked
+{
+  __asm
+    ldw x, sp
+    addw x, #2
+    ret
+  __endasm;
+}
+
+static void bench_paint(uint16_t sp)
+{
+  volatile uint8_t * p = (volatile uint8_t *)BENCH_STACK_BOTTOM;
+
+  while ( (uint16_t)p < sp - BENCH_STACK_MARGIN )
+  {
+    *p++ = BENCH_STACK_MARK;
+  }
+}
+
+static uint16_t bench_depth(uint16_t sp)
+{
+  volatile uint8_t * p = (volatile uint8_t *)BENCH_STACK_BOTTOM;
+
+  while ( (uint16_t)p < sp && BENCH_STACK_MARK == *p )
+  {
+    p++;
+  }
+  return sp - (uint16_t)p;
+}
+
+static void bench_record(bench_ID_t id, uint16_t cycles, uint16_t depth)
+{
+  bench_stats_t * ps = &Bench_stats[ id ];
+
+  cycles = (cycles > Bench_overhead) ? cycles - Bench_overhead : 0;
+
+  if (0 == ps->calls || cycles < ps->cyc_min)
+  {
+    ps->cyc_min = cycles;
+  }
+  if (cycles > ps->cyc_max)
+  {
+    ps->cyc_max = cycles;
+  }
+  if (depth > ps->stack)
+  {
+    ps->stack = depth;
+  }
+  ps->cyc_sum += cycles;
+  ps->calls += 1;
+}
+
+/*
+ * The stack is painted outside of the timed section, the depth is from the SP
+ * at the call.
+ */
+#define BENCH( _ID_, _CALL_ ) \
+  do { \
+    uint16_t sp = bench_sp(); \
+    uint16_t t0; \
+    uint16_t dt; \
+    bench_paint(sp); \
+    t0 = bench_count(); \
+    _CALL_; \
+    dt = bench_count() - t0; \
+    bench_record(_ID_, dt, bench_depth(sp)); \
+  } while (0)
+
+static void bench_setup(void)
+{
+  CLK->CKDIVR = 0; // HSI/1, fMASTER == fCPU == 16 MHz
+
+  // TIM1 free-running at fMASTER
+  TIM1->PSCRH = 0;
+  TIM1->PSCRL = 0;
+  TIM1->ARRH = 0xFF;
+  TIM1->ARRL = 0xFF;
+  TIM1->EGR = TIM1_EGR_UG;
+  TIM1->CR1 = TIM1_CR1_CEN;
+
+  UART2->BRR2 = BENCH_UART_BRR2;
+  UART2->BRR1 = BENCH_UART_BRR1;
+  UART2->CR2 = UART2_CR2_TEN;
+}
+
+static void bench_calibrate(void)
+{
+  uint8_t n;
+
+  for (n = 0; n < 8; n++)
+  {
+    uint16_t t0 = bench_count();
+    uint16_t dt = bench_count() - t0;
+
+    if (0 == n || dt < Bench_overhead)
+    {
+      Bench_overhead = dt;
+    }
+  }
+}
+
+static void bench_run(void)
+{
+  Driver_command_t cmd = { BENCH_THROTTLE, 0, FALSE };
+  uint8_t frames_per_upd = PWM_get_frames_per_upd();
+  uint8_t upd_count = 0;
+  uint16_t frame;
+
+  Driver_set_command(&cmd);
+
+  for (frame = 0; frame < BENCH_NR_FRAMES; frame++)
+  {
+    BENCH( BENCH_ADC_CONV, Driver_on_ADC_conv() );
+
+    if (++upd_count >= frames_per_upd)
+    {
+      upd_count = 0;
+      BENCH( BENCH_DRIVER_UPDATE, Driver_Update() );
+    }
+    Driver_on_PWM_edge();
+
+    // the commutation alternately through the driver and the sequence directly
+    if (0 == (frame % BENCH_COMM_FRAMES))
+    {
+      if (0 == (frame & BENCH_COMM_FRAMES))
+      {
+        BENCH( BENCH_DRIVER_STEP, Driver_Step() );
+      }
+      else
+      {
+        BENCH( BENCH_SEQUENCE_STEP, Sequence_Step() );
+      }
+    }
+    if (0 == (frame % BENCH_CTRL_FRAMES))
+    {
+      BENCH( BENCH_BLDC_UPDATE, BLDC_Update() );
+    }
+
+    // auto-clear fault, asserted in bursts so that it is set and cleared
+    BENCH( BENCH_FAULTM_UPD,
+           Faultm_upd( THROTTLE_HI, (faultm_assert_t)( 0 != (frame & 0x40) ) ) );
+  }
+}
+
+static void bench_report(void)
+{
+  uint8_t n;
+
+  printf("# bench %s cycles at fMASTER, stack in bytes\r\n", BENCH_FLAGS_NAME);
+  printf("name,calls,cyc_min,cyc_avg,cyc_max,stack\r\n");
+
+  for (n = 0; n < BENCH_NR_FUNCS; n++)
+  {
+    const bench_stats_t * ps = &Bench_stats[ n ];
+    uint16_t avg = (0 != ps->calls) ? (uint16_t)( ps->cyc_sum / ps->calls ) : 0;
+
+    printf("%s,%u,%u,%u,%u,%u\r\n",
+           Bench_names[ n ], ps->calls, ps->cyc_min, avg, ps->cyc_max, ps->stack);
+  }
+  printf("# end\r\n");
+}
+
+
+/* Public functions ---------------------------------------------------------*/
+
+/*
+ * Stubs of mcu_stm8s.c: TIM3 (commutation timer) and EEPROM are not used in
+ * the benchmark, the commutation is called at a fixed rate.
+ */
+void MCU_set_comm_timer(uint16_t period)
+{
+  (void)period;
+}
+
+void MCU_stop_comm_timer(void)
+{
+}
+
+uint16_t MCU_get_comm_timer_count(void)
+{
+  return 0;
+}
+
+void MCU_restart_comm_timer(uint16_t count, uint16_t period)
+{
+  (void)count;
+  (void)period;
+}
+
+void MCU_set_comm_compare(uint8_t chan, uint16_t count)
+{
+  (void)chan;
+  (void)count;
+}
+
+void MCU_enable_comm_compare(uint8_t chan, uint8_t enable)
+{
+  (void)chan;
+  (void)enable;
+}
+
+void MCU_EEPROM_read(uint8_t offs, uint8_t * pdata, uint8_t nbytes)
+{
+  (void)offs;
+
+  while (nbytes-- > 0)
+  {
+    *pdata++ = 0; // erased, the defaults are loaded
+  }
+}
+
+void MCU_EEPROM_write(uint8_t offs, const uint8_t * pdata, uint8_t nbytes)
+{
+  (void)offs;
+  (void)pdata;
+  (void)nbytes;
+}
+
+/*
+ * polled, the report is at the end of the run
+ */
+PUTCHAR_PROTOTYPE
+{
+  while (0 == (UART2->SR & UART2_SR_TXE))
+  {
+    ;
+  }
+  UART2->DR = (uint8_t)c;
+
+  return c;
+}
+
+/*
+ * interrupts are left disabled: the ISR handlers are not linked, the ISR
+ * functions are called from the benchmark loop
+ */
+void main(void)
+{
+  bench_setup();
+  bench_calibrate();
+
+  // as MCU_Init() and main()
+  PWM_setup();
+  Load_OL_Timing();
+  BL_reset();
+
+  bench_run();
+  bench_report();
+
+  while (1)
+  {
+    ;
+  }
+}
+
+/**
+ * @brief  SPL parameter check (USE_FULL_ASSERT).
+ */
+void assert_failed(uint8_t* file, uint32_t line)
+{
+  (void)file;
+  (void)line;
+
+  while (1)
+  {
+    ;
+  }
+}
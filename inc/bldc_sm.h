@@ -51,6 +51,10 @@ void BLDC_PWMDC_Set(uint8_t dc);
 uint16_t BLDC_PWMDC_Get(void);
 
 void BL_reset(void);
+void BL_set_decel(uint8_t enable);
+void BL_set_vbatt_comp(uint8_t enable);
+void BL_set_dc_limits(uint8_t startup, uint8_t shutoff);
+void BL_set_timing_gains(uint8_t kp, uint8_t ki);
 
 BL_RUNSTATE_t BL_get_state(void);
 uint8_t BL_get_ct_mode(void);
@@ -0,0 +1,326 @@
+/**
+  ******************************************************************************
+  * @file board.h
+  * @brief Board descriptors: timer, channel and pin assignment of each board
+  * @author Neidermeier
+  * @version
+  * @date
+  ******************************************************************************
+  *
+  * The board is defined in the project file (S105_DEV, S105_DISCOVERY or
+  * S003_DEV), along with the STM8 variant. Each board is a single descriptor
+  * block of its pin routing, the timer and channel numbers of the PWM, the
+  * commutation timer and the servo input capture, and the board features.
+  *
+  * The timer and channel numbers are resolved at compile time to the register
+  * names (PWM_TIM, COMM_TIM, CAP_TIM ...) so that the ISR code is direct
+  * register loads and stores, with no SPL call and no test of the board.
+  */
+#ifndef BOARD_H
+#define BOARD_H
+
+/* Board descriptors ---------------------------------------------------------*/
+
+#if defined ( S105_DEV )
+/*
+ * TIM2 CH3 pin is not available (unless by alt. function) so the PWM is on
+ * TIM1, which also has the TRGO to start the ADC. TIM2 is left for the servo
+ * input capture.
+ */
+  #define BOARD_PWM_TIM      1
+  #define BOARD_PWM_CH_A     2  // C2
+  #define BOARD_PWM_CH_B     3  // C3
+  #define BOARD_PWM_CH_C     4  // C4
+
+  #define BOARD_COMM_TIM     3
+
+  #define BOARD_CAP_TIM      2
+  #define BOARD_CAP_CH_RISE  1  // D4
+  #define BOARD_CAP_CH_FALL  2  // indirect TI1
+
+  #define ESTOP_BTN_IN_PORT  GPIOF
+  #define ESTOP_BTN_IN_PIN   GPIO_PIN_4
+
+// AIN0, B0
+  #define PH0_BEMF_IN_PORT   GPIOB
+  #define PH0_BEMF_IN_PIN    GPIO_PIN_0
+
+// AIN1, B1
+  #define ISHUNT_IN_PORT     GPIOB
+  #define ISHUNT_IN_PIN      GPIO_PIN_1
+
+// AIN2, B2 and AIN4, B4
+  #define PH1_BEMF_IN_PORT   GPIOB
+  #define PH1_BEMF_IN_PIN    GPIO_PIN_2
+  #define PH2_BEMF_IN_PORT   GPIOB
+  #define PH2_BEMF_IN_PIN    GPIO_PIN_4
+
+  #define LED_GPIO_PORT    GPIOE
+  #define LED_GPIO_PIN     GPIO_PIN_5
+
+  #define SERVO_GPIO_PORT  GPIOD
+  #define SERVO_GPIO_PIN   GPIO_PIN_4
+
+// IR2104 /SD, leave D3 and D4 available for servo pulse input capture (TIM2 CH1 and CH2)
+  #define SDa_SD_PIN  GPIO_PIN_0  // D0
+  #define SDb_SD_PIN  GPIO_PIN_2  // D2
+  #define SDc_SD_PIN  GPIO_PIN_1  // A1
+
+  #define SDa_SD_PORT  GPIOD  // D0
+  #define SDb_SD_PORT  GPIOD  // D2
+  #define SDc_SD_PORT  GPIOA  // A1
+
+// the /SD pins by GPIO port (see pwm_stm8s.h)
+  #define SD_NR_PORTS   2
+  #define SD_PORT_0     GPIOD  // D0, D2
+  #define SD_PORT_1     GPIOA  // A1
+  #define SD_PORT_0_PINS( _EN_ ) \
+    ( SD_PIN_EN( _EN_, PWM_PH_A, SDa_SD_PIN ) | SD_PIN_EN( _EN_, PWM_PH_B, SDb_SD_PIN ) )
+  #define SD_PORT_1_PINS( _EN_ ) \
+    ( SD_PIN_EN( _EN_, PWM_PH_C, SDc_SD_PIN ) )
+
+// PWM timer channel pins
+  #define SDa_PWM_PIN  GPIO_PIN_2 // C2
+  #define SDb_PWM_PIN  GPIO_PIN_3 // C3
+  #define SDc_PWM_PIN  GPIO_PIN_4 // C4
+
+  #define SDa_PWM_PORT  GPIOC
+  #define SDb_PWM_PORT  GPIOC
+  #define SDc_PWM_PORT  GPIOC
+
+  #define HAS_SERVO_INPUT
+  #define SPI_ENABLED      SPI_STM8_MASTER
+
+  #define UNDERVOLTAGE_FAULT_ENABLED
+  #define TRACE_ENABLED
+
+  #define ADC_VREF_MV      3300
+
+// the ADC external trigger is only from TIM1 TRGO, so only possible where TIM1 has the PWM
+  #define ADC_HW_TRIGGER
+
+#elif defined ( S105_DISCOVERY )
+/*
+ * S105 Discovery board can't use TIM1 for PWM (unless solder bridges connecting the
+ * touch sensor are removed). Therefore, TIM2 drives PWM/controller, and TIM3 to
+ * drive the commutation step, leaving TIM1 for the input capture of the servo
+ * signal from R/C radio or flight controller.
+ */
+  #define BOARD_PWM_TIM      2
+  #define BOARD_PWM_CH_A     1  // D4
+  #define BOARD_PWM_CH_B     2  // D3
+  #define BOARD_PWM_CH_C     3  // A3
+
+  #define BOARD_COMM_TIM     3
+
+  #define BOARD_CAP_TIM      1
+  #define BOARD_CAP_CH_RISE  4  // C4
+  #define BOARD_CAP_CH_FALL  3  // indirect TI4
+
+// external high-speed crystal
+  #define BOARD_CLK_HSE
+
+  #define ESTOP_BTN_IN_PORT  GPIOA
+  #define ESTOP_BTN_IN_PIN   GPIO_PIN_4
+
+// AIN0, B0
+  #define PH0_BEMF_IN_PORT   GPIOB
+  #define PH0_BEMF_IN_PIN    GPIO_PIN_0
+
+// AIN1, B1
+  #define ISHUNT_IN_PORT     GPIOB
+  #define ISHUNT_IN_PIN      GPIO_PIN_1
+
+// AIN2, B2 and AIN4, B4
+  #define PH1_BEMF_IN_PORT   GPIOB
+  #define PH1_BEMF_IN_PIN    GPIO_PIN_2
+  #define PH2_BEMF_IN_PORT   GPIOB
+  #define PH2_BEMF_IN_PIN    GPIO_PIN_4
+
+  #define LED_GPIO_PORT    GPIOD
+  #define LED_GPIO_PIN     GPIO_PIN_0
+
+  #define SERVO_GPIO_PORT  GPIOC
+  #define SERVO_GPIO_PIN   GPIO_PIN_4
+
+// IR2104 /SD
+  #define SDa_SD_PIN  GPIO_PIN_2  // D2
+  #define SDb_SD_PIN  GPIO_PIN_0  // E0
+  #define SDc_SD_PIN  GPIO_PIN_5  // A5
+
+  #define SDa_SD_PORT  GPIOD
+  #define SDb_SD_PORT  GPIOE
+  #define SDc_SD_PORT  GPIOA
+
+  #define SD_NR_PORTS   3
+  #define SD_PORT_0     GPIOD  // D2
+  #define SD_PORT_1     GPIOE  // E0
+  #define SD_PORT_2     GPIOA  // A5
+  #define SD_PORT_0_PINS( _EN_ )  ( SD_PIN_EN( _EN_, PWM_PH_A, SDa_SD_PIN ) )
+  #define SD_PORT_1_PINS( _EN_ )  ( SD_PIN_EN( _EN_, PWM_PH_B, SDb_SD_PIN ) )
+  #define SD_PORT_2_PINS( _EN_ )  ( SD_PIN_EN( _EN_, PWM_PH_C, SDc_SD_PIN ) )
+
+// PWM timer channel pins
+  #define SDa_PWM_PIN  GPIO_PIN_4 // D4
+  #define SDb_PWM_PIN  GPIO_PIN_3 // D3
+  #define SDc_PWM_PIN  GPIO_PIN_3 // A3
+
+  #define SDa_PWM_PORT  GPIOD
+  #define SDb_PWM_PORT  GPIOD
+  #define SDc_PWM_PORT  GPIOA
+
+  #define SPI_ENABLED      SPI_STM8_MASTER
+  #define HAS_SERVO_INPUT
+
+  #define UNDERVOLTAGE_FAULT_ENABLED
+  #define TRACE_ENABLED
+
+  #define ADC_VREF_MV      5000
+
+#elif defined ( S003_DEV )
+/*
+ * s003 does not have TIM3. TIM2 drives PWM/control, TIM1 drives commutation step.
+ * Not likely to use the 8k flash part, code barely or does not fit.
+ */
+  #define BOARD_PWM_TIM      2
+  #define BOARD_PWM_CH_A     1  // D4
+  #define BOARD_PWM_CH_B     2  // D3
+  #define BOARD_PWM_CH_C     3  // A3
+
+  #define BOARD_COMM_TIM     1
+
+  #define BOARD_CAP_TIM      0  // no timer available
+
+// C4 is ok so long as AIN3 is not needed
+  #define ESTOP_BTN_IN_PORT  GPIOD
+  #define ESTOP_BTN_IN_PIN   GPIO_PIN_2
+
+// AIN2, C4
+  #define PH0_BEMF_IN_PORT   GPIOC
+  #define PH0_BEMF_IN_PIN    GPIO_PIN_4 // B4 is not HS (TTL)
+
+  #define LED_GPIO_PORT    GPIOB
+  #define LED_GPIO_PIN     GPIO_PIN_5
+
+// invalid .. no timer avilable ?
+  #define SERVO_GPIO_PORT  (GPIO_TypeDef *)-1
+  #define SERVO_GPIO_PIN   (uint8_t)-1
+
+// IR2104 /SD, SPI not enabled so three drive pins useable
+  #define SDa_SD_PIN  GPIO_PIN_7 // C7
+  #define SDb_SD_PIN  GPIO_PIN_6 // C6
+  #define SDc_SD_PIN  GPIO_PIN_5 // C5
+
+  #define SDa_SD_PORT  GPIOC
+  #define SDb_SD_PORT  GPIOC
+  #define SDc_SD_PORT  GPIOC
+
+  #define SD_NR_PORTS   1
+  #define SD_PORT_0     GPIOC  // C7, C6, C5
+  #define SD_PORT_0_PINS( _EN_ ) \
+    ( SD_PIN_EN( _EN_, PWM_PH_A, SDa_SD_PIN ) | SD_PIN_EN( _EN_, PWM_PH_B, SDb_SD_PIN ) | \
+      SD_PIN_EN( _EN_, PWM_PH_C, SDc_SD_PIN ) )
+
+// PWM timer channel pins, as S105_DISCOVERY
+  #define SDa_PWM_PIN  GPIO_PIN_4 // D4
+  #define SDb_PWM_PIN  GPIO_PIN_3 // D3
+  #define SDc_PWM_PIN  GPIO_PIN_3 // A3
+
+  #define SDa_PWM_PORT  GPIOD
+  #define SDb_PWM_PORT  GPIOD
+  #define SDc_PWM_PORT  GPIOA
+
+  #define ADC_VREF_MV      3300
+
+// ADC1_setup() is left out, code barely fits
+  #define BOARD_NO_ADC_SETUP
+
+//  #define HAS_SERVO_INPUT // no timer available?
+//  #define SPI_ENABLED     // can't fit SPI in 8k
+//  #define UNDERVOLTAGE_FAULT_ENABLED
+//  #define TRACE_ENABLED   // not enough RAM
+
+#elif !defined( UNIT_TEST )
+  #error "board not defined (S105_DEV, S105_DISCOVERY or S003_DEV)"
+#endif
+
+#if defined( BOARD_PWM_TIM ) && \
+    ( BOARD_PWM_TIM == BOARD_COMM_TIM || BOARD_CAP_TIM == BOARD_COMM_TIM || BOARD_CAP_TIM == BOARD_PWM_TIM )
+  #error "board: PWM, commutation and capture need separate timers"
+#endif
+
+#if defined( ADC_HW_TRIGGER ) && BOARD_PWM_TIM != 1
+  #error "ADC_HW_TRIGGER: the ADC external trigger is only from TIM1 TRGO"
+#endif
+
+
+/* Timer register access -----------------------------------------------------*/
+
+#define BOARD_CAT3_( _A_, _B_, _C_ )  _A_ ## _B_ ## _C_
+#define BOARD_CAT3( _A_, _B_, _C_ )   BOARD_CAT3_( _A_, _B_, _C_ )
+
+/*
+ * Timer and register bit names from the numbers of the descriptor e.g.
+ * BOARD_TIM( 3 ) is TIM3, BOARD_TIM_BIT( 3, IER_UIE ) is TIM3_IER_UIE.
+ */
+#define BOARD_TIM( _N_ )                BOARD_CAT3( TIM, _N_, )
+#define BOARD_TIM_BIT( _N_, _BIT_ )     BOARD_CAT3( TIM, _N_, _ ## _BIT_ )
+#define BOARD_TIM_CCRH( _N_, _CH_ )     BOARD_CAT3( BOARD_TIM( _N_ )->CCR, _CH_, H )
+#define BOARD_TIM_CCRL( _N_, _CH_ )     BOARD_CAT3( BOARD_TIM( _N_ )->CCR, _CH_, L )
+#define BOARD_TIM_CCIF( _N_, _CH_ )     BOARD_CAT3( BOARD_TIM_BIT( _N_, SR1_CC ), _CH_, IF )
+
+/*
+ * The flags in TIMx_SR1 are rc_w0, i.e. a flag is cleared by a single store
+ * of its complement (no read-modify-write).
+ */
+#define BOARD_TIM_CLR_FLAGS( _TIM_, _FLAGS_ )  (_TIM_)->SR1 = (uint8_t)~(_FLAGS_)
+
+// 16-bit registers are written high byte first
+#define BOARD_SET_REG16( _H_, _L_, _V_ ) \
+    (_H_) = (uint8_t)( (_V_) >> 8 );     \
+    (_L_) = (uint8_t)( _V_ )
+
+// PWM timer, the duty-cycle compare registers of the phase channels
+#define PWM_TIM          BOARD_TIM( BOARD_PWM_TIM )
+#define PWM_TIM_UIF      BOARD_TIM_BIT( BOARD_PWM_TIM, SR1_UIF )
+#define PWM_CCRH_A       BOARD_TIM_CCRH( BOARD_PWM_TIM, BOARD_PWM_CH_A )
+#define PWM_CCRL_A       BOARD_TIM_CCRL( BOARD_PWM_TIM, BOARD_PWM_CH_A )
+#define PWM_CCRH_B       BOARD_TIM_CCRH( BOARD_PWM_TIM, BOARD_PWM_CH_B )
+#define PWM_CCRL_B       BOARD_TIM_CCRL( BOARD_PWM_TIM, BOARD_PWM_CH_B )
+#define PWM_CCRH_C       BOARD_TIM_CCRH( BOARD_PWM_TIM, BOARD_PWM_CH_C )
+#define PWM_CCRL_C       BOARD_TIM_CCRL( BOARD_PWM_TIM, BOARD_PWM_CH_C )
+
+// commutation timer, update event and compare channels 1 and 2 (no outputs)
+#define COMM_TIM         BOARD_TIM( BOARD_COMM_TIM )
+#define COMM_TIM_UIF     BOARD_TIM_BIT( BOARD_COMM_TIM, SR1_UIF )
+#define COMM_TIM_CC1IF   BOARD_TIM_BIT( BOARD_COMM_TIM, SR1_CC1IF )
+#define COMM_TIM_CC2IF   BOARD_TIM_BIT( BOARD_COMM_TIM, SR1_CC2IF )
+#define COMM_TIM_UIE     BOARD_TIM_BIT( BOARD_COMM_TIM, IER_UIE )
+#define COMM_TIM_CC1IE   BOARD_TIM_BIT( BOARD_COMM_TIM, IER_CC1IE )
+#define COMM_TIM_CC2IE   BOARD_TIM_BIT( BOARD_COMM_TIM, IER_CC2IE )
+#define COMM_TIM_CEN     BOARD_TIM_BIT( BOARD_COMM_TIM, CR1_CEN )
+#define COMM_TIM_URS     BOARD_TIM_BIT( BOARD_COMM_TIM, CR1_URS )
+#define COMM_TIM_ARPE    BOARD_TIM_BIT( BOARD_COMM_TIM, CR1_ARPE )
+#define COMM_TIM_UG      BOARD_TIM_BIT( BOARD_COMM_TIM, EGR_UG )
+
+// servo input capture, the flag of a channel is cleared by the read of its CCRxL
+#if BOARD_CAP_TIM != 0
+#define CAP_TIM          BOARD_TIM( BOARD_CAP_TIM )
+#define CAP_TIM_UIF      BOARD_TIM_BIT( BOARD_CAP_TIM, SR1_UIF )
+#define CAP_RISE_IF      BOARD_TIM_CCIF( BOARD_CAP_TIM, BOARD_CAP_CH_RISE )
+#define CAP_FALL_IF      BOARD_TIM_CCIF( BOARD_CAP_TIM, BOARD_CAP_CH_FALL )
+#define CAP_RISE_CCRH    BOARD_TIM_CCRH( BOARD_CAP_TIM, BOARD_CAP_CH_RISE )
+#define CAP_RISE_CCRL    BOARD_TIM_CCRL( BOARD_CAP_TIM, BOARD_CAP_CH_RISE )
+#define CAP_FALL_CCRH    BOARD_TIM_CCRH( BOARD_CAP_TIM, BOARD_CAP_CH_FALL )
+#define CAP_FALL_CCRL    BOARD_TIM_CCRL( BOARD_CAP_TIM, BOARD_CAP_CH_FALL )
+#endif
+
+
+/* GPIO access ---------------------------------------------------------------*/
+
+#define BOARD_LED_TOGGLE()   (LED_GPIO_PORT)->ODR ^= (uint8_t)LED_GPIO_PIN
+
+#define BOARD_SERVO_INPUT()  ( 0 != ( (SERVO_GPIO_PORT)->IDR & (uint8_t)SERVO_GPIO_PIN ) )
+
+
+#endif // BOARD_H
@@ -0,0 +1,62 @@
+/**
+  ******************************************************************************
+  * @file cmd.h
+  * @brief Command line parser of the debug terminal
+  * @author Neidermeier
+  * @version
+  * @date
+  ******************************************************************************
+  */
+#ifndef CMD_H
+#define CMD_H
+
+/* Includes ------------------------------------------------------------------*/
+#include "system.h"
+
+#ifdef UNIT_TEST
+#include <stdint.h>
+#endif
+
+
+/* defines -------------------------------------------------------------------*/
+
+/**
+ * @brief Start of a command line, any other character outside of a line is a
+ *  key of the terminal UI.
+ */
+#define CMD_START     ':'
+
+#define CMD_MAX_ARGS  2
+
+
+/* types ---------------------------------------------------------------------*/
+
+/**
+ * @brief Result of a character input to the parser.
+ */
+typedef enum
+{
+  CMD_KEY = 0, /**< not in a command line, the character is a key */
+  CMD_BUSY,    /**< taken by the command line */
+  CMD_READY,   /**< end of a valid command line, the command is parsed */
+  CMD_ERROR    /**< end of a command line that is not valid */
+} cmd_status_t;
+
+/**
+ * @brief Command line ':' code [arg [arg]] (CR or LF), the code is a letter
+ *  (upper case) and the arguments 16-bit decimal or 0x hex.
+ */
+typedef struct
+{
+  char     code;
+  uint8_t  argc;
+  uint16_t argv[ CMD_MAX_ARGS ];
+} cmd_t;
+
+
+/* prototypes ----------------------------------------------------------------*/
+
+cmd_status_t Cmd_input(char c, cmd_t * pcmd);
+
+
+#endif // CMD_H
@@ -20,18 +20,6 @@
 #include "system.h"
 
 
-/* Private defines -----------------------------------------------------------*/
-
-// divider: 33k/18k
-//  18/(18+33)=0.35
-// 0.35 * 14.1v = 4.98
-// 4.98 / 2 = 2.48v ........... 1/2 Vdc in proportion to the resister divider
-//  2.48v/5v =  x counts / 1024 ocunts so 1/2 Vdc is equivalent to x counts ...
-//   x = 1024 * 2.48/5 = 509   (0x01FD)
-#define DC_HALF_REF         0x01FD
-
-
-
 /* Private types -----------------------------------------------------------*/
 
 /*
@@ -43,6 +31,78 @@
  * types
  */
 
+/**
+ * @brief Index of the ADC scan channels (ADC1_setup: Ch 0, 1, 2, and 3, and 4
+ *  with the three-phase back-EMF)
+ */
+typedef enum
+{
+  ADC_SNAP_PH0 = 0,  /**< phase A voltage: back-EMF or system voltage */
+  ADC_SNAP_ISHUNT,   /**< phase current (shunt amplifier) sampled in the PWM on-time */
+  ADC_SNAP_PH1,      /**< phase B voltage (THREE_PHASE_BEMF_ENABLED) */
+  ADC_SNAP_SLIDER,   /**< analog throttle */
+#ifdef THREE_PHASE_BEMF_ENABLED
+  ADC_SNAP_PH2,      /**< phase C voltage */
+#endif
+  ADC_SNAP_NR_CH
+} ADC_snap_ch_t;
+
+/**
+ * @brief Results of all channels of one ADC scan.
+ */
+typedef struct
+{
+  uint16_t ch[ ADC_SNAP_NR_CH ];
+} ADC_snapshot_t;
+
+
+/**
+ * @brief State produced by the ISRs, published to the background task.
+ */
+typedef struct
+{
+  ADC_snapshot_t adc;       /**< most recent ADC scan */
+  uint16_t vbatt;           /**< system voltage */
+  uint16_t bemf_r;          /**< back-EMF integration, rising */
+  uint16_t bemf_f;          /**< back-EMF integration, falling */
+  int16_t  timing_error;    /**< commutation timing error term */
+  uint16_t comm_period;     /**< commutation period */
+  uint16_t erpm10;          /**< speed estimate, eRPM / 10 */
+  uint16_t pwm_dc;          /**< commanded duty-cycle */
+  uint16_t ibus;            /**< averaged bus current (ADC counts of ISENSE_ADC) */
+  uint16_t pulse_perd;      /**< servo input pulse period */
+  uint16_t pulse_dur;       /**< servo input pulse duration */
+  uint8_t  faults;          /**< fault status word */
+  uint8_t  run_state;       /**< BL_RUNSTATE_t */
+} Driver_status_t;
+
+/**
+ * @brief Mid-sector events, from the compare channels of the commutation
+ *  timer. The compare interrupt is only enabled while a callback is set.
+ */
+typedef enum
+{
+  DRIVER_EVT_QTR1 = 0, /**< 1/4 of the sector (compare channel 1) */
+  DRIVER_EVT_QTR3,     /**< 3/4 of the sector (compare channel 2) */
+  DRIVER_NR_EVTS
+} Driver_sector_evt_t;
+
+/**
+ * @brief Callback of a mid-sector event (ISR context).
+ */
+typedef void (*Driver_sector_cb_t)(void);
+
+/**
+ * @brief Command produced by the background (UI) task, consumed by the control
+ *  task.
+ */
+typedef struct
+{
+  uint8_t dc;       /**< speed setting (BLDC_PWMDC_Set) */
+  uint8_t stop_req; /**< incremented to request a stop/reset (BL_reset) */
+  uint8_t governor; /**< TRUE: the speed setting is an RPM setpoint */
+} Driver_command_t;
+
 
 /*
  * variables
@@ -56,7 +116,20 @@
 void Driver_Step(void);
 void Driver_Update(void);
 
+void Driver_set_comm_period(uint16_t period);
+void Driver_set_idle(uint8_t idle);
+void Driver_set_sector_cb(Driver_sector_evt_t evt, Driver_sector_cb_t cb);
+void Driver_on_sector_event(uint8_t evt);
+
 uint16_t Driver_Get_ADC(void);
+uint16_t Driver_Get_Phase_ADC(ADC_snap_ch_t ch);
+void Driver_get_ADC_snapshot(ADC_snapshot_t * psnap);
+
+void Driver_publish_status(void);
+void Driver_get_status(Driver_status_t * pstatus);
+
+void Driver_set_command(const Driver_command_t * pcmd);
+uint8_t Driver_get_command(Driver_command_t * pcmd);
 uint16_t Driver_Get_Back_EMF_Avg(void);
 
 void Driver_on_PWM_edge(void);
@@ -64,9 +137,17 @@ void Driver_on_ADC_conv(void);
 
 void Driver_on_capture_rise(void);
 void Driver_on_capture_fall(void);
+void Driver_on_capture_ovf(void);
 
 uint16_t Driver_get_pulse_perd(void);
 uint16_t Driver_get_pulse_dur(void);
 
+uint16_t Driver_get_ZC_period(void);
+void Driver_ZC_reset(void);
+void Driver_set_timing_advance(uint8_t adv);
+void Driver_set_current_limit(uint16_t ilim);
+void Driver_set_catch(uint8_t enable);
+uint8_t Driver_get_catch(uint16_t * pperiod);
+
 
 #endif // DRIVER_H
@@ -38,7 +38,10 @@ typedef enum
     FAULT_0 = 1,
     FAULT_1 = 2,
     VOLTAGE_NG = 4,
-    THROTTLE_HI = 8
+    THROTTLE_HI = 8,
+    STALL = 0x10,  // no back-EMF zero-crossing
+    DESYNC = 0x20, // zero-crossing out of step with the commutation
+    OVERCURRENT = 0x40
 } faultm_ID_t;
 
 /**
@@ -46,6 +49,21 @@ typedef enum
  */
 typedef uint8_t fault_status_reg_t; // fault status bitmap
 
+/**
+ * @brief Fault event log entry
+ */
+typedef struct
+{
+    uint16_t tick;      /**< scheduler tick count (Sched_get_ticks) */
+    uint8_t  faultm_ID; /**< faultm_ID_t */
+    uint8_t  set;       /**< TRUE if the fault was set, FALSE if cleared */
+} faultm_event_t;
+
+/**
+ * @brief Size of the fault event log (power of 2)
+ */
+#define FAULTM_NR_EVENTS  8
+
 
 /*
  * prototypes
@@ -59,5 +77,7 @@ void Faultm_set(faultm_ID_t faultm_ID);
 
 fault_status_reg_t Faultm_get_status(void);
 
+uint8_t Faultm_get_events(faultm_event_t * pevents);
+
 
 #endif // FAULTM_H
@@ -0,0 +1,70 @@
+/**
+  ******************************************************************************
+  * @file isr_prof.h
+  * @brief ISR execution time profiling
+  * @author Neidermeier
+  * @version
+  * @date
+  ******************************************************************************
+  */
+#ifndef ISR_PROF_H
+#define ISR_PROF_H
+
+/* Includes ------------------------------------------------------------------*/
+#include "system.h"
+
+/* defines -------------------------------------------------------------------*/
+
+/**
+ * @brief Identifiers of the profiled ISRs.
+ */
+typedef enum
+{
+  ISR_PROF_COMM = 0, /**< commutation timer ISR (Driver_Step) */
+  ISR_PROF_PWM,      /**< PWM timer update ISR (Driver_Update, ADC start) */
+  ISR_PROF_ADC,      /**< ADC end of conversion ISR */
+  ISR_PROF_SPI,      /**< SPI byte received ISR */
+  ISR_PROF_NR_IDS
+} isr_prof_id_t;
+
+/**
+ * Profiling is enabled at compile time, otherwise the ISR entry/exit macros
+ * expand to nothing. ISR_PROF_ENTRY() is a declaration, so it has to be placed
+ * after any other declarations at the top of the ISR body.
+ */
+#ifdef ISR_PROFILE_ENABLED
+  #define ISR_PROF_ENTRY( _ID_ )  uint8_t isr_prof_t0_ = Isr_prof_entry( _ID_ )
+  #define ISR_PROF_EXIT( _ID_ )   Isr_prof_exit( _ID_, isr_prof_t0_ )
+#else
+  #define ISR_PROF_ENTRY( _ID_ )
+  #define ISR_PROF_EXIT( _ID_ )
+#endif
+
+
+/* types ---------------------------------------------------------------------*/
+
+/**
+ * @brief Execution time statistics of one ISR.
+ *
+ * @details Times are in counts of the free-running profiling timer (TIM4 @ 1us
+ *  i.e. 16 CPU cycles @ 16 Mhz).
+ */
+typedef struct
+{
+  uint8_t  min;   /**< minimum execution time */
+  uint8_t  max;   /**< maximum execution time */
+  uint16_t avg8;  /**< sliding average execution time, scaled by 8 */
+  uint8_t  nest;  /**< count of ISR entries with another profiled ISR in progress */
+} isr_prof_t;
+
+
+/* prototypes ----------------------------------------------------------------*/
+
+uint8_t Isr_prof_entry(isr_prof_id_t id);
+void Isr_prof_exit(isr_prof_id_t id, uint8_t t0);
+
+void Isr_prof_get(isr_prof_t * pstats);
+void Isr_prof_reset(void);
+
+
+#endif // ISR_PROF_H
@@ -58,9 +58,22 @@ uint8_t SerialKeyPressed(char *key);
 
 void UARTputs(char *message);
 
+void MCU_on_UART_TX(void);
+uint16_t MCU_get_UART_TX_drops(void);
+void MCU_on_UART_RX(void);
+uint16_t MCU_get_UART_RX_drops(void);
+
 void MCU_Init(void);
 
 void MCU_set_comm_timer(uint16_t);
+void MCU_stop_comm_timer(void);
+uint16_t MCU_get_comm_timer_count(void);
+void MCU_restart_comm_timer(uint16_t, uint16_t);
+void MCU_set_comm_compare(uint8_t chan, uint16_t count);
+void MCU_enable_comm_compare(uint8_t chan, uint8_t enable);
+
+void MCU_EEPROM_read(uint8_t offs, uint8_t * pdata, uint8_t nbytes);
+void MCU_EEPROM_write(uint8_t offs, const uint8_t * pdata, uint8_t nbytes);
 
 
 #endif // MCU_STM8S
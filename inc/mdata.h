@@ -30,6 +30,14 @@
  * prototypes
  */
 uint16_t Get_OL_Timing(uint16_t);
+void Set_OL_Profile(uint16_t);
+uint16_t Get_OL_Vbatt(void);
+
+uint8_t Get_Timing_Advance(uint16_t);
+
+void Learn_OL_Timing(uint16_t, uint16_t);
+void Load_OL_Timing(void);
+void Save_OL_Timing(void);
 
 
 #endif // MDATA_H
@@ -1,183 +0,0 @@
-1700, //   0, 0, 0, 6A4
-1666, //   1, 1, 1, 682
-1633, //   2, 1, 2, 661
-1601, //   3, 2, 3, 641
-1569, //   4, 2, 4, 621
-1538, //   5, 3, 5, 602
-1508, //   6, 3, 6, 5E4
-1478, //   7, 4, 7, 5C6
-1449, //   8, 4, 8, 5A9
-1420, //   9, 5, 9, 58C
-1392, //   10, 6, A, 570
-1364, //   11, 6, B, 554
-1337, //   12, 7, C, 539
-1311, //   13, 7, D, 51F
-1285, //   14, 8, E, 505
-1259, //   15, 8, F, 4EB
-1234, //   16, 9, 10, 4D2
-1210, //   17, 9, 11, 4BA
-1186, //   18, 10, 12, 4A2
-1163, //   19, 11, 13, 48B
-1140, //   20, 11, 14, 474
-1117, //   21, 12, 15, 45D
-1095, //   22, 12, 16, 447
-1073, //   23, 13, 17, 431
-1052, //   24, 13, 18, 41C
-1031, //   25, 14, 19, 407
-1011, //   26, 14, 1A, 3F3
-991, //   27, 15, 1B, 3DF
-971, //   28, 16, 1C, 3CB
-952, //   29, 16, 1D, 3B8
-933, //   30, 17, 1E, 3A5
-915, //   31, 17, 1F, 393
-896, //   32, 18, 20, 380
-879, //   33, 18, 21, 36F
-861, //   34, 19, 22, 35D
-844, //   35, 19, 23, 34C
-827, //   36, 20, 24, 33B
-811, //   37, 21, 25, 32B
-795, //   38, 21, 26, 31B
-779, //   39, 22, 27, 30B
-764, //   40, 22, 28, 2FC
-749, //   41, 23, 29, 2ED
-734, //   42, 23, 2A, 2DE
-719, //   43, 24, 2B, 2CF
-705, //   44, 24, 2C, 2C1
-691, //   45, 25, 2D, 2B3
-677, //   46, 26, 2E, 2A5
-664, //   47, 26, 2F, 298
-651, //   48, 27, 30, 28B
-638, //   49, 27, 31, 27E
-625, //   50, 28, 32, 271
-613, //   51, 28, 33, 265
-601, //   52, 29, 34, 259
-589, //   53, 29, 35, 24D
-577, //   54, 30, 36, 241
-566, //   55, 31, 37, 236
-555, //   56, 31, 38, 22B
-544, //   57, 32, 39, 220
-533, //   58, 32, 3A, 215
-522, //   59, 33, 3B, 20A
-512, //   60, 33, 3C, 200
-502, //   61, 34, 3D, 1F6
-492, //   62, 34, 3E, 1EC
-482, //   63, 35, 3F, 1E2
-473, //   64, 36, 40, 1D9
-463, //   65, 36, 41, 1CF
-454, //   66, 37, 42, 1C6
-445, //   67, 37, 43, 1BD
-436, //   68, 38, 44, 1B4
-428, //   69, 38, 45, 1AC
-419, //   70, 39, 46, 1A3
-411, //   71, 39, 47, 19B
-403, //   72, 40, 48, 193
-395, //   73, 41, 49, 18B
-399, //   74, 41, 4A, 18F
-396, //   75, 42, 4B, 18C
-393, //   76, 42, 4C, 189
-390, //   77, 43, 4D, 186
-387, //   78, 43, 4E, 183
-384, //   79, 44, 4F, 180
-381, //   80, 44, 50, 17D
-378, //   81, 45, 51, 17A
-375, //   82, 46, 52, 177
-372, //   83, 46, 53, 174
-369, //   84, 47, 54, 171
-366, //   85, 47, 55, 16E
-363, //   86, 48, 56, 16B
-360, //   87, 48, 57, 168
-357, //   88, 49, 58, 165
-354, //   89, 49, 59, 162
-351, //   90, 50, 5A, 15F
-348, //   91, 51, 5B, 15C
-345, //   92, 51, 5C, 159
-342, //   93, 52, 5D, 156
-339, //   94, 52, 5E, 153
-336, //   95, 53, 5F, 150
-333, //   96, 53, 60, 14D
-330, //   97, 54, 61, 14A
-327, //   98, 54, 62, 147
-324, //   99, 55, 63, 144
-321, //   100, 56, 64, 141
-318, //   101, 56, 65, 13E
-315, //   102, 57, 66, 13B
-312, //   103, 57, 67, 138
-309, //   104, 58, 68, 135
-306, //   105, 58, 69, 132
-303, //   106, 59, 6A, 12F
-300, //   107, 59, 6B, 12C
-297, //   108, 60, 6C, 129
-294, //   109, 61, 6D, 126
-291, //   110, 61, 6E, 123
-288, //   111, 62, 6F, 120
-285, //   112, 62, 70, 11D
-282, //   113, 63, 71, 11A
-279, //   114, 63, 72, 117
-276, //   115, 64, 73, 114
-273, //   116, 64, 74, 111
-270, //   117, 65, 75, 10E
-267, //   118, 66, 76, 10B
-264, //   119, 66, 77, 108
-261, //   120, 67, 78, 105
-258, //   121, 67, 79, 102
-255, //   122, 68, 7A, FF
-252, //   123, 68, 7B, FC
-249, //   124, 69, 7C, F9
-246, //   125, 69, 7D, F6
-243, //   126, 70, 7E, F3
-240, //   127, 71, 7F, F0
-237, //   128, 71, 80, ED
-234, //   129, 72, 81, EA
-231, //   130, 72, 82, E7
-228, //   131, 73, 83, E4
-225, //   132, 73, 84, E1
-222, //   133, 74, 85, DE
-219, //   134, 74, 86, DB
-216, //   135, 75, 87, D8
-213, //   136, 76, 88, D5
-210, //   137, 76, 89, D2
-207, //   138, 77, 8A, CF
-204, //   139, 77, 8B, CC
-201, //   140, 78, 8C, C9
-198, //   141, 78, 8D, C6
-195, //   142, 79, 8E, C3
-192, //   143, 79, 8F, C0
-189, //   144, 80, 90, BD
-186, //   145, 81, 91, BA
-183, //   146, 81, 92, B7
-180, //   147, 82, 93, B4
-177, //   148, 82, 94, B1
-174, //   149, 83, 95, AE
-171, //   150, 83, 96, AB
-168, //   151, 84, 97, A8
-165, //   152, 84, 98, A5
-162, //   153, 85, 99, A2
-159, //   154, 86, 9A, 9F
-156, //   155, 86, 9B, 9C
-153, //   156, 87, 9C, 99
-150, //   157, 87, 9D, 96
-147, //   158, 88, 9E, 93
-144, //   159, 88, 9F, 90
-141, //   160, 89, A0, 8D
-138, //   161, 89, A1, 8A
-135, //   162, 90, A2, 87
-132, //   163, 91, A3, 84
-129, //   164, 91, A4, 81
-126, //   165, 92, A5, 7E
-123, //   166, 92, A6, 7B
-120, //   167, 93, A7, 78
-117, //   168, 93, A8, 75
-114, //   169, 94, A9, 72
-111, //   170, 94, AA, 6F
-108, //   171, 95, AB, 6C
-105, //   172, 96, AC, 69
-102, //   173, 96, AD, 66
-99, //   174, 97, AE, 63
-96, //   175, 97, AF, 60
-93, //   176, 98, B0, 5D
-90, //   177, 98, B1, 5A
-87, //   178, 99, B2, 57
-84, //   179, 99, B3, 54
-// [1:74]  f(x) = 1500 * e ^ -x/50
-// [75:TBLSZ]  f(x) = 3x + 565
-// 10.0 * (   dtable(:, //   2)  +60 )  + 1700
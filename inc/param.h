@@ -0,0 +1,57 @@
+/**
+  ******************************************************************************
+  * @file param.h
+  * @brief Run-time parameters with the data EEPROM record
+  * @author Neidermeier
+  * @version
+  * @date
+  ******************************************************************************
+  */
+#ifndef PARAM_H
+#define PARAM_H
+
+/* Includes ------------------------------------------------------------------*/
+#include "system.h"
+
+#ifdef UNIT_TEST
+#include <stdint.h>
+#endif
+
+
+/* types ---------------------------------------------------------------------*/
+
+/**
+ * @brief Parameter IDs.
+ *
+ * @details  New parameters are only ever appended, so the record of a
+ *  previous build is loaded and the added parameters take their defaults.
+ *  The SPI register of each is SPI_REG_PARAM + ID.
+ */
+typedef enum
+{
+  PARAM_DC_STARTUP = 0, /**< duty-cycle to start the motor (PWM counts) */
+  PARAM_DC_SHUTOFF,     /**< duty-cycle at which the motor is switched off (PWM counts) */
+  PARAM_V_SHUTDOWN,     /**< undervoltage fault threshold (ADC counts) */
+  PARAM_PI_KP,          /**< commutation timing PI proportional gain (Q8) */
+  PARAM_PI_KI,          /**< commutation timing PI integral gain (Q8 per control tick) */
+  PARAM_ILIM,           /**< pulse-by-pulse current limit (ADC counts of ISENSE_ADC) */
+  PARAM_BRAKE_MODE,     /**< brake of the stopped motor (BRAKE_NONE etc.) */
+  PARAM_BRAKE_STRENGTH, /**< brake on time [0:BRAKE_STRENGTH_MAX] (sixteenths) */
+  PARAM_DECEL,          /**< regenerative deceleration on throttle-down (0 or 1) */
+  PARAM_VBATT_COMP,     /**< battery voltage compensation of the duty-cycle (0 or 1) */
+  PARAM_SPI_ADDR,       /**< slot of the SPI broadcast frame */
+  PARAM_NR              /**< number of parameters */
+} param_ID_t;
+
+
+/* prototypes ----------------------------------------------------------------*/
+
+void Param_load(void);
+uint16_t Param_get(param_ID_t id);
+uint8_t Param_check(param_ID_t id, uint16_t val);
+uint8_t Param_set(param_ID_t id, uint16_t val);
+void Param_commit(void);
+uint8_t Param_save(void);
+
+
+#endif // PARAM_H
@@ -18,8 +18,6 @@
 
 /* Public function prototypes -----------------------------------------------*/
 
-void Periodic_Task_Wake(void);
-
 uint8_t Task_Ready(void);
 
 void UI_Stop(void);
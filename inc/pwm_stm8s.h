@@ -21,75 +21,21 @@
 /**
  * The MCU drives 3 GPIO as output to IR2104 /SD pins. There is no significance 
  * to their pin assignment or pin configuration other than setting the internal
- * pullup (not open-collector) 
+ * pullup (not open-collector). The /SD and PWM pins of each board are in the
+ * board descriptor (board.h).
  */
-#if defined ( S105_DEV )
-// leave D3 and D4 available for servo pulse input capture (TIM2 CH1 and CH2)
-  #define SDa_SD_PIN  GPIO_PIN_0  // D0
-  #define SDb_SD_PIN  GPIO_PIN_2  // D2
-  #define SDc_SD_PIN  GPIO_PIN_1  // A1
-
-  #define SDa_SD_PORT  GPIOD  // D0
-  #define SDb_SD_PORT  GPIOD  // D2
-  #define SDc_SD_PORT  GPIOA  // A1
-
-#elif defined ( S105_DISCOVERY )
-
-  #define SDa_SD_PIN  GPIO_PIN_2  // D2
-  #define SDb_SD_PIN  GPIO_PIN_0  // E0
-  #define SDc_SD_PIN  GPIO_PIN_5  // A5
-
-  #define SDa_SD_PORT  GPIOD
-  #define SDb_SD_PORT  GPIOE
-  #define SDc_SD_PORT  GPIOA
-
-#elif defined ( S003_DEV ) // SPI not enabled, three drive pins useable for /SD
-  #define SDa_SD_PIN  GPIO_PIN_7 // C7
-  #define SDb_SD_PIN  GPIO_PIN_6 // C6
-  #define SDc_SD_PIN  GPIO_PIN_5 // C5
-
-  #define SDa_SD_PORT  GPIOC
-  #define SDb_SD_PORT  GPIOC
-  #define SDc_SD_PORT  GPIOC
-#endif
-
-
-#if defined( S105_DISCOVERY ) || defined( S003_DEV )
-/**
- * Using TIM2 as PWM ... pins are same for 2 platforms
- */
-  #define SDa_PWM_PIN  GPIO_PIN_4 // D4
-  #define SDb_PWM_PIN  GPIO_PIN_3 // D3
-  #define SDc_PWM_PIN  GPIO_PIN_3 // A3
-
-  #define SDa_PWM_PORT  GPIOD
-  #define SDb_PWM_PORT  GPIOD
-  #define SDc_PWM_PORT  GPIOA
-
-#else if defined( S105_DEV )
-/**
- * TIM2 not available, uses TIM1
- */
-  #define SDa_PWM_PIN  GPIO_PIN_2 // C2
-  #define SDb_PWM_PIN  GPIO_PIN_3 // C3
-  #define SDc_PWM_PIN  GPIO_PIN_4 // C4
-
-  #define SDa_PWM_PORT  GPIOC
-  #define SDb_PWM_PORT  GPIOC
-  #define SDc_PWM_PORT  GPIOC
-#endif
 
 // PD4 set LO
 #define PWM_PhA_OUTP_LO( )                              \
-    SDc_PWM_PORT->ODR &= (uint8_t) ( ~SDa_PWM_PIN );    \
-    SDc_PWM_PORT->DDR |=  SDa_PWM_PIN;                   \
-    SDc_PWM_PORT->CR1 |=  SDa_PWM_PIN;
+    SDa_PWM_PORT->ODR &= (uint8_t) ( ~SDa_PWM_PIN );    \
+    SDa_PWM_PORT->DDR |=  SDa_PWM_PIN;                   \
+    SDa_PWM_PORT->CR1 |=  SDa_PWM_PIN;
 
 // PD3 set LO
 #define PWM_PhB_OUTP_LO( )                              \
-    SDc_PWM_PORT->ODR &= (uint8_t) ( ~SDb_PWM_PIN );    \
-    SDc_PWM_PORT->DDR |=  SDb_PWM_PIN;                   \
-    SDc_PWM_PORT->CR1 |=  SDb_PWM_PIN;
+    SDb_PWM_PORT->ODR &= (uint8_t) ( ~SDb_PWM_PIN );    \
+    SDb_PWM_PORT->DDR |=  SDb_PWM_PIN;                   \
+    SDb_PWM_PORT->CR1 |=  SDb_PWM_PIN;
 
 // PA3 set LO
 #define PWM_PhC_OUTP_LO( )                              \
@@ -124,7 +70,120 @@
     SDc_SD_PORT->ODR &=  (uint8_t) ( ~SDc_SD_PIN );
 
 
+/**
+ * Commutation output state tables: phase bits for composing the per-sector
+ * output state i.e. which phase is PWM'd (HI) and which phase is driven LO
+ * (the remaining phase is floating).
+ */
+#define PWM_PH_NONE  0
+#define PWM_PH_A     1
+#define PWM_PH_B     2
+#define PWM_PH_C     4
+
+/**
+ * PWM timer capture/compare enable registers. The polarity (and complementary
+ * output enable on TIM1) bits are part of the written value so that the
+ * register can be stored directly without read-modify-write.
+ */
+#define PWM_TIMER_CCER1   PWM_TIM->CCER1
+#define PWM_TIMER_CCER2   PWM_TIM->CCER2
+
+#if BOARD_PWM_TIM == 1
+  // CH2 (A) in CCER1, CH3 (B) and CH4 (C) in CCER2
+  #define PWM_CCER1_BASE  ( TIM1_CCER1_CC2P | TIM1_CCER1_CC2NE | TIM1_CCER1_CC2NP )
+  #define PWM_CCER2_BASE  ( TIM1_CCER2_CC3P | TIM1_CCER2_CC3NE | TIM1_CCER2_CC3NP | \
+                            TIM1_CCER2_CC4P )
+  #define PWM_CCER1_A     TIM1_CCER1_CC2E
+  #define PWM_CCER1_B     0
+  #define PWM_CCER1_C     0
+  #define PWM_CCER2_A     0
+  #define PWM_CCER2_B     TIM1_CCER2_CC3E
+  #define PWM_CCER2_C     TIM1_CCER2_CC4E
+
+#else // TIM2
+  // CH1 (A) and CH2 (B) in CCER1, CH3 (C) in CCER2
+  #define PWM_CCER1_BASE  ( TIM2_CCER1_CC1P | TIM2_CCER1_CC2P )
+  #define PWM_CCER2_BASE  ( TIM2_CCER2_CC3P )
+  #define PWM_CCER1_A     TIM2_CCER1_CC1E
+  #define PWM_CCER1_B     TIM2_CCER1_CC2E
+  #define PWM_CCER1_C     0
+  #define PWM_CCER2_A     0
+  #define PWM_CCER2_B     0
+  #define PWM_CCER2_C     TIM2_CCER2_CC3E
+#endif
+
+/**
+ * The /SD pins are grouped by GPIO port so that each port is updated with a
+ * single store. Each SD_PORT_n_PINS( _EN_ ) of the board descriptor resolves
+ * the pins of that port for the set of enabled phases.
+ */
+#define SD_PIN_EN( _EN_, _PH_, _PIN_ )  ( ( (_EN_) & (_PH_) ) ? (_PIN_) : 0 )
+
+#define SD_PORT_0_MSK  SD_PORT_0_PINS( PWM_PH_A | PWM_PH_B | PWM_PH_C )
+#if SD_NR_PORTS > 1
+#define SD_PORT_1_MSK  SD_PORT_1_PINS( PWM_PH_A | PWM_PH_B | PWM_PH_C )
+#endif
+#if SD_NR_PORTS > 2
+#define SD_PORT_2_MSK  SD_PORT_2_PINS( PWM_PH_A | PWM_PH_B | PWM_PH_C )
+#endif
+
+// initializer of the per-port /SD pin states of the enabled phases
+#if SD_NR_PORTS == 1
+#define PWM_SD_STATE( _EN_ )  { SD_PORT_0_PINS( _EN_ ) }
+#elif SD_NR_PORTS == 2
+#define PWM_SD_STATE( _EN_ )  { SD_PORT_0_PINS( _EN_ ), SD_PORT_1_PINS( _EN_ ) }
+#else
+#define PWM_SD_STATE( _EN_ )  { SD_PORT_0_PINS( _EN_ ), SD_PORT_1_PINS( _EN_ ), \
+                                SD_PORT_2_PINS( _EN_ ) }
+#endif
+
+/**
+ * @brief  Compose a commutation output state table entry.
+ *
+ * @details  The HI phase is PWM'd (timer channel enabled), the LO phase has
+ *  its timer channel disabled so the pin reverts to GPIO output low. Both have
+ *  the /SD input of the IR2104 enabled, while the unspecified phase is floating.
+ *
+ * @param  _HI_  Phase bit of the PWM'd phase.
+ * @param  _LO_  Phase bit of the phase driven low.
+ */
+#define PWM_COMM_STATE( _HI_, _LO_ )                                 \
+  {                                                                  \
+    (uint8_t)( PWM_CCER1_BASE | SD_PIN_EN( _HI_, PWM_PH_A, PWM_CCER1_A ) | \
+               SD_PIN_EN( _HI_, PWM_PH_B, PWM_CCER1_B ) |            \
+               SD_PIN_EN( _HI_, PWM_PH_C, PWM_CCER1_C ) ),           \
+    (uint8_t)( PWM_CCER2_BASE | SD_PIN_EN( _HI_, PWM_PH_A, PWM_CCER2_A ) | \
+               SD_PIN_EN( _HI_, PWM_PH_B, PWM_CCER2_B ) |            \
+               SD_PIN_EN( _HI_, PWM_PH_C, PWM_CCER2_C ) ),           \
+    PWM_SD_STATE( (_HI_) | (_LO_) )                                  \
+  }
+
 /* Public types -------------------------------------------------------------*/
+
+/**
+ * @brief  Commutation output state.
+ *
+ * @details  Precomputed register values for one commutation sector, written
+ *  by PWM_set_comm_state() with direct register stores.
+ */
+typedef struct
+{
+  uint8_t ccer1;                /**< PWM timer CCER1 value. */
+  uint8_t ccer2;                /**< PWM timer CCER2 value. */
+  uint8_t sd_odr[SD_NR_PORTS];  /**< /SD pin states of each SD port. */
+} PWM_comm_state_t;
+
+/**
+ * @brief  PWM rates, as multiples of the nominal rate (TIM2_PWM_PD).
+ */
+typedef enum
+{
+  PWM_RATE_X1 = 0, /**< nominal rate e.g. 8 kHz */
+  PWM_RATE_X1_5,   /**< 1.5x e.g. 12 kHz */
+  PWM_RATE_X2,     /**< 2x e.g. 16 kHz */
+  PWM_NR_RATES
+} PWM_rate_t;
+
 /**
  * @brief  Generic PWM channel type.
  */
@@ -136,6 +195,11 @@ typedef  TIM2_Channel_TypeDef PWM_Channel_Typedef ;
 /* Public function prototypes -----------------------------------------------*/
 
 void All_phase_stop(void);
+void PWM_set_brake(uint8_t brake);
+
+void PWM_set_comm_state(const PWM_comm_state_t * pstate);
+void PWM_cut_pulse(void);
+void PWM_restore_pulse(void);
 
 void PWM_PhA_Disable(void);
 void PWM_PhB_Disable(void);
@@ -147,6 +211,10 @@ void PWM_PhC_Enable(void);
 
 void set_dutycycle(uint16_t);
 
+void PWM_set_rate(PWM_rate_t rate);
+PWM_rate_t PWM_get_rate(void);
+uint8_t PWM_get_frames_per_upd(void);
+
 void PWM_setup(void);
 
 #endif // PWM_STM_S_H
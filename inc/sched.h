@@ -0,0 +1,54 @@
+/**
+  ******************************************************************************
+  * @file sched.h
+  * @brief Static rate-group scheduler
+  * @author Neidermeier
+  * @version
+  * @date
+  ******************************************************************************
+  */
+#ifndef SCHED_H
+#define SCHED_H
+
+/* Includes ------------------------------------------------------------------*/
+#include "system.h"
+
+/* defines -------------------------------------------------------------------*/
+
+/**
+ * @brief Rate groups, in order of the scheduler table.
+ */
+typedef enum
+{
+  SCHED_COMM = 0, /**< commutation timer period refresh (every tick) */
+  SCHED_CTRL,     /**< control task BLDC_Update (~1 kHz) */
+  SCHED_UI,       /**< UI and fault manager, background periodic task (~60 Hz) */
+  SCHED_SPI,      /**< SPI master, background (~30 Hz) */
+  SCHED_NR_GROUPS
+} sched_group_t;
+
+
+/* types ---------------------------------------------------------------------*/
+
+/**
+ * @brief Run-time statistics of a rate group.
+ */
+typedef struct
+{
+  uint8_t wcet;    /**< worst-case execution time of the ISR part (ISR profiling timer counts) */
+  uint8_t overrun; /**< released again before the previous release was complete */
+} sched_stat_t;
+
+
+/* prototypes ----------------------------------------------------------------*/
+
+void Sched_tick(void);
+uint16_t Sched_get_ticks(void);
+
+uint8_t Sched_is_ready(sched_group_t grp);
+
+void Sched_get_stats(sched_stat_t * pstats);
+void Sched_reset(void);
+
+
+#endif // SCHED_H
@@ -26,6 +26,12 @@ uint16_t Seq_Get_bemfF(void);
 uint16_t Seq_Get_Vbatt(void);
 int16_t Seq_get_timing_error(void);
 int8_t Seq_get_timing_error_p(void);
+uint8_t Seq_ZC_detect(uint16_t adc_sample);
+uint8_t Seq_ZC_expected(void);
+uint8_t Seq_get_bemf_ch(void);
+void Seq_set_rising_step(void);
+void Seq_set_brake(uint8_t mode, uint8_t strength);
+uint8_t Seq_brake_update(void);
 void Sequence_Step(void);
 
 
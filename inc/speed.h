@@ -0,0 +1,56 @@
+/**
+  ******************************************************************************
+  * @file speed.h
+  * @brief Motor speed estimator, stall and desync detection
+  * @author Neidermeier
+  * @version
+  * @date
+  ******************************************************************************
+  */
+#ifndef SPEED_H
+#define SPEED_H
+
+/* Includes ------------------------------------------------------------------*/
+#include "system.h"
+
+#ifdef UNIT_TEST
+#include <stdint.h>
+#endif
+
+/* defines -------------------------------------------------------------------*/
+
+/**
+ * eRPM from commutation period: 60 s / (6 sectors * 4 periods * 0.125 us)
+ * = 20e6 / period, in units of 10 eRPM the constant is 62500 * 2^5
+ */
+#define SPEED_ERPM10_K   62500UL
+#define SPEED_ERPM10_SH  5
+
+
+/* types ---------------------------------------------------------------------*/
+
+/**
+ * @brief Zero-crossing result of a sector.
+ */
+typedef enum
+{
+  SPEED_ZC_NA = 0,   /**< no ZC is expected in the sector */
+  SPEED_ZC_MISSED,   /**< ZC expected but not detected */
+  SPEED_ZC_DETECTED  /**< ZC detected */
+} speed_zc_t;
+
+
+/* prototypes ----------------------------------------------------------------*/
+
+uint16_t Speed_recip(uint16_t x, uint8_t * psh);
+uint16_t Speed_erpm10(uint16_t period);
+uint16_t Speed_rpm(uint16_t erpm10);
+
+uint16_t Speed_get_erpm10(void);
+
+void Speed_reset(void);
+uint8_t Speed_is_locked(void);
+void Speed_on_sector(speed_zc_t zc, uint16_t zc_elapsed, uint16_t comm_period);
+
+
+#endif // SPEED_H
@@ -1,7 +1,7 @@
 /**
   ******************************************************************************
   * @file spi_stm8s.h
-  * @brief This file contains the main function for the BLDC motor control
+  * @brief SPI link to the flight-controller (register map protocol)
   * @author Neidermeier
   * @version
   * @date March-2021
@@ -11,23 +11,96 @@
 #define SPI_H
 
 /* Includes ------------------------------------------------------------------*/
+#include "driver.h" // Driver_status_t
 
 
 /* Defines -------------------------------------------------------------------*/
 
+/**
+ * @brief Register addresses.
+ *
+ * @details A request frame is { 0xA5, addr, data LSB, data MSB, CRC8 }, with
+ *  bit 7 of the address set to write. The response frame has the header 0x5A
+ *  and is clocked out in the following transaction, with the address (or
+ *  SPI_REG_NACK) and the register value. The run-time parameters are at
+ *  SPI_REG_PARAM + ID (param_ID_t), a write that is out of range, or while the
+ *  previous one is still to be applied (one UI task frame), is NACKed.
+ */
+typedef enum
+{
+  SPI_REG_ID        = 0x00, /**< protocol version (RO) */
+  SPI_REG_THROTTLE  = 0x01, /**< throttle setpoint [0:255] (RW) */
+  SPI_REG_MODE      = 0x02, /**< SPI_MODE_STOP or SPI_MODE_RUN (RW) */
+  SPI_REG_FAULT_CLR = 0x03, /**< any write resets the controller (WO) */
+  SPI_REG_COMMIT    = 0x04, /**< any write saves the parameters to EEPROM once stopped (WO) */
+  SPI_REG_ERPM      = 0x10, /**< electrical RPM / 10 (RO) */
+  SPI_REG_VBATT     = 0x11, /**< system voltage, ADC counts (RO) */
+  SPI_REG_FAULTS    = 0x12, /**< fault status word (RO) */
+  SPI_REG_STATE     = 0x13, /**< BL_RUNSTATE_t (RO) */
+  SPI_REG_ERRORS    = 0x14, /**< count of frames with CRC error (RO) */
+  SPI_REG_PARAM     = 0x20, /**< first of the run-time parameters (RW) */
+  SPI_REG_NACK      = 0x7F  /**< response to an invalid request */
+} SPI_reg_t;
+
+#define SPI_MODE_STOP  0  /**< throttle from the local UI */
+#define SPI_MODE_RUN   1  /**< throttle from the SPI link */
 
-/*
- *  timer1 free running, time between periodic task is 0x2080
+/**
+ * @brief Peripherals on the bus, the slots of the broadcast throttle frame
+ *  { 0xB4, nr of slots, mode, throttle of each address, CRC8 }.
  */
-#define TIME_OUT_0 0x1000
+#define SPI_BUS_MAX_ESC  4
 
-#define RX_BUF_SZ 16
+/**
+ * @brief Chip selects of the peripherals (SPI_CTRLR_USE_CS), in order of the
+ *  address. All are asserted for the broadcast frame, which is write-only (the
+ *  peripherals disable MISO after the header byte).
+ */
+#define SPI_CS_PORT      GPIOE
+#define SPI_CS_PIN_0     GPIO_PIN_5
+#define SPI_CS_PIN_1     GPIO_PIN_6
+#define SPI_CS_PIN_2     GPIO_PIN_7
+#define SPI_CS_PIN_3     GPIO_PIN_3
+#define SPI_CS_PINS      ( SPI_CS_PIN_0 | SPI_CS_PIN_1 | SPI_CS_PIN_2 | SPI_CS_PIN_3 )
+
+#if SPI_BUS_NR_ESC > SPI_BUS_MAX_ESC
+  #error "SPI_BUS_NR_ESC: too many peripherals on the bus"
+#endif
+
+#if SPI_ENABLED == SPI_STM8_MASTER && SPI_BUS_NR_ESC > 1 && !defined( SPI_CTRLR_USE_CS )
+  #error "SPI_BUS_NR_ESC: more than one peripheral needs the chip selects (SPI_CTRLR_USE_CS)"
+#endif
 
 
 /* Declarations --------------------------------------------------------------*/
 
+/**
+ * @brief Read-back registers of a peripheral.
+ */
+typedef struct
+{
+  uint16_t erpm10;
+  uint16_t vbatt;
+  uint8_t  faults;
+  uint8_t  run_state;
+} SPI_readback_t;
+
+
 /* Function prototypes -------------------------------------------------------*/
+void SPI_on_IRQ(void);
+
 void SPI_controld(void);
 
+void SPI_publish_status(const Driver_status_t * pstatus);
+uint8_t SPI_get_throttle(uint8_t * pthrottle);
+uint8_t SPI_is_fault_clr(void);
+uint8_t SPI_get_param_write(uint8_t * pid, uint16_t * pval);
+uint8_t SPI_is_param_commit(void);
+void SPI_set_address(uint8_t addr);
+
+void SPI_bus_set_throttle(uint8_t addr, uint8_t throttle);
+void SPI_bus_set_mode(uint8_t mode);
+void SPI_bus_get_readback(uint8_t addr, SPI_readback_t * prb);
+
 
 #endif
@@ -0,0 +1,43 @@
+/**
+  ******************************************************************************
+  * @file startup.h
+  * @brief Rotor alignment and startup ramp profile
+  * @author Neidermeier
+  * @version
+  * @date
+  ******************************************************************************
+  */
+#ifndef STARTUP_H
+#define STARTUP_H
+
+/* Includes ------------------------------------------------------------------*/
+#include "system.h"
+
+#ifdef UNIT_TEST
+#include <stdint.h>
+#endif
+
+
+/* types ---------------------------------------------------------------------*/
+
+/**
+ * @brief Startup phase.
+ */
+typedef enum
+{
+  STARTUP_CATCH = 0, /**< bridge off, the back-EMF of the rotor is sensed (flying start) */
+  STARTUP_ALIGN,     /**< one sector held, the rotor is pulled into alignment */
+  STARTUP_RAMP,      /**< commutation period and duty-cycle from the profile */
+  STARTUP_DONE       /**< handed off to the run-time timing control */
+} startup_phase_t;
+
+
+/* prototypes ----------------------------------------------------------------*/
+
+void Startup_reset(uint8_t recover);
+void Startup_set_catch_on_start(uint8_t enable);
+startup_phase_t Startup_get_phase(void);
+uint8_t Startup_update(uint16_t * pperiod, uint16_t * pduty);
+
+
+#endif // STARTUP_H
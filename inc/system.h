@@ -27,95 +27,111 @@
 
 // apparently this is not working (6/7/2021)
 //#define CLMODE_ENABLED
-
-
-// List of supported SPI configurations
-#define SPI_NONE                0
-#define SPI_STM8_MASTER         1
-#define SPI_STM8_SLAVE          2
-
 
-/**
- * the STM8 variant is defined in the project file, along with the appropriate 
- * compiler settings for the particular MCU (memory model etc.)
- * Here is defined the particular platform, where the particular MCU and pin
- * routing determines how the peripherals and GPIO pins are allocated.
- */
-#if defined ( S105_DEV )
-
-  #define ESTOP_BTN_IN_PORT  GPIOF
-  #define ESTOP_BTN_IN_PIN   GPIO_PIN_4
+// closed-loop commutation timing is taken from the back-EMF zero-crossing
+// (otherwise from the ratio of the rising/falling back-EMF integration)
+#define ZC_COMM_ENABLED
 
-// AIN0, B0
-  #define PH0_BEMF_IN_PORT   GPIOB
-  #define PH0_BEMF_IN_PIN    GPIO_PIN_0
+// instrument the ISRs for execution time (TIM4 time-base, 'p' key to dump)
+//#define ISR_PROFILE_ENABLED
 
-  #define LED_GPIO_PORT    GPIOE
-  #define LED_GPIO_PIN     GPIO_PIN_5
+// phase current from a shunt amplifier on AIN1 (pulse-by-pulse limit, overcurrent fault)
+//#define CURRENT_SENSE_ENABLED
 
-  #define SERVO_GPIO_PORT  GPIOD
-  #define SERVO_GPIO_PIN   GPIO_PIN_4
+// back-EMF of phase B and C on AIN2 and AIN4 (ZC and timing error in all sectors)
+//#define THREE_PHASE_BEMF_ENABLED
 
-  #define HAS_SERVO_INPUT
-  #define SPI_ENABLED      SPI_STM8_MASTER
+// the back-EMF of a turning rotor is sensed on the start and on a loss of sync,
+// and the commutation resumed at its speed (otherwise aligned and ramped)
+// only tested in the simulator so far, leave off until verified on the bench
+//#define FLYING_START_ENABLED
 
-  #define UNDERVOLTAGE_FAULT_ENABLED
+// back-EMF for the timing error integrated over the middle of each sector
+// (otherwise the latest sample of the sector)
+//#define BUFFER_ADC_BEMF
 
-#elif defined ( S105_DISCOVERY )
-/*
- * S105 Discovery board can't use TIM1 for PWM (unless solder bridges connecting the
- * touch sensor are removed). Therefore, TIM2 drives PWM/controller, and TIM3 to
- * drive the commutation step, leaving TIM1 unnused (TIM1 input capture/compare 
- * might be used capture servo signal from R/C radio or flight controller).
- */
-  #define ESTOP_BTN_IN_PORT  GPIOA
-  #define ESTOP_BTN_IN_PIN   GPIO_PIN_4
 
-// AIN0, B0
-  #define PH0_BEMF_IN_PORT   GPIOB
-  #define PH0_BEMF_IN_PIN    GPIO_PIN_0
+// List of brake modes of the stopped motor
+#define BRAKE_NONE              0  // windmill
+#define BRAKE_LOWSIDE           1  // low-side switches of all phases on
+#define BRAKE_COMPL             2  // all phases PWM'd in unison (low and high side alternately)
 
-  #define LED_GPIO_PORT    GPIOD
-  #define LED_GPIO_PIN     GPIO_PIN_0
+// brake applied once stopped, strength in 1/16 of the control ticks [0:16]
+// (the brake is on for a fraction of the ticks, dithered by the accumulator
+// overflow)
+#define BRAKE_MODE          BRAKE_NONE
+#define BRAKE_STRENGTH      8
+#define BRAKE_STRENGTH_MAX  16
 
-  #define SERVO_GPIO_PORT  GPIOC
-  #define SERVO_GPIO_PIN   GPIO_PIN_4
+// on throttle-down to shutoff, keep commutating at the minimum duty-cycle while
+// the motor slows (regenerative deceleration), else it is switched off at once
+#define DECEL_MODE      0
 
-  #define SPI_ENABLED      SPI_STM8_MASTER
-  #define HAS_SERVO_INPUT
+// scale the duty-cycle by the nominal / filtered battery voltage (feed-forward)
+#define VBATT_COMP_MODE  0
 
-  #define UNDERVOLTAGE_FAULT_ENABLED
-
-#elif defined ( S003_DEV )
 /*
- * s003 does not have TIM3. TIM2 drives PWM/control, TIM1 drives commutation step.
- * Not likely to use the 8k flash part, code barely or does not fit.
+ * Defaults of the run-time parameters (param.c), in effect unless there is a
+ * valid record in the data EEPROM. The above modes are parameters as well.
  */
-// C4 is ok so long as AIN3 is not needed
-  #define ESTOP_BTN_IN_PORT  GPIOD
-  #define ESTOP_BTN_IN_PIN   GPIO_PIN_2
+// duty-cycle (percent) at which the motor is started, and switched off
+#define PWM_DC_STARTUP   12.0   // 0x1E ... 30 * 0.4 = 12.0
+#define PWM_DC_SHUTOFF   8.0    // stalls below 18 counts (7.4 %)
+
+// commutation timing PI controller gains, Q8 (256 == 1.0)
+#define PI_KP            64     // 0.25
+#define PI_KI            8      // 0.03125 per control tick
+
+// Threshold is set low enuogh that the machine doesn't stall
+// thru the lower speed transition into closed-loop control.
+// The fault can be tested by letting the spinning prop disc strike a flimsy
+// obstacle like a 3x5 index card.
+#if defined ( S105_DEV )
+//  Vcc==3.3v  33k/10k @ Vbatt==12.4v
+  #define V_SHUTDOWN_THR      0x0390    // experimentally determined @ 12.4v 
+#else
+  // applies presently only to the stm8s-Discovery, at 14.2v and ADCref == 5v
+  #define V_SHUTDOWN_THR      0x0340    // experimentally determined!
+#endif
 
-// AIN2, C4
-  #define PH0_BEMF_IN_PORT   GPIOC
-  #define PH0_BEMF_IN_PIN    GPIO_PIN_4 // B4 is not HS (TTL)
 
-  #define LED_GPIO_PORT    GPIOB
-  #define LED_GPIO_PIN     GPIO_PIN_5
+// List of supported SPI configurations
+#define SPI_NONE                0
+#define SPI_STM8_MASTER         1
+#define SPI_STM8_SLAVE          2
 
-// invalid .. no timer avilable ?
-  #define SERVO_GPIO_PORT  (GPIO_TypeDef *)-1
-  #define SERVO_GPIO_PIN   (uint8_t)-1
 
-//  #define HAS_SERVO_INPUT // no timer available?
-//  #define SPI_ENABLED     // can't fit SPI in 8k
-//  #define UNDERVOLTAGE_FAULT_ENABLED
+/**
+ * the STM8 variant is defined in the project file, along with the appropriate 
+ * compiler settings for the particular MCU (memory model etc.)
+ * The particular platform, where the particular MCU and pin routing determines
+ * how the peripherals and GPIO pins are allocated, is the board descriptor.
+ */
+#include "board.h"
+
+#if defined( CURRENT_SENSE_ENABLED ) && !defined( ISHUNT_IN_PORT )
+  #error "CURRENT_SENSE_ENABLED: no shunt input (AIN1) on this board"
+#endif
+
+#if defined( THREE_PHASE_BEMF_ENABLED ) && !defined( PH2_BEMF_IN_PORT )
+  #error "THREE_PHASE_BEMF_ENABLED: no phase B, C inputs (AIN2, AIN4) on this board"
 #endif
 
-#ifndef SPI_ENABLED
-#define SPI_ENABLED SPI_NONE
+#ifndef SPI_ENABLED
+#define SPI_ENABLED SPI_NONE
 #endif
 
-#define SPI_RX_BUF_SZ  16 // 256 // tmp
+// SPI bus: peripherals addressed by the master (more than one needs the chip
+// selects, SPI_CTRLR_USE_CS), and the address (broadcast slot) as peripheral
+#define SPI_BUS_NR_ESC  1
+#define SPI_ESC_ADDR    0
+
+// per-commutation trace, entries (power of 2) of sizeof(trace_entry_t) == 11
+#define TRACE_DEPTH  32
+
+// data EEPROM allocation (byte offsets)
+#define EE_OL_LRN_OFFS  0x00  // learned open-loop timing (mdata)
+#define EE_PARAM_OFFS   0x40  // run-time parameters (param)
 
 
 /*
@@ -145,12 +161,32 @@
 
 #define CTIME_SCALAR 2
 
+// motor pole-pairs (12 magnet poles), for the mechanical RPM
+#define MOTOR_POLE_PAIRS  6
+
+// commutation timing advance map of the motor (mdata.c): 0 none, 1 low, 2 high
+#define MOTOR_TIMING_ADV  1
+
+/*
+ * Shunt current sense (CURRENT_SENSE_ENABLED): the output of the shunt
+ * amplifier e.g. 1 mOhm x 50, in ADC counts per A. The PWM pulse is cut at the
+ * limit, the OVERCURRENT fault is set at the trip level.
+ */
+#define ISENSE_MV_PER_A    50
+#define ISENSE_ADC( _A_ )  (uint16_t)( ( (_A_) * ISENSE_MV_PER_A * 1023.0 ) / ADC_VREF_MV )
+
+#define ILIM_AMPS          20
+#define ITRIP_AMPS         30
+
 
 /*
- * (un)comment macro to set PWM 8 Khz or ?
+ * (un)comment macro to set PWM 8 Khz or ? (the nominal i.e. lowest PWM rate)
  */
 #define PWM_8K
 
+// step the PWM rate up to 2x nominal with the motor speed (else fixed nominal)
+//#define PWM_RATE_SCHED_ENABLED
+
 
 // 1/8000  = 0.000125 = 12.5 * 10^(-5)
 // 1/12000 = 0.000083 = 8.3 * 10^(-5)
@@ -173,5 +209,12 @@
 
 #define PWM_100PCNT  TIM2_PWM_PD
 
+// PWM timer count at which the ADC is triggered (ADC_HW_TRIGGER)
+#define ADC_TRIG_POINT  8  // 4uS (approximately where the ISR used to start the ADC)
+
+// PWM cycles per PWM timer update ISR (i.e. per Driver_Update) at the nominal
+// rate (scaled with the PWM rate so the update rate is the same)
+#define PWM_FRAMES_PER_UPD  4
+
 
 #endif // SYSTEM_H
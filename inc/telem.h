@@ -0,0 +1,76 @@
+/**
+  ******************************************************************************
+  * @file telem.h
+  * @brief Binary telemetry frame
+  * @author Neidermeier
+  * @version
+  * @date
+  ******************************************************************************
+  */
+#ifndef TELEM_H
+#define TELEM_H
+
+/* Includes ------------------------------------------------------------------*/
+#include "system.h"
+
+#ifdef UNIT_TEST
+#include <stdint.h>
+#endif
+
+/* defines -------------------------------------------------------------------*/
+
+/**
+ * Frame layout (multi-byte fields are little-endian):
+ *
+ *  offset  size  field
+ *   0       1    sync (TELEM_SYNC)
+ *   1       1    sequence counter
+ *   2       2    commutation period
+ *   4       2    PWM duty-cycle
+ *   6       2    Vsystem
+ *   8       1    fault status
+ *   9       2    back-EMF rising
+ *  11       2    back-EMF falling
+ *  13       2    timing error (signed)
+ *  15       2    speed estimate (eRPM / 10)
+ *  17       1    CRC8 of bytes [0:16]
+ */
+#define TELEM_SYNC      0xA5
+#define TELEM_FRAME_SZ  18
+
+#define TELEM_CRC8_POLY  0x07  // x^8 + x^2 + x + 1, initial value 0
+
+/**
+ * Send a frame every TELEM_RATE_DIV periodic task frames (~60 Hz)
+ */
+#define TELEM_RATE_DIV  1
+
+
+/* types ---------------------------------------------------------------------*/
+
+/**
+ * @brief One telemetry sample.
+ */
+typedef struct
+{
+  uint16_t comm_period;
+  uint16_t pwm_dc;
+  uint16_t vsystem;
+  uint8_t  faults;
+  uint16_t bemf_r;
+  uint16_t bemf_f;
+  int16_t  timing_error;
+  uint16_t erpm10;
+} telem_sample_t;
+
+
+/* prototypes ----------------------------------------------------------------*/
+
+uint8_t Telem_crc8(const uint8_t * pbuf, uint8_t len);
+
+void Telem_pack(uint8_t * pframe, uint8_t seq, const telem_sample_t * psample);
+
+void Telem_send(const telem_sample_t * psample);
+
+
+#endif // TELEM_H
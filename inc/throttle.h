@@ -0,0 +1,56 @@
+/**
+  ******************************************************************************
+  * @file throttle.h
+  * @brief Throttle input protocols (servo PWM, Oneshot125, Multishot)
+  * @author Neidermeier
+  * @version
+  * @date
+  ******************************************************************************
+  */
+#ifndef THROTTLE_H
+#define THROTTLE_H
+
+/* Includes ------------------------------------------------------------------*/
+#include "system.h"
+
+#ifdef UNIT_TEST
+#include <stdint.h>
+#endif
+
+/* defines -------------------------------------------------------------------*/
+
+/**
+ * Capture timer counts per microsecond (timer clock fMASTER / 2)
+ */
+#ifdef CLOCK_16
+  #define THR_TICKS_PER_US  8
+#else
+  #define THR_TICKS_PER_US  4
+#endif
+
+
+/* types ---------------------------------------------------------------------*/
+
+/**
+ * @brief Throttle input protocols, in order of the detection table.
+ */
+typedef enum
+{
+  THR_PROTO_SERVO = 0,  /**< 1000-2000 us pulse @ 50 Hz */
+  THR_PROTO_ONESHOT125, /**< 125-250 us pulse */
+  THR_PROTO_MULTISHOT,  /**< 5-25 us pulse */
+  THR_PROTO_NONE        /**< not (yet) detected */
+} thr_proto_t;
+
+
+/* prototypes ----------------------------------------------------------------*/
+
+void Throttle_init(void);
+
+void Throttle_on_pulse(uint16_t width);
+
+uint8_t Throttle_get(uint8_t * pthrottle);
+thr_proto_t Throttle_get_proto(void);
+
+
+#endif // THROTTLE_H
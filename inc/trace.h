@@ -0,0 +1,50 @@
+/**
+  ******************************************************************************
+  * @file trace.h
+  * @brief Per-commutation RAM trace buffer
+  * @author Neidermeier
+  * @version
+  * @date
+  ******************************************************************************
+  */
+#ifndef TRACE_H
+#define TRACE_H
+
+/* Includes ------------------------------------------------------------------*/
+#include "system.h"
+
+#ifdef UNIT_TEST
+#include <stdint.h>
+#endif
+
+/* defines -------------------------------------------------------------------*/
+
+#define TRACE_DEPTH_MSK  ( TRACE_DEPTH - 1 )
+
+
+/* types ---------------------------------------------------------------------*/
+
+/**
+ * @brief One trace entry, written at each commutation step.
+ */
+typedef struct
+{
+  uint8_t  step;         /**< commutation step [0:5] */
+  uint16_t adc;          /**< ADC sample of the previous sector */
+  uint16_t bemf_r;       /**< back-EMF rising (Back_EMF_Riseing_PhX) */
+  uint16_t bemf_f;       /**< back-EMF falling (Back_EMF_Falling_PhX) */
+  uint16_t comm_period;  /**< commutation period */
+  uint16_t duty;         /**< commanded duty-cycle */
+} trace_entry_t;
+
+
+/* prototypes ----------------------------------------------------------------*/
+
+trace_entry_t * Trace_next(void);
+void Trace_freeze(void);
+
+void Trace_dump_req(void);
+uint8_t Trace_dump_line(void);
+
+
+#endif // TRACE_H
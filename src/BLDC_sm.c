@@ -20,6 +20,11 @@
 #include "pwm_stm8s.h" // motor phase control
 #include "faultm.h"
 #include "sequence.h"
+#include "driver.h"
+#include "throttle.h"
+#include "speed.h"
+#include "startup.h"
+#include "spi_stm8s.h"
 
 /* Private defines -----------------------------------------------------------*/
 
@@ -35,11 +40,9 @@
 #define PWM_X_PCNT( _PCNT_ )   (uint16_t)( ( _PCNT_ * PWM_100PCNT ) / 100.0 )
 
 /*
- * precision is 1/TIM2_PWM_PD = 0.4% per count
+ * precision is 1/TIM2_PWM_PD = 0.4% per count (the duty-cycle is in counts of
+ * the nominal PWM period at any PWM rate, see set_dutycycle)
  */
-#define PWM_DC_STARTUP   12.0   // 0x1E ... 30 * 0.4 = 12.0
-#define PWM_DC_SHUTOFF   8.0    // stalls below 18 counts (7.4 %)
-
 #define PWM_PD_STARTUP   PWM_X_PCNT( PWM_DC_STARTUP )
 #define PWM_PD_SHUTOFF   PWM_X_PCNT( PWM_DC_SHUTOFF )
 
@@ -64,9 +67,9 @@
  */
 
 //#define TIM3_RATE_MODULUS   4 // each commutation sector of 60-degrees spans 4x TIM3 periods
-// the commutation timing constants (TIM3 period) effectively have a factor of
-// 'TIM3_RATE_MODULUS' rolled into them since the timer fires 4x faster than the
-// actual motor commutation frequency.
+// the commutation timing constants (TIM3 period) are 1/4 of the sector, the
+// factor of 'TIM3_RATE_MODULUS' is applied where the timer is loaded with the
+// sector time (Driver_set_comm_period).
 #define BLDC_OL_TM_LO_SPD     (0x0C00 * CTIME_SCALAR) // commutation period at start of ramp (est. @ 12v)
 
 //   0.000667 seconds / 24 / 0.25us = 111 counts
@@ -77,6 +80,87 @@
 // commutation time factor is rolled in there as well
 #define BLDC_ONE_RAMP_UNIT    (0.5 * CTRL_RATEM * CTIME_SCALAR)
 
+/*
+ * Closed-loop commutation timing PI controller, evaluated at the control rate
+ * (~1 kHz). Gains are Q8 (256 == 1.0) and the error term is saturated to 8-bits
+ * so that the products fit a 16-bit multiply. The output is a correction to
+ * the open-loop timing for the present duty-cycle (i.e. feed-forward), clamped
+ * to +/- 1/(2^PI_CLAMP_SH) of it, and the commutation period is rate limited.
+ * The gains are parameters (PI_KP, PI_KI by default) of at most 8-bits.
+ */
+#define PI_Q_SH      8
+#define PI_ERR_MAX   127
+#define PI_CLAMP_SH  2    // +/- 25% of the open-loop timing
+#define PI_RATE_MAX  (uint16_t)( 4 * BLDC_ONE_RAMP_UNIT ) // per control tick
+
+/*
+ * PWM rate schedule: the rate is stepped up as the commutation period gets
+ * shorter, to keep at least ~3 PWM cycles (back-EMF samples) per sector, and
+ * stepped down with 1/8 hysteresis. At the nominal 8 kHz a PWM cycle is 250
+ * commutation timer counts (/CTIME_SCALAR) of the 4 per sector.
+ */
+#define PWM_SCHED_X1_5   (0x0177 * CTIME_SCALAR) // 3 cycles @ 8 kHz
+#define PWM_SCHED_X2     (0x00FA * CTIME_SCALAR) // 3 cycles @ 12 kHz
+
+/*
+ * Control mode bits: the commutation timing loop, and the speed setting as
+ * duty-cycle or as RPM setpoint (governor)
+ */
+#define CTM_CLOSED_LOOP  0x01
+#define CTM_GOVERNOR     0x02
+
+/*
+ * Speed governor, evaluated at the control rate. The speed setting [0:255] is
+ * the setpoint in steps of 250 eRPM (i.e. ~42 RPM for 6 pole-pairs). The gain
+ * is Q16 (duty-cycle counts per eRPM/10 per control tick), the product is
+ * 32-bits. The output is the duty-cycle, followed by the open-loop timing at
+ * its ramp rate: a proportional term only makes the speed hunt (the response
+ * is bound by the ramp), so it is an integral controller.
+ */
+#define GOV_ERPM10_PER_CNT  25
+#define GOV_Q_SH      16
+#define GOV_KI        4     // 10000 eRPM error -> ~0.06 duty-cycle counts per tick
+#define GOV_ERR_MAX   2000
+#define GOV_DB_SH     6     // dead-band +/- 1/64 of the setpoint
+#define GOV_DC_MIN    Dc_shutoff
+#define GOV_DC_MAX    PWM_X_PCNT( 70.0 )
+
+/*
+ * Regenerative deceleration: while the throttle is falling, the lower duty-
+ * cycle (below the back-EMF, so the current reverses) is applied at once and
+ * the open-loop timing follows the slowing rotor at DECEL_RAMP_STEP. On
+ * throttle-down to the shutoff, the motor is commutated at the minimum duty-
+ * cycle until the commutation period is within 1/2^DECEL_TOL_SH of the
+ * open-loop timing at that duty-cycle, or until the timeout.
+ */
+#define DECEL_DC          (uint8_t)( Dc_shutoff + 1 )
+#define DECEL_TOL_SH      3
+#define DECEL_TICKS_MAX   1000  // control ticks (~1 s)
+#define DECEL_RAMP_STEP   (uint8_t)( 4 * BLDC_ONE_RAMP_UNIT ) // open-loop timing ramp
+
+/*
+ * Battery voltage compensation: the duty-cycle to the PWM is scaled by the
+ * ratio of the voltage at which the open-loop timing and startup were tuned
+ * to the filtered battery voltage, so the effective phase voltage at a given
+ * duty-cycle, and so the speed on the open-loop timing, holds over the
+ * discharge of the pack. The ratio is Q8 and bounded to the plausible range.
+ */
+#define VCOMP_Q_SH     8
+#define VCOMP_EMA_SH   4     // 1/16 per control tick (~16 ms)
+#define VCOMP_MIN      (uint16_t)( 0.75 * ( 1 << VCOMP_Q_SH ) )
+#define VCOMP_MAX      (uint16_t)( 1.33 * ( 1 << VCOMP_Q_SH ) )
+
+/*
+ * Recovery from a loss of sync (FLYING_START_ENABLED): on a stall or desync
+ * fault the bridge is off (hard fault), and the motor is caught from its
+ * back-EMF by the flying start rather than stopped. The recovery is retried up
+ * to RECOVER_MAX times, the count is cleared once the motor has been in sync
+ * for RECOVER_HOLD_TICKS, else the fault is kept and the motor stops.
+ */
+#define RECOVER_FAULTS      ( STALL | DESYNC )
+#define RECOVER_MAX         3
+#define RECOVER_HOLD_TICKS  1000  // control ticks (~1 s)
+
 
 /* Private types -----------------------------------------------------------*/
 
@@ -90,7 +174,29 @@ static uint16_t Commanded_Dutycycle; // copied select DC to global for logging
 
 static uint8_t BL_pwm_period;  // input from UI task, file-scope for sm_update
 
-static uint8_t Control_mode;   // indicates manual commuation buttons are active
+static uint8_t Control_mode;   // CTM_CLOSED_LOOP, CTM_GOVERNOR
+
+static int32_t Gov_integ;      // integrator of the speed governor (Q16 duty-cycle)
+
+static uint8_t Timing_settled; // the open-loop timing ramp is at its target
+
+static int32_t PI_integ;       // integrator of the timing controller (Q8)
+static uint8_t PI_kp = PI_KP;
+static uint8_t PI_ki = PI_KI;
+
+static uint8_t Dc_startup = PWM_PD_STARTUP;
+static uint8_t Dc_shutoff = PWM_PD_SHUTOFF;
+
+static uint8_t Decel_mode = DECEL_MODE;
+static uint16_t Decel_ticks;   // control ticks in the deceleration, 0 if not
+
+static uint8_t Vcomp_mode = VBATT_COMP_MODE;
+static uint16_t Vbatt_q4;      // filtered battery voltage (ADC counts, Q4)
+
+#ifdef FLYING_START_ENABLED
+static uint8_t Recover_count;  // recoveries from a loss of sync
+static uint16_t Sync_ticks;    // control ticks in sync since the latest recovery
+#endif
 
 
 /* Private function prototypes -----------------------------------------------*/
@@ -98,6 +204,31 @@ static uint8_t Control_mode;   // indicates manual commuation buttons are active
 
 /* Private functions ---------------------------------------------------------*/
 
+#if defined( PWM_RATE_SCHED_ENABLED )
+/*
+ * Step the PWM rate according to the commutation period
+ */
+static void pwm_rate_schedule(uint16_t comm_period)
+{
+  // period threshold to step up from each rate
+  static const uint16_t sched_tbl[ PWM_NR_RATES - 1 ] =
+  {
+    PWM_SCHED_X1_5, PWM_SCHED_X2
+  };
+  PWM_rate_t rate = PWM_get_rate();
+
+  if (rate < PWM_NR_RATES - 1 && comm_period < sched_tbl[ rate ])
+  {
+    PWM_set_rate( (PWM_rate_t)(rate + 1) );
+  }
+  else if (rate > PWM_RATE_X1 &&
+           comm_period > sched_tbl[ rate - 1 ] + (sched_tbl[ rate - 1 ] >> 3) )
+  {
+    PWM_set_rate( (PWM_rate_t)(rate - 1) );
+  }
+}
+#endif
+
 /**
  * @brief  Commutation timing ramp control.
  *
@@ -105,11 +236,12 @@ static uint8_t Control_mode;   // indicates manual commuation buttons are active
  * stepped in increment of +/- step depending on the sign of the error.
  *
  * @param   tgt_commutation_per  Target value to track.
+ * @param   stepi                Step per control tick.
+ *
+ * @return  TRUE if the commutation period is at the target
  */
-static void timing_ramp_control(uint16_t tgt_commutation_per)
+static uint8_t timing_ramp_control(uint16_t tgt_commutation_per, uint8_t stepi)
 {
-  const uint8_t stepi = BLDC_ONE_RAMP_UNIT;
-
   uint16_t u16 = BLDC_OL_comm_tm;
 
   // determine signage of error i.e. step increment
@@ -131,19 +263,266 @@ static void timing_ramp_control(uint16_t tgt_commutation_per)
     }
     BLDC_OL_comm_tm  = u16;
   }
+  return (uint8_t)( BLDC_OL_comm_tm == tgt_commutation_per );
+}
+
+/**
+ * @brief  Commutation timing PI controller.
+ *
+ * @details  Anti-windup: the integrator is updated only if the output is not
+ *  saturated, or if the error term would bring it back out of saturation.
+ *
+ * @param  error   Timing error, positive if the commutation period is to be
+ *                 increased.
+ * @param  ol_per  Open-loop commutation period for the present duty-cycle.
+ *
+ * @return  Correction to the open-loop commutation period.
+ */
+static int16_t timing_pi_control(int16_t error, uint16_t ol_per)
+{
+  const int16_t limit = (int16_t)( ol_per >> PI_CLAMP_SH );
+  int32_t integ;
+  int16_t u;
+
+  if (error > PI_ERR_MAX)
+  {
+    error = PI_ERR_MAX;
+  }
+  else if (error < -PI_ERR_MAX)
+  {
+    error = -PI_ERR_MAX;
+  }
+
+  integ = PI_integ + (int16_t)( error * PI_ki );
+  u = (int16_t)( ( integ + (int16_t)( error * PI_kp ) ) >> PI_Q_SH );
+
+  if (u > limit)
+  {
+    u = limit;
+    if (error < 0)
+    {
+      PI_integ = integ;
+    }
+  }
+  else if (u < -limit)
+  {
+    u = -limit;
+    if (error > 0)
+    {
+      PI_integ = integ;
+    }
+  }
+  else
+  {
+    PI_integ = integ;
+  }
+  return u;
+}
+
+/**
+ * @brief  Speed governor controller.
+ *
+ * @details  Anti-windup: the integrator is clamped to the duty-cycle range,
+ *  and is held while the open-loop timing is ramping to the duty-cycle (the
+ *  speed can't follow the duty-cycle any faster than the ramp), or while the
+ *  error is inside the dead-band. The integrator
+ *  is preset from the duty-cycle on engaging the governor, so the transfer is
+ *  bumpless.
+ *
+ * @param  setpoint  eRPM / 10
+ * @param  erpm10    Speed estimate, eRPM / 10
+ * @param  settled   TRUE if the commutation timing has settled
+ *
+ * @return  Duty-cycle
+ */
+static uint16_t governor_control(uint16_t setpoint, uint16_t erpm10, uint8_t settled)
+{
+  const int32_t integ_min = (int32_t)GOV_DC_MIN << GOV_Q_SH;
+  const int32_t integ_max = (int32_t)GOV_DC_MAX << GOV_Q_SH;
+  int32_t error = (int32_t)setpoint - erpm10;
+
+  if (error > GOV_ERR_MAX)
+  {
+    error = GOV_ERR_MAX;
+  }
+  else if (error < -GOV_ERR_MAX)
+  {
+    error = -GOV_ERR_MAX;
+  }
+
+  // the speed steps with each duty-cycle count of the open-loop timing, so
+  // a dead-band of about half a step stops the integrator dithering
+  if (FALSE != settled  &&
+      ( error > (int16_t)(setpoint >> GOV_DB_SH) || error < -(int16_t)(setpoint >> GOV_DB_SH) ) )
+  {
+    Gov_integ += error * GOV_KI;
+  }
+
+  if (Gov_integ > integ_max)
+  {
+    Gov_integ = integ_max;
+  }
+  else if (Gov_integ < integ_min)
+  {
+    Gov_integ = integ_min;
+  }
+
+  return (uint16_t)( Gov_integ >> GOV_Q_SH );
+}
+
+/*
+ * Select the speed setting as duty-cycle or RPM setpoint
+ */
+static void set_governor(uint8_t enable)
+{
+  const uint8_t mode = (FALSE != enable) ? CTM_GOVERNOR : 0;
+
+  if (mode != (Control_mode & CTM_GOVERNOR))
+  {
+    Control_mode = (uint8_t)( ( Control_mode & ~CTM_GOVERNOR ) | mode );
+
+    // bumpless from the present duty-cycle
+    Gov_integ = (int32_t)Commanded_Dutycycle << GOV_Q_SH;
+  }
+}
+
+/*
+ * End of the regenerative deceleration: stop once slowed down
+ */
+static void decel_control(void)
+{
+  const uint16_t ol_per = Get_OL_Timing( DECEL_DC );
+
+  Decel_ticks += 1;
+
+  if ( BLDC_OL_comm_tm + ( ol_per >> DECEL_TOL_SH ) >= ol_per ||
+       Decel_ticks > DECEL_TICKS_MAX )
+  {
+    BL_reset();
+  }
+}
+
+/*
+ * Battery voltage compensation of the duty-cycle to the PWM
+ */
+static uint16_t vbatt_compensation(uint16_t dc)
+{
+  const uint16_t vbatt = Seq_Get_Vbatt();
+  uint16_t ratio;
+  uint32_t t32;
+
+  // measured once per electrical cycle while running, the filter is kept
+  // while stopped
+  if (0 != vbatt)
+  {
+    if (0 == Vbatt_q4)
+    {
+      Vbatt_q4 = vbatt << VCOMP_EMA_SH;
+    }
+    else
+    {
+      Vbatt_q4 += vbatt - ( Vbatt_q4 >> VCOMP_EMA_SH );
+    }
+  }
+
+  if (0 == Vcomp_mode || Vbatt_q4 < ( 1 << ( VCOMP_EMA_SH + 2 ) ))
+  {
+    return dc;
+  }
+
+  // 16-bit divide, the voltage to 1/4 of the ADC resolution
+  ratio = ( Get_OL_Vbatt() << ( VCOMP_Q_SH - 2 ) ) / ( Vbatt_q4 >> ( VCOMP_EMA_SH + 2 ) );
+
+  if (ratio > VCOMP_MAX)
+  {
+    ratio = VCOMP_MAX;
+  }
+  else if (ratio < VCOMP_MIN)
+  {
+    ratio = VCOMP_MIN;
+  }
+  t32 = ( (uint32_t)dc * ratio ) >> VCOMP_Q_SH;
+
+  return (t32 > PWM_100PCNT) ? PWM_100PCNT : (uint16_t)t32;
+}
+
+/*
+ * Re-arm the startup and the timing control, common to the reset and the
+ * recovery from a loss of sync (recover), which is from the flying start
+ */
+static void control_reset(uint8_t recover)
+{
+  Faultm_init();
+
+  Driver_ZC_reset();
+
+  Speed_reset();
+
+  Startup_reset(recover);
+
+  // the speed setting mode is kept, the timing is open-loop until the hand-off
+  Control_mode &= CTM_GOVERNOR;
+
+  PI_integ = 0;
+
+  Timing_settled = FALSE;
+
+#if defined( PWM_RATE_SCHED_ENABLED )
+  if (PWM_RATE_X1 != PWM_get_rate())
+  {
+    PWM_set_rate( PWM_RATE_X1 );
+  }
+#endif
 }
 
+#ifdef FLYING_START_ENABLED
+/*
+ * Loss of sync: the motor is caught again by the flying start (the fault has
+ * shut off the bridge), if the retries are not used up. The speed setting is
+ * kept, the commutation period until the back-EMF is measured.
+ */
+static uint8_t sync_recovery(fault_status_reg_t fm_status)
+{
+  if (STARTUP_DONE == Startup_get_phase() && Speed_is_locked())
+  {
+    if (Sync_ticks < RECOVER_HOLD_TICKS)
+    {
+      Sync_ticks += 1;
+    }
+    else
+    {
+      Recover_count = 0;
+    }
+  }
+
+  if ( 0 == fm_status || 0 != ( fm_status & ~RECOVER_FAULTS ) ||
+       0 == BL_pwm_period || Recover_count >= RECOVER_MAX )
+  {
+    return FALSE;
+  }
+  Recover_count += 1;
+  Sync_ticks = 0;
+
+  control_reset(TRUE);
+
+  return TRUE;
+}
+#endif
+
 /*
  * BL_stop
  * common sub for stopping and fault states
  */
 static void haltensie(void)
 {
+  if (0 != BL_pwm_period)
+  {
 // have to clear the local UI_speed since that is the transition OFF->RAMP condition
-  BL_pwm_period = 0;
+    BL_pwm_period = 0;
 
-  // kill the driver signals
-  All_phase_stop();
+    // kill the driver signals, once stopped the bridge is the brake's
+    All_phase_stop();
+  }
 }
 
 
@@ -156,10 +535,14 @@ static void haltensie(void)
  *    as well as following a fault condition state.
  *
  * @details
- *    expect to be called from non-ISR/CS context (i.e. from  UI handler)
+ *    called at startup, and from the control task (ISR context) on a stop
+ *    request from the UI or speed input below the shutoff threshold
  */
 void BL_reset(void)
 {
+  // the timing profile for the last measured voltage (0 if not measured)
+  Set_OL_Profile( Seq_Get_Vbatt() );
+
   // stop the system in case it is already running
   haltensie();  //  zeros the  UI speed
 
@@ -171,9 +554,14 @@ void BL_reset(void)
   // Set initial commutation timing period upon state transition.
   BLDC_OL_comm_tm = BLDC_OL_TM_LO_SPD;
 
-  Faultm_init();
+  control_reset(FALSE);
 
-  Control_mode = FALSE;
+  Decel_ticks = 0;
+
+#ifdef FLYING_START_ENABLED
+  Recover_count = 0;
+  Sync_ticks = 0;
+#endif
   // eventually it gets around to asserting the timer/PWM reset in the ISR update
   // but explicitly handled here will be more deterministic
 //    set_dutycycle( PWM_0PCNT );
@@ -185,9 +573,10 @@ void BL_reset(void)
  *
  * @details
  *  The motor is started once reaching the ramp speed threshold, and allowed to
- *  slow down to the low shutoff threshold.
- *  UI Speed is shared with background task so this function should
- *  be invoked only from within a CS.
+ *  slow down to the low shutoff threshold. Below the shutoff it is stopped, or
+ *  decelerated first if enabled and the startup is done.
+ *  Invoked from the control task with the speed setting published by the
+ *  background task.
  *
  * @param dc Speed input which can be in the range [0:255]
  *            TODO: needs to be in terms of percent of speed range (0:100)
@@ -195,32 +584,25 @@ void BL_reset(void)
 void BLDC_PWMDC_Set(uint8_t dc)
 {
 
-  if (dc > PWM_PD_SHUTOFF)
+  if (dc > Dc_shutoff)
   {
     // Update the dc if speed input greater than ramp start, OR if system already running
-    if ( dc > PWM_PD_STARTUP  ||  0 != BL_pwm_period )
+    if ( dc > Dc_startup  ||  0 != BL_pwm_period )
     {
       BL_pwm_period = dc;
-
-      // on speed change, check for condition to transition to closed loopo
-      if (FALSE == Control_mode)
-      {
-        /*
-         * checks a plausibility condition for transition to closed-loop
-         * control of commutation timing. Also considered imposing a minimum
-         * elapsed run-time but there is apparently no obvious reason to do such a thing.
-        */
-        if ( 0 == Seq_get_timing_error_p() )
-        {
-#ifdef CLMODE_ENABLED
-          Control_mode = TRUE;
-#endif
-        }
-      }
-      // else
-      // if dc < THRESHOLD, then unlatch control mode?
+      Decel_ticks = 0;
     }
   }
+  else if ( 0 != Decel_mode && 0 != BL_pwm_period &&
+            STARTUP_DONE == Startup_get_phase() )
+  {
+    // the control task stops the motor once it has slowed down
+    if (0 == Decel_ticks)
+    {
+      Decel_ticks = 1;
+    }
+    BL_pwm_period = DECEL_DC;
+  }
   else
   {
     // reset needed in case system was running, in which case there is no
@@ -229,6 +611,63 @@ void BLDC_PWMDC_Set(uint8_t dc)
   }
 }
 
+/**
+ * @brief  Enable the regenerative deceleration on throttle-down.
+ *
+ * @details  Takes effect at the next throttle-down, expected to be called
+ *  while the motor is stopped.
+ *
+ * @param  enable  TRUE to decelerate, else the motor is switched off at once
+ */
+void BL_set_decel(uint8_t enable)
+{
+  Decel_mode = enable;
+}
+
+/**
+ * @brief  Enable the battery voltage compensation of the duty-cycle.
+ *
+ * @details  The commanded duty-cycle (and the open-loop timing indexed by it)
+ *  is on the scale of the nominal voltage of the timing profile, the duty-cycle
+ *  to the PWM is compensated.
+ *
+ * @param  enable  TRUE to compensate
+ */
+void BL_set_vbatt_comp(uint8_t enable)
+{
+  Vcomp_mode = enable;
+}
+
+/**
+ * @brief  Set the duty-cycle thresholds of the speed input.
+ *
+ * @details  The motor is started once the speed input is above the startup
+ *  threshold, and switched off (or decelerated) at the shutoff threshold.
+ *  Called from the background task, each is a byte write.
+ *
+ * @param  startup  Duty-cycle to start the motor (PWM counts)
+ * @param  shutoff  Duty-cycle to switch it off (PWM counts)
+ */
+void BL_set_dc_limits(uint8_t startup, uint8_t shutoff)
+{
+  Dc_startup = startup;
+  Dc_shutoff = shutoff;
+}
+
+/**
+ * @brief  Set the gains of the commutation timing PI controller.
+ *
+ * @details  Takes effect at the next control tick, the integrator is kept.
+ *
+ * @param  kp  Proportional gain (Q8)
+ * @param  ki  Integral gain (Q8 per control tick)
+ */
+void BL_set_timing_gains(uint8_t kp, uint8_t ki)
+{
+  PI_kp = kp;
+  PI_ki = ki;
+}
+
 /**
  * @brief Accessor for Commanded Duty Cycle
  *
@@ -246,7 +685,7 @@ uint16_t BLDC_PWMDC_Get(void)
  */
 void BLDC_Spd_dec()
 {
-  Control_mode = TRUE; //tbd
+  Control_mode |= CTM_CLOSED_LOOP; //tbd
 
   BLDC_OL_comm_tm += 1; // slower
 }
@@ -256,7 +695,7 @@ void BLDC_Spd_dec()
  */
 void BLDC_Spd_inc()
 {
-  Control_mode = TRUE; // tbd
+  Control_mode |= CTM_CLOSED_LOOP; // tbd
 
   BLDC_OL_comm_tm -= 1; // faster
 }
@@ -285,7 +724,7 @@ uint16_t get_commutation_period(void)
  */
 BL_RUNSTATE_t BL_get_state(void)
 {
-  if (BL_pwm_period > PWM_PD_SHUTOFF )
+  if (BL_pwm_period > Dc_shutoff )
   {
     return BL_IS_RUNNING;
   }
@@ -304,7 +743,7 @@ BL_RUNSTATE_t BL_get_state(void)
  */
 uint8_t BL_get_ct_mode(void)
 {
-  return Control_mode;
+  return (uint8_t)( 0 != (Control_mode & CTM_CLOSED_LOOP) );
 }
 
 /**
@@ -312,18 +751,105 @@ uint8_t BL_get_ct_mode(void)
  */
 void BLDC_Update(void)
 {
-  // 1 bit is /2 for sma, 1 bit is /2 for "gain"
-#define SMA_SH  1 // tmp
-#define GAIN_SH  2 // tmp
-  static const uint8_t CONTROL_GAIN_SH  = (GAIN_SH + SMA_SH);
-
-  static  int16_t timing_error ;
-  static uint8_t ctrl_tick = 0; // persistent count for sub-rating the control loop
-
 // does it need static previous copy of speed input to check for state transition?
+  static uint8_t stop_req = 0;
+
   uint16_t inp_dutycycle = 0; // intialize to 0
 
-  fault_status_reg_t  fm_status = Faultm_get_status();
+  fault_status_reg_t  fm_status;
+
+  Driver_command_t cmd;
+
+  uint8_t startup = FALSE;
+
+  uint8_t braking;
+
+  const uint16_t erpm10 = Speed_get_erpm10();
+
+#if defined( HAS_SERVO_INPUT )
+  static uint8_t thr_present = FALSE;
+  static uint8_t thr_prev;
+  uint8_t thr;
+#endif
+#if SPI_ENABLED == SPI_STM8_SLAVE
+  static uint8_t link_present = FALSE;
+  static uint8_t link_prev;
+  uint8_t link_thr;
+#endif
+
+  // new command from the UI task
+  if (TRUE == Driver_get_command(&cmd))
+  {
+    if (cmd.stop_req != stop_req)
+    {
+      stop_req = cmd.stop_req;
+      BL_reset();
+    }
+    set_governor(cmd.governor);
+
+#if defined( HAS_SERVO_INPUT )
+    if (FALSE == thr_present)
+#endif
+#if SPI_ENABLED == SPI_STM8_SLAVE
+    if (FALSE == link_present)
+#endif
+    {
+      BLDC_PWMDC_Set(cmd.dc);
+    }
+  }
+
+#if defined( HAS_SERVO_INPUT )
+  // the throttle input has precedence over the UI speed and is applied at the
+  // control rate, rather than the UI task rate
+  if (TRUE == Throttle_get(&thr))
+  {
+    if (FALSE == thr_present || thr != thr_prev)
+    {
+      thr_present = TRUE;
+      thr_prev = thr;
+      BLDC_PWMDC_Set(thr);
+    }
+  }
+  else if (FALSE != thr_present)
+  {
+    // signal lost
+    thr_present = FALSE;
+    BLDC_PWMDC_Set(0);
+  }
+#endif
+
+#if SPI_ENABLED == SPI_STM8_SLAVE
+  // likewise the flight-controller link while in run mode (SPI_MODE_RUN)
+  if (TRUE == SPI_get_throttle(&link_thr))
+  {
+    if (FALSE == link_present || link_thr != link_prev)
+    {
+      link_present = TRUE;
+      link_prev = link_thr;
+      BLDC_PWMDC_Set(link_thr);
+    }
+  }
+  else if (FALSE != link_present)
+  {
+    // out of run mode, the UI speed applies from its next command
+    link_present = FALSE;
+    BLDC_PWMDC_Set(0);
+  }
+#endif
+
+  if (0 != Decel_ticks)
+  {
+    decel_control();
+  }
+
+  fm_status = Faultm_get_status();
+
+#ifdef FLYING_START_ENABLED
+  if (FALSE != sync_recovery(fm_status))
+  {
+    fm_status = 0;
+  }
+#endif
 
   if ( 0 == fm_status )
   {
@@ -336,33 +862,133 @@ void BLDC_Update(void)
     // assert ... inp_dutycycle = 0;
   }
 
+  // the startup has the duty-cycle and commutation period until the hand-off
+  if (inp_dutycycle > 0)
+  {
+    startup = Startup_update( &BLDC_OL_comm_tm, &inp_dutycycle );
+
+    if (0 != (Control_mode & CTM_GOVERNOR))
+    {
+      if (FALSE != startup || 0 != Decel_ticks)
+      {
+        // tracks the startup (and deceleration) for a bumpless hand-off, the
+        // flying start keeps the duty-cycle from before the loss of sync (the
+        // bridge is off while the back-EMF is sensed)
+        if (STARTUP_CATCH != Startup_get_phase())
+        {
+          Gov_integ = (int32_t)inp_dutycycle << GOV_Q_SH;
+        }
+      }
+      else
+      {
+        // the speed setting is the RPM setpoint
+        inp_dutycycle = governor_control(
+                          (uint16_t)BL_pwm_period * GOV_ERPM10_PER_CNT, erpm10,
+                          Timing_settled );
+      }
+    }
+  }
+
+  // the brake has the bridge (and the duty-cycle) while stopped
+  braking = Seq_brake_update();
+
   // refresh the duty-cycle and commutation period ... sets the pwm
   // which will be upated to the PWM timer peripheral at next commutation point.
-  set_dutycycle( inp_dutycycle );
+  if (FALSE == braking)
+  {
+    set_dutycycle( vbatt_compensation( inp_dutycycle ) );
+  }
 
   // there isn't much point in enabling commuation timing contrl if speed is 0
   // and by leaving it along until the system is actually running, it can set
   // the initial condition in the global BL_Reset() above.
-  if (inp_dutycycle > 0    &&  ( 0 == fm_status ) )
+  if (inp_dutycycle > 0    &&  ( 0 == fm_status )  &&  FALSE == startup )
   {
-    if (FALSE == Control_mode)
+    if (0 == (Control_mode & CTM_CLOSED_LOOP))
     {
-      timing_ramp_control( Get_OL_Timing( inp_dutycycle ) );
+      const uint16_t ol_per = Get_OL_Timing( inp_dutycycle );
+
+      // decelerating (throttle falling, or down to the shutoff) the timing
+      // follows the rotor slowed by the lower duty-cycle at the faster ramp
+      const uint8_t step = ( 0 != Decel_ticks ||
+                             ( 0 != Decel_mode && ol_per > BLDC_OL_comm_tm ) ) ?
+                           DECEL_RAMP_STEP : BLDC_ONE_RAMP_UNIT;
+
+      Timing_settled = timing_ramp_control( ol_per, step );
+#ifdef CLMODE_ENABLED
+      /*
+       * checks a plausibility condition for transition to closed-loop
+       * control of commutation timing, which ends the startup as soon as it
+       * is met
+       */
+      if ( 0 == Seq_get_timing_error_p() )
+      {
+        Control_mode |= CTM_CLOSED_LOOP;
+        PI_integ = 0;
+        Timing_settled = TRUE;
+      }
+#endif
     }
     else
     {
-      // the control gain is macro'd together with the unscaling of the error term and also /2 of the sma
-      uint16_t t16 = BLDC_OL_comm_tm ;
-      timing_error = ( Seq_get_timing_error() + timing_error ) >> CONTROL_GAIN_SH;
-      t16 += timing_error;
-
-// if this overshoots, the control runs away until the TIM3 becomes so low the system locks up and no faultm can work .. not failsafe!
-      if (t16 > LUDICROUS_SPEED)
+      const uint16_t ol_per = Get_OL_Timing( inp_dutycycle );
+      uint16_t t16;
+#ifdef ZC_COMM_ENABLED
+      // commutation period is tracked from the measured back-EMF zero-crossing
+      const uint16_t zc_per = Driver_get_ZC_period();
+      int16_t timing_error = 0;
+
+      if (0 != zc_per)
       {
-        BLDC_OL_comm_tm  = t16;
+        timing_error = (int16_t)( zc_per - BLDC_OL_comm_tm );
+      }
+#else
+      // ratio of the back-EMF integration, positive if advanced
+      int16_t timing_error = Seq_get_timing_error();
+#endif
+      if (U16_MAX != ol_per)
+      {
+        t16 = ol_per + timing_pi_control( timing_error, ol_per );
+
+        // rate limit (the difference is compared, the sums would wrap in 16-bits)
+        if (t16 > BLDC_OL_comm_tm && t16 - BLDC_OL_comm_tm > PI_RATE_MAX)
+        {
+          t16 = BLDC_OL_comm_tm + PI_RATE_MAX;
+        }
+        else if (t16 < BLDC_OL_comm_tm && BLDC_OL_comm_tm - t16 > PI_RATE_MAX)
+        {
+          t16 = BLDC_OL_comm_tm - PI_RATE_MAX;
+        }
+        else
+        {
+          // settled, the open-loop timing learns from the closed-loop period
+          Learn_OL_Timing( inp_dutycycle, t16 );
+        }
+
+        // the output clamp bounds the period w.r.t. the duty-cycle but don't
+        // ever let the TIM3 period get low enough to lock up the system
+        if (t16 > LUDICROUS_SPEED)
+        {
+          BLDC_OL_comm_tm  = t16;
+        }
       }
     }
   }
+#if defined( PWM_RATE_SCHED_ENABLED )
+  // the back-EMF of the flying start is timed at the nominal rate
+  if (STARTUP_CATCH != Startup_get_phase())
+  {
+    pwm_rate_schedule( BLDC_OL_comm_tm );
+  }
+#endif
+
+  // the ZC commutation is advanced with the speed, from the map of the motor
+  Driver_set_timing_advance( Get_Timing_Advance( erpm10 ) );
+
+  // the driver idles while stopped unless braking (the speed setting is kept
+  // through the flying start, which has the duty-cycle at 0)
+  Driver_set_idle( (uint8_t)( 0 == BL_pwm_period && FALSE == braking ) );
+
   Commanded_Dutycycle = inp_dutycycle; // refresh the logger variable
 }
 
@@ -0,0 +1,194 @@
+/**
+  ******************************************************************************
+  * @file cmd.c
+  * @brief Command line parser of the debug terminal
+  * @author Neidermeier
+  * @version
+  * @date
+  ******************************************************************************
+  */
+/**
+ * \defgroup cmd Command line
+ * @brief Multi-byte commands of the debug terminal, for scripted host-driven
+ *  test sequences. The line is parsed as the characters arrive so there is no
+ *  line buffer, and the single-key UI works as before outside of a line.
+ * @{
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "cmd.h"
+
+
+/* Private defines -----------------------------------------------------------*/
+
+#define CMD_ESC       0x1B  // cancels the line
+
+#define CMD_NOT_DIGIT 0xFF
+
+
+/* Private types -------------------------------------------------------------*/
+
+typedef enum
+{
+  CMD_ST_IDLE = 0, // not in a line
+  CMD_ST_CODE,     // after the start character
+  CMD_ST_ARGS,     // between the arguments
+  CMD_ST_NUM,      // in an argument
+  CMD_ST_ERR       // not valid, to the end of line
+} cmd_state_t;
+
+
+/* Private variables ---------------------------------------------------------*/
+
+static uint8_t State;   // cmd_state_t
+static uint8_t Base;    // of the argument, 10 or 16
+static uint8_t Ndigits; // digits of the argument
+static cmd_t   Cmd;
+
+
+/* Private functions ---------------------------------------------------------*/
+
+/*
+ * Value of a digit in the base of the argument
+ */
+static uint8_t num_digit(char c)
+{
+  uint8_t d = CMD_NOT_DIGIT;
+
+  if (c >= '0' && c <= '9')
+  {
+    d = (uint8_t)(c - '0');
+  }
+  else if (c >= 'a' && c <= 'f')
+  {
+    d = (uint8_t)(c - 'a' + 10);
+  }
+  else if (c >= 'A' && c <= 'F')
+  {
+    d = (uint8_t)(c - 'A' + 10);
+  }
+  return (d < Base) ? d : CMD_NOT_DIGIT;
+}
+
+/*
+ * Next character of an argument, the state is CMD_ST_ERR if it is not valid
+ */
+static void num_input(char c)
+{
+  uint16_t * parg = &Cmd.argv[ Cmd.argc ];
+  uint8_t d;
+
+  if (' ' == c)
+  {
+    State = (0 != Ndigits) ? CMD_ST_ARGS : CMD_ST_ERR;
+    Cmd.argc += 1;
+    return;
+  }
+  if ( ('x' == c || 'X' == c) && 10 == Base && 1 == Ndigits && 0 == *parg )
+  {
+    Base = 16;
+    Ndigits = 0;
+    return;
+  }
+
+  d = num_digit(c);
+
+  if (CMD_NOT_DIGIT == d || *parg > (uint16_t)( (U16_MAX - d) / Base ))
+  {
+    State = CMD_ST_ERR;
+    return;
+  }
+  *parg = (uint16_t)( *parg * Base + d );
+  Ndigits += 1;
+}
+
+
+/* Public functions ---------------------------------------------------------*/
+
+/**
+ * @brief  Input a character from the terminal to the parser.
+ *
+ * @details  Called from the background task for each character received. A
+ *  line is started by CMD_START, ended by CR or LF and cancelled by ESC.
+ *
+ * @param        c     Character
+ * @param [out]  pcmd  Command, set if CMD_READY
+ *
+ * @return  CMD_KEY if the character is a key, CMD_READY or CMD_ERROR at the
+ *  end of a line, else CMD_BUSY
+ */
+cmd_status_t Cmd_input(char c, cmd_t * pcmd)
+{
+  if (CMD_ST_IDLE == State)
+  {
+    if (CMD_START != c)
+    {
+      return CMD_KEY;
+    }
+    Cmd.argc = 0;
+    State = CMD_ST_CODE;
+    return CMD_BUSY;
+  }
+
+  if ('\r' == c || '\n' == c)
+  {
+    cmd_status_t status = CMD_READY;
+
+    if (CMD_ST_NUM == State)
+    {
+      num_input(' '); // end of the last argument
+    }
+    if (CMD_ST_CODE == State || CMD_ST_ERR == State)
+    {
+      status = CMD_ERROR;
+    }
+    else
+    {
+      *pcmd = Cmd;
+    }
+    State = CMD_ST_IDLE;
+    return status;
+  }
+
+  if (CMD_ESC == c)
+  {
+    State = CMD_ST_IDLE;
+    return CMD_BUSY;
+  }
+
+  switch (State)
+  {
+  case CMD_ST_CODE:
+    if (c >= 'a' && c <= 'z')
+    {
+      c = (char)(c - 'a' + 'A');
+    }
+    Cmd.code = c;
+    State = (c >= 'A' && c <= 'Z') ? CMD_ST_ARGS : CMD_ST_ERR;
+    break;
+  case CMD_ST_ARGS:
+    if (' ' == c)
+    {
+      break;
+    }
+    if (Cmd.argc >= CMD_MAX_ARGS)
+    {
+      State = CMD_ST_ERR;
+      break;
+    }
+    Cmd.argv[ Cmd.argc ] = 0;
+    Base = 10;
+    Ndigits = 0;
+    State = CMD_ST_NUM;
+    num_input(c);
+    break;
+  case CMD_ST_NUM:
+    num_input(c);
+    break;
+  default:
+    break; // CMD_ST_ERR
+  }
+  return CMD_BUSY;
+}
+
+/**@}*/ // defgroup
@@ -20,13 +20,15 @@
 #include "mcu_stm8s.h"
 #include "bldc_sm.h"
 #include "sequence.h"
-#include "per_task.h"
+#include "faultm.h"
+#include "sched.h"
+#include "driver.h"
+#include "throttle.h"
+#include "speed.h"
 
 
 /* Private defines -----------------------------------------------------------*/
 
-#define PH0_ADC_TBUF_SZ  8
-
 /*
  TODO: resistor divider values must be updated for 3.3v operation
 */
@@ -67,6 +69,94 @@
 
 #define FOUR_SECTORS  4 // each commutation sector of 60-degrees spans 4x TIM3 periods
 
+/*
+ * The commutation period is kept in units of 1/4 sector as above, but the
+ * timer is loaded with the whole sector so there is one update interrupt per
+ * commutation. The sector time is saturated to the 16-bit timer.
+ */
+#define SECTOR_TIME_MAX  ( 0xFFFFu / FOUR_SECTORS )
+
+#define SECTOR_TIME( _PERIOD_ ) \
+  ( ( (_PERIOD_) > SECTOR_TIME_MAX ) ? 0xFFFFu : (uint16_t)( (_PERIOD_) * FOUR_SECTORS ) )
+
+/*
+ * Zero-crossing commutation: the ZC should occur at 30 degrees i.e. half-way
+ * through the sector, so the next commutation is scheduled at ZC + 30 degrees,
+ * which is 2 of the 4 quarter periods of the sector. The timer is restarted
+ * for the remaining 2 quarters.
+ */
+#define ZC_DELAY_QTRS   ( FOUR_SECTORS - 2 )
+
+/*
+ * The commutation may be advanced from ZC + 30 degrees (timing advance map),
+ * by a fraction of the 1/4 sector which is less than the ZC blanking.
+ */
+#define ZC_ADV_SH       8
+
+/*
+ * Samples in the first quarter of the sector following the commutation are
+ * ignored by the ZC detector (blanking) as they are upset by the flyback
+ * current of the phase that has just been switched to floating
+ * ("demagnetization time").
+ */
+#define ZC_BLANKING_QTRS  1
+
+/*
+ * Back-EMF integration (BUFFER_ADC_BEMF): the samples past the ZC blanking up
+ * to the end of the window are summed as they are converted, and the sector
+ * average is taken at the commutation. The window ends at 3/4 of the sector,
+ * so the integral is of the middle half of the sector (FOUR_SECTORS for all of
+ * the sector past the blanking).
+ */
+#define BEMF_WINDOW_END_QTRS  ( FOUR_SECTORS - 1 )
+
+/*
+ * The 10-bit samples are summed in 16 bits, so at low speed the sum and the
+ * count are halved at this count to keep the sum in range.
+ */
+#define BEMF_SUM_MAX_COUNT    64
+
+/*
+ * Flying start (FLYING_START_ENABLED): with the bridge off, phase A is at the
+ * positive half of its back-EMF (the negative half is clamped at 0), so the
+ * rising edge is the ZC of the sector in which phase A is floating (rising).
+ * The electrical period is timed in PWM cycles between the rising edges, each
+ * is 1000 commutation timer counts (0.125 us) at the nominal rate, i.e. 1000 /
+ * 24 counts of the 1/4 sector per PWM cycle of the period. The edge detected
+ * at the sample is on average 1/2 PWM cycle late.
+ */
+#define CATCH_CNT_PER_PWM  ( TIM2_PWM_PD * 4 )
+#define CATCH_QTR( _PER_ ) \
+  (uint16_t)( ( (_PER_) * ( CATCH_CNT_PER_PWM / 8 ) ) / ( 24 / 8 ) )
+
+#define CATCH_BEMF_HI    0x0010  // ADC counts (~0.2 v of the phase voltage)
+#define CATCH_BEMF_LO    0x0008
+
+// the period range in PWM cycles, 8 to 128 is ~10000 to ~625 RPM (6 pole-pairs)
+#define CATCH_PER_MIN    8
+#define CATCH_PER_MAX    128
+
+// consecutive periods that agree within 1/2^CATCH_TOL_SH for the lock
+#define CATCH_LOCK_CNT   1
+#define CATCH_TOL_SH     2
+
+/*
+ * Phase current average, EMA of 1/16 per PWM cycle i.e. ~2 ms at 8 kHz (Q4)
+ */
+#define ISENSE_EMA_SH     4
+
+/*
+ * Idle (motor stopped): the ADC scan is started every IDLE_ADC_DIV PWM cycles
+ * i.e. ~1 ms at 8 kHz, enough for the system voltage and the analog inputs
+ */
+#define IDLE_ADC_DIV      8
+
+/*
+ * Servo input period in units of 2^PULSE_PERD_SH capture counts, 2 us at
+ * 16 MHz, so the servo frame (20 ms) fits in 16-bits
+ */
+#define PULSE_PERD_SH     4
+
 
 /* Private types -----------------------------------------------------------*/
 
@@ -78,42 +168,271 @@
 
 static uint16_t ADC_Global;
 
-// Accummulates a string of 10-bit ADC samples for averaging - could reduce
-// to 8 bits as possibly the 2 lsb's are not that significant anyway.
-static uint16_t ph0_adc_fbuf[PH0_ADC_TBUF_SZ];
-
-static uint8_t  ph0_adc_tbct;
+static ADC_snapshot_t ADC_snap; // all channels of the most recent ADC scan
 
+#ifdef BUFFER_ADC_BEMF
+// back-EMF samples of the present sector in the window, and the average of the previous
+static uint16_t Bemf_sum;
+static uint8_t  Bemf_count;
 static uint16_t phase_average;
 
-static uint16_t prev_pulse_start_tm;
-static uint16_t curr_pulse_start_tm;
+// TIM3 counts from the commutation to the end of the back-EMF window
+static uint16_t Bemf_window_end;
+#endif
+
+#ifdef FLYING_START_ENABLED
+static uint8_t  Catch_active; // sensing the back-EMF of the rotor with the bridge off
+static uint8_t  Catch_high;   // phase A is in the positive half of its back-EMF
+static uint8_t  Catch_cycles; // PWM cycles since the latest rising edge, 0 before the first
+static uint8_t  Catch_prev;   // PWM cycles of the previous period
+static uint8_t  Catch_lock;   // consecutive periods in agreement
+static uint16_t Catch_period; // measured commutation period (TIM3 counts of 1/4 sector)
+#endif
+
+static uint32_t prev_pulse_start_tm; // capture counts extended by Cap_ovf
+static uint32_t curr_pulse_start_tm;
+static uint8_t  Cap_ovf;             // capture timer overflows (update ISR)
 
 static uint16_t Pulse_perd;
 static uint16_t Pulse_dur;
 
+// TIM3 counts from the commutation to the start of the present timer period
+static uint16_t Sector_offset;
+
+// TIM3 counts from the commutation to the end of the ZC blanking
+static uint16_t Blanking_count;
+
+// mid-sector event callbacks, and the position of each event in 1/4 sectors
+static Driver_sector_cb_t Sector_cb[ DRIVER_NR_EVTS ];
+
+static const uint8_t Sector_evt_qtrs[ DRIVER_NR_EVTS ] = { 1, 3 };
+
+static uint16_t ZC_comm_period; // commutation period measured from ZC
+
+static uint16_t ZC_elapsed; // time of the ZC in the present sector, 0 if none
+
+static uint8_t  ZC_advance_q8; // commanded advance, Q8 of 1/4 sector
+
+static uint16_t ZC_advance; // advance (TIM3 counts) of the latest ZC commutation
+
+static uint8_t  Idle;     // motor stopped, the commutation timer is off
+static uint8_t  Idle_div; // PWM cycles since the latest ADC scan in idle
+
+#ifdef CURRENT_SENSE_ENABLED
+static uint16_t ILim_count = ISENSE_ADC( ILIM_AMPS ); // pulse-by-pulse limit
+
+static uint16_t I_avg_q4; // phase current average (ADC counts, Q4)
+
+static uint8_t  I_cut; // the pulse of the present PWM cycle has been cut
+#endif
+
+/*
+ * Double-buffered exchange with the background task. The producer fills the
+ * inactive buffer and then increments the sequence (byte write is atomic),
+ * which makes it the active buffer i.e. [ seq & 1 ]. The status is read in the
+ * background which retries if the sequence changed during the copy. The command
+ * is read in the ISR which can't be preempted by the background producer.
+ */
+static Driver_status_t Status_buf[2];
+static volatile uint8_t Status_seq;
+
+static Driver_command_t Command_buf[2];
+static volatile uint8_t Command_seq;
+
 
 /* Private function prototypes -----------------------------------------------*/
 
 /* Private functions ---------------------------------------------------------*/
+
+/*
+ * Set the compare channels of the mid-sector events that have a callback,
+ * relative to the start of the present timer period. An event that is
+ * already past is set beyond the end of the period.
+ */
+static void set_sector_events(uint16_t comm_period)
+{
+  uint8_t n;
+
+  for (n = 0; n < DRIVER_NR_EVTS; n++)
+  {
+    if (NULL != Sector_cb[n])
+    {
+      uint16_t count = Sector_evt_qtrs[n] * comm_period;
+
+      MCU_set_comm_compare( n, (count > Sector_offset) ? (uint16_t)( count - Sector_offset ) : 0xFFFFu );
+    }
+  }
+}
+
+/*
+ * Zero-crossing event: measures the elapsed time since the commutation and
+ * (if ZC commutation is active) re-schedules the next commutation at ZC + 30
+ * degrees less the timing advance.
+ * The elapsed time is in units of TIM3 counts, as is the commutation period.
+ * Since the ZC ideally occurs at 30 degrees (2 quarters of the sector), half
+ * of the elapsed time would be the commutation period if the motor is in time.
+ * The commutations following an advanced one are early by the advance, which
+ * is taken off the elapsed time (the ZC is past the blanking so there is no
+ * underflow).
+ */
+static void on_zero_crossing(void)
+{
+  uint16_t zc_elapsed = Sector_offset + MCU_get_comm_timer_count() - ZC_advance;
+
+  ZC_elapsed = zc_elapsed;
+
+  // sma
+  ZC_comm_period = ( ZC_comm_period + ( zc_elapsed >> 1 ) ) >> 1;
+
+#ifdef ZC_COMM_ENABLED
+  if ( FALSE != BL_get_ct_mode() )
+  {
+    // the sector has to fit the 16-bit timer, which also bounds the products
+    // below (the advance is less than a quarter): 2 + 1 quarters < 0xFFFF
+    uint16_t period = (ZC_comm_period > SECTOR_TIME_MAX) ? SECTOR_TIME_MAX : ZC_comm_period;
+
+    ZC_advance = (uint16_t)( ( (uint32_t)period * ZC_advance_q8 ) >> ZC_ADV_SH );
+
+    // 30-degree delay taken from the latest measured sector time, then the
+    // following sectors at that time until the next refresh of the period.
+    // The commutation is at ZC + 2 quarters less the advance, which in the
+    // sector time of the events is the end of the sector (4 quarters), so the
+    // rest of the timer period starts at 2 quarters plus the advance.
+    Sector_offset = ZC_DELAY_QTRS * period + ZC_advance;
+
+    MCU_restart_comm_timer( ZC_DELAY_QTRS * period - ZC_advance, SECTOR_TIME( period ) );
+
+    set_sector_events( period );
+  }
+  else
+  {
+    ZC_advance = 0;
+  }
+#endif
+}
+
+#ifdef CURRENT_SENSE_ENABLED
+/*
+ * Pulse-by-pulse current limit, on the shunt sample taken in the PWM on-time.
+ * Over the limit, the pulse is cut for the rest of the PWM cycle. It is
+ * restored at the start of the next cycle (Driver_on_PWM_edge), or with the
+ * ADC triggered by the timer at the next conversion, which has then been taken
+ * while it was cut and so is not used (neither for the current nor for the
+ * back-EMF). Over the trip level the overcurrent fault shuts off the bridge
+ * within the present PWM cycle.
+ * Returns TRUE if the sample is not valid.
+ */
+static uint8_t current_limit(uint16_t ishunt)
+{
+  if (FALSE != I_cut)
+  {
+    I_cut = FALSE;
+    PWM_restore_pulse();
+    return TRUE;
+  }
+
+  if (ishunt >= ISENSE_ADC( ITRIP_AMPS ))
+  {
+    Faultm_set( OVERCURRENT );
+  }
+  else if (ishunt >= ILim_count)
+  {
+    PWM_cut_pulse();
+    I_cut = TRUE;
+  }
+
+  I_avg_q4 += ishunt - ( I_avg_q4 >> ISENSE_EMA_SH );
+
+  return FALSE;
+}
+#endif
+
 #ifdef BUFFER_ADC_BEMF
 /*
- * averag 8 samples .. could be inline or macro
+ * Sector average of the back-EMF, and restart the sum for the next sector.
+ * The count is at most BEMF_SUM_MAX_COUNT so the mean is a 16/8 divide.
  */
 static void udpate_phase_average(void)
 {
-  int n;
-// use midpoint  as initial condition which yields neutral control action
-  phase_average = MID_ADC;
+  if (0 != Bemf_count)
+  {
+    phase_average = Bemf_sum / Bemf_count;
+  }
+  else
+  {
+    // use midpoint which yields neutral control action
+    phase_average = MID_ADC;
+  }
+  Bemf_sum = 0;
+  Bemf_count = 0;
+}
+#endif
 
-  for(n  = 0 ; n < PH0_ADC_TBUF_SZ; n++)
+#ifdef FLYING_START_ENABLED
+/*
+ * Back-EMF sensing of the flying start, from the ADC ISR. At each rising edge
+ * of phase A the commutation timer is restarted to the next commutation at
+ * ZC + 30 degrees, and the sector is set to the one in which phase A is
+ * floating (rising), so the sequence keeps step with the rotor while the
+ * bridge is off and is driven from the sector that follows on the hand-off.
+ */
+static void catch_sense(uint16_t sample)
+{
+  uint8_t per;
+
+  if (0 != Catch_cycles && Catch_cycles < U8_MAX)
   {
-    phase_average = (phase_average  + ph0_adc_fbuf[n]) >> 1;
+    Catch_cycles += 1;
+  }
 
-    ph0_adc_fbuf[n] = MID_ADC; // initialize each element to midpoint
+  if (FALSE == Catch_high)
+  {
+    Catch_high = (uint8_t)( sample > CATCH_BEMF_HI );
+  }
+  else
+  {
+    Catch_high = (uint8_t)( sample >= CATCH_BEMF_LO );
+    return;
+  }
+  if (FALSE == Catch_high)
+  {
+    return;
   }
 
-  ph0_adc_tbct = 0; // reset the sample index
+  // rising edge
+  per = Catch_cycles;
+  Catch_cycles = 1;
+
+  if (per < CATCH_PER_MIN || per > CATCH_PER_MAX)
+  {
+    Catch_prev = 0;
+    Catch_lock = 0;
+    return;
+  }
+
+  if ( 0 != Catch_prev &&
+       ( (per > Catch_prev) ? per - Catch_prev : Catch_prev - per ) <= ( Catch_prev >> CATCH_TOL_SH ) )
+  {
+    if (Catch_lock < CATCH_LOCK_CNT)
+    {
+      Catch_lock += 1;
+    }
+    // average of the latest two periods
+    Catch_period = CATCH_QTR( (uint16_t)per + Catch_prev ) >> 1;
+  }
+  else
+  {
+    Catch_lock = 0;
+    Catch_period = CATCH_QTR( per );
+  }
+  Catch_prev = per;
+
+  Seq_set_rising_step();
+
+  Sector_offset = ZC_DELAY_QTRS * Catch_period;
+
+  MCU_restart_comm_timer(
+    ZC_DELAY_QTRS * Catch_period - ( CATCH_CNT_PER_PWM / 2 ), SECTOR_TIME( Catch_period ) );
 }
 #endif
 
@@ -121,31 +440,68 @@ static void udpate_phase_average(void)
 
 /** @cond */
 
-#if defined( S105_DEV )
+#if BOARD_CAP_TIM != 0
 
+/*
+ * The capture register is read MSB first, the read of the LSB clears the flag
+ */
 uint16_t get_pulse_start(void)
 {
-    return TIM2_GetCapture1();
+    uint16_t count = (uint16_t)CAP_RISE_CCRH << 8;
+    return count | CAP_RISE_CCRL;
 }
 
 uint16_t get_pulse_end(void)
 {
-    return TIM2_GetCapture2();
+    uint16_t count = (uint16_t)CAP_FALL_CCRH << 8;
+    return count | CAP_FALL_CCRL;
 }
 
-#elif defined(S105_DISCOVERY)
-
-uint16_t get_pulse_start(void)
+#if defined( HAS_SERVO_INPUT )
+static uint16_t cap_counter(void)
 {
-    return TIM1_GetCapture4();
+    uint16_t count = (uint16_t)CAP_TIM->CNTRH << 8; // the LSB is latched
+    return count | CAP_TIM->CNTRL;
 }
 
-uint16_t get_pulse_end(void)
+/*
+ * Capture count extended by the overflows of the capture timer. The update ISR
+ * may preempt (or be pending), so the overflow count and the pending flag are
+ * read until consistent, and the counter tells if the wrap is before or after
+ * the capture (the ISR latency being much less than the timer period).
+ */
+static uint32_t cap_extend(uint16_t cap)
 {
-    return TIM1_GetCapture3();
+    uint8_t ovf;
+    uint8_t pending;
+    uint16_t count;
+
+    do
+    {
+        ovf = Cap_ovf;
+        pending = (uint8_t)( 0 != (CAP_TIM->SR1 & CAP_TIM_UIF) );
+        count = cap_counter();
+    }
+    while (ovf != Cap_ovf);
+
+    if (count < cap)
+    {
+        // wrap since the capture, not to be counted
+        if (0 == pending)
+        {
+            ovf -= 1;
+        }
+    }
+    else if (0 != pending)
+    {
+        // wrap before the capture, not yet counted
+        ovf += 1;
+    }
+    return ( (uint32_t)ovf << 16 ) | cap;
 }
+#endif
 
-#else // unimplemented ... stm8s003
+#else // no capture timer ... stm8s003
 
 uint16_t get_pulse_start(void)
 {
@@ -157,18 +513,38 @@ uint16_t get_pulse_end(void)
     return (uint16_t)-1;
 }
 #endif
+
 /** @endcond */
 
 /**
  * @brief Call from timer/capture ISR on capture of rising edge of servo pulse
  *
+ * @details The period is measured on the capture counts extended by the timer
+ *  overflows, as the 16-bit count (~8 ms) is shorter than the servo frame.
+ *  Pulse_perd is in units of PULSE_PERD_SH counts (2 us @ 16 MHz), saturated
+ *  at 0xFFFF (~131 ms, or a signal that was lost).
 */
 void Driver_on_capture_rise(void)
 {
-// 16-bit counter setup to wrap at 0xffff so no concern for sign of result
+#if defined( HAS_SERVO_INPUT )
+  uint32_t perd;
+
   prev_pulse_start_tm = curr_pulse_start_tm;
-  curr_pulse_start_tm = get_pulse_start();
-  Pulse_perd = curr_pulse_start_tm  - prev_pulse_start_tm;
+  curr_pulse_start_tm = cap_extend( get_pulse_start() );
+
+  // the extended count wraps at 24 bits
+  perd = ( ( curr_pulse_start_tm - prev_pulse_start_tm ) & 0x00FFFFFFUL ) >> PULSE_PERD_SH;
+
+  Pulse_perd = (perd > U16_MAX) ? U16_MAX : (uint16_t)perd;
+#endif
+}
+
+/**
+ * @brief Call from timer ISR on the overflow (update event) of the capture timer
+ */
+void Driver_on_capture_ovf(void)
+{
+  Cap_ovf += 1;
 }
 
 /**
@@ -176,10 +552,11 @@ void Driver_on_capture_rise(void)
  */
 void Driver_on_capture_fall(void)
 {
-// noise on this signal when motor running
-//    uint16_t t16 =  TIM1_GetCapture3() - TIM1_GetCapture4();
-//    Pulse_dur = (Pulse_dur + t16) >> 1; // sma
   Pulse_dur = get_pulse_end() - get_pulse_start();
+
+#if defined( HAS_SERVO_INPUT )
+  Throttle_on_pulse(Pulse_dur);
+#endif
 }
 
 /**
@@ -208,14 +585,27 @@ uint16_t Driver_get_pulse_dur(void)
  */
 void Driver_on_PWM_edge(void)
 {
-#ifdef BUFFER_ADC_BEMF
-  ph0_adc_tbct += 1 ; // advance the buffer index
+#ifdef CURRENT_SENSE_ENABLED
+  // restore the pulse of a cycle that had been cut, before the next sample
+  if (FALSE != I_cut)
+  {
+    I_cut = FALSE;
+    PWM_restore_pulse();
+  }
 #endif
+  if (FALSE != Idle)
+  {
+    if (++Idle_div < IDLE_ADC_DIV)
+    {
+      return;
+    }
+    Idle_div = 0;
+  }
 // Enable the ADC: 1 -> ADON for the first time it just wakes the ADC up
-  ADC1_Cmd(ENABLE);
+  ADC1->CR1 |= ADC1_CR1_ADON;
 
 // ADON = 1 for the 2nd time => starts the ADC conversion
-  ADC1_StartConversion();
+  ADC1->CR1 |= ADC1_CR1_ADON;
 }
 
 /**
@@ -227,28 +617,164 @@ void Driver_on_PWM_edge(void)
  */
 void Driver_on_ADC_conv(void)
 {
-  ADC_Global = ADC1_GetBufferValue( ADC1_CHANNEL_0 );
-#ifdef BUFFER_ADC_BEMF
-// assert (buffer should be sized big enough for slowest speed)
+  // copy all scan channels from the data buffer registers in one pass
+  volatile uint8_t * preg = &ADC1->DB0RH;
+  uint16_t sector_tm;
+  uint8_t n;
 
-// TODO: ph0_adc_fbuf can simply be a running sma ... there is no real need to
-// reset the average at each commutation switch????!!!???
+  for (n = 0; n < ADC_SNAP_NR_CH; n++)
+  {
+    uint8_t lsb = preg[1]; // right-aligned: LSB is read first
+    ADC_snap.ch[n] = ((uint16_t)preg[0] << 8) | lsb;
+    preg += 2;
+  }
+
+#ifdef CURRENT_SENSE_ENABLED
+  if ( FALSE != current_limit( ADC_snap.ch[ ADC_SNAP_ISHUNT ] ) )
+  {
+    return;
+  }
+#endif
 
-  if (ph0_adc_tbct < PH0_ADC_TBUF_SZ)
+#ifdef THREE_PHASE_BEMF_ENABLED
+  // the floating phase of the present sector
+  ADC_Global = ADC_snap.ch[ Seq_get_bemf_ch() ];
+#else
+  ADC_Global = ADC_snap.ch[ ADC_SNAP_PH0 ];
+#endif
+#ifdef FLYING_START_ENABLED
+  if (FALSE != Catch_active)
   {
-    ph0_adc_fbuf[ph0_adc_tbct] = ADC_Global ;
+    catch_sense( ADC_snap.ch[ ADC_SNAP_PH0 ] );
+    return;
   }
 #endif
+
+  sector_tm = Sector_offset + MCU_get_comm_timer_count();
+
+  if ( sector_tm >= Blanking_count )
+  {
+#ifdef BUFFER_ADC_BEMF
+    if ( sector_tm < Bemf_window_end )
+    {
+      if (Bemf_count >= BEMF_SUM_MAX_COUNT)
+      {
+        Bemf_sum >>= 1;
+        Bemf_count >>= 1;
+      }
+      Bemf_sum += ADC_Global;
+      Bemf_count += 1;
+    }
+#endif
+    if ( FALSE != Seq_ZC_detect( ADC_Global ) )
+    {
+      on_zero_crossing();
+    }
+  }
+}
+
+/**
+ * @brief  Accessor for commutation period measured from back-EMF zero-crossing.
+ *
+ * @return  Commutation period (TIM3 counts), 0 if no ZC has been detected.
+ */
+uint16_t Driver_get_ZC_period(void)
+{
+  return ZC_comm_period;
 }
 
+/**
+ * @brief  Set the commutation timing advance w.r.t. ZC + 30 degrees.
+ *
+ * @details  Called from the control task (ISR context), effective at the next
+ *  ZC commutation.
+ *
+ * @param  adv  Advance, Q8 of the 1/4 sector (15 degrees)
+ */
+void Driver_set_timing_advance(uint8_t adv)
+{
+  ZC_advance_q8 = adv;
+}
+
+#ifdef CURRENT_SENSE_ENABLED
+/**
+ * @brief  Set the pulse-by-pulse current limit.
+ *
+ * @details  The overcurrent trip level is fixed (ITRIP_AMPS).
+ *
+ * @param  ilim  Current limit, ADC counts (ISENSE_ADC)
+ */
+void Driver_set_current_limit(uint16_t ilim)
+{
+  ILim_count = ilim;
+}
+#endif
+
+/**
+ * @brief  Reset the zero-crossing period measurement.
+ *
+ * @details  Expected to be called from non-ISR/CS context (i.e. on system reset).
+ */
+void Driver_ZC_reset(void)
+{
+  ZC_comm_period = 0;
+  ZC_advance = 0;
+}
+
+#ifdef FLYING_START_ENABLED
+/**
+ * @brief  Start or end the back-EMF sensing of the flying start.
+ *
+ * @details  Called from the control task. The bridge is switched off for the
+ *  sensing, the commutation sequence does not drive it during the catch phase
+ *  of the startup.
+ *
+ * @param  enable  TRUE to start the sensing
+ */
+void Driver_set_catch(uint8_t enable)
+{
+  if (FALSE != enable)
+  {
+    All_phase_stop();
+
+    Catch_high = TRUE; // an edge only from a sample in the negative half
+    Catch_cycles = 0;
+    Catch_prev = 0;
+    Catch_lock = 0;
+    Catch_period = 0;
+  }
+  Catch_active = enable;
+}
+
+/**
+ * @brief  Result of the back-EMF sensing of the flying start.
+ *
+ * @details  Called from the control task. The period is set once two rising
+ *  edges are timed, and the sequence keeps step with the rotor from then on.
+ *
+ * @param [out]  pperiod  Commutation period (TIM3 counts of 1/4 sector), 0
+ *                        if not measured
+ *
+ * @return  TRUE if locked i.e. the period is consistent over the latest
+ *  CATCH_LOCK_CNT + 1 electrical cycles
+ */
+uint8_t Driver_get_catch(uint16_t * pperiod)
+{
+  *pperiod = Catch_period;
+
+  return (uint8_t)( CATCH_LOCK_CNT == Catch_lock );
+}
+#endif
+
 #ifdef BUFFER_ADC_BEMF
 /** @cond */
 /**
- * @brief Get Back-EMF buffer averaged.
+ * @brief Get Back-EMF averaged over the window of the previous sector.
  *
- * @details 4 samples are captured within a single commutation sector.
+ * @details Called at the commutation step i.e. once the average of the
+ *  sector that has ended is updated.
  *
- * @return  Calculated average of 4 samples stored in back-EMF frame buffer
+ * @return  Average of the samples, MID_ADC if there were none
  */
 uint16_t Driver_Get_Back_EMF_Avg(void)
 {
@@ -260,7 +786,8 @@ uint16_t Driver_Get_Back_EMF_Avg(void)
 /**
  * @brief Accessor for system voltage measurement.
  * @details Phase voltage measurement from ADC Channel 0 is to be used as
- * back-EMF sensing or system voltage.
+ * back-EMF sensing or system voltage. With the three-phase back-EMF, it is
+ * the channel of the floating phase of the sector.
  * @return  Most recent captured ADC conversion value from Channel 0
  */
 uint16_t Driver_Get_ADC(void)
@@ -268,73 +795,247 @@ uint16_t Driver_Get_ADC(void)
   return ADC_Global;
 }
 
+/**
+ * @brief Accessor for a phase voltage measurement.
+ * @details Called from ISR.
+ * @param  ch  ADC_SNAP_PH0 etc.
+ * @return  Most recent captured ADC conversion value of the channel
+ */
+uint16_t Driver_Get_Phase_ADC(ADC_snap_ch_t ch)
+{
+  return ADC_snap.ch[ ch ];
+}
+
+/**
+ * @brief Get a copy of all channels of the ADC scan of the latest published
+ *  status (Driver_publish_status).
+ * @details Called in non-ISR context, no CS needed: the copy is taken from the
+ *  double-buffered status, and retried if the ISR publishes during the copy,
+ *  so the channels are from the same scan.
+ * @param [out]  psnap  Pointer to the snapshot.
+ */
+void Driver_get_ADC_snapshot(ADC_snapshot_t * psnap)
+{
+  uint8_t seq;
+
+  do
+  {
+    seq = Status_seq;
+    *psnap = Status_buf[ seq & 1 ].adc;
+  }
+  while (seq != Status_seq);
+}
+
+/**
+ * @brief  Publish the ISR state to the background task.
+ * @details  Called from ISR, at the release of the background (UI) task.
+ */
+void Driver_publish_status(void)
+{
+  Driver_status_t * pstatus = &Status_buf[ (uint8_t)( Status_seq + 1 ) & 1 ];
+
+  pstatus->adc = ADC_snap;
+  pstatus->vbatt = Seq_Get_Vbatt();
+  pstatus->bemf_r = Seq_Get_bemfR();
+  pstatus->bemf_f = Seq_Get_bemfF();
+  pstatus->timing_error = Seq_get_timing_error();
+  pstatus->comm_period = get_commutation_period();
+  pstatus->erpm10 = Speed_get_erpm10();
+  pstatus->pwm_dc = BLDC_PWMDC_Get();
+#ifdef CURRENT_SENSE_ENABLED
+  // the supply current flows in the PWM on-time
+  pstatus->ibus = (uint16_t)( ( (uint32_t)( I_avg_q4 >> ISENSE_EMA_SH ) * pstatus->pwm_dc ) /
+                              PWM_100PCNT );
+#else
+  pstatus->ibus = 0;
+#endif
+  pstatus->pulse_perd = Pulse_perd;
+  pstatus->pulse_dur = Pulse_dur;
+  pstatus->faults = Faultm_get_status();
+  pstatus->run_state = (uint8_t)BL_get_state();
+
+  Status_seq += 1;
+}
+
+/**
+ * @brief  Get a consistent copy of the published ISR state.
+ * @details  Called in non-ISR context, no CS needed.
+ * @param [out]  pstatus  Pointer to the copy.
+ */
+void Driver_get_status(Driver_status_t * pstatus)
+{
+  uint8_t seq;
+
+  do
+  {
+    seq = Status_seq;
+    *pstatus = Status_buf[ seq & 1 ];
+  }
+  while (seq != Status_seq);
+}
+
+/**
+ * @brief  Publish the command to the control task.
+ * @details  Called in non-ISR context, no CS needed.
+ * @param  pcmd  Pointer to the command.
+ */
+void Driver_set_command(const Driver_command_t * pcmd)
+{
+  Command_buf[ (uint8_t)( Command_seq + 1 ) & 1 ] = *pcmd;
+
+  Command_seq += 1;
+}
+
+/**
+ * @brief  Get the latest command.
+ * @details  Called from ISR (control task).
+ * @param [out]  pcmd  Pointer to the copy.
+ * @return  TRUE if the command has been published since the previous call.
+ */
+uint8_t Driver_get_command(Driver_command_t * pcmd)
+{
+  static uint8_t prev_seq;
+  const uint8_t seq = Command_seq;
+
+  if (seq == prev_seq)
+  {
+    return FALSE;
+  }
+  prev_seq = seq;
+  *pcmd = Command_buf[ seq & 1 ];
+
+  return TRUE;
+}
+
 /**
  * @brief  Invoke background task and control task.
  *
- * @details  Called from timer ISR. The commutation time is updated each time the
- * control task is updated, and in turn the timer reload register value is refreshed
- * from latest calculated commutation time period.
+ * @details  Called from timer ISR. The rate groups (commutation timer refresh,
+ *  control task, background tasks) are dispatched by the scheduler.
  */
 void Driver_Update(void)
 {
-  static const uint8_t UI_UPDATEM  = 32; // 16 Mhz sysclock
-  static uint8_t trate = 0;
+  Sched_tick();
+}
 
-#ifndef CLOCK_16
-  UI_UPDATEM = 16; // 8 Mhz sysclock
-#endif
-  // the controller and the UI are updated on alternate frames (doubled the
-  // timer rate) presently ths update done every 1.024mS so the controller rate ~1Khz
-  if ( 0 != ( ++trate & 0x01 ) )
+
+/**
+ * @brief  Set the commutation timer period for the following sectors.
+ *
+ * @details  Called from the control task. The period is preloaded, so the
+ *  present sector is not affected.
+ *
+ * @param  period  Commutation period (TIM3 counts of 1/4 sector)
+ */
+void Driver_set_comm_period(uint16_t period)
+{
+  if (FALSE != Idle)
+  {
+    return;
+  }
+  MCU_set_comm_timer( SECTOR_TIME( period ) );
+}
+
+/**
+ * @brief  Set the idle mode of the stopped motor.
+ *
+ * @details  Called from the control task. In idle the commutation timer is
+ *  stopped (there is no sector to commutate) and the ADC scan rate is reduced,
+ *  which lowers the interrupt load while the background task waits in WFI. The
+ *  timer is restarted at the present commutation period when the idle ends. On
+ *  the boards with ADC_HW_TRIGGER the scan rate is not reduced.
+ *
+ * @param  idle  True if the motor is stopped (and the bridge is off)
+ */
+void Driver_set_idle(uint8_t idle)
+{
+  if (idle == Idle)
   {
-    BLDC_Update();
+    return;
   }
-  else if ( 0 == (trate % UI_UPDATEM))
+  Idle = idle;
+  Idle_div = 0;
+
+  if (FALSE != idle)
   {
-#if 1
-    /* Toggles LED */
-    GPIO_WriteReverse(LED_GPIO_PORT, (GPIO_Pin_TypeDef)LED_GPIO_PIN);
-#endif
-    Periodic_Task_Wake();
+    MCU_stop_comm_timer();
   }
+  else
+  {
+    MCU_set_comm_timer( SECTOR_TIME( get_commutation_period() ) );
+  }
+}
+
+/**
+ * @brief  Set the callback of a mid-sector event.
+ *
+ * @details  The compare interrupt is enabled only while a callback is set, so
+ *  there is no interrupt load from unused events. The event is set from the
+ *  next commutation.
+ *
+ * @param  evt  The event
+ * @param  cb   Callback (ISR context), NULL to disable the event
+ */
+void Driver_set_sector_cb(Driver_sector_evt_t evt, Driver_sector_cb_t cb)
+{
+  MCU_enable_comm_compare( (uint8_t)evt, FALSE );
+
+  Sector_cb[ evt ] = cb;
 
-  // update the commutation switch timer period
-  MCU_set_comm_timer( get_commutation_period() );
+  if (NULL != cb)
+  {
+    MCU_set_comm_compare( (uint8_t)evt, 0xFFFFu );
+    MCU_enable_comm_compare( (uint8_t)evt, TRUE );
+  }
 }
 
+/**
+ * @brief  Mid-sector event.
+ *
+ * @details  Invoked from the compare ISR of the commutation timer.
+ *
+ * @param  evt  Driver_sector_evt_t (the compare channel)
+ */
+void Driver_on_sector_event(uint8_t evt)
+{
+  Driver_sector_cb_t cb = Sector_cb[ evt ];
+
+  if (NULL != cb)
+  {
+    cb();
+  }
+}
 
 /**
  * @brief  Top-level task for commutation switching sequence
  *
- * @details  Invoked from timer ISR
+ * @details  Invoked from timer ISR, once per sector i.e. at each commutation.
  */
 void Driver_Step(void)
 {
-  static const int SectorC = FOUR_SECTORS;
-  static int index = 0;
-
-// Since the modulus being used (4) is a power of 2, then a bitwise & can be used
-// instead of a MOD (%) to save a few instructions, which is actually significant
-// as this is a very high frequency ISR!
-  index = (index + 1) & (SectorC - 1);
-
-// Distribute the work done in the ISR by partitioning
-//  sequence_step, memcpy,  get_ADC into  separate sub-steps
-// Logically the call to Sequence_Step() occurs following the memcpy()
+  uint16_t comm_period = get_commutation_period();
+  speed_zc_t zc = SPEED_ZC_NA;
 
-  switch(index)
+  // ZC result of the sector that has ended
+  if ( FALSE != Seq_ZC_expected() )
   {
-  case 0:
+    zc = (0 != ZC_elapsed) ? SPEED_ZC_DETECTED : SPEED_ZC_MISSED;
+  }
+  Speed_on_sector( zc, ZC_elapsed, comm_period );
+  ZC_elapsed = 0;
+
+  Sector_offset = 0;
+  Blanking_count = ZC_BLANKING_QTRS * comm_period;
 #ifdef BUFFER_ADC_BEMF
-    udpate_phase_average(); // average 8 samples from frame buffer
+  Bemf_window_end = ( comm_period > SECTOR_TIME_MAX ) ?
+                    0xFFFFu : (uint16_t)( BEMF_WINDOW_END_QTRS * comm_period );
 #endif
-    Sequence_Step();
-    break;
 
-  case 1:
-  case 2:
-  case 3:
-    break;
-  }
+  set_sector_events( comm_period );
+
+#ifdef BUFFER_ADC_BEMF
+  udpate_phase_average(); // average of the sector that has ended
+#endif
+  Sequence_Step();
 }
 /**@}*/ // defgroup
@@ -16,19 +16,19 @@
 /* Includes ------------------------------------------------------------------*/
 #include <string.h> // memset
 #include "faultm.h" // public types used internally
+#include "pwm_stm8s.h" // All_phase_stop
+#include "sched.h"
+#include "trace.h"
 
 
 /* Private defines -----------------------------------------------------------*/
 
 /**
- * @brief  Initialization value for fault counter bucket.
+ * @brief  Size of the fault counter bucket.
  *
- * @details  The fault matrix defines the bucket as a 6-bits unsigned integer bit-field.
- *
- * @note  This value should be derived from the faultm update rate somehow - it is
- * expected that faulm_upd() would be called for all fault codes from within
- * the background task. Therefore the bucket counts and/or increment rates should
- * share a timing factor with the background task.
+ * @details  The fault matrix defines the bucket as a 6-bits unsigned integer
+ *  bit-field, so the trip threshold of each fault (fault configuration table)
+ *  is limited to FAULT_BUCKET_LIM.
  */
 #define  FAULT_BUCKET_BITS   6 // power of 2 ...  2^6==64
 
@@ -36,15 +36,18 @@
 #define  FAULT_BUCKET_MASK   ( ( 1 << FAULT_BUCKET_BITS ) - 1)  // 63 // 6-bits bit-field
 #define  FAULT_BUCKET_LIM     FAULT_BUCKET_MASK
 
-// INI must be <= Limit
-#define  FAULT_BUCKET_INI    (48 - 1)
-
 
 /**
  * @brief The fault status word is 8-bits wide.
  */
 #define NR_DEFINED_FAULTS  8
 
+/**
+ * @brief  Fault policy bits (fault configuration table)
+ */
+#define FAULTM_LATCH  0x01  // held until Faultm_init, else cleared once the bucket is empty
+#define FAULTM_HARD   0x02  // the bridge is shut off at once, in the context of the caller
+
 
 /* Private types -----------------------------------------------------------*/
 
@@ -84,6 +87,20 @@ typedef struct fault_matrix
 
 } faultm_mat_t;
 
+/**
+ * @brief Fault configuration.
+ *
+ * @details  The bucket rates are per call of Faultm_upd(), so they are relative
+ *  to the rate at which the fault condition is tested.
+ */
+typedef struct
+{
+    uint8_t thresh; /**< bucket count at which the fault is set [1:FAULT_BUCKET_LIM] */
+    uint8_t inc;    /**< bucket increment while the condition is asserted */
+    uint8_t dec;    /**< bucket decrement (leak) while the condition is clear */
+    uint8_t policy; /**< FAULTM_LATCH, FAULTM_HARD */
+} faultm_cfg_t;
+
 
 /* Public variables  ---------------------------------------------------------*/
 
@@ -97,18 +114,109 @@ fault_status_reg_t fault_status_reg;
 
 static faultm_mat_t fault_matrix[ NR_DEFINED_FAULTS ];
 
+/*
+ * fault configuration table, in order of the bit position of the fault ID
+ */
+static const faultm_cfg_t fault_cfg[ NR_DEFINED_FAULTS ] =
+{
+  //  thresh  inc  dec  policy
+    { 48,     1,   1,   FAULTM_LATCH },               // FAULT_0
+    { 48,     1,   1,   FAULTM_LATCH },               // FAULT_1
+    { 48,     1,   1,   FAULTM_LATCH },               // VOLTAGE_NG (UI rate, ~0.8 s)
+    { 8,      1,   1,   0 },                          // THROTTLE_HI (auto-clear)
+    { 12,     2,   1,   FAULTM_LATCH | FAULTM_HARD }, // STALL (commutation rate, ~2 e-cycles)
+    { 24,     2,   1,   FAULTM_LATCH | FAULTM_HARD }, // DESYNC (commutation rate)
+    { 1,      1,   1,   FAULTM_LATCH | FAULTM_HARD }, // OVERCURRENT (first occurence)
+    { 48,     1,   1,   FAULTM_LATCH }                // unassigned
+};
+
+/*
+ * fault event log, the entry at the head is the oldest (overwritten next)
+ */
+static faultm_event_t fault_log[ FAULTM_NR_EVENTS ];
+static uint8_t fault_log_head;
+static uint8_t fault_log_count;
+
 
 /* Private function prototypes -----------------------------------------------*/
 
 /* Private functions ---------------------------------------------------------*/
 
+/*
+ * The fault ID is the bit of the fault in the status word, the matrix is
+ * indexed by the bit position.
+ */
+static uint8_t get_index(faultm_ID_t faultm_ID)
+{
+    uint8_t mask = (uint8_t)faultm_ID;
+    uint8_t nnn = 0;
+
+    while (mask > 1)
+    {
+        mask >>= 1;
+        nnn += 1;
+    }
+    return nnn;
+}
+
+/*
+ * add an event to the log
+ */
+static void log_event(faultm_ID_t faultm_ID, uint8_t set)
+{
+    faultm_event_t * pevent = &fault_log[ fault_log_head ];
+
+    pevent->tick = Sched_get_ticks();
+    pevent->faultm_ID = (uint8_t)faultm_ID;
+    pevent->set = set;
+
+    fault_log_head = (uint8_t)( (fault_log_head + 1) & (FAULTM_NR_EVENTS - 1) );
+
+    if (fault_log_count < FAULTM_NR_EVENTS)
+    {
+        fault_log_count += 1;
+    }
+}
+
+/*
+ * set the fault (if enabled and not already set)
+ */
+static void set_fault(faultm_ID_t faultm_ID, uint8_t nnn)
+{
+    faultm_mat_t * pfaultm  = &fault_matrix[ nnn ];
+
+    if (DISABLED == pfaultm->enabled || FCLR != pfaultm->state)
+    {
+        return;
+    }
+
+    if (0 != (fault_cfg[ nnn ].policy & FAULTM_HARD))
+    {
+        // kill the driver signals now, the control task stops the machine at
+        // its next tick
+        All_phase_stop();
+    }
+    pfaultm->state = FSET;
+
+    // multiple faults can be indicated in the status-word
+    fault_status_reg |= (fault_status_reg_t)faultm_ID;
+
+    log_event(faultm_ID, TRUE);
+
+#if defined( TRACE_ENABLED )
+    // keep the commutations leading up to the fault for the post-mortem dump
+    Trace_freeze();
+#endif
+}
+
 
 /* Public functions ---------------------------------------------------------*/
 
 /**
  * @brief Initialize the Fault Manager
  *
- * Must be called each time the motor state changes from off to running.
+ * Must be called each time the motor state changes from off to running. The
+ * event log is kept.
  */
 void Faultm_init(void)
 {
@@ -117,9 +225,6 @@ void Faultm_init(void)
     // intialize fault matrix
     memset(fault_matrix, 0, sizeof(fault_matrix) /* size in bytes */ );
 
-//fault_matrix[VOLTAGE_NG ].enabled = 1;
-//fault_matrix[THROTTLE_HI ].enabled = 1;
-
     for (nnn= 0; nnn < NR_DEFINED_FAULTS; nnn++)
     {
         fault_matrix[nnn].enabled = TRUE;
@@ -141,6 +246,26 @@ fault_status_reg_t Faultm_get_status(void)
     return fault_status_reg;
 }
 
+/**
+ * @brief  Get a copy of the fault event log.
+ *
+ * @details  Expected to be called from within a CS.
+ *
+ * @param [out]  pevents  Buffer of FAULTM_NR_EVENTS entries, newest first.
+ * @return  Number of entries.
+ */
+uint8_t Faultm_get_events(faultm_event_t * pevents)
+{
+    uint8_t nnn;
+
+    for (nnn = 0; nnn < fault_log_count; nnn++)
+    {
+        pevents[nnn] =
+            fault_log[ (uint8_t)(fault_log_head - 1 - nnn) & (FAULTM_NR_EVENTS - 1) ];
+    }
+    return fault_log_count;
+}
+
 /**
  * @brief  Enable or disable triggering of specified fault.
  *
@@ -152,7 +277,7 @@ void Faultm_enable(faultm_ID_t faultm_ID, int enable_b)
 // assert (fault_ID < MAX)
 
 // use a pointer to cleanup (and optimize away the array-access?)
-    faultm_mat_t * pfaultm  = &fault_matrix[ faultm_ID ];
+    faultm_mat_t * pfaultm  = &fault_matrix[ get_index( faultm_ID ) ];
 
     pfaultm->enabled = enable_b;
 }
@@ -160,71 +285,72 @@ void Faultm_enable(faultm_ID_t faultm_ID, int enable_b)
 /**
  * @brief Set the fault matrix bit and status word.
  *
- * @note  A single fault shuts down the system, i.e. no need to flag/mask
- * multiple fault conditions.
+ * @details  The fast path, bypassing the bucket: safe to call from the
+ *  commutation or ADC ISR (or from within a CS). If the fault is configured
+ *  hard, the bridge is shut off before returning i.e. within the present PWM
+ *  cycle.
  *
  * @param faultm_ID  Numerical ID of the fault to be set.
  */
 void Faultm_set(faultm_ID_t faultm_ID)
 {
-// assert (fault_ID < MAX)
-
-// use a pointer to cleanup (and optimize away the array-access?)
-    faultm_mat_t * pfaultm  = &fault_matrix[ faultm_ID ];
-
-//    fault_status_reg_t  mask = (1 << faultm_ID); // maybe ... not necessary for now
-    uint8_t  mask = (uint8_t) faultm_ID;
-
-    pfaultm->state =  (FALSE != pfaultm->enabled);
+    const uint8_t nnn = get_index( faultm_ID );
 
-// set bucket full ... wouldn't really need the "state" varaible
-    pfaultm->bucket = FAULT_BUCKET_INI;
+// set bucket full ... so it takes as long to leak as to fill
+    fault_matrix[ nnn ].bucket = fault_cfg[ nnn ].thresh;
 
-    // note: OR allows multiple faults to be indicated in the status-word not that it
-    // makes much difference
-    fault_status_reg = mask; // |= mask;
+    set_fault(faultm_ID, nnn);
 }
 
 
 /**
  * @brief Manage fault status with leaky bucket.
+ *
+ * @details  The threshold and rates of the bucket, and whether the fault is
+ *  latched, are configured for each fault. Called from ISR, or from within a
+ *  CS in non-ISR context.
+ *
  * @param faultm_ID  Numerical ID of the fault to be set.
  * @param tcondition  Boolean condition indicating if the fault condition was detected.
  */
 void Faultm_upd(faultm_ID_t faultm_ID, faultm_assert_t tcondition)
 {
-    // suspect that compiler clips the intermediate macro term out of range of 6-bit bitfield??
-    const uint8_t const_lmt_term = FAULT_BUCKET_INI; // FixMyMacro
-
-// assert (fault_ID < MAX)
-//    fault_status_reg_t  mask = (1 << faultm_ID); // maybe ... not necessary for now
-    fault_status_reg_t  mask = (fault_status_reg_t) faultm_ID;
+    const uint8_t nnn = get_index( faultm_ID );
+    const faultm_cfg_t * pcfg = &fault_cfg[ nnn ];
 
 // use a pointer to cleanup (and optimize away the array-access?)
-    faultm_mat_t * pfaultm  = &fault_matrix[ faultm_ID ];
+    faultm_mat_t * pfaultm  = &fault_matrix[ nnn ];
+
+    uint8_t bucket = pfaultm->bucket;
 
     if (tcondition)
     {
         // if bucket < thr, then increment it else latch the fault
-        if ( pfaultm->bucket < const_lmt_term )
+        if ( bucket + pcfg->inc < pcfg->thresh )
         {
-            pfaultm->bucket += 1;
+            pfaultm->bucket = bucket + pcfg->inc;
         }
         else
         {
+            pfaultm->bucket = pcfg->thresh;
+
             // if the fault is enabled, then set it
-            Faultm_set(faultm_ID);
+            set_fault(faultm_ID, nnn);
         }
     }
     else
     {
-        if ( pfaultm->bucket > 0 )
-        {
-            pfaultm->bucket -= 1; // leaky bucket
-        }
-        else
+        bucket = ( bucket > pcfg->dec ) ? bucket - pcfg->dec : 0; // leaky bucket
+
+        pfaultm->bucket = bucket;
+
+        if ( 0 == bucket && FCLR != pfaultm->state &&
+             0 == (pcfg->policy & FAULTM_LATCH) )
         {
-// shouldnt need to do anything here ... we don't clear faults (requires system reset)
+            pfaultm->state = FCLR;
+            fault_status_reg &= (fault_status_reg_t)~faultm_ID;
+
+            log_event(faultm_ID, FALSE);
         }
     }
 }
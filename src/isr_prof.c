@@ -0,0 +1,117 @@
+/**
+  ******************************************************************************
+  * @file isr_prof.c
+  * @brief ISR execution time profiling
+  * @author Neidermeier
+  * @version
+  * @date
+  ******************************************************************************
+  */
+/**
+ * \defgroup isr_prof ISR Profiling
+ * @brief ISR execution time profiling
+ * @{
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <string.h> // memcpy
+#include "isr_prof.h"
+
+
+#ifdef ISR_PROFILE_ENABLED
+
+/* Private defines -----------------------------------------------------------*/
+
+// sliding average: avg8 = avg8 - avg8/8 + t  i.e. 1/8 weighting of each sample
+#define AVG_SH  3
+
+
+/* Private variables ---------------------------------------------------------*/
+
+static isr_prof_t isr_prof_tbl[ ISR_PROF_NR_IDS ];
+
+static uint8_t isr_prof_depth; // number of profiled ISRs in progress
+
+
+/* Public functions ---------------------------------------------------------*/
+
+/**
+ * @brief  Time-stamp ISR entry.
+ *
+ * @details  Called at the top of the ISR. Detects nesting i.e. another profiled
+ *  ISR in progress.
+ *
+ * @param  id  Identifier of the ISR.
+ * @return  Time-stamp of the free-running profiling timer.
+ */
+uint8_t Isr_prof_entry(isr_prof_id_t id)
+{
+  if (0 != isr_prof_depth)
+  {
+    isr_prof_tbl[id].nest += 1;
+  }
+  isr_prof_depth += 1;
+
+  return TIM4->CNTR;
+}
+
+/**
+ * @brief  Update the statistics at ISR exit.
+ *
+ * @details  The 8-bit timer wraps ever 256us, which is longer than any ISR is
+ *  expected to run, so that the unsigned difference is the elapsed time.
+ *
+ * @param  id  Identifier of the ISR.
+ * @param  t0  Time-stamp from ISR entry.
+ */
+void Isr_prof_exit(isr_prof_id_t id, uint8_t t0)
+{
+  isr_prof_t * pstats = &isr_prof_tbl[id];
+
+  uint8_t dt = (uint8_t)(TIM4->CNTR - t0);
+
+  if (dt < pstats->min)
+  {
+    pstats->min = dt;
+  }
+  if (dt > pstats->max)
+  {
+    pstats->max = dt;
+  }
+  pstats->avg8 = pstats->avg8 - (pstats->avg8 >> AVG_SH) + dt;
+
+  isr_prof_depth -= 1;
+}
+
+/**
+ * @brief  Get a copy of the statistics of all ISRs.
+ *
+ * @details  Expected to be called from within a CS.
+ *
+ * @param [out]  pstats  Table of ISR_PROF_NR_IDS elements.
+ */
+void Isr_prof_get(isr_prof_t * pstats)
+{
+  memcpy(pstats, isr_prof_tbl, sizeof(isr_prof_tbl));
+}
+
+/**
+ * @brief  Reset the statistics of all ISRs.
+ *
+ * @details  Expected to be called from within a CS.
+ */
+void Isr_prof_reset(void)
+{
+  uint8_t n;
+  for (n = 0; n < ISR_PROF_NR_IDS; n++)
+  {
+    isr_prof_tbl[n].min = U8_MAX;
+    isr_prof_tbl[n].max = 0;
+    isr_prof_tbl[n].avg8 = 0;
+    isr_prof_tbl[n].nest = 0;
+  }
+}
+
+#endif // ISR_PROFILE_ENABLED
+
+/**@}*/ // defgroup
@@ -20,6 +20,10 @@
 #include "mcu_stm8s.h"
 #include "bldc_sm.h"
 #include "per_task.h"
+#include "isr_prof.h"
+#include "mdata.h"
+#include "param.h"
+#include "throttle.h"
 
 
 #ifdef _SDCC_
@@ -42,13 +46,24 @@ included in the file that contains the function main.
 void main(int argc, char **argv)
 {
   uint8_t linec = 0;
-  uint8_t framecount = 0;
   uint8_t i = 0;
   (void) argc;
   (void) argv;
 
   MCU_Init();
 
+#ifdef ISR_PROFILE_ENABLED
+  Isr_prof_reset();
+#endif
+
+  Param_load();
+
+  Load_OL_Timing();
+
+#if defined( HAS_SERVO_INPUT )
+  Throttle_init();
+#endif
+
   BL_reset();
 
   printf("\n\rProgram Startup.......\n\r");
@@ -87,12 +102,11 @@ void main(int argc, char **argv)
     }
 #endif
 
-    if ( TRUE == Task_Ready() )
+    // the background groups are released by the PWM timer ISR, so the CPU
+    // waits for the next interrupt (at most one PWM cycle) when none is ready
+    if (FALSE == Task_Ready())
     {
-// this modulus provides a time reference of approximately 2 Hz (debug/test/dev/usage)
-      if ( ! ((framecount++) % 0x20) )
-      {
-      }
+      wfi();
     }
   } // while 1
 }
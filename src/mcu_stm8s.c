@@ -20,13 +20,65 @@
  // external declarations used internally
 #include "mcu_stm8s.h"
 #include "pwm_stm8s.h"
+#include "spi_stm8s.h" // SPI_CS_PORT
 
 /* Private defines -----------------------------------------------------------*/
 
+// size of the TX ring buffer (must be power of 2)
+#ifdef STM8S105
+  #define UART_TX_BUF_SZ  128
+#else
+  #define UART_TX_BUF_SZ  64  // s003 1k RAM
+#endif
+
+#define UART_TX_BUF_MSK  (UART_TX_BUF_SZ - 1)
+
+// size of the RX ring buffer (must be power of 2), a command line at full rate
+#ifdef STM8S105
+  #define UART_RX_BUF_SZ  32
+#else
+  #define UART_RX_BUF_SZ  16
+#endif
+
+#define UART_RX_BUF_MSK  (UART_RX_BUF_SZ - 1)
+
+// the debug terminal is on UART2 (S105) or UART1 (S003)
+#ifdef STM8S105
+  #define UART_SR         UART2->SR
+  #define UART_SR_OR      UART2_SR_OR
+  #define UART_DR         UART2->DR
+  #define UART_CR2        UART2->CR2
+  #define UART_CR2_TIEN   UART2_CR2_TIEN
+#else
+  #define UART_SR         UART1->SR
+  #define UART_SR_OR      UART1_SR_OR
+  #define UART_DR         UART1->DR
+  #define UART_CR2        UART1->CR2
+  #define UART_CR2_TIEN   UART1_CR2_TIEN
+#endif
+
 /* Public variables  ---------------------------------------------------------*/
 
 /* Private variables ---------------------------------------------------------*/
 
+/*
+ * TX ring buffer: the head index is written only by putchar() (background)
+ * and the tail index only by the TX ISR, so that no CS is needed.
+ */
+static char UART_tx_buf[ UART_TX_BUF_SZ ];
+static volatile uint8_t UART_tx_head;
+static volatile uint8_t UART_tx_tail;
+static uint16_t UART_tx_drops;
+
+/*
+ * RX ring buffer: the head index is written only by the RX ISR and the tail
+ * index only by SerialKeyPressed() (background).
+ */
+static char UART_rx_buf[ UART_RX_BUF_SZ ];
+static volatile uint8_t UART_rx_head;
+static volatile uint8_t UART_rx_tail;
+static uint16_t UART_rx_drops;
+
 /* Private function prototypes -----------------------------------------------*/
 
 /* Private functions ---------------------------------------------------------*/
@@ -55,125 +107,140 @@
   */
 /** @cond */ // Doxygen gets tripped up over the "prototype" macros
 
-#ifdef STM8S105 // S105 Dev board or DISCOVERY
-
 /**
   * @brief Retargets the C library printf function to the UART.
   * @param c Character to send
   * @details
-  * // Based on SPL UART example project
+  * The character is put in the TX ring buffer and the TX interrupt is enabled,
+  * so that the caller is never blocked. If the buffer is full the character is
+  * dropped and counted.
   * @retval char Character sent
   */
 PUTCHAR_PROTOTYPE
 {
-  /* Write a character to the UART1 */
-  UART2_SendData8(c);
-  /* Loop until the end of transmission */
-  while (UART2_GetFlagStatus(UART2_FLAG_TXE) == RESET);
+  uint8_t next = (uint8_t)((UART_tx_head + 1) & UART_TX_BUF_MSK);
+
+  if (next == UART_tx_tail)
+  {
+    UART_tx_drops += 1;
+  }
+  else
+  {
+    UART_tx_buf[UART_tx_head] = (char)c;
+    UART_tx_head = next;
+
+    UART_CR2 |= UART_CR2_TIEN; // TXE interrupt drains the buffer
+  }
 
   return (c);
 }
 
+
 /**
   * @brief getch()-like funcction.
-  * @detail  See above.
+  * @detail  See above. Blocks until there is a character in the RX ring buffer.
   * @param None
   * @retval char Character to Read
   */
 GETCHAR_PROTOTYPE
 {
-#ifdef _COSMIC_
   char c = 0;
-#else
-  int c = 0;
-#endif
-  /* Loop until the Read data register flag is SET */
-  while (UART2_GetFlagStatus(UART2_FLAG_RXNE) == RESET);
-    c = UART2_ReceiveData8();
+
+  while ( 0 == SerialKeyPressed(&c) );
   return (c);
 }
 
 /**
 * @brief  Test to see if a key has been pressed on the terminal.
 *
-* @details Allows reading a character but non-blocking.
+* @details Allows reading a character but non-blocking, from the RX ring buffer
+*  which is filled by the RX ISR (so characters received between the polls are
+*  kept).
 * @param [out]  key  Pointer to byte for receiving character code.
 * @retval  1  a character has been read
 * @retval  0  no character has been read
 */
 uint8_t SerialKeyPressed(char *key)
 {
-  FlagStatus flag  ;
-  /* First clear Rx buffer */
-  flag = UART2_GetFlagStatus(UART2_FLAG_RXNE);
-  if ( flag == SET)
+  uint8_t tail = UART_rx_tail;
+
+  if (tail != UART_rx_head)
   {
-    *key = (char)UART2->DR;
+    *key = UART_rx_buf[tail];
+    UART_rx_tail = (uint8_t)((tail + 1) & UART_RX_BUF_MSK);
     return 1;
   }
 
   return 0;
 }
-#else // stm8s003
+/** @endcond */
+
 /**
-  * @brief Retargets the C library printf function to the UART.
-  * @param c Character to send
-  * @details
-  * // Based on SPL UART example project
-  * @retval char Character sent
-  */
-PUTCHAR_PROTOTYPE
+ * @brief  Service the UART TX Empty interrupt.
+ *
+ * @details  Called in ISR context. Moves the next character from the TX ring
+ *  buffer to the UART data register, and disables the interrupt when the buffer
+ *  is empty.
+ */
+void MCU_on_UART_TX(void)
 {
-  /* Write a character to the UART1 */
-  UART1_SendData8(c);
-  /* Loop until the end of transmission */
-  while (UART1_GetFlagStatus(UART1_FLAG_TXE) == RESET);
+  uint8_t tail = UART_tx_tail;
 
-  return (c);
+  if (tail != UART_tx_head)
+  {
+    UART_DR = UART_tx_buf[tail];
+    UART_tx_tail = (uint8_t)((tail + 1) & UART_TX_BUF_MSK);
+  }
+  else
+  {
+    UART_CR2 &= (uint8_t)~UART_CR2_TIEN;
+  }
 }
 
 /**
-  * @brief getch()-like funcction.
-	* @detail  See above.
-  * @param None
-  * @retval char Character to Read
-  */
-GETCHAR_PROTOTYPE
+ * @brief  Get the count of characters dropped from the UART TX ring buffer.
+ */
+uint16_t MCU_get_UART_TX_drops(void)
 {
-#ifdef _COSMIC_
-  char c = 0;
-#else
-  int c = 0;
-#endif
-  /* Loop until the Read data register flag is SET */
-  while (UART1_GetFlagStatus(UART1_FLAG_RXNE) == RESET);
-    c = UART1_ReceiveData8();
-  return (c);
+  return UART_tx_drops;
 }
 
 /**
-* @brief  Test to see if a key has been pressed on the terminal.
-*
-* @details Allows reading a character but non-blocking.
-* @param [out]  key  Pointer to byte for receiving character code.
-* @retval  1  a character has been read
-* @retval  0  no character has been read
-*/
-uint8_t SerialKeyPressed(char *key)
+ * @brief  Service the UART RX Not Empty interrupt.
+ *
+ * @details  Called in ISR context. The character is put in the RX ring buffer,
+ *  or dropped and counted if the buffer is full. A character lost to the
+ *  overrun of the data register is counted as well.
+ */
+void MCU_on_UART_RX(void)
 {
-  FlagStatus flag  ;
-  /* First clear Rx buffer */
-  flag = UART1_GetFlagStatus(UART1_FLAG_RXNE);
-  if ( flag == SET)
+  uint8_t sr = UART_SR;
+  char c = (char)UART_DR; // the read of SR then DR clears RXNE and OR
+  uint8_t next = (uint8_t)((UART_rx_head + 1) & UART_RX_BUF_MSK);
+
+  if (0 != (sr & UART_SR_OR))
   {
-    *key = (char)UART1->DR;
-    return 1;
+    UART_rx_drops += 1;
   }
 
-  return 0;
+  if (next == UART_rx_tail)
+  {
+    UART_rx_drops += 1;
+  }
+  else
+  {
+    UART_rx_buf[UART_rx_head] = c;
+    UART_rx_head = next;
+  }
+}
+
+/**
+ * @brief  Get the count of characters dropped from the UART RX ring buffer.
+ */
+uint16_t MCU_get_UART_RX_drops(void)
+{
+  return UART_rx_drops;
 }
-#endif
-/** @endcond */
 
 /*
  * @brief Configure GPIO.
@@ -206,6 +273,17 @@ static void GPIO_Config(void)
 // AIN0 (back-EMF sensor): Input floating, no external interrupt
   GPIO_Init(PH0_BEMF_IN_PORT, (GPIO_Pin_TypeDef)PH0_BEMF_IN_PIN, GPIO_MODE_IN_FL_NO_IT);
 
+#if defined( THREE_PHASE_BEMF_ENABLED )
+// AIN2, AIN4 (back-EMF sensor): Input floating, no external interrupt
+  GPIO_Init(PH1_BEMF_IN_PORT, (GPIO_Pin_TypeDef)PH1_BEMF_IN_PIN, GPIO_MODE_IN_FL_NO_IT);
+  GPIO_Init(PH2_BEMF_IN_PORT, (GPIO_Pin_TypeDef)PH2_BEMF_IN_PIN, GPIO_MODE_IN_FL_NO_IT);
+#endif
+
+#if defined( CURRENT_SENSE_ENABLED )
+// AIN1 (shunt amplifier): Input floating, no external interrupt
+  GPIO_Init(ISHUNT_IN_PORT, (GPIO_Pin_TypeDef)ISHUNT_IN_PIN, GPIO_MODE_IN_FL_NO_IT);
+#endif
+
 #if defined( HAS_SERVO_INPUT )
 // Input pull-up, no external interrupt
   GPIO_Init(SERVO_GPIO_PORT, (GPIO_Pin_TypeDef)SERVO_GPIO_PIN, GPIO_MODE_IN_PU_NO_IT);
@@ -213,16 +291,6 @@ static void GPIO_Config(void)
 
 // Input pull-up, no external interrupt
   GPIO_Init(PH0_BEMF_IN_PORT, (GPIO_Pin_TypeDef)PH0_BEMF_IN_PIN, GPIO_MODE_IN_PU_NO_IT);
-
-#if defined ( S105_DEV )
-#elif defined( S105_DISCOVERY )
-#if 0
-// PA4 as button input (Stop)
-  GPIOA->DDR &= ~GPIO_PIN_4;
-  GPIOA->CR1 |= GPIO_PIN_4;  // pull up w/o interrupts
-#endif
-#else
-#endif
 }
 
 /**
@@ -238,7 +306,7 @@ static void GPIO_Config(void)
  */
 static void UART_setup(void)
 {
-#if defined( S105_DEV ) || defined( S105_DISCOVERY )
+#ifdef STM8S105
 
   UART2_DeInit();
 
@@ -249,9 +317,11 @@ static void UART_setup(void)
              UART2_SYNCMODE_CLOCK_DISABLE,
              UART2_MODE_TXRX_ENABLE);
 
+  UART2_ITConfig(UART2_IT_RXNE_OR, ENABLE); // RX ring buffer
+
   UART2_Cmd(ENABLE);
 
-#elif defined( S003_DEV )
+#else
 
   UART1_DeInit();
 
@@ -263,6 +333,8 @@ static void UART_setup(void)
     UART1_SYNCMODE_CLOCK_DISABLE,
     UART1_MODE_TXRX_ENABLE);
 
+    UART1_ITConfig(UART1_IT_RXNE_OR, ENABLE); // RX ring buffer
+
     UART1_Cmd(ENABLE);
 #endif
 }
@@ -277,6 +349,13 @@ static void UART_setup(void)
 #else
 #define ADC_DIVIDER ADC1_PRESSEL_FCPU_D2  // 4 ->  8/2 = 4
 #endif
+
+// the scan is from Ch 0 to the last channel (ADC_snap_ch_t)
+#if defined( THREE_PHASE_BEMF_ENABLED )
+#define ADC_SCAN_LAST_CH  ADC1_CHANNEL_4  // i.e. Ch 0, 1, 2, 3 and 4 are enabled
+#else
+#define ADC_SCAN_LAST_CH  ADC1_CHANNEL_3  // i.e. Ch 0, 1, 2, and 3 are enabled
+#endif
 /*
  * https://community.st.com/s/question/0D50X00009XkbA1SAJ/multichannel-adc
  */
@@ -287,10 +366,14 @@ static void ADC1_setup(void)
   ADC1_DeInit();
 
   ADC1_Init(ADC1_CONVERSIONMODE_SINGLE, // don't care, see ConversionConfig below ..
-            ADC1_CHANNEL_3,        // i.e. Ch 0, 1, 2, and 3 are enabled
+            ADC_SCAN_LAST_CH,      // scan from Ch 0
             ADC_DIVIDER,
-            ADC1_EXTTRIG_TIM,      //  ADC1_EXTTRIG_GPIO ... not presently using any ex triggern
-            DISABLE,               // ExtTriggerState
+            ADC1_EXTTRIG_TIM,      // TIM1 TRGO (ADC1_EXTTRIG_GPIO not used)
+#if defined( ADC_HW_TRIGGER )
+            ENABLE,                // ExtTriggerState: scan started by PWM timer TRGO
+#else
+            DISABLE,               // ExtTriggerState: scan started from PWM update ISR
+#endif
             ADC1_ALIGN_RIGHT,
             ADC1_SCHMITTTRIG_ALL,
             DISABLE);              // SchmittTriggerState
@@ -303,8 +386,10 @@ static void ADC1_setup(void)
 // Enable the ADC: 1 -> ADON for the first time it just wakes the ADC up
   ADC1_Cmd(ENABLE);
 
+#if !defined( ADC_HW_TRIGGER )
 // ADON = 1 for the 2nd time => starts the ADC conversion of all channels in sequence
   ADC1_StartConversion(); // i.e. for scanning mode only has to start once ...
+#endif
 }
 
 /**
@@ -313,7 +398,7 @@ static void ADC1_setup(void)
  */
 #if defined( HAS_SERVO_INPUT )
 
-#if defined( S105_DEV )
+#if BOARD_CAP_TIM == 2
 /*
  * Available pins for PWM channels require use of TIM1 ... TIM2 CH1 is a spare
  * pin on the STM8S105 Black (D4) so the input capture is assigned there.
@@ -322,10 +407,13 @@ static void ADC1_setup(void)
  * @brief Setup timer capture for servo signal pulse input.
  *
  * @details
- * The clock prescaler is used to scale 1ms radio signal pulse measurement to a
- * range of just of 0x0300 (exceeds the PWM resolution commanded to the motor).
+ * The clock prescaler is set for a resolution (THR_TICKS_PER_US) that is fine
+ * enough to measure the Multishot pulse, while a servo pulse of up to ~8ms
+ * still fits in the 16-bit count (see throttle.c). The period of the servo
+ * frame is longer than the count, so the overflows are counted by the update
+ * interrupt (Driver_on_capture_ovf).
  * The timer period is set to maximum and left free running and the capture-compare
- * channels 3 & 4 used to get leading and trailing edges of radio signal pulse.
+ * channels 1 & 2 used to get leading and trailing edges of radio signal pulse.
  * THis is explained in STM8 Reference Manual RM0016.
 */
 static void Servo_CC_setup(void)
@@ -336,7 +424,7 @@ static void Servo_CC_setup(void)
   TIM2_DeInit();
 
 // The counter clock frequency fCK_CNT is equal to fCK_PSC / 2(PSC[3:0])
-  TIM2_TimeBaseInit( TIM2_PRESCALER_32, period);
+  TIM2_TimeBaseInit( TIM2_PRESCALER_2, period);
 
   TIM2_ICInit(TIM2_CHANNEL_1,
               TIM2_ICPOLARITY_RISING,
@@ -352,17 +440,21 @@ static void Servo_CC_setup(void)
               ICFilter
              );
 
-// timer update/ovrflow ISR not strictly needed but is handy to confirm timer rate
-//  TIM2_ITConfig(TIM2_IT_UPDATE, ENABLE);
+// timer update/ovrflow ISR extends the capture count for the period measurement
+  TIM2_ITConfig(TIM2_IT_UPDATE, ENABLE);
 
 // enable capture channels
   TIM2_ITConfig(TIM2_IT_CC1, ENABLE);
   TIM2_ITConfig(TIM2_IT_CC2, ENABLE);
 
+// the capture ISR is set to lower priority than the motor control ISRs
+// (software priority level 1, IRQ14)
+  ITC->ISPR4 = (uint8_t)((ITC->ISPR4 & ~(3 << 4)) | (ITC_PRIORITYLEVEL_1 << 4));
+
   TIM2_Cmd(ENABLE);
 }
 
-#elif defined( S105_DISCOVERY )
+#elif BOARD_CAP_TIM == 1
 /*
  * STM8s105 Discovery TIM1 not available for PWM (unless touch pad disabled by
  * removing solder bridges, i.e. PWM must be on TIM2 but TIM1 is available for input capture.
@@ -371,8 +463,11 @@ static void Servo_CC_setup(void)
  * @brief Setup timer capture for servo signal pulse input.
  *
  * @details
- * The clock prescaler is used to scale 1ms radio signal pulse measurement to a
- * range of just of 0x0300 (exceeds the PWM resolution commanded to the motor).
+ * The clock prescaler is set for a resolution (THR_TICKS_PER_US) that is fine
+ * enough to measure the Multishot pulse, while a servo pulse of up to ~8ms
+ * still fits in the 16-bit count (see throttle.c). The period of the servo
+ * frame is longer than the count, so the overflows are counted by the update
+ * interrupt (Driver_on_capture_ovf).
  * The timer period is set to maximum and left free running and the capture-compare
  * channels 3 & 4 used to get leading and trailing edges of radio signal pulse.
  * THis is explained in STM8 Reference Manual RM0016.
@@ -382,7 +477,7 @@ static void Servo_CC_setup(void)
 /*
  * counter clock frequency fCK_CNT is equal to fCK_PSC / (PSCR[15:0]+1)
  */
-  const uint16_t T1_Prescaler = 32 - 1; // 1/16Mhz * 32 * 65536 = 0.131072 (about 131ms)
+  const uint16_t T1_Prescaler = 2 - 1; // 1/16Mhz * 2 * 65536 = 0.008192 (about 8ms)
 
   const uint16_t T1_Period = 0xFFFF;
   const uint8_t repetitionCounter = 1;
@@ -405,34 +500,47 @@ static void Servo_CC_setup(void)
               ICFilter
              );
 
-// timer update/ovrflow ISR not strictly needed but is handy to confirm timer rate
-//  TIM1_ITConfig(TIM1_IT_UPDATE, ENABLE); // be sure flag is cleared in ISR!
+// timer update/ovrflow ISR extends the capture count for the period measurement
+  TIM1_ITConfig(TIM1_IT_UPDATE, ENABLE); // be sure flag is cleared in ISR!
 
 // enable capture channels 3 & 4
   TIM1_ITConfig(TIM1_IT_CC4, ENABLE);
   TIM1_ITConfig(TIM1_IT_CC3, ENABLE);
 
+// the capture ISR is set to lower priority than the motor control ISRs
+// (software priority level 1, IRQ12)
+  ITC->ISPR4 = (uint8_t)((ITC->ISPR4 & ~(3 << 0)) | (ITC_PRIORITYLEVEL_1 << 0));
+
   TIM1_Cmd(ENABLE);
 }
-#endif // S105 DISCOVERY
+#endif // BOARD_CAP_TIM
 #endif // HAS_SERVO_INP
 
 /*
  * commutation timer on TIM1 or TIM3 depending on the specific stm8s part
- */
-#if defined ( S105_DEV ) || defined ( S105_DISCOVERY )
-/*
- * Timers 2 3 & 5 are 16-bit general purpose timers
- *  Sets the commutation switching period.
+ * (COMM_TIM of the board descriptor)
  *
  *  @8Mhz, fMASTER period ==  0.000000125 S
  *   Timer Step:
  *     step = 1 / 8Mhz * prescaler = 0.000000125 * (2^1) = 0.000000250 S
  */
+#if BOARD_COMM_TIM == 1
+// TIM1 (s003) prescaler is fCK_PSC / (PSCR[15:0]+1)
 #ifdef CLOCK_16
-#define TIM3_PSCR  0x01  // 2^1 == 2
+#define COMM_TIM_PSCR  0x01  // 2
 #else
-#define TIM3_PSCR  0x00  // 2^0 == 1
+#define COMM_TIM_PSCR  0x00  // 1
+#endif
+#define COMM_TIM_SET_PSCR()  TIM1->PSCRH = 0; TIM1->PSCRL = COMM_TIM_PSCR
+
+#else
+// Timers 2 3 & 5 are 16-bit general purpose timers, prescaler is 2^PSCR[3:0]
+#ifdef CLOCK_16
+#define COMM_TIM_PSCR  0x01  // 2^1 == 2
+#else
+#define COMM_TIM_PSCR  0x00  // 2^0 == 1
+#endif
+#define COMM_TIM_SET_PSCR()  COMM_TIM->PSCR = COMM_TIM_PSCR
 #endif
 
 /**
@@ -441,45 +549,144 @@ static void Servo_CC_setup(void)
  */
 void MCU_set_comm_timer(uint16_t period)
 {
-  TIM3->PSCR = TIM3_PSCR;
+  COMM_TIM_SET_PSCR();
 
-  TIM3->ARRH = (uint8_t)(period >> 8);   // be sure to set byte ARRH first, see data sheet
-  TIM3->ARRL = (uint8_t)(period & 0xff);
+  BOARD_SET_REG16( COMM_TIM->ARRH, COMM_TIM->ARRL, period ); // be sure to set byte ARRH first, see data sheet
 
-  TIM3->IER |= TIM3_IER_UIE; // Enable Update Interrupt
-  TIM3->CR1 = TIM3_CR1_ARPE; // auto (re)loading the count
-  TIM3->CR1 |= TIM3_CR1_CEN; // Enable TIM3
+  COMM_TIM->IER |= COMM_TIM_UIE; // Enable Update Interrupt
+  COMM_TIM->CR1 = COMM_TIM_ARPE; // auto (re)loading the count
+  COMM_TIM->CR1 |= COMM_TIM_CEN; // Enable timer
 }
 
-#elif defined( S003_DEV ) // uses TIM1 which is not preferred
+/**
+ * @brief  Stop the commutation timer, and disable its interrupts.
+ * @details  Restarted by MCU_set_comm_timer, the first period after the
+ *  restart is not a full sector.
+ */
+void MCU_stop_comm_timer(void)
+{
+  COMM_TIM->IER &= (uint8_t)~( COMM_TIM_UIE | COMM_TIM_CC1IE | COMM_TIM_CC2IE );
+  COMM_TIM->CR1 &= (uint8_t)~COMM_TIM_CEN;
+}
 
 /**
- * @brief Sets period of the commutation timer.
- * Prescaler value is set depending whether system is configured for 8 or 16 Mhz CPU clock.
- * @param  period  Value written to auto-reload register
+ * @brief  Get the commutation timer count.
+ * @return  Counter value i.e. counts elapsed in the present period
  */
-#ifdef CLOCK_16
-#define TIM1_PSCR  0x02
-#else
-#define TIM1_PSCR  0x01
-#endif
+uint16_t MCU_get_comm_timer_count(void)
+{
+  uint16_t count = (uint16_t)COMM_TIM->CNTRH << 8; // read MSB first, LSB is latched
+  return count | COMM_TIM->CNTRL;
+}
 
-void MCU_set_comm_timer(uint16_t period)
+/**
+ * @brief  Restart the commutation timer period.
+ * @details  The counter is reset and the count is loaded immediately (not
+ *  at the next update event). The update request source is restricted to
+ *  counter overflow so that the software-generated update does not trigger
+ *  the ISR. The period is then preloaded for the following update events.
+ * @param  count   Counts to the next update event
+ * @param  period  Value written to timer reload register
+ */
+void MCU_restart_comm_timer(uint16_t count, uint16_t period)
 {
-  const uint16_t TIM1_Prescaler = TIM1_PSCR - 1;
+  BOARD_SET_REG16( COMM_TIM->ARRH, COMM_TIM->ARRL, count );
 
-  /* Set the Prescaler value */
-  TIM1->PSCRH = (uint8_t)(TIM1_Prescaler >> 8);
-  TIM1->PSCRL = (uint8_t)(TIM1_Prescaler);
+  COMM_TIM->CR1 |= COMM_TIM_URS; // only counter overflow triggers update interrupt
+  COMM_TIM->EGR = COMM_TIM_UG;   // reset counter and reload prescaler + ARR
 
-  TIM1->ARRH = (uint8_t)(period >> 8);   // be sure to set byte ARRH first, see data sheet
-  TIM1->ARRL = (uint8_t)(period & 0xff);
+  BOARD_SET_REG16( COMM_TIM->ARRH, COMM_TIM->ARRL, period );
+}
 
-  TIM1->IER |= TIM1_IER_UIE; // Enable Update Interrupt
-  TIM1->CR1 = TIM1_CR1_ARPE; // auto (re)loading the count
-  TIM1->CR1 |= TIM1_CR1_CEN; // Enable timer
+/**
+ * @brief  Set a compare channel of the commutation timer.
+ * @details  The channels are in frozen output compare mode (reset state) so
+ *  there is no output, only the flag/interrupt. A count past the period sets
+ *  no event.
+ * @param  chan   Compare channel 1 or 2 as [0:1]
+ * @param  count  Counts from the start of the timer period
+ */
+void MCU_set_comm_compare(uint8_t chan, uint16_t count)
+{
+  // MSB first, the compare is inhibited until LSB is written
+  if (0 == chan)
+  {
+    BOARD_SET_REG16( COMM_TIM->CCR1H, COMM_TIM->CCR1L, count );
+  }
+  else
+  {
+    BOARD_SET_REG16( COMM_TIM->CCR2H, COMM_TIM->CCR2L, count );
+  }
+}
+
+/**
+ * @brief  Enable the interrupt of a compare channel of the commutation timer.
+ * @details  A stale flag is cleared before the interrupt is enabled.
+ * @param  chan    Compare channel 1 or 2 as [0:1]
+ * @param  enable  True to enable
+ */
+void MCU_enable_comm_compare(uint8_t chan, uint8_t enable)
+{
+  const uint8_t mask = (0 == chan) ? COMM_TIM_CC1IE : COMM_TIM_CC2IE;
+
+  if (FALSE != enable)
+  {
+    BOARD_TIM_CLR_FLAGS( COMM_TIM, mask ); // the CCxIF bits match CCxIE
+    COMM_TIM->IER |= mask;
+  }
+  else
+  {
+    COMM_TIM->IER &= (uint8_t)~mask;
+  }
+}
+
+/**
+ * @brief  Read from data EEPROM.
+ * @param  offs    Byte offset in the data EEPROM
+ * @param  pdata   Destination
+ * @param  nbytes  Number of bytes
+ */
+void MCU_EEPROM_read(uint8_t offs, uint8_t * pdata, uint8_t nbytes)
+{
+  const uint8_t * pee = (const uint8_t *)FLASH_DATA_START_PHYSICAL_ADDRESS;
+
+  while (nbytes-- > 0)
+  {
+    *pdata++ = pee[offs++];
+  }
+}
+
+/**
+ * @brief  Write to data EEPROM.
+ * @details  Only the bytes that differ are programmed. Blocks for the
+ *  programming time (~3ms per byte), so not to be used while the motor is
+ *  running.
+ * @param  offs    Byte offset in the data EEPROM
+ * @param  pdata   Source
+ * @param  nbytes  Number of bytes
+ */
+void MCU_EEPROM_write(uint8_t offs, const uint8_t * pdata, uint8_t nbytes)
+{
+  volatile uint8_t * pee = (volatile uint8_t *)FLASH_DATA_START_PHYSICAL_ADDRESS;
+
+  // unlock the data EEPROM (MASS keys), see FLASH_Unlock()
+  FLASH->DUKR = FLASH_RASS_KEY2;
+  FLASH->DUKR = FLASH_RASS_KEY1;
+  while (0 == (FLASH->IAPSR & FLASH_IAPSR_DUL));
+
+  while (nbytes-- > 0)
+  {
+    if (pee[offs] != *pdata)
+    {
+      pee[offs] = *pdata;
+      while (0 == (FLASH->IAPSR & FLASH_IAPSR_EOP)); // EOP cleared by the read
+    }
+    pdata++;
+    offs++;
+  }
+
+  FLASH->IAPSR &= (uint8_t)~FLASH_IAPSR_DUL; // lock
 }
-#endif
 
 /*
  * http://embedded-lab.com/blog/starting-stm8-microcontrollers/13/
@@ -491,11 +698,11 @@ static void Clock_setup(void)
 {
   CLK_DeInit();
 
-#if defined( S105_DEV ) || defined( S003_DEV )
+#if !defined( BOARD_CLK_HSE )
   /*High speed internal clock prescaler: 1*/
   CLK_HSIPrescalerConfig(CLK_PRESCALER_HSIDIV1);
 
-#elif defined( S105_DISCOVERY )
+#else
   // Configure Quartz Clock
   CLK_HSECmd(ENABLE);
 #endif
@@ -513,6 +720,31 @@ static void Clock_setup(void)
   CLK_PeripheralClockConfig(CLK_PERIPHERAL_TIMER3, ENABLE);
 }
 
+#ifdef ISR_PROFILE_ENABLED
+/*
+ * TIM4 is 8-bit basic timer, otherwise unused, free-running as time-base for
+ * profiling ISR execution time.
+ *   @16Mhz: step = 1 / 16Mhz * prescaler = 0.0000000625 * (2^4) = 0.000001 S
+ */
+#ifdef CLOCK_16
+#define TIM4_PSCR  0x04  // 2^4 == 16
+#else
+#define TIM4_PSCR  0x03  // 2^3 == 8
+#endif
+
+/**
+ * @brief  Configure TIM4 as free-running 1us time-base (no interrupt).
+ */
+static void TIM4_setup(void)
+{
+  CLK_PeripheralClockConfig(CLK_PERIPHERAL_TIMER4, ENABLE);
+
+  TIM4->PSCR = TIM4_PSCR;
+  TIM4->ARR = 0xFF;
+  TIM4->CR1 |= TIM4_CR1_CEN;
+}
+#endif // ISR_PROFILE_ENABLED
+
 #if SPI_ENABLED
 /**
  * @brief  Configure SPI bus
@@ -531,9 +763,10 @@ void SPI_setup(void)
 
   // Set GPIO pins to output push-pull high level.
 
-// S105_BLACK ... LED on E5
-// CS not required for single master/slave pair
-//   GPIO_Init(GPIOE, GPIO_PIN_5, GPIO_MODE_OUT_PP_HIGH_SLOW); // CS
+// CS not required for single master/slave pair (S105_DEV has the LED on E5)
+#ifdef SPI_CTRLR_USE_CS
+  GPIO_Init(SPI_CS_PORT, (GPIO_Pin_TypeDef)SPI_CS_PINS, GPIO_MODE_OUT_PP_HIGH_SLOW);
+#endif
 
   GPIO_Init(GPIOC, GPIO_PIN_5, GPIO_MODE_OUT_PP_HIGH_SLOW); // SCLK
   GPIO_Init(GPIOC, GPIO_PIN_6, GPIO_MODE_OUT_PP_HIGH_SLOW); // MOSI
@@ -551,6 +784,8 @@ void SPI_setup(void)
            SPI_CLOCKPOLARITY_LOW, SPI_CLOCKPHASE_1EDGE,
            SPI_DATADIRECTION_2LINES_FULLDUPLEX, SPI_NSS_SOFT, (uint8_t)0x07);
 
+  // the RXNE interrupt is enabled for the duration of each transaction
+
 #else
   // configure input pins with pullup
   GPIO_Init(GPIOE, GPIO_PIN_5, GPIO_MODE_IN_PU_NO_IT);  // CS
@@ -566,9 +801,7 @@ void SPI_setup(void)
            SPI_CLOCKPOLARITY_LOW, SPI_CLOCKPHASE_1EDGE,
            SPI_DATADIRECTION_2LINES_FULLDUPLEX, SPI_NSS_HARD, (uint8_t)0x07);
 
-#if 0 //  #ifdef SPI_PERPIPH_INT
   SPI_ITConfig(SPI_IT_RXNE, ENABLE); // Interrupt when the Rx buffer is not empty.
-#endif
 
 #endif // SPI_ENABLED == SPI_STM8_MASTER
 
@@ -590,7 +823,7 @@ void MCU_Init(void)
   UART_setup();
   PWM_setup();
 
-#if !defined (S003_DEV)
+#if !defined( BOARD_NO_ADC_SETUP )
   ADC1_setup();
 #endif
 
@@ -601,6 +834,10 @@ void MCU_Init(void)
 #if SPI_ENABLED
   SPI_setup();
 #endif
+
+#ifdef ISR_PROFILE_ENABLED
+  TIM4_setup();
+#endif
 }
 
 /**@}*/ // defgroup
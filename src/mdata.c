@@ -15,121 +15,540 @@
 
 /* Includes ------------------------------------------------------------------*/
 
+#include <stddef.h> // offsetof
 #include "system.h" // dependency of motor data on cpu clock specific timer rate
+#include "mdata.h"
+#include "mcu_stm8s.h" // data EEPROM
+#include "speed.h"     // Speed_recip
+
+/* Private types -------------------------------------------------------------*/
 
 /*
- * The table is indexed by PWM duty cycle counts (i.e. [0:1:250)
- * The function generates the data in Scilab and imported from csv:
- *
- *   y =  ( 4000 * EXP( -t/25 ) ) + 150
- *
- * Excel was used  to find initial parameters using some data obtained experimentally
- * sync range seems to be [32-68] (duty-cycle) with parameters roughly in these ranges:
- *  A     = [ 1800 : 2000 ]
- *  TAU   = [ 38 : 34 ]
- *  Y_INT = [ 25 : 30 ]
- *  X_INT = 0
- *
- *  (32-80)/(788-268) =  -0.0923077
+ * Segment of the open-loop timing model, valid from the duty-cycle at its
+ * start up to the start of the next segment. Slope is Q8 (TIM3 counts per
+ * duty-cycle count * 256).
+ */
+typedef struct
+{
+    uint8_t  dc;
+    uint16_t period;
+    int16_t  slope;
+} ol_segment_t;
+
+/*
+ * Profile is selected by the battery voltage (ADC counts), and was tuned at
+ * the nominal voltage.
+ */
+typedef struct
+{
+    uint16_t vbatt_min;
+    uint16_t vbatt_nom;
+    uint8_t  nr_segs;
+    const ol_segment_t * segs;
+} ol_profile_t;
+
+/*
+ * Segment of the timing advance map, valid from the speed at its start up to
+ * the start of the next segment. The advance is Q8 of the 1/4 sector (15
+ * degrees), the slope is Q12 (advance per eRPM/10 * 4096).
+ */
+typedef struct
+{
+    uint16_t erpm10;
+    uint8_t  adv;
+    int16_t  slope;
+} adv_segment_t;
+
+typedef struct
+{
+    uint8_t  nr_segs;
+    const adv_segment_t * segs;
+} adv_profile_t;
+
+/* Private defines -----------------------------------------------------------*/
+
+/*
+ * A segment from the breakpoints at its start and end, the slope computed by
+ * the compiler so the model data is just the breakpoints (dc, period).
+ */
+#define OL_SEG( _X0_, _Y0_, _X1_, _Y1_ ) \
+    { _X0_, _Y0_, (int16_t)( ( ( (_Y1_) - (_Y0_) ) * 256L ) / ( (_X1_) - (_X0_) ) ) }
+
+#define OL_NR_SEGS( _SEGS_ )  (uint8_t)( sizeof(_SEGS_) / sizeof(ol_segment_t) )
+
+// 12.25v is 0x0374: 33k/18k with 5v ref (S105 Discovery), 33k/10k with 3.3v ref (S105 DEV)
+#define OL_VBATT( _V_ )  (uint16_t)( ( (_V_) * 0x0374 ) / 12.25 )
+
+#if defined (S003_DEV)
+  #define OL_DC_MAX      63
+#else
+  #define OL_DC_MAX      179
+#endif
+
+/*
+ * Timing advance in electrical degrees, as Q8 of the 1/4 sector i.e. up to
+ * (not including) 15 degrees.
+ */
+#define ADV_DEG( _D_ )  (uint8_t)( ( (_D_) * 256.0 ) / 15 )
+
+/*
+ * A segment of the advance map from the breakpoints (eRPM, degrees) at its
+ * start and end, and the last segment which is flat.
+ */
+#define ADV_SEG( _E0_, _D0_, _E1_, _D1_ ) \
+    { (_E0_) / 10, ADV_DEG( _D0_ ), \
+      (int16_t)( ( ( (int16_t)ADV_DEG( _D1_ ) - ADV_DEG( _D0_ ) ) * 4096L ) / \
+                 ( ( (_E1_) - (_E0_) ) / 10 ) ) }
+
+#define ADV_END( _E0_, _D0_ )  { (_E0_) / 10, ADV_DEG( _D0_ ), 0 }
+
+#define ADV_NR_SEGS( _SEGS_ )  (uint8_t)( sizeof(_SEGS_) / sizeof(adv_segment_t) )
+
+/*
+ * Learned timing: the correction to the model is recorded for each bucket of
+ * 2^OL_LRN_SH duty-cycle counts during closed-loop operation. It is a fraction
+ * of the model period, so it applies to the model of whichever profile is
+ * selected by the battery voltage.
+ */
+#define OL_LRN_SH        4
+#define OL_LRN_NR        ( ( OL_DC_MAX >> OL_LRN_SH ) + 1 )
+#define OL_LRN_Q         10   // correction Q10 of the model period
+#define OL_LRN_EMA_SH    3    // smoothing 1/8
+#define OL_LRN_SETTLE_SH 8
+#define OL_LRN_SETTLE    ( 1 << OL_LRN_SETTLE_SH ) // samples (control ticks) until the bucket is valid
+#define OL_LRN_HYST      4    // change from the saved value to be (re)saved (~0.4%)
+#define OL_LRN_LIM       ( (1 << OL_LRN_Q) >> 2 ) // plausible if within +/- 25% of the model
+#define OL_LRN_MAGIC     ( 0xB0 | OL_LRN_NR ) // 0xA0: correction in model counts
+
+/*
+ * Learned timing record as stored in data EEPROM. The correction is Q10 of
+ * the model period.
+ */
+typedef struct
+{
+    uint8_t  magic;
+    uint16_t valid;              // bit per bucket
+    int16_t  corr[ OL_LRN_NR ];
+    uint8_t  csum;
+} ol_learned_t;
+
+/* Private variables ---------------------------------------------------------*/
+
+/*
+ * The breakpoints are fit (within 1%) to the curves generated by the Scilab
+ * script (model.c), indexed by PWM duty cycle counts:
  *
- * The range that needs to be synced is between "Idle" (DC=32) and some higher speed where b-emf is measureable.
- * The exponential seems to do a better job at tracking over the needed
- * interval. Taking the coordinates at the start and end of the range over which
- * the motor is able to stay in sync would give the slope that could be tried for
- * a linear tracking function.
+ *   [0:74]    y = A * exp( -x/50 )
+ *   [75:179]  y = 1 - 3x + OFFS
  *
+ * The sync range seems to be [32-68] (duty-cycle). The exponential does a
+ * better job at tracking the low speed range, the response seems to become more
+ * linear past 30%.
  */
-static const uint16_t OL_Timing[ /* TABLE_SIZE */ ] =
-{
 #if defined (S003_DEV)
-1500, //   0, 0, 0, 5DC
-1470, //   1, 1, 1, 5BE
-1441, //   2, 1, 2, 5A1
-1413, //   3, 2, 3, 585
-1385, //   4, 2, 4, 569
-1357, //   5, 3, 5, 54D
-1330, //   6, 3, 6, 532
-1304, //   7, 4, 7, 518
-1278, //   8, 4, 8, 4FE
-1253, //   9, 5, 9, 4E5
-1228, //   10, 6, A, 4CC
-1204, //   11, 6, B, 4B4
-1180, //   12, 7, C, 49C
-1157, //   13, 7, D, 485
-1134, //   14, 8, E, 46E
-1111, //   15, 8, F, 457
-1089, //   16, 9, 10, 441
-1068, //   17, 9, 11, 42C
-1047, //   18, 10, 12, 417
-1026, //   19, 11, 13, 402
-1005, //   20, 11, 14, 3ED
-986, //   21, 12, 15, 3DA
-966, //   22, 12, 16, 3C6
-947, //   23, 13, 17, 3B3
-928, //   24, 13, 18, 3A0
-910, //   25, 14, 19, 38E
-892, //   26, 14, 1A, 37C
-874, //   27, 15, 1B, 36A
-857, //   28, 16, 1C, 359
-840, //   29, 16, 1D, 348
-823, //   30, 17, 1E, 337
-807, //   31, 17, 1F, 327
-791, //   32, 18, 20, 317
-775, //   33, 18, 21, 307
-760, //   34, 19, 22, 2F8
-745, //   35, 19, 23, 2E9
-730, //   36, 20, 24, 2DA
-716, //   37, 21, 25, 2CC
-701, //   38, 21, 26, 2BD
-688, //   39, 22, 27, 2B0
-674, //   40, 22, 28, 2A2
-661, //   41, 23, 29, 295
-648, //   42, 23, 2A, 288
-635, //   43, 24, 2B, 27B
-622, //   44, 24, 2C, 26E
-610, //   45, 25, 2D, 262
-598, //   46, 26, 2E, 256
-586, //   47, 26, 2F, 24A
-574, //   48, 27, 30, 23E
-563, //   49, 27, 31, 233
-552, //   50, 28, 32, 228
-541, //   51, 28, 33, 21D
-530, //   52, 29, 34, 212
-520, //   53, 29, 35, 208
-509, //   54, 30, 36, 1FD
-499, //   55, 31, 37, 1F3
-489, //   56, 31, 38, 1E9
-480, //   57, 32, 39, 1E0
-470, //   58, 32, 3A, 1D6
-461, //   59, 33, 3B, 1CD
-452, //   60, 33, 3C, 1C4
-443, //   61, 34, 3D, 1BB
-434, //   62, 34, 3E, 1B2
-425, //   63, 35, 3F, 1A9
+// A = 1500
+static const ol_segment_t OL_segs_12v[] =
+{
+    OL_SEG(  0, 1500, 13, 1157 ),
+    OL_SEG( 13, 1157, 26,  892 ),
+    OL_SEG( 26,  892, 39,  688 ),
+    OL_SEG( 39,  688, 52,  530 ),
+    OL_SEG( 52,  530, 63,  425 ),
+};
+
+static const ol_profile_t OL_profiles[] =
+{
+    { 0, OL_VBATT( 12.0 ), OL_NR_SEGS( OL_segs_12v ), OL_segs_12v },
+};
 #else
-  #include "model.h" // hack   headers are horrible
-#endif	
+// A = 1700, OFFS = 620 (12.5v WW)
+static const ol_segment_t OL_segs_12v5[] =
+{
+    OL_SEG(  0, 1700,  14, 1285 ),
+    OL_SEG( 14, 1285,  28,  971 ),
+    OL_SEG( 28,  971,  41,  749 ),
+    OL_SEG( 41,  749,  54,  577 ),
+    OL_SEG( 54,  577,  68,  436 ),
+    OL_SEG( 68,  436,  73,  395 ),
+    OL_SEG( 73,  395,  75,  396 ),
+    OL_SEG( 75,  396, 179,   84 ),
 };
 
-#define OL_TIMING_TBL_SIZE    ( sizeof(OL_Timing) / sizeof(uint16_t) )
+// A = 1800, OFFS = 630 (starts and runs close to time @ 12v on BPS)
+static const ol_segment_t OL_segs_12v[] =
+{
+    OL_SEG(  0, 1800,  14, 1360 ),
+    OL_SEG( 14, 1360,  28, 1028 ),
+    OL_SEG( 28, 1028,  41,  793 ),
+    OL_SEG( 41,  793,  54,  611 ),
+    OL_SEG( 54,  611,  68,  462 ),
+    OL_SEG( 68,  462,  73,  418 ),
+    OL_SEG( 73,  418,  75,  406 ),
+    OL_SEG( 75,  406, 179,   94 ),
+};
+
+// in order of descending voltage
+static const ol_profile_t OL_profiles[] =
+{
+    { OL_VBATT( 12.25 ), OL_VBATT( 12.5 ), OL_NR_SEGS( OL_segs_12v5 ), OL_segs_12v5 },
+    { 0,                 OL_VBATT( 12.0 ), OL_NR_SEGS( OL_segs_12v ),  OL_segs_12v },
+};
+#endif
+
+#define OL_NR_PROFILES  ( sizeof(OL_profiles) / sizeof(ol_profile_t) )
+
+static const ol_profile_t * OL_profile = &OL_profiles[0];
+
+/*
+ * Timing advance maps, selected for the motor by MOTOR_TIMING_ADV. There is
+ * little to gain at low speed where the commutation is short of the phase
+ * inductance time constant, so the advance is ramped in with the speed.
+ */
+static const adv_segment_t Adv_segs_none[] =
+{
+    ADV_END(     0, 0.0 ),
+};
+
+static const adv_segment_t Adv_segs_low[] =
+{
+    ADV_SEG(     0, 0.0, 10000, 0.0 ),
+    ADV_SEG( 10000, 0.0, 40000, 7.5 ),
+    ADV_END( 40000, 7.5 ),
+};
+
+static const adv_segment_t Adv_segs_high[] =
+{
+    ADV_SEG(     0, 0.0, 10000,  0.0 ),
+    ADV_SEG( 10000, 0.0, 50000, 14.0 ),
+    ADV_END( 50000, 14.0 ),
+};
+
+static const adv_profile_t Adv_profiles[] =
+{
+    { ADV_NR_SEGS( Adv_segs_none ), Adv_segs_none },
+    { ADV_NR_SEGS( Adv_segs_low ),  Adv_segs_low },
+    { ADV_NR_SEGS( Adv_segs_high ), Adv_segs_high },
+};
+
+static const adv_profile_t * const Adv_profile = &Adv_profiles[ MOTOR_TIMING_ADV ];
+
+static ol_learned_t OL_lrn;
+
+static int16_t OL_lrn_saved[ OL_LRN_NR ];
+static uint16_t OL_lrn_count[ OL_LRN_NR ];
+static uint8_t OL_lrn_dirty;
+
+
+/* Private functions ---------------------------------------------------------*/
+
+/*
+ * Open-loop timing model: linear interpolation on the segment of the present
+ * profile (in model counts i.e. not CTIME scaled)
+ */
+static uint16_t ol_model(uint8_t dc)
+{
+    const ol_segment_t * ps;
+    uint8_t n = OL_profile->nr_segs;
+
+    // find the segment
+    do
+    {
+        n -= 1;
+        ps = &OL_profile->segs[n];
+    }
+    while ( n > 0 && ps->dc > dc );
+
+    return (uint16_t)( ps->period +
+           (int16_t)( ( (int32_t)ps->slope * (uint8_t)( dc - ps->dc ) ) >> 8 ) );
+}
+
+/*
+ * Plausibility of a correction term (Q10 of the model timing)
+ */
+static uint8_t lrn_plausible(int32_t corr)
+{
+    return (uint8_t)( corr <= OL_LRN_LIM && corr >= -OL_LRN_LIM );
+}
+
+/*
+ * Learned correction of a bucket applied to the model period (model counts).
+ * A bucket that is not valid yet is blended in as it settles, so the
+ * feed-forward doesn't step when the bucket becomes valid.
+ */
+static int16_t lrn_correction(uint8_t b, uint16_t model)
+{
+    const uint16_t weight = ( 0 != ( OL_lrn.valid & ( 1 << b ) ) ) ?
+                            OL_LRN_SETTLE : OL_lrn_count[b];
+
+    return (int16_t)( ( (int32_t)OL_lrn.corr[b] * model * weight )
+                      >> ( OL_LRN_Q + OL_LRN_SETTLE_SH ) );
+}
+
+static uint8_t lrn_checksum(void)
+{
+    const uint8_t * pb = (const uint8_t *)&OL_lrn;
+    uint8_t csum = 0;
+    uint8_t n;
+
+    for (n = 0; n < offsetof( ol_learned_t, csum ); n++)
+    {
+        csum += pb[n];
+    }
+    return (uint8_t)~csum;
+}
+
 
+/* Public functions ---------------------------------------------------------*/
 
 /**
- * @brief Table lookup for open-loop commutation timing
+ * @brief Select the open-loop timing profile for the battery voltage
  *
- * @param index  Index into the table - motor speed i.e. PWM duty-cycle
+ * @details Expected to be called from CS context while the motor is not
+ *  running. A voltage of 0 (not yet measured) keeps the present profile.
  *
- * @return LUT value @ index
+ * @param vbatt  Battery voltage (ADC counts)
+ */
+void Set_OL_Profile(uint16_t vbatt)
+{
+    uint8_t n;
+
+    if (0 == vbatt)
+    {
+        return;
+    }
+    for (n = 0; n < OL_NR_PROFILES; n++)
+    {
+        if (vbatt >= OL_profiles[n].vbatt_min)
+        {
+            OL_profile = &OL_profiles[n];
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Nominal voltage of the open-loop timing profile
+ *
+ * @details The voltage at which the present profile (and the startup) was
+ *  tuned, the reference of the battery voltage compensation.
+ *
+ * @return Battery voltage (ADC counts)
+ */
+uint16_t Get_OL_Vbatt(void)
+{
+    return OL_profile->vbatt_nom;
+}
+
+/**
+ * @brief Open-loop commutation timing
+ *
+ * @details The model timing for the present profile, corrected by the learned
+ *  timing of the bucket (in part while the bucket is settling).
+ *
+ * @param index  Motor speed i.e. PWM duty-cycle
+ *
+ * @return Commutation period @ index
  * @retval -1 error
  */
 uint16_t Get_OL_Timing(uint16_t index)
 {
-    // assert index < OL_TIMING_TBL_SIZE
-    if ( index < OL_TIMING_TBL_SIZE )
+    uint16_t period;
+    uint8_t b;
+
+    if ( index > OL_DC_MAX )
+    {
+        return (U16_MAX); // error
+    }
+
+    period = ol_model( (uint8_t)index );
+
+    b = (uint8_t)( index >> OL_LRN_SH );
+
+    period += lrn_correction( b, period );
+
+    return period * CTIME_SCALAR;
+}
+
+/**
+ * @brief Commutation timing advance
+ *
+ * @details Linear interpolation on the segment of the advance map of the motor.
+ *
+ * @param erpm10  Motor speed, eRPM / 10
+ *
+ * @return Advance w.r.t. ZC + 30 degrees, Q8 of the 1/4 sector (15 degrees)
+ */
+uint8_t Get_Timing_Advance(uint16_t erpm10)
+{
+    const adv_segment_t * ps;
+    uint8_t n = Adv_profile->nr_segs;
+
+    // find the segment
+    do
+    {
+        n -= 1;
+        ps = &Adv_profile->segs[n];
+    }
+    while ( n > 0 && ps->erpm10 > erpm10 );
+
+    return (uint8_t)( ps->adv +
+           (int16_t)( ( (int32_t)ps->slope * (uint16_t)( erpm10 - ps->erpm10 ) ) >> 12 ) );
+}
+
+/**
+ * @brief Record the converged commutation period.
+ *
+ * @details Called from the control task (ISR) in closed-loop mode while the
+ *  commutation period is settled. The correction to the model is smoothed in
+ *  the bucket of the duty-cycle, the bucket becomes valid after a number of
+ *  samples. The first sample seeds a bucket that is not valid, a valid
+ *  (loaded) bucket is smoothed from its value.
+ *
+ * @param dc      PWM duty-cycle
+ * @param period  Commutation period
+ */
+void Learn_OL_Timing(uint16_t dc, uint16_t period)
+{
+    uint16_t model;
+    int16_t diff;
+    uint16_t r;
+    int16_t corr;
+    uint8_t sh;
+    uint8_t b;
+
+    if ( dc > OL_DC_MAX )
+    {
+        return;
+    }
+
+    model = ol_model( (uint8_t)dc );
+    diff = (int16_t)( period / CTIME_SCALAR - model );
+
+    // range of lrn_plausible, tested before the scaling so the product fits
+    if ( 0 == model ||
+         diff > (int16_t)( model >> 2 ) || diff < -(int16_t)( model >> 2 ) )
+    {
+        return;
+    }
+
+    // Q10 of the model, by the reciprocal as there is no 32-bit divide
+    r = Speed_recip( model, &sh );
+    corr = (int16_t)( ( (int32_t)diff * r ) >> ( 30 - OL_LRN_Q - sh ) );
+
+    // at the limit, the interpolated reciprocal can be over by a count or two
+    if ( corr > OL_LRN_LIM )
+    {
+        corr = OL_LRN_LIM;
+    }
+    else if ( corr < -OL_LRN_LIM )
+    {
+        corr = -OL_LRN_LIM;
+    }
+
+    b = (uint8_t)( dc >> OL_LRN_SH );
+
+    if ( 0 == OL_lrn_count[b] && 0 == ( OL_lrn.valid & ( 1 << b ) ) )
+    {
+        OL_lrn.corr[b] = corr;
+    }
+    else
+    {
+        OL_lrn.corr[b] += ( corr - OL_lrn.corr[b] ) >> OL_LRN_EMA_SH;
+    }
+
+    if ( OL_lrn_count[b] < OL_LRN_SETTLE )
+    {
+        OL_lrn_count[b] += 1;
+    }
+    else
+    {
+        corr = OL_lrn.corr[b] - OL_lrn_saved[b];
+
+        if ( 0 == ( OL_lrn.valid & ( 1 << b ) ) ||
+             corr > OL_LRN_HYST || corr < -OL_LRN_HYST )
+        {
+            OL_lrn.valid |= ( 1 << b );
+            OL_lrn_dirty = TRUE;
+        }
+    }
+}
+
+/**
+ * @brief Load the learned timing from data EEPROM.
+ *
+ * @details The record is discarded if the checksum does not match. A bucket is
+ *  discarded if the correction is not plausible w.r.t. the model, or if the
+ *  corrected timing does not decrease with the duty-cycle.
+ */
+void Load_OL_Timing(void)
+{
+    uint16_t prev = U16_MAX;
+    uint8_t b;
+
+    MCU_EEPROM_read( EE_OL_LRN_OFFS, (uint8_t *)&OL_lrn, sizeof(OL_lrn) );
+
+    if ( OL_LRN_MAGIC != OL_lrn.magic || lrn_checksum() != OL_lrn.csum )
+    {
+        OL_lrn.valid = 0;
+    }
+
+    for (b = 0; b < OL_LRN_NR; b++)
+    {
+        if ( 0 != ( OL_lrn.valid & ( 1 << b ) ) &&
+             FALSE == lrn_plausible( OL_lrn.corr[b] ) )
+        {
+            OL_lrn.valid &= ~( 1 << b );
+        }
+        if ( 0 != ( OL_lrn.valid & ( 1 << b ) ) )
+        {
+            const uint16_t model = ol_model( (uint8_t)( b << OL_LRN_SH ) );
+            const uint16_t period = model + lrn_correction( b, model );
+
+            if ( period > prev )
+            {
+                OL_lrn.valid &= ~( 1 << b );
+            }
+            else
+            {
+                prev = period;
+            }
+        }
+        if ( 0 == ( OL_lrn.valid & ( 1 << b ) ) )
+        {
+            OL_lrn.corr[b] = 0;
+        }
+        OL_lrn_saved[b] = OL_lrn.corr[b];
+        OL_lrn_count[b] = 0;
+    }
+    OL_lrn_dirty = FALSE;
+}
+
+/**
+ * @brief Write the learned timing to data EEPROM if it has changed.
+ *
+ * @details Blocking (EEPROM programming time is a few ms per byte), so expected
+ *  to be called from the background task only while the motor is not running.
+ */
+void Save_OL_Timing(void)
+{
+    uint8_t b;
+
+    if ( FALSE == OL_lrn_dirty )
+    {
+        return;
+    }
+
+    OL_lrn.magic = OL_LRN_MAGIC;
+    OL_lrn.csum = lrn_checksum();
+
+    // only the bytes that differ are programmed
+    MCU_EEPROM_write( EE_OL_LRN_OFFS, (const uint8_t *)&OL_lrn, sizeof(OL_lrn) );
+
+    for (b = 0; b < OL_LRN_NR; b++)
     {
-        return OL_Timing[ index ] * CTIME_SCALAR;
+        OL_lrn_saved[b] = OL_lrn.corr[b];
     }
-    return (U16_MAX); // error
+    OL_lrn_dirty = FALSE;
 }
 
 /**@}*/ // defgroup
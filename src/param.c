@@ -0,0 +1,307 @@
+/**
+  ******************************************************************************
+  * @file param.c
+  * @brief Run-time parameters with the data EEPROM record
+  * @author Neidermeier
+  * @version
+  * @date
+  ******************************************************************************
+  */
+/**
+ * \defgroup param Parameters
+ * @brief Tunables of the controller in a RAM shadow, loaded from a record in
+ *  data EEPROM at startup and applied to the modules that use them. The
+ *  parameters are set over the UART and the SPI register map, and committed
+ *  to the record on request once the motor is stopped.
+ * @{
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "param.h"
+#include "bldc_sm.h"
+#include "driver.h"
+#include "mcu_stm8s.h" // data EEPROM
+#include "sequence.h"
+#include "spi_stm8s.h"
+#include "telem.h"     // Telem_crc8
+
+
+/* Private defines -----------------------------------------------------------*/
+
+/*
+ * Format of the record, changed only if the meaning or the unit of an existing
+ * parameter changes (the record is then discarded)
+ */
+#define PARAM_VERSION  1
+#define PARAM_MAGIC    ( 0x50 | PARAM_VERSION )
+
+// size of the header (magic, count), of the values, and of the record with the CRC8
+#define PARAM_HDR_SZ   2
+#define PARAM_VAL_SZ( _N_ )  (uint8_t)( (_N_) * sizeof(uint16_t) )
+#define PARAM_REC_SZ( _N_ )  (uint8_t)( PARAM_HDR_SZ + PARAM_VAL_SZ( _N_ ) + 1 )
+
+// duty-cycle in counts of the nominal PWM period
+#define PARAM_DC( _PCNT_ )  (uint16_t)( ( (_PCNT_) * PWM_100PCNT ) / 100.0 )
+
+
+/* Private types -------------------------------------------------------------*/
+
+typedef struct
+{
+  uint16_t def;
+  uint16_t min;
+  uint16_t max;
+} param_desc_t;
+
+/*
+ * Record as stored in data EEPROM: the CRC8 of the header and the values
+ * follows the values, i.e. it is at val[ count ] in a record of a previous
+ * build with fewer parameters.
+ */
+typedef struct
+{
+  uint8_t  magic;
+  uint8_t  count;
+  uint16_t val[ PARAM_NR ];
+  uint8_t  crc;
+} param_record_t;
+
+
+/* Private variables ---------------------------------------------------------*/
+
+static const param_desc_t Param_desc[ PARAM_NR ] =
+{
+  { PARAM_DC( PWM_DC_STARTUP ), PARAM_DC( 2.0 ), PARAM_DC( 30.0 ) }, // PARAM_DC_STARTUP
+  { PARAM_DC( PWM_DC_SHUTOFF ), PARAM_DC( 2.0 ), PARAM_DC( 30.0 ) }, // PARAM_DC_SHUTOFF
+  { V_SHUTDOWN_THR, 0, 0x03FF },                                     // PARAM_V_SHUTDOWN
+  { PI_KP, 0, U8_MAX },                                              // PARAM_PI_KP
+  { PI_KI, 0, U8_MAX },                                              // PARAM_PI_KI
+  { ISENSE_ADC( ILIM_AMPS ), ISENSE_ADC( 1 ), ISENSE_ADC( ITRIP_AMPS ) }, // PARAM_ILIM
+  { BRAKE_MODE, BRAKE_NONE, BRAKE_COMPL },                           // PARAM_BRAKE_MODE
+  { BRAKE_STRENGTH, 0, BRAKE_STRENGTH_MAX },                         // PARAM_BRAKE_STRENGTH
+  { DECEL_MODE, 0, 1 },                                              // PARAM_DECEL
+  { VBATT_COMP_MODE, 0, 1 },                                         // PARAM_VBATT_COMP
+  { SPI_ESC_ADDR, 0, SPI_BUS_MAX_ESC - 1 }                           // PARAM_SPI_ADDR
+};
+
+static param_record_t Record; // the values are the RAM shadow
+
+static uint8_t Commit_req;
+
+
+/* Private functions ---------------------------------------------------------*/
+
+static uint8_t param_in_range(param_ID_t id, uint16_t val)
+{
+  return (uint8_t)( val >= Param_desc[ id ].min && val <= Param_desc[ id ].max );
+}
+
+/*
+ * The shutoff duty-cycle has to be below the startup, else the motor would be
+ * switched off as it is started
+ */
+static uint8_t dc_limits_valid(uint16_t startup, uint16_t shutoff)
+{
+  return (uint8_t)( shutoff < startup );
+}
+
+/*
+ * Apply a parameter to the module that uses it
+ */
+static void param_apply(param_ID_t id)
+{
+  const uint16_t * pval = Record.val;
+
+  switch (id)
+  {
+  case PARAM_DC_STARTUP:
+  case PARAM_DC_SHUTOFF:
+    BL_set_dc_limits( (uint8_t)pval[ PARAM_DC_STARTUP ], (uint8_t)pval[ PARAM_DC_SHUTOFF ] );
+    break;
+  case PARAM_PI_KP:
+  case PARAM_PI_KI:
+    BL_set_timing_gains( (uint8_t)pval[ PARAM_PI_KP ], (uint8_t)pval[ PARAM_PI_KI ] );
+    break;
+#ifdef CURRENT_SENSE_ENABLED
+  case PARAM_ILIM:
+    Driver_set_current_limit( pval[ PARAM_ILIM ] );
+    break;
+#endif
+  case PARAM_BRAKE_MODE:
+  case PARAM_BRAKE_STRENGTH:
+    Seq_set_brake( (uint8_t)pval[ PARAM_BRAKE_MODE ], (uint8_t)pval[ PARAM_BRAKE_STRENGTH ] );
+    break;
+  case PARAM_DECEL:
+    BL_set_decel( (uint8_t)pval[ PARAM_DECEL ] );
+    break;
+  case PARAM_VBATT_COMP:
+    BL_set_vbatt_comp( (uint8_t)pval[ PARAM_VBATT_COMP ] );
+    break;
+#if SPI_ENABLED == SPI_STM8_SLAVE
+  case PARAM_SPI_ADDR:
+    SPI_set_address( (uint8_t)pval[ PARAM_SPI_ADDR ] );
+    break;
+#endif
+  default:
+    break; // read where it is used (PARAM_V_SHUTDOWN)
+  }
+}
+
+
+/* Public functions ---------------------------------------------------------*/
+
+/**
+ * @brief  Load the parameters from data EEPROM, and apply them.
+ *
+ * @details  Called at startup, with the interrupts disabled. The record is
+ *  discarded if the format or the CRC do not match, and a parameter out of its
+ *  range is defaulted, as are both duty-cycle limits if the shutoff is not
+ *  below the startup. A record of a previous build with fewer parameters is
+ *  loaded, the added parameters are defaulted.
+ */
+void Param_load(void)
+{
+  uint8_t count = 0;
+  uint8_t n;
+
+  MCU_EEPROM_read( EE_PARAM_OFFS, (uint8_t *)&Record, PARAM_HDR_SZ );
+
+  if (PARAM_MAGIC == Record.magic && Record.count <= PARAM_NR)
+  {
+    uint8_t crc;
+
+    MCU_EEPROM_read( EE_PARAM_OFFS + PARAM_HDR_SZ,
+                     (uint8_t *)Record.val, PARAM_VAL_SZ( Record.count ) );
+    MCU_EEPROM_read( EE_PARAM_OFFS + PARAM_HDR_SZ + PARAM_VAL_SZ( Record.count ),
+                     &crc, 1 );
+
+    if ( crc == Telem_crc8( (const uint8_t *)&Record,
+                            PARAM_HDR_SZ + PARAM_VAL_SZ( Record.count ) ) )
+    {
+      count = Record.count;
+    }
+  }
+
+  for (n = 0; n < PARAM_NR; n++)
+  {
+    if ( n >= count || FALSE == param_in_range( (param_ID_t)n, Record.val[n] ) )
+    {
+      Record.val[n] = Param_desc[n].def;
+    }
+  }
+  if ( FALSE == dc_limits_valid( Record.val[ PARAM_DC_STARTUP ],
+                                 Record.val[ PARAM_DC_SHUTOFF ] ) )
+  {
+    Record.val[ PARAM_DC_STARTUP ] = Param_desc[ PARAM_DC_STARTUP ].def;
+    Record.val[ PARAM_DC_SHUTOFF ] = Param_desc[ PARAM_DC_SHUTOFF ].def;
+  }
+  for (n = 0; n < PARAM_NR; n++)
+  {
+    param_apply( (param_ID_t)n );
+  }
+  Commit_req = FALSE;
+}
+
+/**
+ * @brief  Accessor for a parameter.
+ *
+ * @details  Also called from the SPI ISR, the value is updated in a CS.
+ *
+ * @param  id  Parameter ID
+ * @return  Value, 0 if the ID is not valid
+ */
+uint16_t Param_get(param_ID_t id)
+{
+  return (id < PARAM_NR) ? Record.val[ id ] : 0;
+}
+
+/**
+ * @brief  Validate a value of a parameter against its range.
+ *
+ * @details  The duty-cycle limits are also checked against each other, the
+ *  shutoff has to be below the startup.
+ *
+ * @param  id   Parameter ID
+ * @param  val  Value
+ * @return  TRUE if the ID is valid and the value in range
+ */
+uint8_t Param_check(param_ID_t id, uint16_t val)
+{
+  if (id >= PARAM_NR || FALSE == param_in_range(id, val))
+  {
+    return FALSE;
+  }
+  if (PARAM_DC_STARTUP == id)
+  {
+    return dc_limits_valid( val, Record.val[ PARAM_DC_SHUTOFF ] );
+  }
+  if (PARAM_DC_SHUTOFF == id)
+  {
+    return dc_limits_valid( Record.val[ PARAM_DC_STARTUP ], val );
+  }
+  return TRUE;
+}
+
+/**
+ * @brief  Set a parameter, and apply it.
+ *
+ * @details  Called from the background task. The value and the module state
+ *  are updated in a CS as they are read in ISR context. The change is in
+ *  the RAM shadow only until Param_commit.
+ *
+ * @param  id   Parameter ID
+ * @param  val  Value
+ * @return  TRUE if set, FALSE if the ID is not valid or the value not in range
+ */
+uint8_t Param_set(param_ID_t id, uint16_t val)
+{
+  if (FALSE == Param_check(id, val))
+  {
+    return FALSE;
+  }
+  disableInterrupts();
+  Record.val[ id ] = val;
+  param_apply(id);
+  enableInterrupts();
+
+  return TRUE;
+}
+
+/**
+ * @brief  Request to write the parameters to data EEPROM.
+ *
+ * @details  The record is written by Param_save once the motor is stopped.
+ */
+void Param_commit(void)
+{
+  Commit_req = TRUE;
+}
+
+/**
+ * @brief  Write the parameters to data EEPROM if requested.
+ *
+ * @details  Blocking (EEPROM programming time is a few ms per byte), so expected
+ *  to be called from the background task only while the motor is not running.
+ *
+ * @return  TRUE if the record was written
+ */
+uint8_t Param_save(void)
+{
+  if (FALSE == Commit_req)
+  {
+    return FALSE;
+  }
+
+  Record.magic = PARAM_MAGIC;
+  Record.count = PARAM_NR;
+  Record.crc = Telem_crc8( (const uint8_t *)&Record, PARAM_HDR_SZ + PARAM_VAL_SZ( PARAM_NR ) );
+
+  // only the bytes that differ are programmed
+  MCU_EEPROM_write( EE_PARAM_OFFS, (const uint8_t *)&Record, PARAM_REC_SZ( PARAM_NR ) );
+
+  Commit_req = FALSE;
+
+  return TRUE;
+}
+
+/**@}*/ // defgroup
@@ -15,33 +15,27 @@
 
 /* Includes ------------------------------------------------------------------*/
 #include <stdio.h>
-#include <stddef.h> // NULL
 
 // app headers
 #include "mcu_stm8s.h"
+#include "cmd.h"
 #include "sequence.h"
 #include "bldc_sm.h"
 #include "faultm.h"
 #include "driver.h"
+#include "mdata.h"
+#include "param.h"
 #include "spi_stm8s.h"
+#include "isr_prof.h"
+#include "telem.h"
+#include "sched.h"
+#include "trace.h"
 
 
 /* Private defines -----------------------------------------------------------*/
 
 #define TRIM_DEFAULT  0 //
 
-// Threshold is set low enuogh that the machine doesn't stall
-// thru the lower speed transition into closed-loop control.
-// The fault can be tested by letting the spinning prop disc strike a flimsy
-// obstacle like a 3x5 index card.
-#if defined ( S105_DEV )
-//  Vcc==3.3v  33k/10k @ Vbatt==12.4v
-  #define V_SHUTDOWN_THR      0x0390    // experimentally determined @ 12.4v 
-#else
-  // applies presently only to the stm8s-Discovery, at 14.2v and ADCref == 5v
-  #define V_SHUTDOWN_THR      0x0340    // experimentally determined!
-#endif
-
 #define LOW_SPEED_THR       20     // turn off before low-speed low-voltage occurs
 
 
@@ -53,6 +47,20 @@ static void spd_plus(void);
 static void spd_minus(void);
 static void m_stop(void);
 static void set_ctlm(void);
+static void telem_toggle(void);
+static void fault_log_req(void);
+static void gov_toggle(void);
+static void param_list(void);
+static void param_next(void);
+static void param_inc(void);
+static void param_dec(void);
+static void param_commit(void);
+#if defined( TRACE_ENABLED )
+static void trace_req(void);
+#endif
+#ifdef ISR_PROFILE_ENABLED
+static void prof_req(void);
+#endif
 
 
 /* Public variables  ---------------------------------------------------------*/
@@ -74,6 +82,16 @@ enum
 #endif
   SPD_PLUS   = '.', //'>',
   SPD_MINUS  = ',', //'<',
+  PROF_DUMP  = 'p',
+  TELEM_TGL  = 't',
+  TRACE_DUMP = 'd',
+  FAULT_LOG  = 'f',
+  GOV_TGL    = 'g',
+  PARAM_LIST = 'l',
+  PARAM_NEXT = 'n',
+  PARAM_INC  = '+',
+  PARAM_DEC  = '-',
+  PARAM_WR   = 'w',
   M_STOP     = ' '  // one space character
 };
 
@@ -94,26 +112,58 @@ typedef struct
 
 /* Private variables ---------------------------------------------------------*/
 
-static uint16_t UI_pulse_dc;
-static uint16_t UI_pulse_perd;
 static uint16_t UI_pulse_dur;
 
 static uint16_t Analog_slider; // input var for 10-bit ADC conversions
 static uint8_t UI_Speed;       // speed setting (needs to be in terms of pcnt of servo position)
-static int8_t Digital_trim_switch; // trim switches have + and - extents
+static int16_t Digital_trim_switch; // trim switches have + and - extents
 
-static uint8_t TaskRdy;  // flag for timer interrupt for BG task timing
 
 static uint8_t Log_Level;
 
+static uint8_t Log_rate = 1; // debug line every n task periods
+
 static  uint16_t Vsystem; // persistent for averaging
 
+static Driver_status_t Status; // ISR state published at the task release
+
+static uint8_t Stop_req; // incremented to request stop/reset in the control task
+
+static uint8_t Telem_enabled; // binary telemetry frames replace the debug line
+
+static uint8_t Governor_enabled; // the speed setting is an RPM setpoint
+
+static uint8_t Param_sel; // parameter of the inc/dec keys
+
+static uint8_t Fault_log_req; // set by key handler, the log is printed outside of CS
+static faultm_event_t Fault_events[ FAULTM_NR_EVENTS ];
+
+#ifdef ISR_PROFILE_ENABLED
+static uint8_t Prof_dump_req; // set by key handler, the dump is printed outside of CS
+static isr_prof_t Prof_stats[ ISR_PROF_NR_IDS ];
+static sched_stat_t Sched_stats[ SCHED_NR_GROUPS ];
+#endif
+
 static const ui_key_handler_t ui_keyhandlers_tb[] =
 {
 //  {COMM_PLUS,  comm_plus},
 //  {COMM_MINUS, comm_minus},
   {SPD_PLUS,   spd_plus},
   {SPD_MINUS,  spd_minus},
+#ifdef ISR_PROFILE_ENABLED
+  {PROF_DUMP,  prof_req},
+#endif
+  {TELEM_TGL,  telem_toggle},
+  {FAULT_LOG,  fault_log_req},
+  {GOV_TGL,    gov_toggle},
+  {PARAM_LIST, param_list},
+  {PARAM_NEXT, param_next},
+  {PARAM_INC,  param_inc},
+  {PARAM_DEC,  param_dec},
+  {PARAM_WR,   param_commit},
+#if defined( TRACE_ENABLED )
+  {TRACE_DUMP, trace_req},
+#endif
   {M_STOP,     m_stop}
 };
 
@@ -134,14 +184,9 @@ static void dbg_println(int zrof)
 {
   static uint16_t Line_Count = 0;
   // whats going on with the prinf format specifiers when lvalues are cast and/or promoted?
-  int faults = (int)Faultm_get_status();
+  int faults = (int)Status.faults;
   int uispd = (int)UI_Speed;
 
-  char sbuf[80] ;                     // am i big enuff?
-
-// globals are accessed (read) outside of CS so be it
-  int16_t timing_error = Seq_get_timing_error();
-
   if ( 0 != zrof)
   {
     Line_Count  = 0;
@@ -150,58 +195,128 @@ static void dbg_println(int zrof)
   Line_Count  += 1;;
 
   printf(
-    "{%04X) UI=%X CT=%04X DC=%04X Vs=%04X SF=%X RC=%04X ERR=%04X \r\n",
+    "{%04X) UI=%X CT=%04X DC=%04X Vs=%04X IB=%04X SF=%X RC=%04X ERR=%04X TXD=%X RXD=%X \r\n",
     Line_Count,
     uispd,
-    get_commutation_period(),
-    BLDC_PWMDC_Get(),
+    Status.comm_period,
+    Status.pwm_dc,
     Vsystem,
+    Status.ibus,
     faults,
     UI_pulse_dur,
-    Seq_get_timing_error()
+    Status.timing_error,
+    MCU_get_UART_TX_drops(),
+    MCU_get_UART_RX_drops()
   );
 }
 
-//$0768 - $044A  = $031E
-#define RF_PCNT_ZERO   0x044A
-#define RF_PCNT_100    0x0768
-#define RF_RANGE       (RF_PCNT_100 - RF_PCNT_ZERO) // 0x031E // hardcode range of pulse
-#define RF_NORDO_THR   0x3000 // arbitrary 0x2BB0 -> 0x55C0 when receiving
+#ifdef ISR_PROFILE_ENABLED
+/**
+ * @brief Print the ISR profiling statistics to the debug serial port.
+ *
+ * @details One line per ISR: minimum, maximum and average (x8) execution time
+ *  in 1us counts, and count of nested entries, since previous dump.
+ */
+static void prof_println(void)
+{
+  static const char * const isr_names[ ISR_PROF_NR_IDS ] = { "COMM", "PWM", "ADC", "SPI" };
+  uint8_t n;
+
+  for (n = 0; n < ISR_PROF_NR_IDS; n++)
+  {
+    printf(
+      "[%s] MIN=%02X MAX=%02X AVG8=%04X NEST=%02X\r\n",
+      isr_names[n],
+      (int)Prof_stats[n].min,
+      (int)Prof_stats[n].max,
+      Prof_stats[n].avg8,
+      (int)Prof_stats[n].nest);
+  }
+  for (n = 0; n < SCHED_NR_GROUPS; n++)
+  {
+    printf(
+      "[G%d] WCET=%02X OVR=%d\r\n",
+      (int)n,
+      (int)Sched_stats[n].wcet,
+      (int)Sched_stats[n].overrun);
+  }
+}
+#endif
+
+/**
+ * @brief Print the fault event log to the debug serial port, newest first.
+ *
+ * @param  count  Number of entries in Fault_events
+ */
+static void fault_log_println(uint8_t count)
+{
+  uint8_t n;
+
+  for (n = 0; n < count; n++)
+  {
+    printf(
+      "!F ID=%02X T=%04X %s\r\n",
+      (int)Fault_events[n].faultm_ID,
+      Fault_events[n].tick,
+      (FALSE != Fault_events[n].set) ? "SET" : "CLR");
+  }
+}
+
+/**
+ * @brief Print a parameter to the debug serial port.
+ *
+ * @param  id  Parameter ID
+ */
+static void param_println(uint8_t id)
+{
+  printf(
+    "!P ID=%02X V=%04X%s\r\n",
+    (int)id,
+    Param_get( (param_ID_t)id ),
+    (id == Param_sel) ? " *" : "");
+}
+
+/**
+ * @brief Send one binary telemetry frame to the debug serial port.
+ */
+static void telem_send(void)
+{
+  telem_sample_t sample;
+
+  sample.comm_period = Status.comm_period;
+  sample.pwm_dc = Status.pwm_dc;
+  sample.vsystem = Vsystem;
+  sample.faults = Status.faults;
+  sample.bemf_r = Status.bemf_r;
+  sample.bemf_f = Status.bemf_f;
+  sample.timing_error = Status.timing_error;
+  sample.erpm10 = Status.erpm10;
+
+  Telem_send(&sample);
+}
+
 /*
  * Service the slider and trim inputs for speed setting.
  * The UI Speed value is a uint8 and represents the adjustment range of e.g. a
- * proportional RC radio control signal (eventually), and alternatively the
- * slider-pot (the developer h/w) - the UI Speed is passed to PWMDC_set() where
- * is expected to be rescaled to suite the range/precision required for PWM timer.
+ * proportional RC radio control signal, and alternatively the slider-pot (the
+ * developer h/w) - the UI Speed is passed to PWMDC_set() where is expected to
+ * be rescaled to suite the range/precision required for PWM timer.
+ * The servo/digital throttle input (throttle.c) bypasses the UI Speed, and is
+ * applied directly in the control task.
  *
  * TODO: rate limit of speed input!
  */
 static void set_ui_speed(void)
 {
-  uint16_t tmp_u16;
   int16_t tmp_sint16;
-  uint16_t adc_tmp16 = ADC1_GetBufferValue( ADC1_CHANNEL_3 ); // ISR safe ... hmmmm
+  uint16_t adc_tmp16 = Status.adc.ch[ ADC_SNAP_SLIDER ];
 #ifdef ANLG_SLIDER
   Analog_slider = adc_tmp16 / 4; // [ 0: 1023 ] -> [ 0: 255 ]
 #else
   Analog_slider = 0;
 #endif
 
-  UI_pulse_perd = Driver_get_pulse_perd();
-
-  UI_pulse_dur = Driver_get_pulse_dur();
-// lose 1 bit of precision here ....
-  tmp_u16 = ( UI_pulse_dur - RF_PCNT_ZERO ) >> 1;  //  /2
-
-//   scale factors ...     ( 1/2   +   1/2 )  /     (1/4)
-  UI_pulse_dc = (PWM_100PCNT>>1) * tmp_u16 / (RF_RANGE>>2);
-
-// if RF pulse qualified, then use it - needs more thought
-  if (UI_pulse_perd > RF_NORDO_THR)
-  {
-//	Analog_slider = UI_pulse_dc;
-  }
-
+  UI_pulse_dur = Status.pulse_dur;
 
 // careful with expression containing signed int ... UI Speed is defaulted
 // to 0 and only assign from temp sum if positive and clip to INT8 MAX S8.
@@ -227,8 +342,8 @@ static void set_ui_speed(void)
  */
 void UI_Stop(void)
 {
-// reset the machine
-  BL_reset();
+// reset the machine (in the control task, at the next command)
+  Stop_req += 1;
 }
 #if 0
 /*
@@ -261,10 +376,80 @@ static void m_stop(void)
   dbg_println(1 /* clear line count */ );
 }
 
+#ifdef ISR_PROFILE_ENABLED
+static void prof_req(void)
+{
+  Prof_dump_req = TRUE;
+}
+#endif
+
+// toggle from text log to binary telemetry
+static void telem_toggle(void)
+{
+  Telem_enabled = !Telem_enabled;
+}
+
+// toggle the speed setting from duty-cycle to RPM setpoint (governor)
+static void gov_toggle(void)
+{
+  Governor_enabled = !Governor_enabled;
+}
+
+// print the fault event log
+static void fault_log_req(void)
+{
+  Fault_log_req = TRUE;
+}
+
+// print all parameters, the selected one is marked
+static void param_list(void)
+{
+  uint8_t n;
+
+  for (n = 0; n < PARAM_NR; n++)
+  {
+    param_println(n);
+  }
+}
+
+// select the parameter of the inc/dec keys
+static void param_next(void)
+{
+  Param_sel = (uint8_t)( ( Param_sel + 1 ) % PARAM_NR );
+  param_println(Param_sel);
+}
+
+// step the selected parameter, within its range
+static void param_inc(void)
+{
+  (void)Param_set( (param_ID_t)Param_sel, Param_get( (param_ID_t)Param_sel ) + 1 );
+  param_println(Param_sel);
+}
+
+static void param_dec(void)
+{
+  (void)Param_set( (param_ID_t)Param_sel, Param_get( (param_ID_t)Param_sel ) - 1 );
+  param_println(Param_sel);
+}
+
+// save the parameters to EEPROM, once the motor is stopped
+static void param_commit(void)
+{
+  Param_commit();
+}
+
+#if defined( TRACE_ENABLED )
+// dump of the trace buffer (frozen on fault, or now)
+static void trace_req(void)
+{
+  Trace_dump_req();
+}
+#endif
+
 static void spd_plus(void)
 {
   // if fault/throttle-high ... diag msg?
-  if (Digital_trim_switch < S8_MAX)
+  if (Digital_trim_switch < U8_MAX)
   {
     Digital_trim_switch += 1;
   }
@@ -273,35 +458,111 @@ static void spd_plus(void)
 static void spd_minus(void)
 {
   // if fault/throttle-high ... diag msg?
-  if (Digital_trim_switch > S8_MIN)
+  if (Digital_trim_switch > -U8_MAX)
   {
     Digital_trim_switch -= 1;
     Log_Level = 1;
   }
 }
 
-static ui_handlrp_t handle_term_inp(void)
+/*
+ * Execute a command line, the reply is printed here as for the keys
+ */
+static void cmd_exec(const cmd_t * pcmd)
 {
-  ui_handlrp_t fp = NULL;
+  uint8_t ok = TRUE;
+
+  switch (pcmd->code)
+  {
+  case 'T': // throttle [0:255], replaces the trim switch setting
+    ok = (uint8_t)( 1 == pcmd->argc && pcmd->argv[0] <= U8_MAX );
+    if (TRUE == ok)
+    {
+      Digital_trim_switch = (int16_t)pcmd->argv[0];
+    }
+    break;
+  case 'S': // stop
+    m_stop();
+    break;
+  case 'P': // list, get (id) or set (id value) a parameter
+    if (0 == pcmd->argc)
+    {
+      param_list();
+    }
+    else if (pcmd->argv[0] >= PARAM_NR)
+    {
+      ok = FALSE;
+    }
+    else if (2 == pcmd->argc)
+    {
+      ok = Param_set( (param_ID_t)pcmd->argv[0], pcmd->argv[1] );
+    }
+    if (TRUE == ok && 0 != pcmd->argc)
+    {
+      param_println( (uint8_t)pcmd->argv[0] );
+    }
+    break;
+  case 'W': // save the parameters
+    Param_commit();
+    break;
+#if defined( TRACE_ENABLED )
+  case 'D': // dump of the trace buffer
+    Trace_dump_req();
+    break;
+#endif
+  case 'L': // debug line every n task periods, 0 to stop the logger output
+    ok = (uint8_t)( 1 == pcmd->argc && pcmd->argv[0] <= U8_MAX );
+    if (TRUE == ok)
+    {
+      Log_rate = (uint8_t)pcmd->argv[0];
+      Log_Level = (0 != Log_rate) ? 255 : 0;
+    }
+    break;
+  default:
+    ok = FALSE;
+    break;
+  }
+  printf( (TRUE == ok) ? "!OK\r\n" : "!ERR\r\n" );
+}
+
+/*
+ * Service all the characters received since the previous task period, a
+ * command line may span several task periods.
+ */
+static void handle_term_inp(void)
+{
+  cmd_t cmd;
   char key;
 
-  if (SerialKeyPressed(&key))
+  while (SerialKeyPressed(&key))
   {
-    int n;
-    for (n = 0; n < _SIZE_K_LUT ; n++)
+    cmd_status_t status = Cmd_input(key, &cmd);
+
+    if (CMD_READY == status)
     {
-      if (key == _GET_KEY_CODE( n ))
+      cmd_exec(&cmd);
+    }
+    else if (CMD_ERROR == status)
+    {
+      printf("!ERR\r\n");
+    }
+    else if (CMD_KEY == status)
+    {
+      int n;
+// anykey ... (before the handler, which may set its own log level)
+      Log_Level = 255;// default anykey enable continous/verbous log
+
+      for (n = 0; n < _SIZE_K_LUT ; n++)
       {
-//any terminal output specific to the key or handelr need to be done here and
-// not in the handler itself because the handler is to be called from w/i the CS
-        fp =_GET_UI_HDLRP( n );
-        break;
+        if (key == _GET_KEY_CODE( n ))
+        {
+// called before the command is published, a parameter key also sets the parameter (Param_set, in a CS)
+          _GET_UI_HDLRP( n )();
+          break;
+        }
       }
     }
-// anykey ...
-    Log_Level = 255;// default anykey enable continous/verbous log
   }
-  return fp;
 }
 
 /**
@@ -313,46 +574,149 @@ static ui_handlrp_t handle_term_inp(void)
 static void Periodic_task(void)
 {
   BL_RUNSTATE_t bl_state;
+  Driver_command_t cmd;
+
+  // the key and command handlers modify the UI state, except a parameter set
+  // (the parameter keys and :P), where Param_set takes its own CS
+  handle_term_inp();
 
-// invoke the terminal input and ui speed subs, updates from their globals to occur in the CS
-  ui_handlrp_t fp = handle_term_inp();
+  // consistent copy of ISR state, without masking the interrupts
+  Driver_get_status(&Status);
 
-  disableInterrupts();  //////////////// DI
+  // update the UI speed input slider+trim
+  set_ui_speed();
 
-  if (NULL != fp)
+#if SPI_ENABLED == SPI_STM8_SLAVE
+  // the flight-controller link overrides the local UI while in run mode, the
+  // throttle is applied in the control task (BLDC_Update)
   {
-    fp();
+    SPI_publish_status(&Status);
+
+    if (TRUE == SPI_is_fault_clr())
+    {
+      UI_Stop();
+    }
+    {
+      uint8_t id;
+      uint16_t val;
+
+      if (TRUE == SPI_get_param_write(&id, &val))
+      {
+        (void)Param_set( (param_ID_t)id, val );
+      }
+    }
+    if (TRUE == SPI_is_param_commit())
+    {
+      Param_commit();
+    }
   }
+#elif SPI_ENABLED == SPI_STM8_MASTER
+  // the peripherals on the bus follow the local speed setting
+  {
+    uint8_t addr;
 
-  // update the UI speed input slider+trim
-  set_ui_speed();
+    for (addr = 0; addr < SPI_BUS_NR_ESC; addr++)
+    {
+      SPI_bus_set_throttle(addr, UI_Speed);
+    }
+    SPI_bus_set_mode(SPI_MODE_RUN);
+  }
+#endif
+
+  cmd.dc = UI_Speed;
+  cmd.stop_req = Stop_req;
+  cmd.governor = Governor_enabled;
+  Driver_set_command(&cmd);
+
+  bl_state = (BL_RUNSTATE_t)Status.run_state;
+
+  Vsystem = Status.vbatt;
+
+#ifdef ISR_PROFILE_ENABLED
+  if (0 != Prof_dump_req)
+  {
+    // the statistics are copied in the CS and restarted from the dump
+    disableInterrupts();
+    Isr_prof_get(Prof_stats);
+    Isr_prof_reset();
+    Sched_get_stats(Sched_stats);
+    Sched_reset();
+    enableInterrupts();
+
+    Prof_dump_req = FALSE;
+    prof_println();
+  }
+#endif
 
-  BLDC_PWMDC_Set(UI_Speed);
+  if (0 != Fault_log_req)
+  {
+    uint8_t count;
 
-  bl_state = BL_get_state();
+    // the log is copied in the CS, faults are logged from the ISRs
+    disableInterrupts();
+    count = Faultm_get_events(Fault_events);
+    enableInterrupts();
 
-  Vsystem = Seq_Get_Vbatt();
+    Fault_log_req = FALSE;
+    fault_log_println(count);
+  }
 
-  enableInterrupts();  ///////////////// EI EI O
+  // learned timing and the committed parameters are written to EEPROM once stopped
+  if (BL_NOT_RUNNING == bl_state)
+  {
+    Save_OL_Timing();
+
+    if (TRUE == Param_save())
+    {
+      printf("!P SAVED\r\n");
+    }
+  }
 
 #if defined( UNDERVOLTAGE_FAULT_ENABLED )
   // update system voltage diagnostic - check plausibilty of Vsys
   if (BL_IS_RUNNING == bl_state  && Vsystem > 0  )
   {
-    Faultm_upd(VOLTAGE_NG, (faultm_assert_t)( Vsystem < V_SHUTDOWN_THR) );
+    // the fault manager is shared with the ISRs
+    disableInterrupts();
+    Faultm_upd(VOLTAGE_NG, (faultm_assert_t)( Vsystem < Param_get( PARAM_V_SHUTDOWN ) ) );
+    enableInterrupts();
   }
 #endif
   /*
    * debug logging to terminal
    */
-  if (Log_Level > 0)
+#if defined( TRACE_ENABLED )
+  if (TRUE == Trace_dump_line())
+  {
+    // the trace dump has the terminal until it is complete
+  }
+  else
+#endif
+  if (0 != Telem_enabled)
+  {
+    static uint8_t telem_div = 0;
+
+    if (++telem_div >= TELEM_RATE_DIV)
+    {
+      telem_div = 0;
+      telem_send();
+    }
+  }
+  else if (Log_Level > 0)
   {
-    // if log level less than <threshold> then decrement the count
-    if (Log_Level < 255)
+    static uint8_t log_div = 0;
+
+    if (++log_div >= Log_rate)
     {
-      Log_Level -= 1;
+      log_div = 0;
+
+      // if log level less than <threshold> then decrement the count
+      if (Log_Level < 255)
+      {
+        Log_Level -= 1;
+      }
+      dbg_println(0);
     }
-    dbg_println(0);
   }
 }
 
@@ -360,44 +724,28 @@ static void Periodic_task(void)
  * @brief  Run Periodic Task if ready
  *
  * @details
- * Called in non-ISR context - checks the background task ready flag which if !0
- * will invoke the Periodic Task function.
+ * Called in non-ISR context - polls the background rate groups of the
+ * scheduler, the UI task is at ~60 Hz and the SPI master at ~30 Hz (the SPI
+ * peripheral is serviced in the SPI ISR).
  * @note  Referred to as Pertask_chk_ready
- * @return  True if task ran (allows caller to also sync w/ the time period)
+ * @return  True if task ran (allows caller to also sync w/ the time period),
+ *  else the caller may wait for the next interrupt
  */
 uint8_t Task_Ready(void)
 {
-  static uint8_t framecount = 0;
-
-  if (0 != TaskRdy)
-  {
-    TaskRdy = FALSE;
-    Periodic_task();
-
-// periodic task is enabled at ~60 Hz ... the modulus provides a time reference of
-// approximately 2 Hz at which time the master attempts to read a few bytes from SPI
-
-    if ( ! ((framecount++) % 0x20) )
-    {
 #if SPI_ENABLED == SPI_STM8_MASTER
-      SPI_controld();
+  // the master broadcasts the throttles and polls a register of a peripheral
+  if ( TRUE == Sched_is_ready(SCHED_SPI) )
+  {
+    SPI_controld();
+  }
 #endif
-    }
+  if ( TRUE == Sched_is_ready(SCHED_UI) )
+  {
+    Periodic_task();
     return TRUE;
   }
   return FALSE;
 }
 
-/**
- * @brief  Trigger background task.
- *
- * @details
- * Called in ISR context - sets the background task ready flag which when seen
- * by polling Task_Ready in background task will invoke the Periodic Task function.
- */
-void Periodic_Task_Wake(void)
-{
-  TaskRdy = TRUE; // notify background process
-}
-
 /**@}*/ // defgroup
@@ -44,15 +44,58 @@
 
 /* Private defines -----------------------------------------------------------*/
 
+// Q8 scale of the nominal duty-cycle to the timer period of a PWM rate
+#define PWM_SCALE_Q8( _PD_ )  (uint16_t)( ( (uint32_t)(_PD_) << 8 ) / TIM2_PWM_PD )
+
+// complementary brake: the low and high side are on for half of each PWM cycle
+// (the high side is not held on, so the IR2104 bootstrap stays charged)
+#define PWM_BRAKE_DC  ( TIM2_PWM_PD / 2 )
+
 
 /* Private types -----------------------------------------------------------*/
 
+/*
+ * The update ISR rate (i.e. the scheduler tick) is kept the same at all PWM
+ * rates by the number of PWM cycles per update.
+ */
+typedef struct
+{
+  uint16_t period;  // timer period
+  uint8_t  frames;  // PWM cycles per update (Driver_Update)
+  uint16_t scale;   // PWM_SCALE_Q8( period )
+} PWM_rate_desc_t;
+
 
 /* Public variables  ---------------------------------------------------------*/
 
 
 /* Private variables ---------------------------------------------------------*/
-static uint16_t global_uDC;
+
+static const PWM_rate_desc_t PWM_rate_tbl[ PWM_NR_RATES ] =
+{
+  { TIM2_PWM_PD,           PWM_FRAMES_PER_UPD,           PWM_SCALE_Q8( TIM2_PWM_PD ) },
+  { TIM2_PWM_PD * 2 / 3,   PWM_FRAMES_PER_UPD * 3 / 2,   PWM_SCALE_Q8( TIM2_PWM_PD * 2 / 3 ) },
+  { TIM2_PWM_PD / 2,       PWM_FRAMES_PER_UPD * 2,       PWM_SCALE_Q8( TIM2_PWM_PD / 2 ) }
+};
+
+static const PWM_rate_desc_t * PWM_prate = &PWM_rate_tbl[ PWM_RATE_X1 ];
+
+static uint16_t global_uDC;     // compare value at the present rate
+static uint16_t global_nom_DC;  // duty-cycle in counts of the nominal period
+
+// all phases floating, PWM channels disabled
+static const PWM_comm_state_t all_phase_off_state =
+  PWM_COMM_STATE( PWM_PH_NONE, PWM_PH_NONE );
+
+// all phases at the same potential i.e. the windings are shorted
+static const PWM_comm_state_t brake_lowside_state =
+  PWM_COMM_STATE( PWM_PH_NONE, PWM_PH_A | PWM_PH_B | PWM_PH_C );
+
+static const PWM_comm_state_t brake_compl_state =
+  PWM_COMM_STATE( PWM_PH_A | PWM_PH_B | PWM_PH_C, PWM_PH_NONE );
+
+// the state last written, for the restore of a pulse that has been cut
+static const PWM_comm_state_t * PWM_pstate = &all_phase_off_state;
 
 
 /* Private function prototypes -----------------------------------------------*/
@@ -61,33 +104,212 @@ static uint16_t global_uDC;
 
 /* Public functions ---------------------------------------------------------*/
 
+/**
+ * @brief  Get the PWM rate.
+ */
+PWM_rate_t PWM_get_rate(void)
+{
+    return (PWM_rate_t)( PWM_prate - PWM_rate_tbl );
+}
+
+/**
+ * @brief  Get the number of PWM cycles per update ISR at the present rate.
+ */
+uint8_t PWM_get_frames_per_upd(void)
+{
+    return PWM_prate->frames;
+}
+
 /**
  * @brief Turn off PWM and disable all 3 phases.
  */
 void All_phase_stop(void)
 {
 // kill the driver signals
-    PWM_PhA_Disable();
-    PWM_PhA_HB_DISABLE();
+    PWM_set_comm_state( &all_phase_off_state );
+}
+
+/**
+ * @brief  Apply the brake, or turn off all 3 phases.
+ *
+ * @details  Called from the control task while the motor is stopped. The
+ *  output state is only written on a change. The complementary brake sets the
+ *  duty-cycle, which the control task leaves to it while the brake is engaged.
+ *
+ * @param  brake  BRAKE_NONE, BRAKE_LOWSIDE or BRAKE_COMPL
+ */
+void PWM_set_brake(uint8_t brake)
+{
+    const PWM_comm_state_t * pstate = &all_phase_off_state;
+
+    if (BRAKE_COMPL == brake)
+    {
+        pstate = &brake_compl_state;
+    }
+    else if (BRAKE_LOWSIDE == brake)
+    {
+        pstate = &brake_lowside_state;
+    }
+
+    if (pstate != PWM_pstate)
+    {
+        if (BRAKE_COMPL == brake)
+        {
+            set_dutycycle( PWM_BRAKE_DC );
+        }
+        PWM_set_comm_state( pstate );
+    }
+}
+
+/**
+ * @brief  Write the commutation output state.
+ *
+ * @details  Called from the commutation ISR. The state is written with direct
+ *  register stores: first the PWM timer channel enables (PWM is switched off
+ *  from the previously PWM'd phase and on to the new HI phase) followed by the
+ *  /SD inputs of the IR2104 (the new floating phase is disabled and the LO phase
+ *  is enabled). The LO phase pin reverts to GPIO output (driven low) once its
+ *  timer channel is disabled, so there is no further pin configuration needed here.
+ *
+ * @param  pstate  Pointer to the precomputed state of the commutation sector.
+ */
+void PWM_set_comm_state(const PWM_comm_state_t * pstate)
+{
+    PWM_pstate = pstate;
+
+    PWM_TIMER_CCER1 = pstate->ccer1;
+    PWM_TIMER_CCER2 = pstate->ccer2;
+
+    SD_PORT_0->ODR = (uint8_t)( ( SD_PORT_0->ODR & ~SD_PORT_0_MSK ) | pstate->sd_odr[0] );
+#if SD_NR_PORTS > 1
+    SD_PORT_1->ODR = (uint8_t)( ( SD_PORT_1->ODR & ~SD_PORT_1_MSK ) | pstate->sd_odr[1] );
+#endif
+#if SD_NR_PORTS > 2
+    SD_PORT_2->ODR = (uint8_t)( ( SD_PORT_2->ODR & ~SD_PORT_2_MSK ) | pstate->sd_odr[2] );
+#endif
+}
 
-    PWM_PhB_Disable();
-    PWM_PhB_HB_DISABLE();
+/**
+ * @brief  Cut the PWM pulse (current limit).
+ *
+ * @details  Called from the ADC ISR. The timer channels are disabled so the
+ *  PWM'd phase is driven LO for the rest of the PWM cycle, the /SD inputs are
+ *  not changed i.e. the current recirculates in the low side as in the PWM
+ *  off-time.
+ */
+void PWM_cut_pulse(void)
+{
+    PWM_TIMER_CCER1 = PWM_CCER1_BASE;
+    PWM_TIMER_CCER2 = PWM_CCER2_BASE;
+}
 
-    PWM_PhC_Disable();
-    PWM_PhC_HB_DISABLE();
+/**
+ * @brief  Restore the PWM pulse of the present output state.
+ *
+ * @details  Called from the ADC ISR, the PWM cycle following the cut.
+ */
+void PWM_restore_pulse(void)
+{
+    PWM_TIMER_CCER1 = PWM_pstate->ccer1;
+    PWM_TIMER_CCER2 = PWM_pstate->ccer2;
 }
 
 /** @cond */ // hide the low-level code
 
-void set_dutycycle(uint16_t global_dutycycle)
+/*
+ * The PWM pins are configured as GPIO output low, which is the pin state when
+ * the timer channel is disabled (i.e. the phase is driven LO when its /SD is
+ * enabled). This only has to be done once.
+ */
+static void PWM_pins_setup(void)
 {
+    PWM_PhA_OUTP_LO();
+    PWM_PhB_OUTP_LO();
+    PWM_PhC_OUTP_LO();
+}
+
+/*
+ * The duty-cycle is written to the compare registers of all 3 channels so that
+ * the commutation step only has to switch the channel enables. The duty-cycle
+ * is in counts of the nominal period (TIM2_PWM_PD) and is rescaled to the
+ * period of the present PWM rate.
+ */
+void set_dutycycle(uint16_t nom_dutycycle)
+{
+    uint16_t global_dutycycle = (uint16_t)( nom_dutycycle * PWM_prate->scale ) >> 8;
+
+    global_nom_DC = nom_dutycycle;
     global_uDC = global_dutycycle;
+
+    BOARD_SET_REG16( PWM_CCRH_A, PWM_CCRL_A, global_dutycycle );
+    BOARD_SET_REG16( PWM_CCRH_B, PWM_CCRL_B, global_dutycycle );
+    BOARD_SET_REG16( PWM_CCRH_C, PWM_CCRL_C, global_dutycycle );
+}
+
+/*
+ * The period (and repetition counter) are preloaded i.e. take effect at the
+ * update event.
+ */
+void PWM_set_rate(PWM_rate_t rate)
+{
+    PWM_prate = &PWM_rate_tbl[ rate ];
+
+    BOARD_SET_REG16( PWM_TIM->ARRH, PWM_TIM->ARRL, PWM_prate->period );
+#if defined( ADC_HW_TRIGGER )
+    // the repetition counter is TIM1 only, as is the ADC trigger (see board.h)
+    PWM_TIM->RCR = (uint8_t)( PWM_prate->frames - 1 );
+#endif
+
+    set_dutycycle( global_nom_DC );
+}
+
+/*
+ * Operate the PWM timer channel of each phase (the /SD inputs to IR2104 are
+ * left as they are)
+ */
+void PWM_PhA_Disable(void)
+{
+    PWM_TIMER_CCER1 &= (uint8_t)~PWM_CCER1_A;
+    PWM_TIMER_CCER2 &= (uint8_t)~PWM_CCER2_A;
+}
+
+void PWM_PhB_Disable(void)
+{
+    PWM_TIMER_CCER1 &= (uint8_t)~PWM_CCER1_B;
+    PWM_TIMER_CCER2 &= (uint8_t)~PWM_CCER2_B;
+}
+
+void PWM_PhC_Disable(void)
+{
+    PWM_TIMER_CCER1 &= (uint8_t)~PWM_CCER1_C;
+    PWM_TIMER_CCER2 &= (uint8_t)~PWM_CCER2_C;
+}
+
+void PWM_PhA_Enable(void)
+{
+    BOARD_SET_REG16( PWM_CCRH_A, PWM_CCRL_A, global_uDC );
+    PWM_TIMER_CCER1 |= PWM_CCER1_A;
+    PWM_TIMER_CCER2 |= PWM_CCER2_A;
+}
+
+void PWM_PhB_Enable(void)
+{
+    BOARD_SET_REG16( PWM_CCRH_B, PWM_CCRL_B, global_uDC );
+    PWM_TIMER_CCER1 |= PWM_CCER1_B;
+    PWM_TIMER_CCER2 |= PWM_CCER2_B;
+}
+
+void PWM_PhC_Enable(void)
+{
+    BOARD_SET_REG16( PWM_CCRH_C, PWM_CCRL_C, global_uDC );
+    PWM_TIMER_CCER1 |= PWM_CCER1_C;
+    PWM_TIMER_CCER2 |= PWM_CCER2_C;
 }
 
 /*
  * The S105 dev board unfortunately does not let the TIM2 CH3 pin (unless by alt. fundtion)
  */
-#if defined ( S105_DISCOVERY ) || defined ( S003_DEV )
+#if BOARD_PWM_TIM == 2
 
 /*
  * Setup TIM2 PWM
@@ -99,10 +321,6 @@ void set_dutycycle(uint16_t global_dutycycle)
 #define TIM2_PRESCALER TIM2_PRESCALER_4  //    (1/8Mhz)  * 4 * 250 -> 0.000125 S
 #endif
 
-#define PWM_TIMER_CHAN_A  TIM2_CHANNEL_1
-#define PWM_TIMER_CHAN_B  TIM2_CHANNEL_2
-#define PWM_TIMER_CHAN_C  TIM2_CHANNEL_3
-
 void PWM_setup(void)
 {
 /* TIM2 Peripheral Configuration */
@@ -122,50 +340,17 @@ void PWM_setup(void)
   TIM2_OC3Init(TIM2_OCMODE_PWM2, TIM2_OUTPUTSTATE_ENABLE, 0, TIM2_OCPOLARITY_LOW );
 //  TIM2_OC3PreloadConfig(ENABLE);
 
-  /* Enables TIM2 peripheral Preload register on ARR */
-//  TIM2_ARRPreloadConfig(ENABLE);
+  /* Enables TIM2 peripheral Preload register on ARR (PWM rate change at update) */
+  TIM2_ARRPreloadConfig(ENABLE);
 
   TIM2_ITConfig(TIM2_IT_UPDATE, ENABLE);  // for triggering ADC capture
   TIM2_Cmd(ENABLE);
-}
-
-/*
- * Operate /SD inputs to IR2104
- */
-void PWM_PhA_Disable(void)
-{
-    TIM2_CCxCmd( PWM_TIMER_CHAN_A, DISABLE );
-}
-
-void PWM_PhB_Disable(void)
-{
-    TIM2_CCxCmd( PWM_TIMER_CHAN_B, DISABLE );
-}
-
-void PWM_PhC_Disable(void)
-{
-    TIM2_CCxCmd( PWM_TIMER_CHAN_C, DISABLE );
-}
-
-void PWM_PhA_Enable(void)
-{
-    TIM2_SetCompare1( global_uDC );
-    TIM2_CCxCmd( PWM_TIMER_CHAN_A, ENABLE );
-}
-
-void PWM_PhB_Enable(void)
-{
-    TIM2_SetCompare2( global_uDC );
-    TIM2_CCxCmd( PWM_TIMER_CHAN_B, ENABLE );
-}
 
-void PWM_PhC_Enable(void)
-{
-    TIM2_SetCompare3( global_uDC );
-    TIM2_CCxCmd( PWM_TIMER_CHAN_C, ENABLE );
+  PWM_pins_setup();
+  All_phase_stop();
 }
 
-#elif defined ( S105_DEV )
+#elif BOARD_PWM_TIM == 1
 
 #ifdef CLOCK_16
 #define TIM1_PRESCALER 8  //    (1/16Mhz) * 8 * 250 -> 0.000125 S
@@ -175,10 +360,6 @@ void PWM_PhC_Enable(void)
 
 #define PWM_MODE  TIM1_OCMODE_PWM2
 
-#define PWM_TIMER_CHAN_A  TIM1_CHANNEL_2
-#define PWM_TIMER_CHAN_B  TIM1_CHANNEL_3
-#define PWM_TIMER_CHAN_C  TIM1_CHANNEL_4
-
 void PWM_setup(void)
 {
     const uint16_t T1_Period = TIM2_PWM_PD;  // 16-bit counter
@@ -189,7 +370,27 @@ void PWM_setup(void)
 /*
  * The counter clock frequency fCK_CNT is equal to fCK_PSC / (PSCR[15:0]+1)  (RM0016)
  */
+#if defined( ADC_HW_TRIGGER )
+/*
+ * Repetition counter divides the update ISR to the Driver_Update rate, the ADC
+ * is started every PWM cycle by the TRGO i.e. no ISR involved.
+ */
+    TIM1_TimeBaseInit(( TIM1_PRESCALER - 1 ), TIM1_COUNTERMODE_UP, T1_Period, ( PWM_FRAMES_PER_UPD - 1 ));
+
+    /* Channel 1 (no output) rising edge of OC1REF at ADC_TRIG_POINT is the TRGO */
+    TIM1_OC1Init( TIM1_OCMODE_PWM2,
+                  TIM1_OUTPUTSTATE_DISABLE,
+                  TIM1_OUTPUTNSTATE_DISABLE,
+                  ADC_TRIG_POINT,
+                  TIM1_OCPOLARITY_HIGH,
+                  TIM1_OCNPOLARITY_HIGH,
+                  TIM1_OCIDLESTATE_RESET,
+                  TIM1_OCNIDLESTATE_RESET);
+
+    TIM1_SelectOutputTrigger(TIM1_TRGOSOURCE_OC1REF);
+#else
     TIM1_TimeBaseInit(( TIM1_PRESCALER - 1 ), TIM1_COUNTERMODE_UP, T1_Period, 0); // ISR at and of "idle" time
+#endif
 
     /* Channel 2 PWM configuration */
     TIM1_OC2Init( PWM_MODE,
@@ -220,46 +421,17 @@ void PWM_setup(void)
 
     TIM1_CtrlPWMOutputs(ENABLE);
 
-    TIM1_ITConfig(TIM1_IT_UPDATE, ENABLE);  // for triggering ADC capture
-    TIM1_Cmd(ENABLE);
-}
-/**
- * Control /SD inputs to IR2104
- */
-void PWM_PhA_Disable(void)
-{
-    TIM1_CCxCmd( PWM_TIMER_CHAN_A, DISABLE );
-}
+    /* Preload register on ARR (PWM rate change at update) */
+    TIM1_ARRPreloadConfig(ENABLE);
 
-void PWM_PhB_Disable(void)
-{
-    TIM1_CCxCmd( PWM_TIMER_CHAN_B, DISABLE );
-}
-
-void PWM_PhC_Disable(void)
-{
-    TIM1_CCxCmd( PWM_TIMER_CHAN_C, DISABLE );
-}
-
-void PWM_PhA_Enable(void)
-{
-    TIM1_SetCompare2( global_uDC );
-    TIM1_CCxCmd( PWM_TIMER_CHAN_A, ENABLE );
-}
-
-void PWM_PhB_Enable(void)
-{
-    TIM1_SetCompare3( global_uDC );
-    TIM1_CCxCmd( PWM_TIMER_CHAN_B, ENABLE );
-}
+    TIM1_ITConfig(TIM1_IT_UPDATE, ENABLE);  // for triggering ADC capture (or only Driver_Update)
+    TIM1_Cmd(ENABLE);
 
-void PWM_PhC_Enable(void)
-{
-    TIM1_SetCompare4( global_uDC );
-    TIM1_CCxCmd( PWM_TIMER_CHAN_C, ENABLE );
+    PWM_pins_setup();
+    All_phase_stop();
 }
 
-#endif // S105
+#endif // BOARD_PWM_TIM
 
 /** @endcond */
 
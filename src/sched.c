@@ -0,0 +1,208 @@
+/**
+  ******************************************************************************
+  * @file sched.c
+  * @brief Static rate-group scheduler
+  * @author Neidermeier
+  * @version
+  * @date
+  ******************************************************************************
+  */
+/**
+ * \defgroup sched Scheduler
+ * @brief Static rate-group scheduler
+ * @{
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stddef.h> // NULL
+#include "sched.h"
+#include "mcu_stm8s.h"
+#include "bldc_sm.h"
+#include "driver.h"
+
+/* Private types -------------------------------------------------------------*/
+
+/*
+ * A group is released when ( tick & ( period - 1 ) ) == phase, so the period
+ * must be a power of 2 (no modulus in the ISR). The ISR part of the group (if
+ * any) runs at the release, a background part polls Sched_is_ready().
+ */
+typedef struct
+{
+  uint16_t period;
+  uint16_t phase;
+  void (*task)(void);  // ISR part, or NULL
+  uint8_t bg;          // has a background part
+} sched_cfg_t;
+
+
+/* Private function prototypes -----------------------------------------------*/
+
+static void comm_update(void);
+static void ui_update(void);
+
+
+/* Private defines -----------------------------------------------------------*/
+
+// the tick is the PWM update ISR i.e. every PWM_FRAMES_PER_UPD PWM cycles (0.5 ms)
+#ifdef CLOCK_16
+  #define UI_PERIOD   32   // 16 Mhz sysclock
+#else
+  #define UI_PERIOD   16   // 8 Mhz sysclock
+#endif
+
+
+/* Private variables ---------------------------------------------------------*/
+
+/*
+ * Rate group table. The control group is on the odd ticks and the UI and SPI
+ * groups on (different) even ticks, so that no tick runs the control task and
+ * also releases a background task.
+ */
+static const sched_cfg_t Sched_tbl[ SCHED_NR_GROUPS ] =
+{
+  {         1,  0, comm_update, FALSE }, // SCHED_COMM
+  {         2,  1, BLDC_Update, FALSE }, // SCHED_CTRL
+  { UI_PERIOD,  0, ui_update,   TRUE  }, // SCHED_UI
+  {        64,  8, NULL,        TRUE  }, // SCHED_SPI
+};
+
+static uint16_t Sched_ticks;
+
+static uint8_t Sched_ready[ SCHED_NR_GROUPS ];
+
+static sched_stat_t Sched_stats[ SCHED_NR_GROUPS ];
+
+
+/* Private functions ---------------------------------------------------------*/
+
+/*
+ * update the commutation switch timer period
+ */
+static void comm_update(void)
+{
+  Driver_set_comm_period( get_commutation_period() );
+}
+
+/*
+ * the UI task runs in the background on the state published at its release,
+ * the LED is just a heartbeat
+ */
+static void ui_update(void)
+{
+  Driver_publish_status();
+
+  BOARD_LED_TOGGLE();
+}
+
+
+/* Public functions ---------------------------------------------------------*/
+
+/**
+ * @brief  Scheduler tick.
+ *
+ * @details  Called from the PWM timer ISR (Driver_Update). Releases the rate
+ *  groups that are due in this tick and runs their ISR part.
+ */
+void Sched_tick(void)
+{
+  const sched_cfg_t * pcfg = Sched_tbl;
+  uint8_t n;
+
+  for (n = 0; n < SCHED_NR_GROUPS; n++, pcfg++)
+  {
+    if ( pcfg->phase == ( Sched_ticks & ( pcfg->period - 1 ) ) )
+    {
+      if (0 != Sched_ready[n])
+      {
+        Sched_stats[n].overrun = TRUE;
+      }
+      Sched_ready[n] = TRUE;
+
+      if (NULL != pcfg->task)
+      {
+#ifdef ISR_PROFILE_ENABLED
+        uint8_t t0 = TIM4->CNTR;
+        uint8_t dt;
+#endif
+        pcfg->task();
+#ifdef ISR_PROFILE_ENABLED
+        dt = (uint8_t)(TIM4->CNTR - t0);
+        if (dt > Sched_stats[n].wcet)
+        {
+          Sched_stats[n].wcet = dt;
+        }
+#endif
+      }
+      // ISR only group is complete
+      if (FALSE == pcfg->bg)
+      {
+        Sched_ready[n] = FALSE;
+      }
+    }
+  }
+  Sched_ticks += 1;
+}
+
+/**
+ * @brief  Accessor for the scheduler tick count.
+ *
+ * @details  Time stamp in ticks (~0.5 ms), wraps around. Called from ISR or
+ *  within a CS (16-bit read).
+ */
+uint16_t Sched_get_ticks(void)
+{
+  return Sched_ticks;
+}
+
+/**
+ * @brief  Poll a background rate group.
+ *
+ * @details  Called in non-ISR context. The ready flag is cleared i.e. the
+ *  release is taken by the caller.
+ *
+ * @param  grp  Rate group.
+ * @return  TRUE if the group has been released since the previous poll.
+ */
+uint8_t Sched_is_ready(sched_group_t grp)
+{
+  if (0 != Sched_ready[grp])
+  {
+    Sched_ready[grp] = FALSE;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+/**
+ * @brief  Get a copy of the statistics of all rate groups.
+ *
+ * @details  Expected to be called from within a CS.
+ *
+ * @param [out]  pstats  Table of SCHED_NR_GROUPS elements.
+ */
+void Sched_get_stats(sched_stat_t * pstats)
+{
+  uint8_t n;
+  for (n = 0; n < SCHED_NR_GROUPS; n++)
+  {
+    pstats[n] = Sched_stats[n];
+  }
+}
+
+/**
+ * @brief  Reset the statistics of all rate groups.
+ *
+ * @details  Expected to be called from within a CS.
+ */
+void Sched_reset(void)
+{
+  uint8_t n;
+  for (n = 0; n < SCHED_NR_GROUPS; n++)
+  {
+    Sched_stats[n].wcet = 0;
+    Sched_stats[n].overrun = FALSE;
+  }
+}
+
+/**@}*/ // defgroup
@@ -18,6 +18,10 @@
 #include "pwm_stm8s.h"
 #include "driver.h"
 #include "bldc_sm.h"
+#include "faultm.h"
+#include "startup.h"
+#include "speed.h"
+#include "trace.h"
 
 
 /* Private defines -----------------------------------------------------------*/
@@ -30,31 +34,37 @@
  */
 #define  BACK_EMF_PLAUS_THR  0x03F8
 
-/* Private types -----------------------------------------------------------*/
+/**
+ * Zero-crossing detection: the floating phase is referenced to the neutral
+ * point which is taken as half of the latest system voltage measurement.
+ * Hysteresis (ADC counts) is applied to the comparison to reject noise on the
+ * unfiltered resistor divider.
+ */
+#define  ZC_NEUTRAL_SH       1
+#define  ZC_HYSTERESIS       0x0008
 
+// the sector in which phase A is floating (rising), see comm_state_table
+#define  SEQ_RISING_STEP_A   5
 
 /* Private types -----------------------------------------------------------*/
 
 /**
-* @brief  Table of handler functions for 6 commutation steps.
-*
-* @details  Each commutation step sequence is implemented as a simple function and
-*  function pointers are aggregated into a single table.
-*
-* @return  void
-*/
-typedef void (*step_ptr_t)( void );
+ * @brief  Expected slope of the back-EMF zero-crossing in each sector.
+ *
+ * @details  Only phase A is routed to the ADC, so a zero-crossing can only be
+ *  detected in the 2 sectors in which phase A is floating, unless all three
+ *  phases are (THREE_PHASE_BEMF_ENABLED).
+ */
+typedef enum
+{
+  ZC_NONE = 0,
+  ZC_RISING,
+  ZC_FALLING
+} zc_edge_t;
 
 
 /* Private function prototypes -----------------------------------------------*/
 
-static void sector_0(void);
-static void sector_1(void);
-static void sector_2(void);
-static void sector_3(void);
-static void sector_4(void);
-static void sector_5(void);
-
 
 /* Public variables  ---------------------------------------------------------*/
 
@@ -67,14 +77,63 @@ uint16_t Back_EMF_Riseing_PhX;
 
 static uint16_t Vbatt_;
 
-static const step_ptr_t step_ptr_table[] =
+static uint8_t s_step; // present commutation sector
+
+static uint8_t zc_detected; // latches the zero-crossing event once per sector
+
+static uint8_t Brake_mode = BRAKE_MODE;
+static uint8_t Brake_strength = BRAKE_STRENGTH;
+static uint8_t Brake_acc;
+
+#ifdef THREE_PHASE_BEMF_ENABLED
+static const zc_edge_t zc_edge_table[] =
 {
-  sector_0,
-  sector_1,
-  sector_2,
-  sector_3,
-  sector_4,
-  sector_5
+  ZC_FALLING, // sector 0: C floating (falling)
+  ZC_RISING,  // sector 1: B floating (rising)
+  ZC_FALLING, // sector 2: A floating (falling)
+  ZC_RISING,  // sector 3: C floating (rising)
+  ZC_FALLING, // sector 4: B floating (falling)
+  ZC_RISING   // sector 5: A floating (rising)
+};
+
+// ADC channel of the floating phase (back-EMF) of each sector
+static const uint8_t bemf_ch_table[] =
+{
+  ADC_SNAP_PH2, ADC_SNAP_PH1, ADC_SNAP_PH0, ADC_SNAP_PH2, ADC_SNAP_PH1, ADC_SNAP_PH0
+};
+
+// ADC channel of the PWM'd phase (system voltage) of each sector
+static const uint8_t vbatt_ch_table[] =
+{
+  ADC_SNAP_PH0, ADC_SNAP_PH0, ADC_SNAP_PH1, ADC_SNAP_PH1, ADC_SNAP_PH2, ADC_SNAP_PH2
+};
+#else
+static const zc_edge_t zc_edge_table[] =
+{
+  ZC_NONE,    // sector 0: C floating
+  ZC_NONE,    // sector 1: B floating
+  ZC_FALLING, // sector 2: A floating (falling)
+  ZC_NONE,    // sector 3: C floating
+  ZC_NONE,    // sector 4: B floating
+  ZC_RISING   // sector 5: A floating (rising)
+};
+#endif
+
+/**
+ * @brief  Table of output states for the 6 commutation steps.
+ *
+ * @details  Each commutation step is a precomputed set of register values for
+ *  the PWM timer channel enables and /SD pins, written in a single pass by
+ *  PWM_set_comm_state().
+ */
+static const PWM_comm_state_t comm_state_table[] =
+{
+  PWM_COMM_STATE( PWM_PH_A, PWM_PH_B ), // 0: A HI, B LO, C float (falling)
+  PWM_COMM_STATE( PWM_PH_A, PWM_PH_C ), // 1: A HI, C LO, B float (rising)
+  PWM_COMM_STATE( PWM_PH_B, PWM_PH_C ), // 2: B HI, C LO, A float (falling)
+  PWM_COMM_STATE( PWM_PH_B, PWM_PH_A ), // 3: B HI, A LO, C float (rising)
+  PWM_COMM_STATE( PWM_PH_C, PWM_PH_A ), // 4: C HI, A LO, B float (falling)
+  PWM_COMM_STATE( PWM_PH_C, PWM_PH_B )  // 5: C HI, B LO, A float (rising)
 };
 
 /*
@@ -95,137 +154,97 @@ static int16_t comm_tm_err_ratio;
 
 /* Private functions ---------------------------------------------------------*/
 
-static void sector_0(void)
+/*
+ * Timing error from the latest rising and falling back-EMF measurements
+ */
+static void update_timing_error(void)
 {
-//    { DC_OUTP_HI,       DC_OUTP_LO,       DC_OUTP_FLOAT_F,
+  // signed_error_ratio = ( post / pre ) - 1
+  // Uses scalar of 64 to get most precision from ADC 10-bit terms (assuming max 0x03ff).
+  // ADC 10-bit i.e. 0x03FF << 6 = 0xFFC0
+  // Calculation result gets scaled down in conjunction with factoring in of
+  //  controller gain term(s).
+  if (0 != Back_EMF_Riseing_PhX) // no divide by 0 e.g. bemf not yet measureable
+  {
+    comm_tm_err_ratio =
+      (int16_t)( ( Back_EMF_Falling_PhX << SCALE_64_LSH ) / Back_EMF_Riseing_PhX )
+      - (int16_t)SCALE_64_ONE;
+  }
+}
 
-// previously phase-A was floating-rising transition
+#ifdef THREE_PHASE_BEMF_ENABLED
+/*
+ * Back-EMF and system voltage measurements at each commutation step, from the
+ * sector that has ended: its floating phase is the rising or falling back-EMF
+ * and its PWM'd phase the system voltage, so the timing error is updated
+ * every sector.
+ */
+static void sector_measurement(uint8_t step)
+{
+  const uint8_t N_ZC_STEPS = sizeof(zc_edge_table) / sizeof(zc_edge_t);
+  const uint8_t prev = ( 0 == step ) ? (uint8_t)( N_ZC_STEPS - 1 ) : (uint8_t)( step - 1 );
 #ifdef BUFFER_ADC_BEMF
-  Back_EMF_Riseing_PhX = ( Back_EMF_Riseing_PhX + Driver_Get_Back_EMF_Avg() ) >> 1 ;
+  const uint16_t bemf = Driver_Get_Back_EMF_Avg();
 #else
-  Back_EMF_Riseing_PhX = ( Back_EMF_Riseing_PhX + Driver_Get_ADC() ) >> 1 ;
+  const uint16_t bemf = Driver_Get_ADC();
 #endif
-//PWM OFF: C
-  PWM_PhC_Disable();
-
-//Float: C
-  PWM_PhC_HB_DISABLE();
-
-//PWM_LO: B
-  PWM_PhB_OUTP_LO();
-  PWM_PhB_HB_ENABLE();
-
-//PWM_HI: A
-  PWM_PhA_Enable();
-  PWM_PhA_HB_ENABLE();
-}
 
-static void sector_1(void)
-{
-//    { DC_OUTP_HI,       DC_OUTP_FLOAT_R,  DC_OUTP_LO,
-
-//PWM OFF:
-//        NOP
-
-//Float: B
-  PWM_PhB_HB_DISABLE();
+  Vbatt_ = Driver_Get_Phase_ADC( (ADC_snap_ch_t)vbatt_ch_table[prev] );
 
-//PWM_LO: C
-  PWM_PhC_OUTP_LO();
-  PWM_PhC_HB_ENABLE();
-
-//PWM_HI:
-//      NOP (A)
+  if (ZC_RISING == zc_edge_table[prev])
+  {
+    Back_EMF_Riseing_PhX = ( Back_EMF_Riseing_PhX + bemf ) >> 1;
+  }
+  else
+  {
+    Back_EMF_Falling_PhX = ( Back_EMF_Falling_PhX + bemf ) >> 1;
+  }
+  update_timing_error();
 }
-
-static void sector_2(void)
+#else
+/*
+ * Back-EMF and system voltage measurements that are coordinated with the
+ * commutation step. The sample last captured by the ADC ISR pertains to the
+ * previous sector, which is not affected by writing the new output state.
+ */
+static void sector_measurement(uint8_t step)
 {
-  // Phase A was driven pwm, so use the ADC measurement as vbat
-  Vbatt_ = Driver_Get_ADC();
-
-//    { DC_OUTP_FLOAT_F,  DC_OUTP_HI,       DC_OUTP_LO,
-
-//PWM OFF: A
-  PWM_PhA_Disable();
-
-//Float: A
-  PWM_PhA_HB_DISABLE();
-
-//PWM_LO: C
-  PWM_PhC_OUTP_LO();
-  PWM_PhC_HB_ENABLE();
+  switch(step)
+  {
+  case 0:
+// previously phase-A was floating-rising transition
+#ifdef BUFFER_ADC_BEMF
+    Back_EMF_Riseing_PhX = ( Back_EMF_Riseing_PhX + Driver_Get_Back_EMF_Avg() ) >> 1 ;
+#else
+    Back_EMF_Riseing_PhX = ( Back_EMF_Riseing_PhX + Driver_Get_ADC() ) >> 1 ;
+#endif
+    break;
 
-//PWM_HI: B
-  PWM_PhB_Enable();
-  PWM_PhB_HB_ENABLE();
-}
+  case 2:
+    // Phase A was driven pwm, so use the ADC measurement as vbat
+    Vbatt_ = Driver_Get_ADC();
+    break;
 
-static void sector_3(void)
-{
+  case 3:
 // previously phase-A was floating-falling transition
 #ifdef BUFFER_ADC_BEMF
-  Back_EMF_Falling_PhX = ( Back_EMF_Falling_PhX + Driver_Get_Back_EMF_Avg() ) >> 1;
+    Back_EMF_Falling_PhX = ( Back_EMF_Falling_PhX + Driver_Get_Back_EMF_Avg() ) >> 1;
 #else
-  Back_EMF_Falling_PhX = ( Back_EMF_Falling_PhX + Driver_Get_ADC() ) >> 1;
+    Back_EMF_Falling_PhX = ( Back_EMF_Falling_PhX + Driver_Get_ADC() ) >> 1;
 #endif
-//    { DC_OUTP_LO,       DC_OUTP_HI,       DC_OUTP_FLOAT_R,
-
-//PWM OFF:
-//        NOP
-
-//Float: C
-  PWM_PhC_HB_DISABLE();
-
-//PWM_LO: A
-  PWM_PhA_OUTP_LO();
-  PWM_PhA_HB_ENABLE();
-
-//PWM_HI:
-//      NOP (B)
-}
-
-static void sector_4(void)
-{
-//    { DC_OUTP_LO,       DC_OUTP_FLOAT_F,  DC_OUTP_HI,
-
-//PWM OFF: B
-  PWM_PhB_Disable();
-//Float: B
-  PWM_PhB_HB_DISABLE();
-//PWM_LO: A
-  PWM_PhA_OUTP_LO();
-  PWM_PhA_HB_ENABLE();
-//PWM_HI: C
-  PWM_PhC_Enable();
-  PWM_PhC_HB_ENABLE();
-}
-
-static void sector_5(void)
-{
-//    { DC_OUTP_FLOAT_R,  DC_OUTP_LO,       DC_OUTP_HI,
-
-//PWM OFF:
-//        NOP
-//Float: A
-  PWM_PhA_HB_DISABLE();
-//PWM_LO: B
-  PWM_PhB_OUTP_LO();
-  PWM_PhB_HB_ENABLE();
-//PWM_HI:
-//        NOP (C)
+    break;
 
+  case 5:
 // update the timing error once per frame
 //  comm_timing_error = (comm_timing_error + TIMING_ERROR_TERM) > 1; // sma
+    update_timing_error();
+    break;
 
-  // signed_error_ratio = ( post / pre ) - 1
-  // Uses scalar of 64 to get most precision from ADC 10-bit terms (assuming max 0x03ff).
-  // ADC 10-bit i.e. 0x03FF << 6 = 0xFFC0
-  // Calculation result gets scaled down in conjunction with factoring in of
-  //  controller gain term(s).
-  comm_tm_err_ratio =
-    (int16_t)( ( Back_EMF_Falling_PhX << SCALE_64_LSH ) / Back_EMF_Riseing_PhX )
-    - (int16_t)SCALE_64_ONE;
+  default:
+    break;
+  }
 }
+#endif
 
 /* Public functions ---------------------------------------------------------*/
 /**
@@ -238,7 +257,12 @@ static void sector_5(void)
  */
 int8_t Seq_get_timing_error_p(void)
 {
+#ifdef ZC_COMM_ENABLED
+  // the error term is from the zero-crossing, detected in consecutive sectors
+  if ( FALSE != Speed_is_locked() )
+#else
   if ( (Back_EMF_Falling_PhX + Back_EMF_Riseing_PhX) > BACK_EMF_PLAUS_THR )
+#endif
   {
     return (int8_t)0;
   }
@@ -259,6 +283,131 @@ int16_t Seq_get_timing_error(void)
   return comm_tm_err_ratio; // positive if advanced
 }
 
+/**
+ * @brief  Back-EMF zero-crossing detector.
+ *
+ * @details  Called from ADC ISR on every PWM-synchronized sample. The sample of
+ *  the floating phase is compared to the neutral reference (1/2 Vbatt) and the
+ *  zero-crossing is reported only on the first sample that has crossed the
+ *  neutral point in the expected direction for the present sector.
+ *
+ * @param  adc_sample  Phase voltage measurement.
+ *
+ * @retval  TRUE   zero-crossing detected in the present sector
+ * @retval  FALSE  no zero-crossing (or sector has no floating phase measurement)
+ */
+uint8_t Seq_ZC_detect(uint16_t adc_sample)
+{
+  const uint16_t neutral = Vbatt_ >> ZC_NEUTRAL_SH;
+  const zc_edge_t edge = zc_edge_table[s_step];
+
+  if ( FALSE != zc_detected || ZC_NONE == edge || 0 == neutral )
+  {
+    return FALSE;
+  }
+
+  if (ZC_RISING == edge)
+  {
+    zc_detected = (uint8_t)( adc_sample > (neutral + ZC_HYSTERESIS) );
+  }
+  else
+  {
+    // the threshold is clamped at 0 (and not wrapped) at a low neutral voltage
+    const uint16_t thr = (neutral > ZC_HYSTERESIS) ? (uint16_t)(neutral - ZC_HYSTERESIS) : 0;
+
+    zc_detected = (uint8_t)( adc_sample < thr );
+  }
+  return zc_detected;
+}
+
+/**
+ * @brief  Test if a zero-crossing is expected in the present sector.
+ *
+ * @return  True if the floating phase is measured in the present sector
+ */
+uint8_t Seq_ZC_expected(void)
+{
+  return (uint8_t)( ZC_NONE != zc_edge_table[s_step] );
+}
+
+#ifdef THREE_PHASE_BEMF_ENABLED
+/**
+ * @brief  ADC channel of the floating phase of the present sector.
+ *
+ * @details  Called from the ADC ISR.
+ *
+ * @return  ADC_snap_ch_t of the back-EMF measurement
+ */
+uint8_t Seq_get_bemf_ch(void)
+{
+  return bemf_ch_table[s_step];
+}
+#endif
+
+#ifdef FLYING_START_ENABLED
+/**
+ * @brief  Set the sector in which phase A is floating with the rising back-EMF.
+ *
+ * @details  Called from the ADC ISR at the rising edge of the phase A back-EMF
+ *  sensed with the bridge off (flying start), which is the ZC of the sector.
+ */
+void Seq_set_rising_step(void)
+{
+  s_step = SEQ_RISING_STEP_A;
+  zc_detected = TRUE;
+}
+#endif
+
+/**
+ * @brief  Configure the brake of the stopped motor.
+ *
+ * @details  Takes effect at the next control tick.
+ *
+ * @param  mode      BRAKE_NONE (windmill), BRAKE_LOWSIDE or BRAKE_COMPL
+ * @param  strength  Fraction of the time the brake is on [0:16] (sixteenths)
+ */
+void Seq_set_brake(uint8_t mode, uint8_t strength)
+{
+  Brake_mode = mode;
+  Brake_strength = (strength > BRAKE_STRENGTH_MAX) ? BRAKE_STRENGTH_MAX : strength;
+}
+
+/**
+ * @brief  Brake the stopped motor.
+ *
+ * @details  Called from the control task (ISR). While running, the bridge is
+ *  left to the commutation sequence (which takes over at the next sector on a
+ *  start). Once a fault has shut off the bridge it stays off.
+ *
+ * @return  TRUE if the brake has the bridge (whether or not it is on in the
+ *  present tick)
+ */
+uint8_t Seq_brake_update(void)
+{
+  uint8_t brake = BRAKE_NONE;
+  uint8_t engaged = FALSE;
+
+  if (BL_IS_RUNNING == BL_get_state())
+  {
+    return FALSE;
+  }
+
+  if (0 == Faultm_get_status() && BRAKE_NONE != Brake_mode)
+  {
+    engaged = TRUE;
+    Brake_acc += Brake_strength;
+
+    if (Brake_acc >= BRAKE_STRENGTH_MAX)
+    {
+      Brake_acc -= BRAKE_STRENGTH_MAX;
+      brake = Brake_mode;
+    }
+  }
+  PWM_set_brake( brake );
+
+  return engaged;
+}
+
 /**
  * @brief  Accessor for back-EMF measurement.
  */
@@ -289,45 +438,67 @@ uint16_t Seq_Get_Vbatt(void)
 /**
  * @brief  Updates the commutation-step sequence.
  *
- * @details  Called from ISR. The 6 steps of the  commutation sequence are
- * implemented as individual functions to reduce the amount of code i.e.
- * optimize the timing which is critical to the motor performance and stability.
+ * @details  Called from ISR. The 6 steps of the commutation sequence are
+ * implemented as a table of precomputed output states in order to reduce the
+ * amount of code i.e. optimize the timing which is critical to the motor
+ * performance and stability.
  *
  * Ideally, when a phase is at 60 degrees (half of its pwm-on sector) there should
  * be no change/disruption to its PWM signal. The timer capture/counter register
  * should not be reset or cleared - only the active timer/PWM channel is switched
  * between the 3 motor phases, so the overall PWM cycle should remain consistent.
  *
- * First: shutoff PWM (before setting any of the new FET states) to ensure PWM
- * leg is turned off and flyback-diode of non-PWM conducts flyback current
- * ("demagnization time".)
+ * First: switch the PWM timer channels i.e. shutoff PWM of the previously PWM'd
+ * phase to ensure PWM leg is turned off and flyback-diode of non-PWM conducts
+ * flyback current ("demagnization time"), and switch PWM to the new HI phase.
  *
- * Second: assert /SD ==OFF  of (only!) the PWMd FET - to ensure that flyback
+ * Second: assert /SD ==OFF  of (only!) the floating phase - to ensure that flyback
  * diode action is complete (de-energizing the coil that is now being transitioned
  * to floating). This seems to be the only way to ensure IR2104 set both switch
- * non-conducting.
- *
- * Third: turn on LO phase
- * The "OFF" (non-PWMd) phase is asserted output pins to GPIO, driven Off (IR2104 enabled)
- *
- * Fourth: turn on HI (pwm) phase
+ * non-conducting.  /SD of the LO phase and the HI phase are asserted ON, where
+ * the LO phase timer channel is disabled i.e. its pin is GPIO output driven Off.
  */
 void Sequence_Step(void)
 {
   // note this sizeof and divide done in preprocessor - verified in the assembly
-  const uint8_t N_CSTEPS = sizeof(step_ptr_table) / sizeof(step_ptr_t);
-
-  static uint8_t s_step;
+  const uint8_t N_CSTEPS = sizeof(comm_state_table) / sizeof(PWM_comm_state_t);
 
 // has to cast modulus expression to uint8
-  s_step = (uint8_t)((s_step + 1) % N_CSTEPS);
+  // the sector is held while the rotor is aligned
+  if (STARTUP_ALIGN != Startup_get_phase())
+  {
+    s_step = (uint8_t)((s_step + 1) % N_CSTEPS);
+  }
 
-// intentionally letting motor windmill (i.e. not braking) when switched off
-// normally
-  if (BL_IS_RUNNING == BL_get_state() )
+// re-arm the zero-crossing detector for the new sector
+  zc_detected = FALSE;
+
+// the bridge is driven only while running, the brake (if any) has it while
+// stopped, and it stays off once a fault has shut it (fault manager) and while
+// the back-EMF of the rotor is sensed (flying start)
+  if (BL_IS_RUNNING == BL_get_state() && 0 == Faultm_get_status() &&
+      STARTUP_CATCH != Startup_get_phase() )
   {
     // let'er rip!
-    step_ptr_table[s_step]();
+    PWM_set_comm_state( &comm_state_table[s_step] );
+
+    sector_measurement( s_step );
+
+#if defined( TRACE_ENABLED )
+    {
+      trace_entry_t * ptrace = Trace_next();
+
+      if (NULL != ptrace)
+      {
+        ptrace->step = s_step;
+        ptrace->adc = Driver_Get_ADC();
+        ptrace->bemf_r = Back_EMF_Riseing_PhX;
+        ptrace->bemf_f = Back_EMF_Falling_PhX;
+        ptrace->comm_period = get_commutation_period();
+        ptrace->duty = BLDC_PWMDC_Get();
+      }
+    }
+#endif
   }
   else
   {
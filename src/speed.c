@@ -0,0 +1,245 @@
+/**
+  ******************************************************************************
+  * @file speed.c
+  * @brief Motor speed estimator, stall and desync detection
+  * @author Neidermeier
+  * @version
+  * @date
+  ******************************************************************************
+  */
+/**
+ * \defgroup speed Speed
+ * @brief eRPM and RPM from the commutation timing (no division), and the
+ *  stall and desync faults from the zero-crossing of each sector.
+ * @{
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "speed.h"
+#include "bldc_sm.h"
+#include "driver.h"
+#include "faultm.h"
+
+
+/* Private defines -----------------------------------------------------------*/
+
+// reciprocal table: 2^30 / m for m in [0x8000:0x10000] in 32 intervals
+#define RECIP_TBL_SH   10    // interval of m
+#define RECIP_FRAC_SH  6     // interpolation bits, the product fits 16-bits
+
+// mechanical RPM from eRPM/10, Q12
+#define SPEED_RPM_SH   12
+#define SPEED_RPM_K    (uint16_t)( ( ( 10UL << SPEED_RPM_SH ) + MOTOR_POLE_PAIRS / 2 ) / MOTOR_POLE_PAIRS )
+
+// consecutive ZC to arm the stall and desync checks
+#define SPEED_LOCK_CNT   4
+
+// consecutive ZC missed for a stall (i.e. one electrical cycle)
+#ifdef THREE_PHASE_BEMF_ENABLED
+#define SPEED_STALL_CNT  6
+#else
+#define SPEED_STALL_CNT  2 // phase A only
+#endif
+
+
+/* Private variables ---------------------------------------------------------*/
+
+static const uint16_t Recip_tbl[] =
+{
+  32768, 31775, 30840, 29959, 29127, 28340, 27594, 26887,
+  26214, 25575, 24966, 24385, 23831, 23302, 22795, 22310,
+  21845, 21400, 20972, 20560, 20165, 19784, 19418, 19065,
+  18725, 18396, 18079, 17772, 17476, 17190, 16913, 16644,
+  16384
+};
+
+static uint8_t  Lock_count;  // consecutive ZC, to SPEED_LOCK_CNT
+static uint8_t  Miss_count;  // consecutive ZC missed
+static uint16_t ZC_prev;     // ZC elapsed time of the previous ZC sector
+
+// conditions asserted at each sector, updated at each sector with a ZC expected
+static uint8_t Stall_cond;
+static uint8_t Desync_cond;
+
+
+/* Public functions ---------------------------------------------------------*/
+
+/**
+ * @brief  Reciprocal, without a division.
+ *
+ * @details  The value is normalized to m = x << sh in [0x8000:0xFFFF] and the
+ *  reciprocal of m is interpolated from a table.
+ *
+ * @param        x    Value, not 0
+ * @param [out]  psh  Normalization shift
+ * @return  2^30 / m, i.e. 1 / x == r * 2^sh / 2^30
+ */
+uint16_t Speed_recip(uint16_t x, uint8_t * psh)
+{
+  uint8_t sh = 0;
+  uint8_t n;
+
+  while (0 == (x & 0x8000))
+  {
+    x <<= 1;
+    sh += 1;
+  }
+  n = (uint8_t)( (x >> RECIP_TBL_SH) & 0x1F );
+
+  *psh = sh;
+
+  return Recip_tbl[n] -
+         (uint16_t)( ( (Recip_tbl[n] - Recip_tbl[n + 1]) *
+                       ( (x >> (RECIP_TBL_SH - RECIP_FRAC_SH)) & 0x3F ) ) >> RECIP_FRAC_SH );
+}
+
+/**
+ * @brief  Electrical RPM from commutation period.
+ *
+ * @details  From the reciprocal of the period (Speed_recip), so there is a
+ *  32-bit multiply but no division.
+ *
+ * @param  period  Commutation period (TIM3 counts of 1/4 sector)
+ * @return  eRPM / 10, saturated to 16-bits, 0 if the period is 0
+ */
+uint16_t Speed_erpm10(uint16_t period)
+{
+  uint8_t sh;
+  uint16_t r;
+  uint32_t t32;
+
+  if (0 == period)
+  {
+    return 0;
+  }
+  r = Speed_recip(period, &sh);
+
+  // 20e6 / x == (2^30 / m) * 62500 * 2^5 * 2^sh / 2^30
+  t32 = ( (uint32_t)r * SPEED_ERPM10_K ) >> ( 30 - SPEED_ERPM10_SH - sh );
+
+  return (t32 > U16_MAX) ? U16_MAX : (uint16_t)t32;
+}
+
+/**
+ * @brief  Mechanical RPM from eRPM.
+ *
+ * @param  erpm10  eRPM / 10
+ * @return  RPM, saturated to 16-bits
+ */
+uint16_t Speed_rpm(uint16_t erpm10)
+{
+  uint32_t t32 = ( (uint32_t)erpm10 * SPEED_RPM_K + ( 1u << ( SPEED_RPM_SH - 1 ) ) ) >> SPEED_RPM_SH;
+
+  return (t32 > U16_MAX) ? U16_MAX : (uint16_t)t32;
+}
+
+/**
+ * @brief  Speed estimate.
+ *
+ * @details  From the commutation period, or with ZC commutation the period
+ *  measured from the zero-crossing (which times the commutation). Called from
+ *  ISR context, at the publish of the driver status.
+ *
+ * @return  eRPM / 10
+ */
+uint16_t Speed_get_erpm10(void)
+{
+  uint16_t period = get_commutation_period();
+
+#ifdef ZC_COMM_ENABLED
+  if ( FALSE != BL_get_ct_mode() && 0 != Driver_get_ZC_period() )
+  {
+    period = Driver_get_ZC_period();
+  }
+#endif
+  if (BL_IS_RUNNING != BL_get_state())
+  {
+    return 0;
+  }
+  return Speed_erpm10(period);
+}
+
+/**
+ * @brief  Reset the stall and desync detection.
+ *
+ * @details  Expected to be called from non-ISR/CS context (i.e. on system reset).
+ */
+void Speed_reset(void)
+{
+  Lock_count = 0;
+  Miss_count = 0;
+  Stall_cond = FALSE;
+  Desync_cond = FALSE;
+}
+
+/**
+ * @brief  Indicate that the ZC has been detected in consecutive sectors.
+ *
+ * @details  The stall and desync checks are armed, and the ZC timing is
+ *  plausible for the closed-loop control.
+ *
+ * @return  TRUE if locked
+ */
+uint8_t Speed_is_locked(void)
+{
+  return (uint8_t)( SPEED_LOCK_CNT == Lock_count );
+}
+
+/**
+ * @brief  Stall and desync detection, at the end of each sector (ISR context).
+ *
+ * @details  The checks are armed once the ZC is detected in a few consecutive
+ *  sectors (the back-EMF is too weak at the start of the ramp). It is a stall
+ *  if the ZC is missed in consecutive sectors, and a desync if a ZC is missed
+ *  or moves by more than 1/4 sector (15 degrees) from the previous one. The
+ *  faults are updated at the commutation rate so they trip within a few
+ *  electrical cycles.
+ *
+ * @param  zc           ZC result of the sector
+ * @param  zc_elapsed   Time of the ZC from the commutation (TIM3 counts)
+ * @param  comm_period  Commutation period (TIM3 counts of 1/4 sector)
+ */
+void Speed_on_sector(speed_zc_t zc, uint16_t zc_elapsed, uint16_t comm_period)
+{
+  if (BL_IS_RUNNING != BL_get_state())
+  {
+    Lock_count = 0;
+    return;
+  }
+
+  if (SPEED_ZC_DETECTED == zc)
+  {
+    uint16_t jump = (zc_elapsed > ZC_prev) ? zc_elapsed - ZC_prev : ZC_prev - zc_elapsed;
+
+    Desync_cond = (uint8_t)( SPEED_LOCK_CNT == Lock_count && jump > comm_period );
+    Stall_cond = FALSE;
+    Miss_count = 0;
+    ZC_prev = zc_elapsed;
+
+    if (Lock_count < SPEED_LOCK_CNT)
+    {
+      Lock_count += 1;
+    }
+  }
+  else if (SPEED_ZC_MISSED == zc)
+  {
+    if (Lock_count < SPEED_LOCK_CNT)
+    {
+      Lock_count = 0;
+    }
+    else if (Miss_count < SPEED_STALL_CNT)
+    {
+      Miss_count += 1;
+    }
+    Desync_cond = (uint8_t)( SPEED_LOCK_CNT == Lock_count );
+    Stall_cond = (uint8_t)( Miss_count >= SPEED_STALL_CNT );
+  }
+
+  if (SPEED_LOCK_CNT == Lock_count)
+  {
+    Faultm_upd(STALL, (faultm_assert_t)Stall_cond);
+    Faultm_upd(DESYNC, (faultm_assert_t)Desync_cond);
+  }
+}
+
+/**@}*/ // defgroup
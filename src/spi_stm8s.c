@@ -1,7 +1,7 @@
 /**
   ******************************************************************************
   * @file spi_stm8s.c
-  * @brief This file contains the main function for the BLDC motor control
+  * @brief SPI link to the flight-controller (register map protocol)
   * @author Neidermeier
   * @version
   * @date March-2021
@@ -14,8 +14,6 @@
  */
 /* Includes ------------------------------------------------------------------*/
 #include <stdio.h>
-#include <ctype.h> // isprint
-#include <string.h> // memset
 
 // unfortunately this has to be included merely for SPI ENABLED define
 // todo consider -DSPI_ENABLED ? in project/makefile
@@ -25,212 +23,714 @@
 
 // app headers
 #include "mcu_stm8s.h"
+#include "spi_stm8s.h"
+#include "param.h"
+#include "telem.h" // Telem_crc8
 
 
 /* Private defines -----------------------------------------------------------*/
 
-/* Chip select */
-#define CS_PIN      5
+/*
+ * Frame: header, address (bit 7 set for write), data LSB, data MSB, CRC8 of
+ * the preceding bytes. Every transaction is one frame in each direction, the
+ * peripheral answers a request in the following transaction.
+ */
+#define SPI_FRM_HDR   0
+#define SPI_FRM_ADDR  1
+#define SPI_FRM_DLO   2
+#define SPI_FRM_DHI   3
+#define SPI_FRM_CRC   4
+#define SPI_FRAME_SZ  5
 
-#define TIME_OUT_0 0x1000 // timer1 free running, time between periodic task is 0x2080
-#define TIME_OUT_1 0x0002 //
-#define RX_BUF_SZ 16
+/*
+ * Broadcast frame: header, number of slots, mode, a throttle slot for each
+ * address, CRC8 of the preceding bytes. All peripherals are selected and none
+ * answers it, the pending response of each is kept for its next request. The
+ * broadcast is write-only: after the header byte (the same response header
+ * from every peripheral), each peripheral disables its MISO output (RXONLY)
+ * to the end of the frame so that the push-pull outputs do not contend.
+ */
+#define SPI_FRM_BC_N     1
+#define SPI_FRM_BC_MODE  2
+#define SPI_FRM_BC_THR   3
+#define SPI_BCAST_SZ( _N_ )  ( SPI_FRM_BC_THR + (_N_) + 1 )
+#define SPI_BCAST_MAX_SZ     SPI_BCAST_SZ( SPI_BUS_MAX_ESC )
+
+#define SPI_HDR_REQ   0xA5  // controller -> peripheral
+#define SPI_HDR_RSP   0x5A  // peripheral -> controller
+#define SPI_HDR_BCAST 0xB4  // controller -> all peripherals
+#define SPI_WR_FLAG   0x80
+
+// peripheral output while the rest of a broadcast frame is clocked in
+#define SPI_FILL      0xFF
+
+// chip selects of all peripherals, for the broadcast frame
+#ifdef SPI_CTRLR_USE_CS
+#define SPI_CS_ALL    SPI_CS_PINS
+#else
+#define SPI_CS_ALL    0
+#endif
+
+#define SPI_PROTO_ID  0x0101 // protocol version 1.1 (parameter registers)
+
+// control ticks (~1 kHz) with no valid request, before the link is lost
+#define SPI_LINK_TMO  500
+
+// controller task periods (~30 Hz) a transaction may take, before it is
+// aborted (it takes a few ms at the slowest clock)
+#define SPI_XFER_TMO  4
 
 
 /** @cond */
 
+/* Private types -------------------------------------------------------------*/
+
 /* Private variables ---------------------------------------------------------*/
 
-uint8_t spi_rx_buf[RX_BUF_SZ];
+static uint8_t Rx_frame[ SPI_BCAST_MAX_SZ ];
+static uint8_t Tx_frame[ SPI_BCAST_MAX_SZ ] = { SPI_HDR_RSP }; // header before any response
+static uint8_t Frame_idx; // index of the next byte of the transaction
+static uint8_t Frame_sz;  // size of the frame of the transaction
+
+static uint8_t Rx_count;  // valid frames received (incremented in ISR)
+static uint8_t Err_count; // frames with CRC error (incremented in ISR)
+
+#if SPI_ENABLED == SPI_STM8_SLAVE
+static SPI_readback_t Readback[2]; // double-buffered, see SPI_publish_status
+static uint8_t Readback_sel;       // buffer visible to the ISR
+
+static uint8_t Reg_throttle;
+static uint8_t Reg_mode;
+static uint8_t Reg_fault_clr;      // incremented on each write
+static uint8_t Reg_commit;         // incremented on each write
+
+static uint8_t Param_wr_id;        // parameter write to be applied by the background
+static uint16_t Param_wr_val;
+static uint8_t Param_wr_pending;
+
+static uint8_t Esc_addr = SPI_ESC_ADDR; // slot of the broadcast frame
+
+static uint8_t Link_rx_count;      // control task copy for the edge detect
+static uint16_t Link_tmo;
+static uint8_t Fault_clr_count;
+static uint8_t Commit_count;
+#else
+static uint8_t Xfer_busy; // set by SPI_controld, cleared by the ISR at the end of the poll
+static uint8_t Xfer_done; // the response of the poll request is in Rx_frame
+static uint8_t Xfer_tmo;  // controller task periods of the present transaction
+static uint8_t Tmo_count; // transactions aborted on the timeout
+
+// the poll request is clocked out by the ISR at the end of the broadcast
+static uint8_t Poll_frame[ SPI_FRAME_SZ ];
+static uint8_t Poll_pending;
+static uint8_t Poll_addr;  // peripheral of the present poll request
+static uint8_t Poll_idx;   // register of the poll table, advanced on each sweep
+
+static uint8_t Bus_throttle[ SPI_BUS_NR_ESC ];
+static uint8_t Bus_mode;
+static SPI_readback_t Bus_readback[ SPI_BUS_NR_ESC ];
+
+#ifdef SPI_CTRLR_USE_CS
+// chip select of each peripheral, in order of the address
+static const uint8_t Cs_pins[ SPI_BUS_MAX_ESC ] =
+{
+    SPI_CS_PIN_0, SPI_CS_PIN_1, SPI_CS_PIN_2, SPI_CS_PIN_3
+};
+#endif
+#endif
+
 
 /* Private functions ---------------------------------------------------------*/
 
-int SPI_read_write_b(uint8_t * chbuf, uint8_t data, uint16_t time_out)
+/*
+ * example codes for SPI functions from
+ * https://lujji.github.io/blog/bare-metal-programming-stm8/#SPI
+ */
+
+#if SPI_ENABLED == SPI_STM8_MASTER
+static void chip_select(uint8_t pins)
 {
-    uint8_t index = 0;
-    uint8_t hup = FALSE;
-    uint8_t spi_rx;
-    uint8_t spi_tx;
-    uint16_t start = TIM1_GetCounter();
-    (void)data; // unused atm
+#ifdef SPI_CTRLR_USE_CS
+    SPI_CS_PORT->ODR &= (uint8_t)~pins;
+#else
+    (void)pins;
+#endif
+}
+static void chip_deselect(void)
+{
+#ifdef SPI_CTRLR_USE_CS
+    SPI_CS_PORT->ODR |= SPI_CS_PINS;
+#endif
+}
 
-// shouldn't need this if it worked correctly ;
-    memset(spi_rx_buf, 0, SPI_RX_BUF_SZ);
+static uint8_t cs_pins(uint8_t addr)
+{
+#ifdef SPI_CTRLR_USE_CS
+    return Cs_pins[ addr ];
+#else
+    (void)addr;
+    return 0;
+#endif
+}
 
+/*
+ * start a transaction of the frame in Tx_frame (the ISR clocks out the rest)
+ */
+static void xfer_start(uint8_t pins, uint8_t size)
+{
+    Frame_idx = 0;
+    Frame_sz = size;
 
-    while( 1 )
-    {
-        if (SPI->SR & SPI_SR_RXNE)
-        {
-            // Clearing the RXNE bit is performed by reading the SPI_DR register
-            spi_rx = SPI->DR;
-            hup = FALSE; // as long as they keep sending ... keep listening
-            index = (uint8_t)((index < (RX_BUF_SZ-1) ) ? index + 1 : 0);
+    chip_select(pins);
+    SPI->DR = Tx_frame[SPI_FRM_HDR];
+}
 
-            if ( spi_rx == 0xF2 )
-            {
-                index = 0;
-                spi_rx = 'X'; // trust rx_cntr get reset!
-            }
-            spi_tx = chbuf[ index ]; // send something back
+/*
+ * Abort a transaction that has stalled: the ISR is stopped first, then the
+ * state it shares is reset and the receiver is flushed (a stale RXNE or OVR
+ * would otherwise take the first byte of the next transaction)
+ */
+static void xfer_abort(void)
+{
+    SPI->ICR &= (uint8_t)~SPI_ICR_RXIE;
+    chip_deselect();
 
-            while (! (SPI->SR & SPI_SR_TXE) );
+    Frame_idx = 0;
+    Frame_sz = 0;
+    Poll_pending = FALSE;
+    Xfer_done = FALSE;
+    Xfer_busy = FALSE;
 
-            SPI->DR = spi_tx;
+    (void)SPI->DR; // DR then SR clears RXNE and OVR
+    (void)SPI->SR;
+}
+#endif
 
-            spi_rx_buf[ index ] =  spi_rx; // trust rx_cntr get reset!
-        }
-        else
+static void frame_pack(uint8_t * pframe, uint8_t hdr, uint8_t addr, uint16_t val)
+{
+    pframe[SPI_FRM_HDR] = hdr;
+    pframe[SPI_FRM_ADDR] = addr;
+    pframe[SPI_FRM_DLO] = (uint8_t)val;
+    pframe[SPI_FRM_DHI] = (uint8_t)(val >> 8);
+    pframe[SPI_FRM_CRC] = Telem_crc8(pframe, SPI_FRAME_SZ - 1);
+}
+
+static uint8_t frame_check(const uint8_t * pframe, uint8_t hdr, uint8_t size)
+{
+    return (uint8_t)( hdr == pframe[SPI_FRM_HDR] &&
+                     Telem_crc8(pframe, size - 1) == pframe[size - 1] );
+}
+
+#if SPI_ENABLED == SPI_STM8_SLAVE
+/*
+ * Execute the request in Rx_frame and prepare the response (ISR context)
+ */
+static void reg_access(void)
+{
+    const SPI_readback_t * prb = &Readback[ Readback_sel ];
+    uint8_t addr = Rx_frame[SPI_FRM_ADDR];
+    uint16_t val =
+        (uint16_t)Rx_frame[SPI_FRM_DLO] | ((uint16_t)Rx_frame[SPI_FRM_DHI] << 8);
+
+    if (0 != (addr & SPI_WR_FLAG))
+    {
+        uint8_t reg = addr & (uint8_t)~SPI_WR_FLAG;
+
+        if (reg >= SPI_REG_PARAM && reg < SPI_REG_PARAM + PARAM_NR)
         {
-            // if timed out then return error
-            if ( (TIM1_GetCounter() - start) > time_out )
+            // held until the background has applied it (Param_set)
+            if (FALSE == Param_wr_pending &&
+                TRUE == Param_check((param_ID_t)(reg - SPI_REG_PARAM), val))
+            {
+                Param_wr_id = reg - SPI_REG_PARAM;
+                Param_wr_val = val;
+                Param_wr_pending = TRUE;
+            }
+            else
             {
-//                index = -1; // timed out, return error
-//								goto exit;
-                return -1 ;
+                addr = SPI_REG_NACK;
             }
-            if (FALSE == hup )
+            frame_pack(Tx_frame, SPI_HDR_RSP, addr, val);
+            return;
+        }
+
+        switch( reg )
+        {
+        case SPI_REG_THROTTLE:
+            Reg_throttle = (val > U8_MAX) ? U8_MAX : (uint8_t)val;
+            break;
+        case SPI_REG_MODE:
+            Reg_mode = (uint8_t)val;
+            break;
+        case SPI_REG_FAULT_CLR:
+            Reg_fault_clr += 1;
+            break;
+        case SPI_REG_COMMIT:
+            Reg_commit += 1;
+            break;
+        default:
+            addr = SPI_REG_NACK; // read-only or unknown register
+            break;
+        }
+    }
+    else
+    {
+        switch( addr )
+        {
+        case SPI_REG_ID:
+            val = SPI_PROTO_ID;
+            break;
+        case SPI_REG_THROTTLE:
+            val = Reg_throttle;
+            break;
+        case SPI_REG_MODE:
+            val = Reg_mode;
+            break;
+        case SPI_REG_ERPM:
+            val = prb->erpm10;
+            break;
+        case SPI_REG_VBATT:
+            val = prb->vbatt;
+            break;
+        case SPI_REG_FAULTS:
+            val = prb->faults;
+            break;
+        case SPI_REG_STATE:
+            val = prb->run_state;
+            break;
+        case SPI_REG_ERRORS:
+            val = Err_count;
+            break;
+        default:
+            if (addr >= SPI_REG_PARAM && addr < SPI_REG_PARAM + PARAM_NR)
             {
-                // one more time in the loop
-                hup = TRUE;
+                val = Param_get((param_ID_t)(addr - SPI_REG_PARAM));
             }
-            else // if hup == true
+            else
             {
-                if (index > 0)
-                {
-//                    goto exit;
-                    return index;
-                }
+                addr = SPI_REG_NACK;
+                val = 0;
             }
+            break;
         }
-    } // while
-
-exit:
-    return index;
+    }
+    frame_pack(Tx_frame, SPI_HDR_RSP, addr, val);
 }
 
 /*
- * example codes for SPI functions from
- * https://lujji.github.io/blog/bare-metal-programming-stm8/#SPI
+ * Take the slot of this peripheral from the broadcast frame in Rx_frame (ISR
+ * context), a frame without the slot is ignored
  */
+static uint8_t bcast_access(void)
+{
+    if (Esc_addr >= Rx_frame[SPI_FRM_BC_N])
+    {
+        return FALSE;
+    }
+    Reg_throttle = Rx_frame[ SPI_FRM_BC_THR + Esc_addr ];
+    Reg_mode = Rx_frame[SPI_FRM_BC_MODE];
 
-void chip_select(void)
+    return TRUE;
+}
+#endif
+
+/** @endcond */
+
+/**
+ * @brief  SPI RXNE interrupt handler, one call per byte.
+ *
+ * @details  As peripheral, the request bytes are collected into a frame (the
+ *  header byte resynchronizes the framing, and sets the size of the frame)
+ *  and the next response byte is loaded for the controller to clock out. As
+ *  controller, the next byte of the pending transaction is sent until the
+ *  frame is complete, and the poll request follows the broadcast frame.
+ */
+void SPI_on_IRQ(void)
 {
-#ifdef SPI_CTRLR_USE_CS
-    GPIOE->ODR &= (uint8_t)~(1 << CS_PIN);
+    uint8_t rx = SPI->DR; // clears RXNE
+
+#if SPI_ENABLED == SPI_STM8_SLAVE
+    if (0 == Frame_idx)
+    {
+        if (SPI_HDR_REQ == rx)
+        {
+            Frame_sz = SPI_FRAME_SZ;
+        }
+        else if (SPI_HDR_BCAST == rx)
+        {
+            Frame_sz = SPI_BCAST_MAX_SZ; // until the number of slots
+            SPI->CR2 |= SPI_CR2_RXONLY;
+        }
+        else
+        {
+            // hunting for the header, response restarts from the first byte
+            SPI->DR = Tx_frame[SPI_FRM_HDR];
+            return;
+        }
+    }
+
+    Rx_frame[ Frame_idx ] = rx;
+    Frame_idx += 1;
+
+    if (SPI_HDR_BCAST == Rx_frame[SPI_FRM_HDR] && (SPI_FRM_BC_N + 1) == Frame_idx)
+    {
+        if (0 == rx || rx > SPI_BUS_MAX_ESC)
+        {
+            Frame_idx = 0;
+            Err_count += 1;
+            SPI->CR2 &= (uint8_t)~SPI_CR2_RXONLY;
+            SPI->DR = Tx_frame[SPI_FRM_HDR];
+            return;
+        }
+        Frame_sz = SPI_BCAST_SZ( rx );
+    }
+
+    if (Frame_idx < Frame_sz)
+    {
+        SPI->DR = (Frame_idx < SPI_FRAME_SZ) ? Tx_frame[ Frame_idx ] : SPI_FILL;
+        return;
+    }
+
+    Frame_idx = 0;
+
+    if (SPI_HDR_BCAST == Rx_frame[SPI_FRM_HDR])
+    {
+        SPI->CR2 &= (uint8_t)~SPI_CR2_RXONLY;
+
+        if (FALSE == frame_check(Rx_frame, SPI_HDR_BCAST, Frame_sz))
+        {
+            Err_count += 1;
+        }
+        else if (TRUE == bcast_access())
+        {
+            Rx_count += 1;
+        }
+    }
+    else if (TRUE == frame_check(Rx_frame, SPI_HDR_REQ, SPI_FRAME_SZ))
+    {
+        Rx_count += 1;
+        reg_access();
+    }
+    else
+    {
+        Err_count += 1;
+        frame_pack(Tx_frame, SPI_HDR_RSP, SPI_REG_NACK, 0);
+    }
+    SPI->DR = Tx_frame[SPI_FRM_HDR];
+#else
+    if (Frame_idx < Frame_sz)
+    {
+        Rx_frame[ Frame_idx ] = rx;
+        Frame_idx += 1;
+    }
+
+    if (Frame_idx < Frame_sz)
+    {
+        SPI->DR = Tx_frame[ Frame_idx ];
+    }
+    else if (TRUE == Poll_pending)
+    {
+        uint8_t n;
+
+        chip_deselect();
+        Poll_pending = FALSE;
+
+        for (n = 0; n < SPI_FRAME_SZ; n++)
+        {
+            Tx_frame[n] = Poll_frame[n];
+        }
+        xfer_start(cs_pins(Poll_addr), SPI_FRAME_SZ);
+    }
+    else
+    {
+        chip_deselect();
+        SPI->ICR &= (uint8_t)~SPI_ICR_RXIE;
+        Xfer_done = TRUE;
+        Xfer_busy = FALSE;
+    }
 #endif
 }
-void chip_deselect(void)
+
+#if SPI_ENABLED == SPI_STM8_SLAVE
+/**
+ * @brief  Update the read-back registers.
+ *
+ * @details  Called from the background task. The inactive buffer is filled and
+ *  then made visible to the ISR by the (atomic) write of the buffer index, so
+ *  a response never has a torn 16-bit value.
+ *
+ * @param  pstatus  Pointer to the driver status.
+ */
+void SPI_publish_status(const Driver_status_t * pstatus)
 {
-#ifdef SPI_CTRLR_USE_CS
-    GPIOE->ODR |= (1 << CS_PIN);
-#endif
+    uint8_t sel = (uint8_t)(Readback_sel ^ 1);
+    SPI_readback_t * prb = &Readback[ sel ];
+
+    prb->erpm10 = pstatus->erpm10;
+    prb->vbatt = pstatus->vbatt;
+    prb->faults = pstatus->faults;
+    prb->run_state = pstatus->run_state;
+
+    Readback_sel = sel;
 }
-/** @endcond */
 
 /**
- * @brief  Write a byte onto SPI bus.
+ * @brief  Get the throttle setpoint from the link.
  *
- * @return  Error on time-out.
+ * @details  Called once per control task tick. If the controller has not sent
+ *  a valid frame within SPI_LINK_TMO ticks, the throttle is failed safe to 0.
+ *
+ * @param [out]  pthrottle  Throttle setpoint [0:255]
+ * @return  True if the link has control of the throttle (MODE register set
+ *  to SPI_MODE_RUN)
  */
-void SPI_write(uint8_t data)
+uint8_t SPI_get_throttle(uint8_t * pthrottle)
 {
-    SPI->DR = data;
-    while (! (SPI->SR & SPI_SR_TXE) );
+    uint8_t rx_count = Rx_count;
+
+    if (rx_count != Link_rx_count)
+    {
+        Link_rx_count = rx_count;
+        Link_tmo = 0;
+    }
+    else if (Link_tmo < SPI_LINK_TMO)
+    {
+        Link_tmo += 1;
+    }
+
+    *pthrottle = (Link_tmo < SPI_LINK_TMO) ? Reg_throttle : 0;
+
+    return (uint8_t)(SPI_MODE_RUN == Reg_mode);
 }
 
 /**
- * @brief  Read a byte from SPI bus.
+ * @brief  Test for a write to the FAULT_CLR register.
  *
- * @return  Error on time-out.
+ * @return  True once for each write since the previous call.
  */
-uint8_t SPI_read( void )
+uint8_t SPI_is_fault_clr(void)
 {
-    SPI_write( 0xA5 );
-    while ( ! (SPI->SR & SPI_SR_RXNE) );
-    return SPI->DR;
+    uint8_t clr_count = Reg_fault_clr;
+
+    if (clr_count != Fault_clr_count)
+    {
+        Fault_clr_count = clr_count;
+        return TRUE;
+    }
+    return FALSE;
 }
 
 /**
- * @brief  Read/write byte on SPI bus.
+ * @brief  Get a write to a parameter register.
  *
- * @return  Error on time-out.
+ * @details  Called from the background task, which applies it (Param_set).
+ *  The next write is accepted once it has been taken.
+ *
+ * @param [out]  pid   Parameter ID (param_ID_t)
+ * @param [out]  pval  Value, in range
+ * @return  True once for each write
  */
-uint8_t SPI_read_write(uint8_t data)
+uint8_t SPI_get_param_write(uint8_t * pid, uint16_t * pval)
 {
-    while (! (SPI->SR & SPI_SR_TXE) );
+    if (FALSE == Param_wr_pending)
+    {
+        return FALSE;
+    }
+    *pid = Param_wr_id;
+    *pval = Param_wr_val;
+    Param_wr_pending = FALSE; // after the copy, the ISR holds off until then
 
-    SPI->DR = data;
+    return TRUE;
+}
 
-    while ( ! (SPI->SR & SPI_SR_RXNE) );
+/**
+ * @brief  Test for a write to the COMMIT register.
+ *
+ * @return  True once for each write since the previous call.
+ */
+uint8_t SPI_is_param_commit(void)
+{
+    uint8_t commit_count = Reg_commit;
+
+    if (commit_count != Commit_count)
+    {
+        Commit_count = commit_count;
+        return TRUE;
+    }
+    return FALSE;
+}
 
-    return SPI->DR;
+/**
+ * @brief  Set the address i.e. the slot of this peripheral in the broadcast
+ *  frame.
+ *
+ * @param  addr  Address [0:SPI_BUS_MAX_ESC-1], default SPI_ESC_ADDR
+ */
+void SPI_set_address(uint8_t addr)
+{
+    Esc_addr = addr;
+}
+
+#else // SPI_STM8_MASTER
+
+/**
+ * @brief  Set the throttle of a peripheral, sent in its slot of the next
+ *  broadcast frame.
+ *
+ * @param  addr      Address of the peripheral [0:SPI_BUS_NR_ESC-1]
+ * @param  throttle  Throttle setpoint [0:255]
+ */
+void SPI_bus_set_throttle(uint8_t addr, uint8_t throttle)
+{
+    if (addr < SPI_BUS_NR_ESC)
+    {
+        Bus_throttle[ addr ] = throttle;
+    }
+}
+
+/**
+ * @brief  Set the mode of all peripherals, sent in the next broadcast frame.
+ *
+ * @param  mode  SPI_MODE_STOP or SPI_MODE_RUN
+ */
+void SPI_bus_set_mode(uint8_t mode)
+{
+    Bus_mode = mode;
+}
+
+/**
+ * @brief  Get the latest read-back registers of a peripheral.
+ *
+ * @details  Called from the background task (as is SPI_controld).
+ *
+ * @param  addr  Address of the peripheral [0:SPI_BUS_NR_ESC-1]
+ * @param [out]  prb  Read-back registers
+ */
+void SPI_bus_get_readback(uint8_t addr, SPI_readback_t * prb)
+{
+    if (addr < SPI_BUS_NR_ESC)
+    {
+        *prb = Bus_readback[ addr ];
+    }
+}
+
+/*
+ * Store the response of a peripheral to its previous poll request, the
+ * changes of the fault and run state are printed.
+ */
+static void poll_response(uint8_t addr)
+{
+    SPI_readback_t * prb = &Bus_readback[ addr ];
+    uint16_t val =
+        (uint16_t)Rx_frame[SPI_FRM_DLO] | ((uint16_t)Rx_frame[SPI_FRM_DHI] << 8);
+
+    if (FALSE == frame_check(Rx_frame, SPI_HDR_RSP, SPI_FRAME_SZ))
+    {
+        Err_count += 1;
+        return;
+    }
+
+    switch( Rx_frame[SPI_FRM_ADDR] )
+    {
+    case SPI_REG_ERPM:
+        prb->erpm10 = val;
+        break;
+    case SPI_REG_VBATT:
+        prb->vbatt = val;
+        break;
+    case SPI_REG_FAULTS:
+        if (prb->faults != (uint8_t)val)
+        {
+            printf(">%u F=%02X\r\n", (int)addr, (int)val);
+        }
+        prb->faults = (uint8_t)val;
+        break;
+    case SPI_REG_STATE:
+        if (prb->run_state != (uint8_t)val)
+        {
+            printf(">%u S=%02X\r\n", (int)addr, (int)val);
+        }
+        prb->run_state = (uint8_t)val;
+        break;
+    default:
+        break; // NACK
+    }
 }
 
 /**
  * @brief  Top-level task for SPI controller (master) task.
  *
- * @return  Error on time-out.
+ * @details  Once per period of the SPI rate group, all peripherals are
+ *  updated by one broadcast frame with the throttle of each in its slot, then
+ *  one of them is polled for a read-back register (round-robin over the
+ *  peripherals, then over the registers). The transactions are done in the
+ *  ISR, so this only stores the previous response and starts the next
+ *  transactions, it does not wait on the bus. A transaction that has not
+ *  completed in SPI_XFER_TMO periods is aborted and counted (printed as
+ *  ">T=count"), and the bus restarts with the next broadcast.
  */
 void SPI_controld(void)
 {
-    static uint8_t n;
-    char sbuf[16]; // am i big enuff?
-    uint8_t rxbuf[8] = { 0, 0, 0, 0 } ;
+    static const uint8_t poll_tbl[] =
+    {
+        SPI_REG_ERPM, SPI_REG_VBATT, SPI_REG_FAULTS, SPI_REG_STATE
+    };
+    uint8_t n;
 
-    n = (uint8_t)((n >= 0x30 && n < 126) ? n + 1 : 0x30);
+    if (TRUE == Xfer_busy)
+    {
+        if (Xfer_tmo < SPI_XFER_TMO)
+        {
+            Xfer_tmo += 1;
+            return; // broadcast or poll in progress
+        }
+        // stalled, the bus is restarted by the next broadcast
+        xfer_abort();
+        Tmo_count += 1;
+        printf(">T=%u\r\n", (int)Tmo_count);
+    }
+    Xfer_tmo = 0;
+
+    if (TRUE == Xfer_done)
+    {
+        // response to the request of the previous sweep
+        poll_response(Poll_addr);
 
-// pretty sure it shouldnot be necessary to DI/EI ... all byte read/writes and
-// SPI is not being run in interrupt mode. Not shared variables. EI/DI
-// will tick the motor if the SPI rate is real low!
-//     disableInterrupts();
-    chip_select();
+        Poll_addr += 1;
+        if (Poll_addr >= SPI_BUS_NR_ESC)
+        {
+            Poll_addr = 0;
 
-    rxbuf[0] = SPI_read_write(0xa5); // start of sequence
-    rxbuf[1] = SPI_read_write( n );
-    rxbuf[2] = SPI_read_write('1');
-    rxbuf[3] = SPI_read_write('2');
+            Poll_idx += 1;
+            if (Poll_idx >= sizeof(poll_tbl))
+            {
+                Poll_idx = 0;
+            }
+        }
+    }
 
-    chip_deselect();
-//    enableInterrupts();
-// tmp dump test SPI test data to UART
-    sbuf[0] = '>';
-    sbuf[1] = n;
-    sbuf[2] = isprint( (int)rxbuf[0] ) ? rxbuf[0] : '.' ;
-    sbuf[3] = isprint( (int)rxbuf[1] ) ? rxbuf[1] : '.' ;
-    sbuf[4] = isprint( (int)rxbuf[2] ) ? rxbuf[2] : '.' ;
-    sbuf[5] = isprint( (int)rxbuf[3] ) ? rxbuf[3] : '.' ;
-    sbuf[6] = 0;
-    printf("%s\r\n", sbuf);
-}
-
-
-#if 0
-static void SPI_periphd(void)
-{
-    static int i;
-    char sbuf[16]; // am i big enuff?
-
-    i = (i >= 0x30 && i < 126) ? i+1 : 0x30;
-// tmp dump test SPI test data to UART
-    disableInterrupts();
-    sbuf[0] = '>';
-    sbuf[1] = i;
-    sbuf[2] = isprint( (int)SPI_rxbuf[0] ) ? SPI_rxbuf[0] : '.' ;
-    sbuf[3] = isprint( (int)SPI_rxbuf[1] ) ? SPI_rxbuf[1] : '.' ;
-    sbuf[4] = isprint( (int)SPI_rxbuf[2] ) ? SPI_rxbuf[2] : '.' ;
-    sbuf[5] = isprint( (int)SPI_rxbuf[3] ) ? SPI_rxbuf[3] : '.' ;
-    sbuf[6] = isprint( (int)SPI_rxbuf[4] ) ? SPI_rxbuf[4] : '.' ;
-    sbuf[7] = '$';
-    sbuf[8] = 0;
-    is_SPI_rx = FALSE;
-    memset(SPI_rxbuf, 0, SPI_RX_BUF_SZ); // tmp
-    enableInterrupts();
-
-    strcat(sbuf, "\r\n");
-    UARTputs(sbuf);
+    frame_pack(Poll_frame, SPI_HDR_REQ, poll_tbl[ Poll_idx ], 0);
+    Poll_pending = TRUE;
+
+    Tx_frame[SPI_FRM_HDR] = SPI_HDR_BCAST;
+    Tx_frame[SPI_FRM_BC_N] = SPI_BUS_NR_ESC;
+    Tx_frame[SPI_FRM_BC_MODE] = Bus_mode;
+
+    for (n = 0; n < SPI_BUS_NR_ESC; n++)
+    {
+        Tx_frame[ SPI_FRM_BC_THR + n ] = Bus_throttle[ n ];
+    }
+    Tx_frame[ SPI_BCAST_SZ( SPI_BUS_NR_ESC ) - 1 ] =
+        Telem_crc8(Tx_frame, SPI_BCAST_SZ( SPI_BUS_NR_ESC ) - 1);
+
+    Xfer_done = FALSE;
+    Xfer_busy = TRUE;
+
+    SPI->ICR |= SPI_ICR_RXIE;
+    xfer_start(SPI_CS_ALL, SPI_BCAST_SZ( SPI_BUS_NR_ESC ));
 }
-#endif
+#endif // SPI_STM8_SLAVE
 
 #endif // SPI_ENABLED
 
+/**@}*/ // defgroup
@@ -0,0 +1,275 @@
+/**
+  ******************************************************************************
+  * @file startup.c
+  * @brief Rotor alignment and startup ramp profile
+  * @author Neidermeier
+  * @version
+  * @date
+  ******************************************************************************
+  */
+/**
+ * \defgroup startup Startup
+ * @brief Rotor alignment followed by an acceleration profile of commutation
+ *  period and duty-cycle, until the control error is plausible for the
+ *  hand-off to the run-time timing control. With the flying start, the
+ *  back-EMF of the rotor is sensed first, and if it is turning the commutation
+ *  is resumed at its speed and position without the alignment and profile.
+ * @{
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "startup.h"
+#include "driver.h"
+#include "sequence.h"
+
+
+/* Private types -------------------------------------------------------------*/
+
+/*
+ * Segment of the acceleration profile, from the commutation period and duty-
+ * cycle at its start to those at the start of the next segment. The slopes
+ * are Q8 per control tick.
+ */
+typedef struct
+{
+  uint8_t  ticks;   // duration (control ticks)
+  uint8_t  dc;      // duty-cycle at the start of the segment
+  uint16_t period;  // commutation period at the start of the segment
+  int16_t  d_slope;
+  int16_t  p_slope;
+} startup_seg_t;
+
+
+/* Private defines -----------------------------------------------------------*/
+
+/*
+ * A segment from the breakpoints at its start and end, the slopes computed by
+ * the compiler so the profile data is just the breakpoints (period, dc).
+ */
+#define STARTUP_SEG( _T_, _P0_, _D0_, _P1_, _D1_ ) \
+  { _T_, _D0_, _P0_, \
+    (int16_t)( ( ( (_D1_) - (_D0_) ) * 256L ) / (_T_) ), \
+    (int16_t)( ( ( (int32_t)(_P1_) - (_P0_) ) * 256L ) / (_T_) ) }
+
+#define STARTUP_NR_SEGS  (uint8_t)( sizeof(Profile) / sizeof(startup_seg_t) )
+
+// duty-cycle in counts of the nominal PWM period
+#define STARTUP_DC( _PCNT_ )  (uint8_t)( ( _PCNT_ * PWM_100PCNT ) / 100.0 )
+
+/*
+ * Alignment: one sector is energized for long enough that the rotor settles
+ * (propeller inertia) before the first commutation.
+ */
+#define STARTUP_ALIGN_TICKS   64    // control ticks (~64 ms)
+#define STARTUP_ALIGN_DC      STARTUP_DC( 10.0 )
+
+/*
+ * Flying start: the back-EMF is sensed for up to this time, which is enough
+ * for the lock at the lowest speed measured (driver.c). The rotor is aligned
+ * if it is not turning (or too slowly).
+ */
+#define STARTUP_CATCH_TICKS   40    // control ticks (~40 ms)
+
+// the profile is retried from the alignment if the hand-off is not plausible
+#define STARTUP_NR_RETRY      2
+
+/*
+ * Profile breakpoints (commutation period, TIM3 counts of 1/4 sector) on the
+ * constant acceleration curve: the speed is linear in time i.e.
+ *   period = P0 / ( 1 + t * alpha / w0 )
+ * with alpha ~600 rad/s^2 from ~540 RPM, a fraction of the torque at the
+ * profile duty-cycle so the rotor keeps up under propeller load.
+ */
+#define STARTUP_PD_0   (0x0C00 * CTIME_SCALAR) // BLDC_OL_TM_LO_SPD
+#define STARTUP_PD_1   (0x0994 * CTIME_SCALAR)
+#define STARTUP_PD_2   (0x07F9 * CTIME_SCALAR)
+#define STARTUP_PD_3   (0x06D3 * CTIME_SCALAR)
+#define STARTUP_PD_4   (0x05F8 * CTIME_SCALAR)
+
+
+/* Private variables ---------------------------------------------------------*/
+
+static const startup_seg_t Profile[] =
+{
+  STARTUP_SEG( 24, STARTUP_PD_0, STARTUP_DC( 10.4 ), STARTUP_PD_1, STARTUP_DC( 10.8 ) ),
+  STARTUP_SEG( 24, STARTUP_PD_1, STARTUP_DC( 10.8 ), STARTUP_PD_2, STARTUP_DC( 11.2 ) ),
+  STARTUP_SEG( 24, STARTUP_PD_2, STARTUP_DC( 11.2 ), STARTUP_PD_3, STARTUP_DC( 11.6 ) ),
+  STARTUP_SEG( 24, STARTUP_PD_3, STARTUP_DC( 11.6 ), STARTUP_PD_4, STARTUP_DC( 12.0 ) ),
+};
+
+static uint8_t  Phase;   // startup_phase_t
+static uint8_t  Seg;     // segment of the profile
+static uint16_t Ticks;   // control ticks in the phase, or in the segment
+static uint8_t  Retries;
+
+#ifdef FLYING_START_ENABLED
+static uint8_t  Catch_on_start = TRUE; // the flying start also precedes a start
+#endif
+
+
+/* Public functions ---------------------------------------------------------*/
+
+/**
+ * @brief  Re-arm the startup, from the flying start (if enabled) or else the
+ *  alignment.
+ *
+ * @details  Called on system reset (BL_reset), and on the recovery from a
+ *  loss of sync which is always from the flying start.
+ *
+ * @param  recover  True on the recovery from a loss of sync
+ */
+void Startup_reset(uint8_t recover)
+{
+#ifdef FLYING_START_ENABLED
+  Driver_set_catch(FALSE);
+  Phase = (FALSE != recover || FALSE != Catch_on_start) ? STARTUP_CATCH : STARTUP_ALIGN;
+#else
+  (void)recover;
+  Phase = STARTUP_ALIGN;
+#endif
+  Seg = 0;
+  Ticks = 0;
+  Retries = 0;
+}
+
+#ifdef FLYING_START_ENABLED
+/**
+ * @brief  Set whether a start (from BL_reset) is preceded by the flying start.
+ *
+ * @details  Takes effect at the next reset. The recovery from a loss of sync
+ *  is from the flying start either way.
+ *
+ * @param  enable  True for the flying start on a start (default)
+ */
+void Startup_set_catch_on_start(uint8_t enable)
+{
+  Catch_on_start = enable;
+}
+#endif
+
+/**
+ * @brief  Accessor for the startup phase.
+ *
+ * @details  The commutation sequence holds the sector during the alignment.
+ *
+ * @return  Startup phase
+ */
+startup_phase_t Startup_get_phase(void)
+{
+  return (startup_phase_t)Phase;
+}
+
+/**
+ * @brief  Startup update, at the control rate while the motor is running.
+ *
+ * @details  The profile is interpolated along the segments. The hand-off is
+ *  as soon as the control error is plausible (Seq_get_timing_error_p), and if
+ *  it is not by the end of the profile the rotor is re-aligned, then handed
+ *  off anyway after the retries (the stall and desync faults take over).
+ *  With the flying start the bridge is off until the back-EMF of the rotor is
+ *  locked, then handed off at the measured commutation period.
+ *
+ * @param [out]  pperiod  Commutation period
+ * @param [out]  pduty    Duty-cycle
+ *
+ * @return  TRUE while the startup has the commutation period and duty-cycle
+ */
+uint8_t Startup_update(uint16_t * pperiod, uint16_t * pduty)
+{
+  const startup_seg_t * pseg;
+
+#ifdef FLYING_START_ENABLED
+  if (STARTUP_CATCH == Phase)
+  {
+    uint16_t period;
+    uint8_t locked;
+
+    if (0 == Ticks)
+    {
+      Driver_set_catch(TRUE);
+    }
+    locked = Driver_get_catch(&period);
+
+    // the commutation timer follows the rotor once the period is measured
+    if (0 != period)
+    {
+      *pperiod = period;
+    }
+    *pduty = 0;
+
+    Ticks += 1;
+
+    if (FALSE != locked)
+    {
+      Driver_set_catch(FALSE);
+      Phase = STARTUP_DONE;
+      return FALSE;
+    }
+    if (Ticks < STARTUP_CATCH_TICKS)
+    {
+      return TRUE;
+    }
+    // not turning
+    Driver_set_catch(FALSE);
+    Phase = STARTUP_ALIGN;
+    Ticks = 0;
+  }
+#endif
+  if (STARTUP_ALIGN == Phase)
+  {
+    *pperiod = Profile[0].period;
+    *pduty = STARTUP_ALIGN_DC;
+
+    Ticks += 1;
+    if (Ticks >= STARTUP_ALIGN_TICKS)
+    {
+      Phase = STARTUP_RAMP;
+      Ticks = 0;
+    }
+    return TRUE;
+  }
+
+  if (STARTUP_RAMP != Phase)
+  {
+    return FALSE;
+  }
+
+  if ( 0 == Seq_get_timing_error_p() )
+  {
+    Phase = STARTUP_DONE;
+    return FALSE;
+  }
+
+  if (Ticks >= Profile[ Seg ].ticks)
+  {
+    Ticks = 0;
+    Seg += 1;
+
+    if (Seg >= STARTUP_NR_SEGS)
+    {
+      Seg = 0;
+
+      if (Retries < STARTUP_NR_RETRY)
+      {
+        Retries += 1;
+        Phase = STARTUP_ALIGN;
+
+        *pperiod = Profile[0].period;
+        *pduty = STARTUP_ALIGN_DC;
+        return TRUE;
+      }
+      Phase = STARTUP_DONE;
+      return FALSE;
+    }
+  }
+  pseg = &Profile[ Seg ];
+
+  *pperiod = pseg->period + (int16_t)( ( (int32_t)pseg->p_slope * Ticks ) >> 8 );
+  *pduty = pseg->dc + (int16_t)( ( (int32_t)pseg->d_slope * Ticks ) >> 8 );
+
+  Ticks += 1;
+
+  return TRUE;
+}
+
+/**@}*/ // defgroup
@@ -14,6 +14,9 @@
 #include "stm8s_it.h"
 #include "system.h"
 #include "driver.h"
+#include "mcu_stm8s.h"
+#include "isr_prof.h"
+#include "spi_stm8s.h"
 
 
 /** @addtogroup Template_Project
@@ -136,7 +139,7 @@ INTERRUPT_HANDLER(EXTI_PORTC_IRQHandler, 5)
   */
 INTERRUPT_HANDLER(EXTI_PORTD_IRQHandler, 6)
 {
-    if (GPIO_ReadInputPin(SERVO_GPIO_PORT, SERVO_GPIO_PIN))
+    if ( BOARD_SERVO_INPUT() )
     {
 //    GPIO_WriteHigh(LED_GPIO_PORT, (GPIO_Pin_TypeDef)LED_GPIO_PIN);
     }
@@ -205,9 +208,13 @@ INTERRUPT_HANDLER(EXTI_PORTE_IRQHandler, 7)
   */
 INTERRUPT_HANDLER(SPI_IRQHandler, 10)
 {
-  /* In order to detect unexpected events during development,
-     it is recommended to set a breakpoint on the following instruction.
-  */
+#if SPI_ENABLED
+  ISR_PROF_ENTRY(ISR_PROF_SPI);
+
+  SPI_on_IRQ();
+
+  ISR_PROF_EXIT(ISR_PROF_SPI);
+#endif
 }
 
 /**
@@ -217,30 +224,46 @@ INTERRUPT_HANDLER(SPI_IRQHandler, 10)
   */
 INTERRUPT_HANDLER(TIM1_UPD_OVF_TRG_BRK_IRQHandler, 11)
 {
-#if defined ( S003_DEV )
+#if BOARD_COMM_TIM == 1
+    ISR_PROF_ENTRY(ISR_PROF_COMM);
+
     Driver_Step();
 
     // reset interrupt flag
-    TIM1_ClearITPendingBit(TIM1_IT_UPDATE);
-    TIM1_ClearFlag(TIM1_FLAG_UPDATE);
+    BOARD_TIM_CLR_FLAGS( COMM_TIM, COMM_TIM_UIF );
+
+    ISR_PROF_EXIT(ISR_PROF_COMM);
 #endif
-#if defined(S105_DEV) || defined (S105_DISCOVERY)
+#if BOARD_PWM_TIM == 1
+#if defined( ADC_HW_TRIGGER )
+    ISR_PROF_ENTRY(ISR_PROF_PWM);
 
-    static const int Frame_count = 4;
+// ISR rate is divided by TIM1 repetition counter, ADC is started by TRGO
+    Driver_Update();
+#else
     static uint8_t frame_counter = 0;
+    ISR_PROF_ENTRY(ISR_PROF_PWM);
 
-// note pre-increment on variable 
-    if ( ++frame_counter >= Frame_count )
+// note pre-increment on variable, the count depends on the PWM rate
+    if ( ++frame_counter >= PWM_get_frames_per_upd() )
     {
         frame_counter = 0;
 
         Driver_Update();
     }
     Driver_on_PWM_edge(); // starts ADC conversion
+#endif
 
     // reset interrupt flag
-    TIM1_ClearITPendingBit(TIM1_IT_UPDATE);
-    TIM1_ClearFlag(TIM1_FLAG_UPDATE);
+    BOARD_TIM_CLR_FLAGS( PWM_TIM, PWM_TIM_UIF );
+
+    ISR_PROF_EXIT(ISR_PROF_PWM);
+#endif
+#if BOARD_CAP_TIM == 1 && defined( HAS_SERVO_INPUT )
+    // capture timer overflow, extends the measurement of the servo period
+    Driver_on_capture_ovf();
+
+    BOARD_TIM_CLR_FLAGS( CAP_TIM, CAP_TIM_UIF );
 #endif
 }
 
@@ -251,21 +274,38 @@ INTERRUPT_HANDLER(TIM1_UPD_OVF_TRG_BRK_IRQHandler, 11)
   */
 INTERRUPT_HANDLER(TIM1_CAP_COM_IRQHandler, 12)
 {
-#if defined( S105_DISCOVERY ) && defined( HAS_SERVO_INPUT )
-    if ( 0 != TIM1_GetFlagStatus(TIM1_FLAG_CC3) )
+#if BOARD_COMM_TIM == 1
+    // mid-sector events of the commutation timer, see TIM3_CAP_COM_IRQHandler
+    uint8_t pending = COMM_TIM->SR1 & COMM_TIM->IER;
+
+    ISR_PROF_ENTRY(ISR_PROF_COMM);
+
+    if ( 0 != (pending & COMM_TIM_CC1IF) )
+    {
+      BOARD_TIM_CLR_FLAGS( COMM_TIM, COMM_TIM_CC1IF );
+      Driver_on_sector_event(DRIVER_EVT_QTR1);
+    }
+    if ( 0 != (pending & COMM_TIM_CC2IF) )
+    {
+      BOARD_TIM_CLR_FLAGS( COMM_TIM, COMM_TIM_CC2IF );
+      Driver_on_sector_event(DRIVER_EVT_QTR3);
+    }
+
+    ISR_PROF_EXIT(ISR_PROF_COMM);
+#endif
+#if BOARD_CAP_TIM == 1 && defined( HAS_SERVO_INPUT )
+    if ( 0 != (CAP_TIM->SR1 & CAP_FALL_IF) )
     {
 //        GPIOD->ODR &=  ~(1<<LED); // clear test pin
         Driver_on_capture_fall();
 
-        TIM1_ClearITPendingBit(TIM1_IT_CC3);
-        TIM1_ClearFlag(TIM1_FLAG_CC3);
+        BOARD_TIM_CLR_FLAGS( CAP_TIM, CAP_FALL_IF );
     }
-    else if ( 0 != TIM1_GetFlagStatus(TIM1_FLAG_CC4) )
+    else if ( 0 != (CAP_TIM->SR1 & CAP_RISE_IF) )
     {
 //        GPIOD->ODR |=  (1<<LED); // set test pin
         Driver_on_capture_rise();
-        TIM1_ClearITPendingBit(TIM1_IT_CC4);
-        TIM1_ClearFlag(TIM1_FLAG_CC4);
+        BOARD_TIM_CLR_FLAGS( CAP_TIM, CAP_RISE_IF );
     }
 #endif
 }
@@ -303,11 +343,12 @@ INTERRUPT_HANDLER(TIM1_CAP_COM_IRQHandler, 12)
   */
  INTERRUPT_HANDLER(TIM2_UPD_OVF_BRK_IRQHandler, 13)
 {
-    static const int Frame_count = 4;
+#if BOARD_PWM_TIM == 2
     static uint8_t frame_counter = 0;
+    ISR_PROF_ENTRY(ISR_PROF_PWM);
 
-// note pre-increment on variable 
-    if ( ++frame_counter >= Frame_count )
+// note pre-increment on variable, the count depends on the PWM rate
+    if ( ++frame_counter >= PWM_get_frames_per_upd() )
     {
         frame_counter = 0;
 
@@ -317,8 +358,16 @@ INTERRUPT_HANDLER(TIM1_CAP_COM_IRQHandler, 12)
     Driver_on_PWM_edge(); // starts ADC conversion
 
     // reset interrupt flag
-    TIM2_ClearITPendingBit(TIM2_IT_UPDATE); // TIM2 interrupt sources defined in stm8s_tim2.h
-//    TIM2->SR1 &= ~ TIM2_SR1_UIF; // Update Interrupt Flag mask defined in stm8s.h
+    BOARD_TIM_CLR_FLAGS( PWM_TIM, PWM_TIM_UIF );
+
+    ISR_PROF_EXIT(ISR_PROF_PWM);
+#endif
+#if BOARD_CAP_TIM == 2 && defined( HAS_SERVO_INPUT )
+    // capture timer overflow, extends the measurement of the servo period
+    Driver_on_capture_ovf();
+
+    BOARD_TIM_CLR_FLAGS( CAP_TIM, CAP_TIM_UIF );
+#endif
 }
 
 /**
@@ -328,21 +377,19 @@ INTERRUPT_HANDLER(TIM1_CAP_COM_IRQHandler, 12)
   */
  INTERRUPT_HANDLER(TIM2_CAP_COM_IRQHandler, 14)
  {
-#if defined( S105_DEV ) && defined( HAS_SERVO_INPUT )
+#if BOARD_CAP_TIM == 2 && defined( HAS_SERVO_INPUT )
 
-    if ( 0 != TIM2_GetFlagStatus(TIM2_FLAG_CC1) )
+    if ( 0 != (CAP_TIM->SR1 & CAP_RISE_IF) )
     {
         Driver_on_capture_rise();
 
-        TIM2_ClearITPendingBit(TIM2_IT_CC1);
-        TIM2_ClearFlag(TIM2_FLAG_CC1);
+        BOARD_TIM_CLR_FLAGS( CAP_TIM, CAP_RISE_IF );
     }
-    else if ( 0 != TIM2_GetFlagStatus(TIM2_FLAG_CC2) )
+    else if ( 0 != (CAP_TIM->SR1 & CAP_FALL_IF) )
     {
         Driver_on_capture_fall();
 
-        TIM2_ClearITPendingBit(TIM2_IT_CC2);
-        TIM2_ClearFlag(TIM2_FLAG_CC2);
+        BOARD_TIM_CLR_FLAGS( CAP_TIM, CAP_FALL_IF );
     }
 #endif
  }
@@ -357,11 +404,14 @@ INTERRUPT_HANDLER(TIM1_CAP_COM_IRQHandler, 12)
   */
  INTERRUPT_HANDLER(TIM3_UPD_OVF_BRK_IRQHandler, 15)
  {
-#if defined( S105_DEV ) || defined(S105_DISCOVERY)
+#if BOARD_COMM_TIM == 3
+    ISR_PROF_ENTRY(ISR_PROF_COMM);
+
     Driver_Step();
     // reset interrupt flag
-//    TIM3_ClearITPendingBit(TIM3_IT_UPDATE);
-    TIM3->SR1 &= ~TIM3_SR1_UIF;
+    BOARD_TIM_CLR_FLAGS( COMM_TIM, COMM_TIM_UIF );
+
+    ISR_PROF_EXIT(ISR_PROF_COMM);
 #endif
  }
 
@@ -372,9 +422,25 @@ INTERRUPT_HANDLER(TIM1_CAP_COM_IRQHandler, 12)
   */
  INTERRUPT_HANDLER(TIM3_CAP_COM_IRQHandler, 16)
  {
-  /* In order to detect unexpected events during development,
-     it is recommended to set a breakpoint on the following instruction.
-  */
+#if BOARD_COMM_TIM == 3
+    // the flags are set on compare match whether or not the interrupt is enabled
+    uint8_t pending = COMM_TIM->SR1 & COMM_TIM->IER;
+
+    ISR_PROF_ENTRY(ISR_PROF_COMM);
+
+    if ( 0 != (pending & COMM_TIM_CC1IF) )
+    {
+      BOARD_TIM_CLR_FLAGS( COMM_TIM, COMM_TIM_CC1IF );
+      Driver_on_sector_event(DRIVER_EVT_QTR1);
+    }
+    if ( 0 != (pending & COMM_TIM_CC2IF) )
+    {
+      BOARD_TIM_CLR_FLAGS( COMM_TIM, COMM_TIM_CC2IF );
+      Driver_on_sector_event(DRIVER_EVT_QTR3);
+    }
+
+    ISR_PROF_EXIT(ISR_PROF_COMM);
+#endif
  }
 #endif /* (STM8S208) || (STM8S207) || (STM8S105) || (STM8AF62Ax) || (STM8AF52Ax) || (STM8AF626x) */
 
@@ -387,9 +453,7 @@ INTERRUPT_HANDLER(TIM1_CAP_COM_IRQHandler, 12)
   */
  INTERRUPT_HANDLER(UART1_TX_IRQHandler, 17)
  {
-    /* In order to detect unexpected events during development,
-       it is recommended to set a breakpoint on the following instruction.
-    */
+    MCU_on_UART_TX();
  }
 
 /**
@@ -399,9 +463,7 @@ INTERRUPT_HANDLER(TIM1_CAP_COM_IRQHandler, 12)
   */
  INTERRUPT_HANDLER(UART1_RX_IRQHandler, 18)
  {
-    /* In order to detect unexpected events during development,
-       it is recommended to set a breakpoint on the following instruction.
-    */
+    MCU_on_UART_RX();
  }
 #endif /* (STM8S208) || (STM8S207) || (STM8S103) || (STM8S001) || (STM8S903) || (STM8AF62Ax) || (STM8AF52Ax) */
 
@@ -451,9 +513,7 @@ INTERRUPT_HANDLER(I2C_IRQHandler, 19)
   */
  INTERRUPT_HANDLER(UART2_TX_IRQHandler, 20)
  {
-    /* In order to detect unexpected events during development,
-       it is recommended to set a breakpoint on the following instruction.
-    */
+    MCU_on_UART_TX();
  }
 
 /**
@@ -463,9 +523,7 @@ INTERRUPT_HANDLER(I2C_IRQHandler, 19)
   */
  INTERRUPT_HANDLER(UART2_RX_IRQHandler, 21)
  {
-    /* In order to detect unexpected events during development,
-       it is recommended to set a breakpoint on the following instruction.
-    */
+    MCU_on_UART_RX();
  }
 #endif /* (STM8S105) || (STM8AF626x) */
 
@@ -515,9 +573,13 @@ INTERRUPT_HANDLER(I2C_IRQHandler, 19)
   */
  INTERRUPT_HANDLER(ADC1_IRQHandler, 22)
  {
+    ISR_PROF_ENTRY(ISR_PROF_ADC);
+
     Driver_on_ADC_conv();
 
-    ADC1_ClearFlag(ADC1_FLAG_EOC);
+    ADC1->CSR &= (uint8_t)~ADC1_CSR_EOC;
+
+    ISR_PROF_EXIT(ISR_PROF_ADC);
  }
 #endif /* (STM8S208) || (STM8S207) || (STM8AF52Ax) || (STM8AF62Ax) */
 
@@ -0,0 +1,110 @@
+/**
+  ******************************************************************************
+  * @file telem.c
+  * @brief Binary telemetry frame
+  * @author Neidermeier
+  * @version
+  * @date
+  ******************************************************************************
+  */
+/**
+ * \defgroup telem Telemetry
+ * @brief Fixed-layout binary telemetry frame sent to the debug serial port.
+ * @{
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h> // putchar
+#include "telem.h"
+
+
+/* Private defines -----------------------------------------------------------*/
+
+#define PUT_U16( _P_, _V_ )  (_P_)[0] = (uint8_t)(_V_); (_P_)[1] = (uint8_t)((_V_) >> 8)
+
+
+/* Private variables ---------------------------------------------------------*/
+
+static uint8_t Telem_seq;
+static uint8_t Telem_frame[ TELEM_FRAME_SZ ];
+
+
+/* Public functions ---------------------------------------------------------*/
+
+/**
+ * @brief  Compute the CRC8 of a buffer.
+ *
+ * @details  Bitwise, no table, as flash is more precious than the cycles.
+ *
+ * @param  pbuf  Pointer to buffer.
+ * @param  len   Number of bytes.
+ * @return  CRC8 (poly TELEM_CRC8_POLY, initial 0)
+ */
+uint8_t Telem_crc8(const uint8_t * pbuf, uint8_t len)
+{
+  uint8_t crc = 0;
+
+  while (len-- > 0)
+  {
+    uint8_t n;
+    crc ^= *pbuf++;
+
+    for (n = 0; n < 8; n++)
+    {
+      if (0 != (crc & 0x80))
+      {
+        crc = (uint8_t)((crc << 1) ^ TELEM_CRC8_POLY);
+      }
+      else
+      {
+        crc = (uint8_t)(crc << 1);
+      }
+    }
+  }
+  return crc;
+}
+
+/**
+ * @brief  Pack a telemetry sample into a frame.
+ *
+ * @param [out]  pframe   Buffer of TELEM_FRAME_SZ bytes.
+ * @param        seq      Sequence counter.
+ * @param        psample  Pointer to the sample.
+ */
+void Telem_pack(uint8_t * pframe, uint8_t seq, const telem_sample_t * psample)
+{
+  pframe[0] = TELEM_SYNC;
+  pframe[1] = seq;
+  PUT_U16( &pframe[2], psample->comm_period );
+  PUT_U16( &pframe[4], psample->pwm_dc );
+  PUT_U16( &pframe[6], psample->vsystem );
+  pframe[8] = psample->faults;
+  PUT_U16( &pframe[9], psample->bemf_r );
+  PUT_U16( &pframe[11], psample->bemf_f );
+  PUT_U16( &pframe[13], (uint16_t)psample->timing_error );
+  PUT_U16( &pframe[15], psample->erpm10 );
+  pframe[TELEM_FRAME_SZ - 1] = Telem_crc8(pframe, TELEM_FRAME_SZ - 1);
+}
+
+/**
+ * @brief  Send a telemetry frame to the serial port.
+ *
+ * @details  Called from the background task. The characters go to the UART TX
+ *  ring buffer, so that there is no formatting or blocking.
+ *
+ * @param  psample  Pointer to the sample.
+ */
+void Telem_send(const telem_sample_t * psample)
+{
+  uint8_t n;
+
+  Telem_pack(Telem_frame, Telem_seq, psample);
+  Telem_seq += 1;
+
+  for (n = 0; n < TELEM_FRAME_SZ; n++)
+  {
+    putchar(Telem_frame[n]);
+  }
+}
+
+/**@}*/ // defgroup
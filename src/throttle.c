@@ -0,0 +1,244 @@
+/**
+  ******************************************************************************
+  * @file throttle.c
+  * @brief Throttle input protocols (servo PWM, Oneshot125, Multishot)
+  * @author Neidermeier
+  * @version
+  * @date
+  ******************************************************************************
+  */
+/**
+ * \defgroup throttle Throttle Input
+ * @brief Decode and auto-detect the throttle signal on the capture input.
+ * @{
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "throttle.h"
+
+#if defined( HAS_SERVO_INPUT )
+
+/* Private defines -----------------------------------------------------------*/
+
+#define US( _T_ )  (uint16_t)( (_T_) * THR_TICKS_PER_US )
+
+// Q8 scale from the span of the raw value to [0:255], (raw * K) fits in 16-bits
+#define THR_K( _SPAN_ )  (uint16_t)( 0xFFFFUL / (_SPAN_) )
+
+// consecutive frames of the same protocol to lock the detection
+#define THR_DETECT_CNT   8
+
+// consecutive frames not plausible for the locked protocol to unlock
+#define THR_GLITCH_MAX   16
+
+// control task frames (~1 ms) with no valid frame before the signal is lost
+#define THR_LOSS_TMO     100
+
+
+/* Private types -------------------------------------------------------------*/
+
+/**
+ * @brief Plausible range and scaling of the pulse width (capture counts)
+ */
+typedef struct
+{
+  uint16_t lo;    /**< minimum plausible raw value */
+  uint16_t hi;    /**< maximum plausible raw value */
+  uint16_t zero;  /**< raw value at 0 throttle */
+  uint16_t span;  /**< raw value range to full throttle */
+  uint16_t k;     /**< THR_K( span ) */
+} thr_proto_desc_t;
+
+
+/* Private variables ---------------------------------------------------------*/
+
+static const thr_proto_desc_t Proto_tbl[ THR_PROTO_NONE ] =
+{
+  { US(900), US(2100), US(1000), US(1000), THR_K( US(1000) ) }, // SERVO
+  { US(115), US(265),  US(125),  US(125),  THR_K( US(125) ) },  // ONESHOT125
+  { US(4),   US(27),   US(5),    US(20),   THR_K( US(20) ) },   // MULTISHOT
+};
+
+/*
+ * Updated in the capture ISR. The throttle is scaled in the ISR so the value
+ * read by the control task is a byte i.e. atomic.
+ */
+static uint8_t Proto;           // thr_proto_t, locked protocol
+static uint8_t Proto_cand;      // thr_proto_t, candidate during detection
+static uint8_t Detect_count;
+static uint8_t Glitch_count;
+static uint8_t Throttle;
+static uint8_t Rx_count;        // frames accepted
+static uint8_t Loss_ack;        // copy of Loss_req, the restart is done
+
+// control task copies for the signal loss timeout
+static uint8_t Loss_rx_count;
+static uint8_t Loss_tmo;
+static uint8_t Loss_req;        // incremented to request the restart of the detection
+
+
+/* Private functions ---------------------------------------------------------*/
+
+/*
+ * Scale the raw value to [0:255], clipped to the range of the protocol
+ */
+static uint8_t scale(const thr_proto_desc_t * pdesc, uint16_t raw)
+{
+  uint16_t t16;
+
+  if (raw <= pdesc->zero)
+  {
+    return 0;
+  }
+  t16 = raw - pdesc->zero;
+
+  if (t16 > pdesc->span)
+  {
+    t16 = pdesc->span;
+  }
+  t16 = (uint16_t)(t16 * pdesc->k) >> 8;
+
+  return (t16 > U8_MAX) ? U8_MAX : (uint8_t)t16;
+}
+
+/*
+ * Detection and glitch filter: the protocol is locked after a run of frames
+ * of the same type, then a frame only updates the throttle if it is plausible
+ * for the locked protocol. A run of implausible frames restarts the detection,
+ * as does the signal loss, which is requested by the control task so that the
+ * detection state is only written in the capture ISR.
+ */
+static void update(uint8_t proto, uint16_t raw)
+{
+  if (Loss_req != Loss_ack)
+  {
+    Loss_ack = Loss_req;
+    Proto = THR_PROTO_NONE;
+    Proto_cand = THR_PROTO_NONE;
+    Detect_count = 0;
+  }
+
+  if (THR_PROTO_NONE == Proto)
+  {
+    if (THR_PROTO_NONE != proto && proto == Proto_cand)
+    {
+      Detect_count += 1;
+
+      if (Detect_count >= THR_DETECT_CNT)
+      {
+        Proto = proto;
+        Glitch_count = 0;
+      }
+    }
+    else
+    {
+      Proto_cand = proto;
+      Detect_count = 0;
+    }
+  }
+  else if (proto == Proto)
+  {
+    Glitch_count = 0;
+    Throttle = scale(&Proto_tbl[ proto ], raw);
+    Rx_count += 1;
+  }
+  else
+  {
+    Glitch_count += 1;
+
+    if (Glitch_count >= THR_GLITCH_MAX)
+    {
+      Proto = THR_PROTO_NONE;
+      Proto_cand = THR_PROTO_NONE;
+      Detect_count = 0;
+    }
+  }
+}
+
+
+/* Public functions ---------------------------------------------------------*/
+
+/**
+ * @brief  Reset the protocol detection.
+ */
+void Throttle_init(void)
+{
+  Proto = THR_PROTO_NONE;
+  Proto_cand = THR_PROTO_NONE;
+  Detect_count = 0;
+  Glitch_count = 0;
+  Throttle = 0;
+  Loss_tmo = THR_LOSS_TMO;
+  Loss_req = Loss_ack;
+}
+
+/**
+ * @brief  Captured pulse of a pulse width protocol (ISR context).
+ *
+ * @param  width  Pulse width in capture timer counts.
+ */
+void Throttle_on_pulse(uint16_t width)
+{
+  uint8_t proto = THR_PROTO_NONE;
+  uint8_t n;
+
+  for (n = 0; n < THR_PROTO_NONE; n++)
+  {
+    if (width >= Proto_tbl[n].lo && width <= Proto_tbl[n].hi)
+    {
+      proto = n;
+      break;
+    }
+  }
+  update(proto, width);
+}
+
+/**
+ * @brief  Get the throttle input.
+ *
+ * @details  Called once per control task frame. If no frame is accepted
+ *  within THR_LOSS_TMO frames, the signal is lost and the detection restarts
+ *  (at the next frame, in the capture ISR).
+ *
+ * @param [out]  pthrottle  Throttle setpoint [0:255]
+ * @return  True if a protocol is locked and the signal is present
+ */
+uint8_t Throttle_get(uint8_t * pthrottle)
+{
+  uint8_t rx_count = Rx_count;
+
+  if (rx_count != Loss_rx_count)
+  {
+    Loss_rx_count = rx_count;
+    Loss_tmo = 0;
+  }
+  else if (Loss_tmo < THR_LOSS_TMO)
+  {
+    Loss_tmo += 1;
+
+    if (THR_LOSS_TMO == Loss_tmo)
+    {
+      Loss_req += 1;
+    }
+  }
+
+  if (Loss_tmo >= THR_LOSS_TMO || THR_PROTO_NONE == Proto)
+  {
+    return FALSE;
+  }
+
+  *pthrottle = Throttle;
+  return TRUE;
+}
+
+/**
+ * @brief  Accessor for the detected protocol.
+ */
+thr_proto_t Throttle_get_proto(void)
+{
+  return (thr_proto_t)Proto;
+}
+
+#endif // HAS_SERVO_INPUT
+
+/**@}*/ // defgroup
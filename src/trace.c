@@ -0,0 +1,126 @@
+/**
+  ******************************************************************************
+  * @file trace.c
+  * @brief Per-commutation RAM trace buffer
+  * @author Neidermeier
+  * @version
+  * @date
+  ******************************************************************************
+  */
+/**
+ * \defgroup trace Trace
+ * @brief Circular buffer of the commutation state, frozen on fault for a
+ *  post-mortem dump to the debug serial port.
+ * @{
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stddef.h> // NULL
+#include "trace.h"
+
+#if defined( TRACE_ENABLED )
+
+/* Private variables ---------------------------------------------------------*/
+
+static trace_entry_t Trace_buf[ TRACE_DEPTH ];
+
+static uint8_t Trace_head;   // index of the next entry i.e. of the oldest entry
+static uint8_t Trace_frozen; // no more writes until the dump is complete
+
+static uint8_t Dump_count;   // entries remaining to dump
+
+
+/* Public functions ---------------------------------------------------------*/
+
+/**
+ * @brief  Get the next entry of the trace buffer to fill (ISR context).
+ *
+ * @details  The caller writes the fields in place, so the cost is only the
+ *  index update. The oldest entry is overwritten.
+ *
+ * @return  Pointer to the entry, or NULL if the trace is frozen
+ */
+trace_entry_t * Trace_next(void)
+{
+  trace_entry_t * pentry;
+
+  if (FALSE != Trace_frozen)
+  {
+    return NULL;
+  }
+  pentry = &Trace_buf[ Trace_head ];
+
+  Trace_head = (uint8_t)((Trace_head + 1) & TRACE_DEPTH_MSK);
+
+  return pentry;
+}
+
+/**
+ * @brief  Stop the trace capture (called on fault).
+ *
+ * @details  The trace stays frozen until it has been dumped.
+ */
+void Trace_freeze(void)
+{
+  Trace_frozen = TRUE;
+}
+
+/**
+ * @brief  Request a dump of the trace buffer.
+ *
+ * @details  The capture is frozen (if not already by a fault) so the dump is
+ *  a consistent snapshot.
+ */
+void Trace_dump_req(void)
+{
+  if (0 == Dump_count)
+  {
+    Trace_frozen = TRUE;
+    Dump_count = TRACE_DEPTH;
+  }
+}
+
+/**
+ * @brief  Print one line of a requested dump, oldest entry first.
+ *
+ * @details  Called from the background task, one line per task period so the
+ *  UART TX buffer is not overrun. The capture is re-armed after the last line.
+ *
+ * @return  True if a dump is in progress
+ */
+uint8_t Trace_dump_line(void)
+{
+  const trace_entry_t * pentry;
+  uint8_t n;
+
+  if (0 == Dump_count)
+  {
+    return FALSE;
+  }
+
+  n = (uint8_t)((Trace_head + TRACE_DEPTH - Dump_count) & TRACE_DEPTH_MSK);
+  pentry = &Trace_buf[ n ];
+
+  printf(
+    "#%02X S=%X A=%04X R=%04X F=%04X CT=%04X DC=%04X\r\n",
+    (int)(TRACE_DEPTH - Dump_count),
+    (int)pentry->step,
+    pentry->adc,
+    pentry->bemf_r,
+    pentry->bemf_f,
+    pentry->comm_period,
+    pentry->duty);
+
+  Dump_count -= 1;
+
+  if (0 == Dump_count)
+  {
+    Trace_frozen = FALSE;
+  }
+  return TRUE;
+}
+
+#endif // TRACE_ENABLED
+
+/**@}*/ // defgroup
@@ -0,0 +1,177 @@
+/**
+  ******************************************************************************
+  * @file motor.c
+  * @brief Discrete-time BLDC motor (plant) model for the simulator
+  * @author Neidermeier
+  * @version
+  * @date
+  ******************************************************************************
+  *
+  * Electrical: the two driven phases are in series (2R, 2L) against the
+  * line-line back-EMF. Back-EMF is sinusoidal, phase x lags phase A by x * 120
+  * electrical degrees. With the windings shorted (brake), each phase carries its
+  * own current against its back-EMF (the neutral is at 0 for balanced EMF).
+  * Mechanical: J dw/dt = T - B w - Tc - Kq w^2.
+  * Integration is forward Euler, the caller keeps dt well below L/R.
+  */
+#include <math.h>
+
+#include "motor.h"
+
+
+#define TWO_PI  (2.0 * M_PI)
+
+/*
+ * per-phase back-EMF shape function
+ */
+static double emf_shape(double theta, int phase)
+{
+  return sin(theta - phase * TWO_PI / MOTOR_NR_PHASES);
+}
+
+/**
+ * @brief  Initialize the motor state at standstill.
+ *
+ * @param [out]  ps      Motor state.
+ * @param        pp      Motor parameters.
+ * @param        theta0  Initial electrical angle (rad).
+ */
+void Motor_init(motor_state_t * ps, const motor_param_t * pp, double theta0)
+{
+  (void)pp;
+  ps->theta = fmod(theta0, TWO_PI);
+  ps->omega = 0;
+  ps->i = 0;
+  ps->ib[0] = ps->ib[1] = ps->ib[2] = 0;
+}
+
+/**
+ * @brief  Advance the motor state by one time step.
+ *
+ * @param [in,out]  ps  Motor state.
+ * @param           pp  Motor parameters.
+ * @param           pd  Bridge output state.
+ * @param           dt  Time step (s).
+ */
+void Motor_step(motor_state_t * ps, const motor_param_t * pp,
+                const motor_drive_t * pd, double dt)
+{
+  double we = ps->omega * pp->pp; // electrical speed
+  double torque = 0;
+  double load;
+  int phase;
+
+  if (0 != pd->brake)
+  {
+    for (phase = 0; phase < MOTOR_NR_PHASES; phase++)
+    {
+      double k = emf_shape(ps->theta, phase);
+
+      ps->ib[phase] += dt * ( -pp->Ke * we * k - pp->R * ps->ib[phase] ) / pp->L;
+
+      torque += pp->Ke * pp->pp * ps->ib[phase] * k;
+    }
+    ps->i = 0;
+  }
+  else if (MOTOR_PH_NONE != pd->hi && MOTOR_PH_NONE != pd->lo)
+  {
+    double k_ll = emf_shape(ps->theta, pd->hi) - emf_shape(ps->theta, pd->lo);
+    double v = pd->duty * pp->Vbatt;
+    double e_ll = pp->Ke * we * k_ll;
+
+    ps->i += dt * (v - e_ll - 2 * pp->R * ps->i) / (2 * pp->L);
+
+    torque = pp->Ke * pp->pp * ps->i * k_ll;
+  }
+  else
+  {
+    // all phases floating or only one phase driven: no current path
+    ps->i = 0;
+  }
+
+  if (0 == pd->brake)
+  {
+    ps->ib[0] = ps->ib[1] = ps->ib[2] = 0;
+  }
+
+  load = pp->B * ps->omega + pp->Kq * ps->omega * ps->omega;
+
+  if (ps->omega > 0)
+  {
+    load += pp->Tc;
+  }
+  else if (torque < pp->Tc)
+  {
+    load = torque; // static friction holds the rotor
+  }
+
+  ps->omega += dt * (torque - load) / pp->J;
+
+  if (ps->omega < 0)
+  {
+    ps->omega = 0; // no reverse rotation
+  }
+
+  ps->theta = fmod(ps->theta + dt * ps->omega * pp->pp, TWO_PI);
+}
+
+/**
+ * @brief  Get the terminal voltage of a phase (w.r.t. ground).
+ *
+ * @details  Sampled during the PWM on-time i.e. the HI phase is at Vbatt. The
+ *  floating phase is at the neutral point plus its back-EMF, the neutral being
+ *  the mid-point of the driven pair less their back-EMF. Clamped by the body
+ *  diodes of the half-bridge to [0:Vbatt].
+ *
+ * @param  ps     Motor state.
+ * @param  pp     Motor parameters.
+ * @param  pd     Bridge output state.
+ * @param  phase  Phase index.
+ *
+ * @return  Phase voltage (V)
+ */
+double Motor_phase_voltage(const motor_state_t * ps, const motor_param_t * pp,
+                           const motor_drive_t * pd, int phase)
+{
+  double we = ps->omega * pp->pp;
+  double e = pp->Ke * we * emf_shape(ps->theta, phase);
+  double v;
+
+  if (phase == pd->hi)
+  {
+    v = pp->Vbatt;
+  }
+  else if (phase == pd->lo)
+  {
+    v = 0;
+  }
+  else if (MOTOR_PH_NONE != pd->hi && MOTOR_PH_NONE != pd->lo)
+  {
+    double e_hi = pp->Ke * we * emf_shape(ps->theta, pd->hi);
+    double e_lo = pp->Ke * we * emf_shape(ps->theta, pd->lo);
+    double vn = ( pp->Vbatt - e_hi - e_lo ) / 2;
+    v = vn + e;
+  }
+  else
+  {
+    v = e; // bridge off, neutral is not referenced to anything in particular
+  }
+
+  if (v < 0)
+  {
+    v = 0;
+  }
+  else if (v > pp->Vbatt)
+  {
+    v = pp->Vbatt;
+  }
+  return v;
+}
+
+/**
+ * @brief  Get the mechanical speed in RPM.
+ */
+double Motor_rpm(const motor_state_t * ps)
+{
+  return ps->omega * 60.0 / TWO_PI;
+}
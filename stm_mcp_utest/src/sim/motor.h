@@ -0,0 +1,77 @@
+/**
+  ******************************************************************************
+  * @file motor.h
+  * @brief Discrete-time BLDC motor (plant) model for the simulator
+  * @author Neidermeier
+  * @version
+  * @date
+  ******************************************************************************
+  */
+#ifndef MOTOR_H
+#define MOTOR_H
+
+/* defines -------------------------------------------------------------------*/
+
+#define MOTOR_NR_PHASES  3
+#define MOTOR_PH_NONE    (-1)
+
+
+/* types ---------------------------------------------------------------------*/
+
+/**
+ * @brief Motor and load parameters.
+ */
+typedef struct
+{
+  double R;      /**< phase resistance (Ohm) */
+  double L;      /**< phase inductance (H) */
+  double Ke;     /**< phase back-EMF constant (V per electrical rad/s, peak) */
+  int    pp;     /**< nr. of pole-pairs */
+  double J;      /**< rotor + propeller inertia (kg m^2) */
+  double B;      /**< viscous friction (Nm per rad/s) */
+  double Tc;     /**< coulomb friction (Nm) */
+  double Kq;     /**< propeller load (Nm per (rad/s)^2) */
+  double Vbatt;  /**< supply voltage (V) */
+} motor_param_t;
+
+/**
+ * @brief Motor state.
+ */
+typedef struct
+{
+  double theta;  /**< electrical angle (rad) [0:2pi) */
+  double omega;  /**< mechanical speed (rad/s) */
+  double i;      /**< current in the driven phase pair (A) */
+  double ib[MOTOR_NR_PHASES]; /**< phase currents while the windings are shorted (A) */
+} motor_state_t;
+
+/**
+ * @brief Bridge output state as seen by the motor.
+ *
+ * @details The PWM is modelled as its average i.e. the synchronous half-bridge
+ *  applies duty * Vbatt to the HI phase, the LO phase is grounded and the
+ *  remaining phase is floating. When braking, all phases are at the same
+ *  potential (the duty-cycle is immaterial).
+ */
+typedef struct
+{
+  int    hi;     /**< phase index of the PWM'd phase or MOTOR_PH_NONE */
+  int    lo;     /**< phase index of the phase driven low or MOTOR_PH_NONE */
+  double duty;   /**< PWM duty-cycle [0:1] */
+  int    brake;  /**< all phases driven i.e. the windings are shorted */
+} motor_drive_t;
+
+
+/* prototypes ----------------------------------------------------------------*/
+
+void Motor_init(motor_state_t * ps, const motor_param_t * pp, double theta0);
+void Motor_step(motor_state_t * ps, const motor_param_t * pp,
+                const motor_drive_t * pd, double dt);
+
+double Motor_phase_voltage(const motor_state_t * ps, const motor_param_t * pp,
+                           const motor_drive_t * pd, int phase);
+
+double Motor_rpm(const motor_state_t * ps);
+
+
+#endif // MOTOR_H
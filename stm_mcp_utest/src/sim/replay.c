@@ -0,0 +1,447 @@
+/**
+  ******************************************************************************
+  * @file replay.c
+  * @brief Host replay of recorded ADC and throttle sequences through the
+  *  firmware control modules, with a regression check against a golden output
+  * @author Neidermeier
+  * @version
+  * @date
+  ******************************************************************************
+  *
+  * The firmware modules are the same as for the simulator, on the same virtual
+  * timeline and ISR dispatch (sim_hal.c), but the ADC scans and the throttle
+  * command of the periodic task are taken from a stimulus file (sim.h) instead
+  * of the motor model. The TIM3 commutation timer and the PWM timer are run by
+  * the firmware as on the target: the commutation periods, duty-cycle and
+  * fault decisions are the output, one CSV line per periodic task.
+  *
+  * The stimulus is open-loop: the recorded back-EMF does not follow a change
+  * of the commutation timing, so a replay is representative as long as the
+  * decisions stay close to those of the recording.
+  *
+  *  usage:  replay -f stimulus [-g golden] [-q]
+  *    -f  stimulus file (sim -w)
+  *    -g  golden output, the run fails on any difference
+  *    -q  no CSV output, only the summary
+  *
+  * The summary has the time to closed-loop (from the start of the run to the
+  * hand-off of the startup), the settling time of the commutation period from
+  * the hand-off, and the ripple (peak-to-peak over the mean) of the period
+  * measured from the zero-crossing at the end of the replay. Exit status is 1
+  * if the output differs from the golden.
+  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "system.h"
+#include "bldc_sm.h"
+#include "driver.h"
+#include "faultm.h"
+#include "mdata.h"
+#include "param.h"
+#include "sched.h"
+#include "startup.h"
+#include "pwm_stm8s.h"
+
+#include "sim.h"
+
+
+/* defines -------------------------------------------------------------------*/
+
+#define LINE_LEN        128
+
+// commutation period within 5% of the final value
+#define SETTLE_TOL      0.05
+
+// ripple measured over the end of the replay
+#define RIPPLE_SEC      0.25
+
+
+/* types ---------------------------------------------------------------------*/
+
+typedef struct
+{
+  uint16_t ch[ SIM_ADC_NR_CH ];
+  unsigned long repeat;
+} scan_t;
+
+typedef struct
+{
+  uint32_t t;
+  uint16_t period;
+  uint16_t zc_period;
+} sample_t;
+
+
+/* variables -----------------------------------------------------------------*/
+
+static scan_t * Scans;
+static size_t Nr_scans;
+static size_t Scan_cur;           // present scan record
+static size_t Scan_next;          // next scan record
+static unsigned long Scan_left;   // repeats left of the present record
+
+static Driver_command_t * Cmds;
+static size_t Nr_cmds;
+
+static sample_t * Samples;        // commutation period at each periodic task
+static size_t Nr_samples;
+
+
+/* functions -----------------------------------------------------------------*/
+
+static void * grow(void * p, size_t n, size_t size)
+{
+  // capacity doubles at each power of 2
+  if (0 == (n & (n - 1)))
+  {
+    p = realloc(p, ( n ? 2 * n : 1 ) * size);
+
+    if (NULL == p)
+    {
+      fprintf(stderr, "out of memory\n");
+      exit(2);
+    }
+  }
+  return p;
+}
+
+static int load_stimulus(const char * fname)
+{
+  FILE * fp = fopen(fname, "r");
+  char line[ LINE_LEN ];
+  unsigned long lineno = 0;
+
+  if (NULL == fp)
+  {
+    fprintf(stderr, "cannot read %s\n", fname);
+    return -1;
+  }
+
+  while (NULL != fgets(line, sizeof(line), fp))
+  {
+    lineno += 1;
+
+    if (SIM_STIM_SCAN == line[0])
+    {
+      scan_t scan = { { 0 }, 1 };
+      char * p = line + 1;
+      char * end;
+      int ch;
+
+      for (ch = 0; ch < SIM_ADC_NR_CH; ch++)
+      {
+        scan.ch[ch] = (uint16_t)strtoul(p, &end, 16);
+
+        if (end == p)
+        {
+          break;
+        }
+        p = end;
+      }
+      if (0 == ch)
+      {
+        fprintf(stderr, "%s:%lu: bad scan\n", fname, lineno);
+        fclose(fp);
+        return -1;
+      }
+      p += strspn(p, " ");
+
+      if ('*' == *p)
+      {
+        scan.repeat = strtoul(p + 1, NULL, 10);
+      }
+      if (0 == scan.repeat)
+      {
+        scan.repeat = 1;
+      }
+
+      Scans = grow(Scans, Nr_scans, sizeof(scan_t));
+      Scans[ Nr_scans++ ] = scan;
+    }
+    else if (SIM_STIM_CMD == line[0])
+    {
+      unsigned dc, governor;
+      Driver_command_t cmd = { 0, 0, 0 };
+
+      if (2 != sscanf(line + 1, "%u %u", &dc, &governor))
+      {
+        fprintf(stderr, "%s:%lu: bad command\n", fname, lineno);
+        fclose(fp);
+        return -1;
+      }
+      cmd.dc = (uint8_t)dc;
+      cmd.governor = (uint8_t)governor;
+
+      Cmds = grow(Cmds, Nr_cmds, sizeof(Driver_command_t));
+      Cmds[ Nr_cmds++ ] = cmd;
+    }
+    else if (SIM_STIM_COMMENT != line[0] && '\n' != line[0])
+    {
+      fprintf(stderr, "%s:%lu: unknown record\n", fname, lineno);
+      fclose(fp);
+      return -1;
+    }
+  }
+  fclose(fp);
+
+  return 0;
+}
+
+/*
+ * at the end of the stimulus
+ */
+static int scans_done(void)
+{
+  return ( Scan_next >= Nr_scans && 0 == Scan_left );
+}
+
+/**
+ * @brief  ADC conversion result of a channel, at the start of the scan: from
+ *  the stimulus, the last scan is held at its end.
+ */
+uint16_t Sim_ADC_sample(uint8_t channel)
+{
+  if (0 == Nr_scans)
+  {
+    return 0;
+  }
+  if (0 == channel)
+  {
+    if (0 == Scan_left && Scan_next < Nr_scans)
+    {
+      Scan_cur = Scan_next++;
+      Scan_left = Scans[ Scan_cur ].repeat;
+    }
+    if (Scan_left > 0)
+    {
+      Scan_left -= 1;
+    }
+  }
+  return Scans[ Scan_cur ].ch[channel];
+}
+
+/*
+ * compare an output line with the next line of the golden file
+ */
+static unsigned long Golden_lineno;
+static unsigned long Golden_diffs;
+
+static void check_golden(FILE * fg, const char * out)
+{
+  char line[ LINE_LEN ];
+
+  Golden_lineno += 1;
+
+  if (NULL == fgets(line, sizeof(line), fg))
+  {
+    line[0] = '\0';
+  }
+  line[ strcspn(line, "\r\n") ] = '\0';
+
+  if (0 != strcmp(line, out))
+  {
+    if (0 == Golden_diffs)
+    {
+      fprintf(stderr, "golden:%lu: expected '%s' got '%s'\n", Golden_lineno, line, out);
+    }
+    Golden_diffs += 1;
+  }
+}
+
+static void output(FILE * fg, int quiet, const char * out)
+{
+  if (0 == quiet)
+  {
+    printf("%s\n", out);
+  }
+  if (NULL != fg)
+  {
+    check_golden(fg, out);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  const char * fstim = NULL;
+  const char * fgolden = NULL;
+  FILE * fg = NULL;
+  int quiet = 0;
+
+  char out[ LINE_LEN ];
+  size_t cmd_next = 0;
+  Driver_command_t cmd = { 0, 0, 0 };
+
+  uint32_t t_run = 0;     // start of the run
+  uint32_t t_handoff = 0; // end of the startup
+  uint32_t t_settle = 0;
+  double ripple = 0;
+  uint16_t zc_min = U16_MAX;
+  uint16_t zc_max = 0;
+  double zc_sum = 0;
+  unsigned nr_zc = 0;
+  unsigned faults = 0;
+  size_t k;
+  int n;
+
+  for (n = 1; n < argc; n++)
+  {
+    if ('-' == argv[n][0] && 'q' == argv[n][1])
+    {
+      quiet = 1;
+    }
+    else if ('-' == argv[n][0] && 'f' == argv[n][1] && (n + 1) < argc)
+    {
+      fstim = argv[++n];
+    }
+    else if ('-' == argv[n][0] && 'g' == argv[n][1] && (n + 1) < argc)
+    {
+      fgolden = argv[++n];
+    }
+    else
+    {
+      fprintf(stderr, "unknown option %s\n", argv[n]);
+      return 2;
+    }
+  }
+
+  if (NULL == fstim)
+  {
+    fprintf(stderr, "usage: replay -f stimulus [-g golden] [-q]\n");
+    return 2;
+  }
+  if (0 != load_stimulus(fstim))
+  {
+    return 2;
+  }
+  if (NULL != fgolden)
+  {
+    fg = fopen(fgolden, "r");
+
+    if (NULL == fg)
+    {
+      fprintf(stderr, "cannot read %s\n", fgolden);
+      return 2;
+    }
+  }
+
+  Sim_hal_init();
+
+  // as MCU_Init() and main()
+  PWM_setup();
+  Param_load();
+  Load_OL_Timing();
+#ifdef FLYING_START_ENABLED
+  // as the simulator, the stimulus is recorded without the flying start on the start
+  Startup_set_catch_on_start( FALSE );
+#endif
+  BL_reset();
+
+  Sim_PWM_start();
+
+  output(fg, quiet, "t_ms,throttle,dc,comm_period,zc_period,ct_mode,faults");
+
+  while ( ! scans_done() )
+  {
+    Sim_ticks = Sim_next_event();
+    Sim_run_ISRs();
+
+    if (0 == t_run && BL_IS_RUNNING == BL_get_state())
+    {
+      t_run = Sim_ticks;
+    }
+    if (0 != t_run && 0 == t_handoff && STARTUP_DONE == Startup_get_phase())
+    {
+      t_handoff = Sim_ticks;
+    }
+
+    // background task
+    if (TRUE == Sched_is_ready(SCHED_UI))
+    {
+      if (cmd_next < Nr_cmds)
+      {
+        cmd = Cmds[ cmd_next++ ];
+      }
+      Driver_set_command(&cmd);
+
+      faults |= Faultm_get_status();
+
+      snprintf(out, sizeof(out), "%.1f,%u,%u,%u,%u,%u,%u",
+               (double)Sim_ticks * 1000 / SIM_TICKS_PER_SEC,
+               cmd.dc,
+               BLDC_PWMDC_Get(),
+               get_commutation_period(),
+               Driver_get_ZC_period(),
+               BL_get_ct_mode(),
+               Faultm_get_status());
+      output(fg, quiet, out);
+
+      Samples = grow(Samples, Nr_samples, sizeof(sample_t));
+      Samples[ Nr_samples ].t = Sim_ticks;
+      Samples[ Nr_samples ].period = get_commutation_period();
+      Samples[ Nr_samples ].zc_period = Driver_get_ZC_period();
+      Nr_samples += 1;
+    }
+  }
+
+  if (NULL != fg)
+  {
+    // the golden is longer than the output
+    char line[ LINE_LEN ];
+
+    while (NULL != fgets(line, sizeof(line), fg))
+    {
+      Golden_diffs += 1;
+    }
+    fclose(fg);
+  }
+
+  // settling: the period stays within the tolerance of its final value from
+  // the hand-off to the end
+  if (0 != t_handoff && Nr_samples > 0)
+  {
+    const double final = Samples[ Nr_samples - 1 ].period;
+    const uint32_t t_end = Samples[ Nr_samples - 1 ].t;
+
+    t_settle = t_handoff;
+
+    for (k = 0; k < Nr_samples; k++)
+    {
+      double dev = ( Samples[k].period - final ) / final;
+
+      if (Samples[k].t > t_handoff && ( dev > SETTLE_TOL || dev < -SETTLE_TOL ) )
+      {
+        t_settle = ( k + 1 < Nr_samples ) ? Samples[k + 1].t : t_end;
+      }
+      if (Samples[k].t + (uint32_t)( RIPPLE_SEC * SIM_TICKS_PER_SEC ) >= t_end &&
+          0 != Samples[k].zc_period)
+      {
+        zc_min = ( Samples[k].zc_period < zc_min ) ? Samples[k].zc_period : zc_min;
+        zc_max = ( Samples[k].zc_period > zc_max ) ? Samples[k].zc_period : zc_max;
+        zc_sum += Samples[k].zc_period;
+        nr_zc += 1;
+      }
+    }
+  }
+  if (nr_zc > 0)
+  {
+    ripple = ( zc_max - zc_min ) / ( zc_sum / nr_zc );
+  }
+
+  n = ( 0 != Golden_diffs );
+
+  fprintf(stderr,
+          "replay %s %.2f s  closed-loop %.0f ms  settling %.0f ms  ripple %.1f %%  faults %X  golden %s%lu/%lu  %s\n",
+          fstim,
+          (double)Sim_ticks / SIM_TICKS_PER_SEC,
+          (0 != t_handoff) ? (double)( t_handoff - t_run ) * 1000 / SIM_TICKS_PER_SEC : 0.0,
+          (0 != t_handoff) ? (double)( t_settle - t_handoff ) * 1000 / SIM_TICKS_PER_SEC : 0.0,
+          ripple * 100,
+          faults,
+          (NULL != fgolden) ? "" : "n/a ",
+          Golden_diffs, Golden_lineno,
+          n ? "FAIL" : "PASS");
+
+  return n;
+}
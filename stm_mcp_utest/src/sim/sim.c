@@ -0,0 +1,657 @@
+/**
+  ******************************************************************************
+  * @file sim.c
+  * @brief Host simulator: firmware control modules against a BLDC motor model
+  * @author Neidermeier
+  * @version
+  * @date
+  ******************************************************************************
+  *
+  * The firmware modules (BLDC_sm, sequence, driver, faultm, mdata, pwm_stm8s,
+  * param with the EEPROM of sim_hal.c erased i.e. the defaults)
+  * are compiled unmodified for the S105_DISCOVERY board (sim3: with the
+  * three-phase back-EMF). The simulator main
+  * plays the part of the ISRs on a virtual timeline (TIM2 PWM update, TIM3
+  * commutation timer, ADC end of conversion) and of the periodic task (throttle
+  * input), and integrates the motor model between the events from the bridge
+  * output state read back from the timer and GPIO registers.
+  *
+  *  usage:  sim [-t sec] [-d dc] [-r sec] [-v volts] [-l load] [-a deg] [-g]
+  *              [-s sec] [-y dc] [-b mode] [-k strength] [-e] [-i amps] [-c] [-q]
+  *              [-j sec] [-f] [-w file]
+  *    -t  simulated time (3 s)
+  *    -d  throttle (PWM DC counts, or RPM setpoint in governor mode) at end of ramp (60)
+  *    -r  throttle ramp time (1 s)
+  *    -v  supply voltage (12.0 V)
+  *    -l  scale factor of the propeller load (1.0)
+  *    -a  initial rotor electrical angle (0 deg)
+  *    -g  governor mode (the throttle is an RPM setpoint)
+  *    -s  throttle to 0 at (the motor is stopped)
+  *    -y  throttle at the -s time instead of 0 (the throttle falls, the
+  *        motor keeps running)
+  *    -b  brake mode of the stopped motor (BRAKE_MODE)
+  *    -k  brake strength, sixteenths (BRAKE_STRENGTH)
+  *    -e  regenerative deceleration on the throttle-down
+  *    -i  pulse-by-pulse current limit (ILIM_AMPS)
+  *    -c  battery voltage compensation of the duty-cycle
+  *    -j  load transient at (the rotor speed is halved, out of sync)
+  *    -f  flying start before the alignment on the start (the recovery from
+  *        a loss of sync is from the flying start either way)
+  *    -q  no CSV trace, only the summary
+  *    -w  record the ADC scans and the throttle to a replay stimulus file
+  *
+  * The CSV trace is one line per periodic task. Exit status is 0 if the rotor
+  * is synchronized with the commutation at the end of the run (and in governor
+  * mode, the speed is at the setpoint), or if stopped, has spun down by the end
+  * of the run. Exit status is 1 if a fault was set at any time, or with the
+  * load transient, if the loss of sync was not recovered (a fault at the end).
+  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "system.h"
+#include "bldc_sm.h"
+#include "driver.h"
+#include "faultm.h"
+#include "mdata.h"
+#include "param.h"
+#include "sched.h"
+#include "speed.h"
+#include "startup.h"
+#include "pwm_stm8s.h"
+#include "sequence.h"
+
+#include "sim.h"
+#include "motor.h"
+
+
+/* defines -------------------------------------------------------------------*/
+
+// model integration step (2us)
+#define SIM_SUBSTEP_TICKS  16
+
+// analog front-end (S105 Discovery): 33k/18k divider, 5v ADC reference
+#define AFE_DIVIDER   ( 18.0 / ( 18.0 + 33.0 ) )
+#define AFE_VREF      5.0
+#define AFE_ADC_MAX   1023
+
+// pull-out: the rotor has slipped a pole w.r.t. the stator field
+#define DESYNC_ANGLE  ( M_PI * 5 / 6 )
+
+// the final part of the run to be checked for sync
+#define CHECK_SEC     0.5
+
+// spun down: below this fraction of the speed at the stop
+#define STOP_RPM_FRAC  0.1
+
+// load transient: fraction of the speed that is kept
+#define JOLT_SPEED_FRAC  0.5
+
+// governor setpoint tolerance
+#define GOV_TOL       0.02
+
+// governor setpoint (RPM) per throttle count, as BLDC_sm.c
+#define GOV_RPM_PER_CNT  ( 250.0 / MOTOR_POLE_PAIRS )
+
+
+/* variables -----------------------------------------------------------------*/
+
+/*
+ * 1100kv, 6 pole-pairs (12N14P outrunner), small propeller
+ * Ke: 60 / (2pi * 1100) = 0.00868 V/(rad/s) line-line per mechanical rad/s
+ */
+static motor_param_t Motor_param =
+{
+  0.10,                                   // R
+  15.0e-6,                                // L
+  0.00868 / ( 1.7320508 * 6 ),            // Ke
+  6,                                      // pp
+  5.0e-6,                                 // J
+  1.0e-6,                                 // B
+  2.0e-3,                                 // Tc
+  3.0e-8,                                 // Kq
+  12.0                                    // Vbatt
+};
+
+static motor_state_t Motor;
+static motor_drive_t Drive;
+
+// replay stimulus recording: the latest ADC scan and its repeat count
+static FILE * Rec;
+static uint16_t Rec_scan[ SIM_ADC_NR_CH ];
+static uint16_t Rec_new[ SIM_ADC_NR_CH ];
+static unsigned long Rec_repeat;
+
+
+/* functions -----------------------------------------------------------------*/
+
+/*
+ * Bridge output state from the PWM timer channel enables and the /SD pins
+ */
+static int phase_sd_enabled(int phase)
+{
+  switch (phase)
+  {
+  case 0:
+    return 0 != (SDa_SD_PORT->ODR & SDa_SD_PIN);
+  case 1:
+    return 0 != (SDb_SD_PORT->ODR & SDb_SD_PIN);
+  default:
+    return 0 != (SDc_SD_PORT->ODR & SDc_SD_PIN);
+  }
+}
+
+static int phase_pwm_enabled(int phase)
+{
+  static const uint8_t ccer1[ MOTOR_NR_PHASES ] = { PWM_CCER1_A, PWM_CCER1_B, PWM_CCER1_C };
+  static const uint8_t ccer2[ MOTOR_NR_PHASES ] = { PWM_CCER2_A, PWM_CCER2_B, PWM_CCER2_C };
+
+  return 0 != ( (PWM_TIMER_CCER1 & ccer1[phase]) | (PWM_TIMER_CCER2 & ccer2[phase]) );
+}
+
+static void read_drive(motor_drive_t * pd)
+{
+  static int hi_prev = MOTOR_PH_NONE;
+  int phase;
+  int nr_sd = 0;
+  uint16_t ccr = (uint16_t)( (TIM2->CCR1H << 8) | TIM2->CCR1L );
+  uint16_t arr = (uint16_t)( (TIM2->ARRH << 8) | TIM2->ARRL );
+
+  pd->hi = MOTOR_PH_NONE;
+  pd->lo = MOTOR_PH_NONE;
+  pd->duty = (double)ccr / arr;
+  pd->brake = 0;
+
+  if (pd->duty > 1.0)
+  {
+    pd->duty = 1.0;
+  }
+
+  for (phase = 0; phase < MOTOR_NR_PHASES; phase++)
+  {
+    if (phase_sd_enabled(phase))
+    {
+      nr_sd += 1;
+
+      if (phase_pwm_enabled(phase))
+      {
+        pd->hi = phase;
+      }
+      else
+      {
+        pd->lo = phase;
+      }
+    }
+  }
+
+  // pulse cut by the current limit: the PWM'd phase is LO for the rest of the
+  // PWM cycle, the current recirculates in the low side
+  if (2 == nr_sd && MOTOR_PH_NONE == pd->hi &&
+      MOTOR_PH_NONE != hi_prev && phase_sd_enabled(hi_prev))
+  {
+    pd->hi = hi_prev;
+    pd->duty = 0;
+
+    for (phase = 0; phase < MOTOR_NR_PHASES; phase++)
+    {
+      if (phase != hi_prev && phase_sd_enabled(phase))
+      {
+        pd->lo = phase;
+      }
+    }
+  }
+  hi_prev = pd->hi;
+
+  // all phases at the same potential (low side, or PWM'd in unison)
+  if (MOTOR_NR_PHASES == nr_sd)
+  {
+    pd->brake = 1;
+    pd->hi = MOTOR_PH_NONE;
+    pd->lo = MOTOR_PH_NONE;
+  }
+}
+
+/*
+ * Load angle [-pi:pi), the angle by which the rotor lags the stator field of
+ * the energized phase pair. Torque is zero at 0 and maximum at pi/2, so with
+ * the 60 degree steps of the field a rotor in sync stays within about
+ * [-pi/6 : pi/2 + pi/6].
+ */
+static double sync_error(const motor_drive_t * pd, double theta)
+{
+  double phi_hi = pd->hi * 2 * M_PI / MOTOR_NR_PHASES;
+  double phi_lo = pd->lo * 2 * M_PI / MOTOR_NR_PHASES;
+  double opt = (phi_hi + phi_lo) / 2;
+  double err;
+
+  // sin(t - phi_hi) - sin(t - phi_lo) = 2 sin((phi_lo - phi_hi)/2) cos(t - opt)
+  if (sin((phi_lo - phi_hi) / 2) < 0)
+  {
+    opt += M_PI;
+  }
+
+  // the field is a quarter cycle ahead of the angle of maximum torque
+  err = fmod(opt + M_PI / 2 - theta, 2 * M_PI);
+  if (err >= M_PI)
+  {
+    err -= 2 * M_PI;
+  }
+  else if (err < -M_PI)
+  {
+    err += 2 * M_PI;
+  }
+  return err;
+}
+
+/*
+ * Speed in RPM at which the commutation is in step with the rotor.
+ * The commutation period is 1/4 sector, 6 sectors per electrical cycle.
+ */
+static double comm_rpm(uint16_t comm_period)
+{
+  double t_ecycle = 6.0 * 4.0 * comm_period * SIM_TICK_SEC;
+
+  if (0 == comm_period)
+  {
+    return 0;
+  }
+  return 60.0 / ( t_ecycle * Motor_param.pp );
+}
+
+/*
+ * Replay stimulus (sim.h): a run of identical ADC scans is written as one line
+ */
+static void rec_flush(void)
+{
+  int nr_ch = SIM_ADC_NR_CH;
+  int ch;
+
+  if (NULL == Rec || 0 == Rec_repeat)
+  {
+    return;
+  }
+  fputc(SIM_STIM_SCAN, Rec);
+
+  // the trailing channels that are 0 are left out
+  while (nr_ch > 1 && 0 == Rec_scan[nr_ch - 1])
+  {
+    nr_ch -= 1;
+  }
+  for (ch = 0; ch < nr_ch; ch++)
+  {
+    fprintf(Rec, " %03X", Rec_scan[ch]);
+  }
+  if (Rec_repeat > 1)
+  {
+    fprintf(Rec, " *%lu", Rec_repeat);
+  }
+  fputc('\n', Rec);
+  Rec_repeat = 0;
+}
+
+static void rec_sample(uint8_t channel, uint16_t sample)
+{
+  Rec_new[channel] = sample;
+
+  if (SIM_ADC_NR_CH - 1 == channel)
+  {
+    if (Rec_repeat > 0 && 0 == memcmp(Rec_new, Rec_scan, sizeof(Rec_scan)))
+    {
+      Rec_repeat += 1;
+    }
+    else
+    {
+      rec_flush();
+      memcpy(Rec_scan, Rec_new, sizeof(Rec_scan));
+      Rec_repeat = 1;
+    }
+  }
+}
+
+static void rec_command(const Driver_command_t * pcmd)
+{
+  rec_flush();
+  fprintf(Rec, "%c %u %u\n", SIM_STIM_CMD, pcmd->dc, pcmd->governor);
+}
+
+/*
+ * Analog front-end: ADC conversion result of a channel.
+ *
+ * Channel 0 is the phase A voltage, channel 1 the shunt amplifier (the current
+ * of the driven phase pair, in the PWM on-time), with the three-phase back-EMF
+ * channel 2 and 4 are phase B and C, the others (throttle slider etc.) are not
+ * connected.
+ */
+static uint16_t afe_sample(uint8_t channel)
+{
+#ifdef THREE_PHASE_BEMF_ENABLED
+  static const int phase_of_ch[ SIM_ADC_NR_CH ] = { 0, -1, 1, -1, 2 };
+#else
+  static const int phase_of_ch[ SIM_ADC_NR_CH ] = { 0, -1, -1, -1 };
+#endif
+
+  if (phase_of_ch[channel] >= 0)
+  {
+    double v = Motor_phase_voltage(&Motor, &Motor_param, &Drive, phase_of_ch[channel]);
+    return (uint16_t)( v * AFE_DIVIDER / AFE_VREF * AFE_ADC_MAX );
+  }
+  if (1 == channel && MOTOR_PH_NONE != Drive.hi && Drive.duty > 0)
+  {
+    double v = fabs(Motor.i) * ISENSE_MV_PER_A / 1000;
+
+    return (uint16_t)( ( ( v < AFE_VREF ) ? v : AFE_VREF ) / AFE_VREF * AFE_ADC_MAX );
+  }
+  return 0;
+}
+
+/**
+ * @brief  ADC conversion result of a channel, at the start of the scan.
+ */
+uint16_t Sim_ADC_sample(uint8_t channel)
+{
+  uint16_t sample = afe_sample(channel);
+
+  if (NULL != Rec)
+  {
+    rec_sample(channel, sample);
+  }
+  return sample;
+}
+
+int main(int argc, char **argv)
+{
+  double t_sim = 3.0;
+  double dc_final = 60;
+  double t_ramp = 1.0;
+  double theta0 = 0;
+  int quiet = 0;
+  int governor = 0;
+  double t_stop = 0;
+  double dc_stop = 0;
+  double t_jolt = 0;
+  int brake = BRAKE_MODE;
+  int strength = BRAKE_STRENGTH;
+  int decel = DECEL_MODE;
+  int vcomp = VBATT_COMP_MODE;
+  int catch_on_start = 0;
+  double ilim = ILIM_AMPS;
+  double imax = 0;
+
+  uint32_t t_end;
+
+  double err_sum = 0;
+  double err_max = 0;
+  unsigned long nr_err = 0;
+  unsigned long nr_desync = 0;
+  unsigned long nr_check = 0;
+
+  uint32_t t_run = 0;     // start of the run
+  uint32_t t_handoff = 0; // end of the startup
+  uint32_t t_spun = 0;    // spun down after the stop
+  double rpm_stop = 0;
+  unsigned faults = 0;
+  int jolted = 0;
+
+  clock_t wall;
+  int n;
+
+  for (n = 1; n < argc; n++)
+  {
+    if ('-' == argv[n][0] && 'q' == argv[n][1])
+    {
+      quiet = 1;
+    }
+    else if ('-' == argv[n][0] && 'g' == argv[n][1])
+    {
+      governor = 1;
+    }
+    else if ('-' == argv[n][0] && 'e' == argv[n][1])
+    {
+      decel = 1;
+    }
+    else if ('-' == argv[n][0] && 'c' == argv[n][1])
+    {
+      vcomp = 1;
+    }
+    else if ('-' == argv[n][0] && 'f' == argv[n][1])
+    {
+      catch_on_start = 1;
+    }
+    else if ('-' == argv[n][0] && 'w' == argv[n][1] && (n + 1) < argc)
+    {
+      n += 1;
+      Rec = fopen(argv[n], "w");
+
+      if (NULL == Rec)
+      {
+        fprintf(stderr, "cannot write %s\n", argv[n]);
+        return 2;
+      }
+      fprintf(Rec, "%c stm8_mcp replay stimulus (sim %d ADC channels)\n", SIM_STIM_COMMENT, SIM_ADC_NR_CH);
+    }
+    else if ('-' == argv[n][0] && (n + 1) < argc)
+    {
+      double arg = atof(argv[n + 1]);
+      switch (argv[n][1])
+      {
+      case 't': t_sim = arg; break;
+      case 'd': dc_final = arg; break;
+      case 'r': t_ramp = arg; break;
+      case 'v': Motor_param.Vbatt = arg; break;
+      case 'l': Motor_param.Kq *= arg; break;
+      case 'a': theta0 = arg * M_PI / 180; break;
+      case 's': t_stop = arg; break;
+      case 'y': dc_stop = arg; break;
+      case 'b': brake = (int)arg; break;
+      case 'k': strength = (int)arg; break;
+      case 'i': ilim = arg; break;
+      case 'j': t_jolt = arg; break;
+      default:
+        fprintf(stderr, "unknown option %s\n", argv[n]);
+        return 2;
+      }
+      n += 1;
+    }
+  }
+
+  Sim_hal_init();
+  Motor_init(&Motor, &Motor_param, theta0);
+
+  // as MCU_Init() and main()
+  PWM_setup();
+  Param_load();
+  Load_OL_Timing();
+#ifdef FLYING_START_ENABLED
+  Startup_set_catch_on_start( (uint8_t)catch_on_start );
+#endif
+  BL_reset();
+
+  Seq_set_brake( (uint8_t)brake, (uint8_t)strength );
+  BL_set_decel( (uint8_t)decel );
+  BL_set_vbatt_comp( (uint8_t)vcomp );
+  Driver_set_current_limit( ISENSE_ADC( ilim ) );
+
+  t_end = (uint32_t)( t_sim * SIM_TICKS_PER_SEC );
+  Sim_PWM_start();
+
+  if (0 == quiet)
+  {
+    printf("t_ms,throttle,dc,comm_period,zc_period,ct_mode,faults,rpm,comm_rpm,load_angle_deg\n");
+  }
+
+  wall = clock();
+
+  while (Sim_ticks < t_end)
+  {
+    uint32_t t_next = Sim_next_event();
+
+    // motor model between events, the bridge state only changes at the events
+    read_drive(&Drive);
+
+    while (Sim_ticks < t_next)
+    {
+      uint32_t dt = t_next - Sim_ticks;
+      if (dt > SIM_SUBSTEP_TICKS)
+      {
+        dt = SIM_SUBSTEP_TICKS;
+      }
+      Motor_step(&Motor, &Motor_param, &Drive, dt * SIM_TICK_SEC);
+      Sim_ticks += dt;
+
+      if (fabs(Motor.i) > imax)
+      {
+        imax = fabs(Motor.i);
+      }
+    }
+
+    if (MOTOR_PH_NONE != Drive.hi && MOTOR_PH_NONE != Drive.lo)
+    {
+      double err = sync_error(&Drive, Motor.theta);
+
+      err_sum += err;
+      nr_err += 1;
+
+      if (Sim_ticks > t_end - (uint32_t)( CHECK_SEC * SIM_TICKS_PER_SEC ))
+      {
+        if (fabs(err) > err_max)
+        {
+          err_max = fabs(err);
+        }
+        nr_check += 1;
+        nr_desync += ( fabs(err) > DESYNC_ANGLE );
+      }
+    }
+
+    if (t_jolt > 0 && Sim_ticks >= (uint32_t)( t_jolt * SIM_TICKS_PER_SEC ))
+    {
+      Motor.omega *= JOLT_SPEED_FRAC;
+      t_jolt = 0;
+      jolted = 1;
+    }
+
+    // ISRs
+    Sim_run_ISRs();
+
+    // time to the hand-off from the startup
+    if (0 == t_run && BL_IS_RUNNING == BL_get_state())
+    {
+      t_run = Sim_ticks;
+    }
+    if (0 != t_run && 0 == t_handoff && STARTUP_DONE == Startup_get_phase())
+    {
+      t_handoff = Sim_ticks;
+    }
+
+    // background task
+    if (TRUE == Sched_is_ready(SCHED_UI))
+    {
+      double t = (double)Sim_ticks / SIM_TICKS_PER_SEC;
+      double throttle = (t < t_ramp) ? dc_final * t / t_ramp : dc_final;
+      Driver_command_t cmd = { 0, 0, 0 };
+
+      // the faults of the run, as they are cleared on the stop
+      faults |= Faultm_get_status();
+
+      if (t_stop > 0 && t >= t_stop)
+      {
+        throttle = dc_stop;
+
+        if (dc_stop > 0)
+        {
+          // the throttle falls, the motor keeps running
+        }
+        else if (0 == rpm_stop)
+        {
+          rpm_stop = Motor_rpm(&Motor);
+        }
+        else if (0 == t_spun && Motor_rpm(&Motor) < rpm_stop * STOP_RPM_FRAC)
+        {
+          t_spun = Sim_ticks;
+        }
+      }
+
+      // as the UI task
+      cmd.dc = (uint8_t)throttle;
+      cmd.governor = (uint8_t)governor;
+      Driver_set_command(&cmd);
+
+      if (NULL != Rec)
+      {
+        rec_command(&cmd);
+      }
+
+      if (0 == quiet)
+      {
+        printf("%.1f,%u,%u,%u,%u,%u,%u,%.0f,%.0f,%.1f\n",
+               t * 1000,
+               (unsigned)throttle,
+               BLDC_PWMDC_Get(),
+               get_commutation_period(),
+               Driver_get_ZC_period(),
+               BL_get_ct_mode(),
+               Faultm_get_status(),
+               Motor_rpm(&Motor),
+               comm_rpm(get_commutation_period()),
+               ( nr_err > 0 ) ? err_sum / nr_err * 180 / M_PI : 0.0);
+      }
+      err_sum = 0;
+      nr_err = 0;
+    }
+  }
+
+  wall = clock() - wall;
+
+  if (NULL != Rec)
+  {
+    rec_flush();
+    fclose(Rec);
+  }
+
+  if (0 != jolted)
+  {
+    // the loss of sync is expected, it is to be recovered by the end
+    faults = Faultm_get_status();
+  }
+  else
+  {
+    faults |= Faultm_get_status();
+  }
+
+  if (t_stop > 0 && 0 == dc_stop)
+  {
+    n = ( 0 == t_spun );
+  }
+  else
+  {
+    n = ( 0 == nr_check || 0 != nr_desync );
+  }
+  n |= ( 0 != faults );
+
+  if (0 != governor)
+  {
+    double setpoint = (uint8_t)( (t_stop > 0) ? dc_stop : dc_final ) * GOV_RPM_PER_CNT;
+
+    n |= ( fabs(Motor_rpm(&Motor) - setpoint) > setpoint * GOV_TOL );
+  }
+
+  fprintf(stderr,
+          "sim %.2f s in %.3f s (x%.0f)  rpm %.0f  comm_rpm %.0f  est_rpm %u  startup %.0f ms  spin-down %.0f ms  imax %.1f A  faults %X  max_err %.0f deg  desync %lu/%lu  %s\n",
+          t_sim,
+          (double)wall / CLOCKS_PER_SEC,
+          t_sim / ( (double)wall / CLOCKS_PER_SEC + 1e-9 ),
+          Motor_rpm(&Motor),
+          comm_rpm(get_commutation_period()),
+          Speed_rpm( Speed_get_erpm10() ),
+          (double)( t_handoff - t_run ) * 1000 / SIM_TICKS_PER_SEC,
+          (0 != t_spun) ? ( (double)t_spun / SIM_TICKS_PER_SEC - t_stop ) * 1000 : 0.0,
+          imax,
+          faults,
+          err_max * 180 / M_PI,
+          nr_desync, nr_check,
+          n ? "FAIL" : "PASS");
+
+  return n;
+}
@@ -0,0 +1,78 @@
+/**
+  ******************************************************************************
+  * @file sim.h
+  * @brief Simulator virtual timeline and peripheral models
+  * @author Neidermeier
+  * @version
+  * @date
+  ******************************************************************************
+  */
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+
+/* defines -------------------------------------------------------------------*/
+
+/*
+ * The virtual time unit is one TIM3 count (fMASTER 16Mhz, prescaler 2)
+ */
+#define SIM_TICKS_PER_SEC   8000000UL
+#define SIM_TICK_SEC        ( 1.0 / SIM_TICKS_PER_SEC )
+
+// TIM2 prescaler 8 i.e. 1 TIM2 count == 4 ticks
+#define SIM_TIM2_TICKS      4
+
+// scan of 4 channels (5 with the three-phase back-EMF)
+#ifdef THREE_PHASE_BEMF_ENABLED
+#define SIM_ADC_NR_CH       5
+#else
+#define SIM_ADC_NR_CH       4
+#endif
+
+// ~3.5us per channel
+#define SIM_ADC_CONV_TICKS  ( SIM_ADC_NR_CH * 28 )
+
+#define SIM_NEVER           UINT32_MAX
+
+/*
+ * Replay stimulus file, one record per line in the order of the events:
+ *   A ch0 ch1 .. [*n]   ADC scan (hex), repeated n times, the channels left
+ *                       out at the end of the line are 0
+ *   T dc governor       command of the periodic task (Driver_command_t)
+ *   # ...               comment
+ */
+#define SIM_STIM_SCAN       'A'
+#define SIM_STIM_CMD        'T'
+#define SIM_STIM_COMMENT    '#'
+
+
+/* variables -----------------------------------------------------------------*/
+
+extern uint32_t Sim_ticks;      // virtual time
+
+
+/* prototypes ----------------------------------------------------------------*/
+
+void Sim_hal_init(void);
+
+uint32_t Sim_PWM_period(void);
+
+uint32_t Sim_TIM3_next_update(void);
+void Sim_TIM3_update(void);
+uint32_t Sim_TIM3_next_compare(void);
+uint8_t Sim_TIM3_compare(void);
+
+void Sim_ADC_start(void);
+uint32_t Sim_ADC_next_done(void);
+void Sim_ADC_done(void);
+
+void Sim_PWM_start(void);
+uint32_t Sim_next_event(void);
+void Sim_run_ISRs(void);
+
+// implemented by the simulator main i.e. the analog front-end
+uint16_t Sim_ADC_sample(uint8_t channel);
+
+
+#endif // SIM_H
@@ -0,0 +1,428 @@
+/**
+  ******************************************************************************
+  * @file sim_hal.c
+  * @brief Simulator stand-ins for the SPL and the MCU platform functions
+  * @author Neidermeier
+  * @version
+  * @date
+  ******************************************************************************
+  *
+  * The firmware writes the peripheral registers in host memory, the timer and
+  * ADC events are generated on the virtual timeline, and the ISRs of the
+  * events are dispatched as by the interrupt controller.
+  */
+#include <string.h>
+
+#include "stm8s.h"
+#include "system.h"
+#include "driver.h"
+#include "mcu_stm8s.h"
+#include "pwm_stm8s.h"
+#include "sim.h"
+
+
+/* peripheral registers ------------------------------------------------------*/
+
+GPIO_TypeDef Sim_GPIOA, Sim_GPIOB, Sim_GPIOC, Sim_GPIOD, Sim_GPIOE;
+TIM1_TypeDef Sim_TIM1;
+TIM2_TypeDef Sim_TIM2;
+TIM3_TypeDef Sim_TIM3;
+ADC1_TypeDef Sim_ADC1;
+
+
+/* simulator state -----------------------------------------------------------*/
+
+uint32_t Sim_ticks;
+
+// data EEPROM (erased)
+static uint8_t EEPROM[ 1024 ];
+
+static uint32_t TIM3_start;     // time of the latest TIM3 update event
+static uint16_t TIM3_period;    // active (shadow) auto-reload value
+static uint8_t  TIM3_cc_done;   // compare events of the present period (SR1 bits)
+
+static uint32_t PWM_next = SIM_NEVER; // time of the next PWM timer update event
+static uint8_t  PWM_frames;            // PWM cycles since the latest Driver_Update
+
+static uint32_t ADC_done_tm = SIM_NEVER;
+static uint16_t ADC_latch[ SIM_ADC_NR_CH ];
+
+
+/*
+ * the firmware writes the 16-bit registers high byte first
+ */
+#define GET_REG16( _H_, _L_ )  (uint16_t)( ( (_H_) << 8 ) | (_L_) )
+#define SET_REG16( _H_, _L_, _V_ ) \
+  (_H_) = (uint8_t)( (_V_) >> 8 ); (_L_) = (uint8_t)( _V_ )
+
+
+/**
+ * @brief  Reset the peripheral registers and the event times.
+ */
+void Sim_hal_init(void)
+{
+  memset((void *)&Sim_GPIOA, 0, sizeof(Sim_GPIOA));
+  memset((void *)&Sim_GPIOB, 0, sizeof(Sim_GPIOB));
+  memset((void *)&Sim_GPIOC, 0, sizeof(Sim_GPIOC));
+  memset((void *)&Sim_GPIOD, 0, sizeof(Sim_GPIOD));
+  memset((void *)&Sim_GPIOE, 0, sizeof(Sim_GPIOE));
+  memset((void *)&Sim_TIM1, 0, sizeof(Sim_TIM1));
+  memset((void *)&Sim_TIM2, 0, sizeof(Sim_TIM2));
+  memset((void *)&Sim_TIM3, 0, sizeof(Sim_TIM3));
+  memset((void *)&Sim_ADC1, 0, sizeof(Sim_ADC1));
+
+  Sim_ticks = 0;
+  TIM3_start = 0;
+  TIM3_period = 0;
+  PWM_next = SIM_NEVER;
+  PWM_frames = 0;
+  ADC_done_tm = SIM_NEVER;
+}
+
+/* timer and ADC events ------------------------------------------------------*/
+
+/**
+ * @brief  PWM period in ticks (TIM2 auto-reload).
+ */
+uint32_t Sim_PWM_period(void)
+{
+  return (uint32_t)GET_REG16( TIM2->ARRH, TIM2->ARRL ) * SIM_TIM2_TICKS;
+}
+
+/**
+ * @brief  Time of the next TIM3 update event.
+ */
+uint32_t Sim_TIM3_next_update(void)
+{
+  if ( 0 == (TIM3->CR1 & TIM3_CR1_CEN) || 0 == (TIM3->IER & TIM3_IER_UIE) )
+  {
+    return SIM_NEVER;
+  }
+  return TIM3_start + TIM3_period + 1;
+}
+
+/**
+ * @brief  TIM3 overflow: counter restarts and the preloaded period is loaded.
+ */
+void Sim_TIM3_update(void)
+{
+  TIM3_start = Sim_ticks;
+  TIM3_period = GET_REG16( TIM3->ARRH, TIM3->ARRL );
+  TIM3_cc_done = 0;
+}
+
+/*
+ * time of the compare match of a channel in the present period
+ */
+static uint32_t tim3_compare_tm(uint8_t flag, uint16_t ccr)
+{
+  if ( 0 == (TIM3->IER & flag) || 0 != (TIM3_cc_done & flag) || ccr > TIM3_period )
+  {
+    return SIM_NEVER;
+  }
+  return TIM3_start + ccr;
+}
+
+/**
+ * @brief  Time of the next TIM3 compare event (enabled channels).
+ */
+uint32_t Sim_TIM3_next_compare(void)
+{
+  uint32_t t1 = tim3_compare_tm( TIM3_SR1_CC1IF, GET_REG16( TIM3->CCR1H, TIM3->CCR1L ) );
+  uint32_t t2 = tim3_compare_tm( TIM3_SR1_CC2IF, GET_REG16( TIM3->CCR2H, TIM3->CCR2L ) );
+
+  return (t1 < t2) ? t1 : t2;
+}
+
+/**
+ * @brief  TIM3 compare: sets the flags of the channels matched at this time.
+ * @return  The flags set (SR1)
+ */
+uint8_t Sim_TIM3_compare(void)
+{
+  uint8_t flags = 0;
+
+  if ( tim3_compare_tm( TIM3_SR1_CC1IF, GET_REG16( TIM3->CCR1H, TIM3->CCR1L ) ) == Sim_ticks )
+  {
+    flags |= TIM3_SR1_CC1IF;
+  }
+  if ( tim3_compare_tm( TIM3_SR1_CC2IF, GET_REG16( TIM3->CCR2H, TIM3->CCR2L ) ) == Sim_ticks )
+  {
+    flags |= TIM3_SR1_CC2IF;
+  }
+  TIM3_cc_done |= flags;
+  TIM3->SR1 |= flags;
+
+  return flags;
+}
+
+/**
+ * @brief  Time of the end of the ADC scan in progress.
+ */
+uint32_t Sim_ADC_next_done(void)
+{
+  return ADC_done_tm;
+}
+
+/**
+ * @brief  Analog front-end at the PWM edge: all channels are sampled, and
+ *  held if a scan is started (ADON written by the firmware), the results are
+ *  available at the end of the scan.
+ *
+ * @details  The channels are sampled at every PWM edge whether or not the
+ *  scan is started, so the replay stimulus is timed by the PWM and not by the
+ *  scans the firmware starts (driver idle). ADON is cleared so the next write
+ *  is seen as the next start.
+ */
+void Sim_ADC_start(void)
+{
+  uint8_t start = ( 0 != (ADC1->CR1 & ADC1_CR1_ADON) );
+  uint8_t n;
+
+  for (n = 0; n < SIM_ADC_NR_CH; n++)
+  {
+    uint16_t sample = Sim_ADC_sample(n);
+
+    if (0 != start)
+    {
+      ADC_latch[n] = sample;
+    }
+  }
+  if (0 != start)
+  {
+    ADC_done_tm = Sim_ticks + SIM_ADC_CONV_TICKS;
+    ADC1->CR1 &= (uint8_t)~ADC1_CR1_ADON;
+  }
+}
+
+/**
+ * @brief  End of ADC scan: the samples held at start of the scan are loaded
+ *  to the data buffer registers.
+ */
+void Sim_ADC_done(void)
+{
+  volatile uint8_t * preg = &ADC1->DB0RH;
+  uint8_t n;
+
+  for (n = 0; n < SIM_ADC_NR_CH; n++)
+  {
+    preg[0] = (uint8_t)(ADC_latch[n] >> 8);
+    preg[1] = (uint8_t)(ADC_latch[n]);
+    preg += 2;
+  }
+  ADC_done_tm = SIM_NEVER;
+}
+
+
+/* ISR dispatch --------------------------------------------------------------*/
+
+/**
+ * @brief  Start of the PWM timer updates, once the PWM is set up.
+ */
+void Sim_PWM_start(void)
+{
+  PWM_next = Sim_ticks + Sim_PWM_period();
+  PWM_frames = 0;
+}
+
+/**
+ * @brief  Time of the next timer or ADC event.
+ */
+uint32_t Sim_next_event(void)
+{
+  uint32_t t_next = PWM_next;
+
+  if (Sim_TIM3_next_update() < t_next)
+  {
+    t_next = Sim_TIM3_next_update();
+  }
+  if (Sim_TIM3_next_compare() < t_next)
+  {
+    t_next = Sim_TIM3_next_compare();
+  }
+  if (Sim_ADC_next_done() < t_next)
+  {
+    t_next = Sim_ADC_next_done();
+  }
+  return t_next;
+}
+
+/**
+ * @brief  Run the ISRs of the events at the present time, in the order of
+ *  the interrupt priorities (ADC, TIM3 compare, TIM3 update, PWM timer).
+ */
+void Sim_run_ISRs(void)
+{
+  if (Sim_ADC_next_done() == Sim_ticks)
+  {
+    Sim_ADC_done();
+    Driver_on_ADC_conv();
+  }
+  if (Sim_TIM3_next_compare() == Sim_ticks)
+  {
+    // as TIM3_CAP_COM_IRQHandler
+    uint8_t flags = Sim_TIM3_compare();
+
+    if ( 0 != (flags & TIM3_SR1_CC1IF) )
+    {
+      TIM3->SR1 &= ~TIM3_SR1_CC1IF;
+      Driver_on_sector_event(DRIVER_EVT_QTR1);
+    }
+    if ( 0 != (flags & TIM3_SR1_CC2IF) )
+    {
+      TIM3->SR1 &= ~TIM3_SR1_CC2IF;
+      Driver_on_sector_event(DRIVER_EVT_QTR3);
+    }
+  }
+  if (Sim_TIM3_next_update() == Sim_ticks)
+  {
+    Sim_TIM3_update();
+    Driver_Step();
+  }
+  if (PWM_next == Sim_ticks)
+  {
+    PWM_next += Sim_PWM_period();
+
+    if ( ++PWM_frames >= PWM_get_frames_per_upd() )
+    {
+      PWM_frames = 0;
+      Driver_Update();
+    }
+    Driver_on_PWM_edge();
+    Sim_ADC_start();
+  }
+}
+
+
+/* MCU platform --------------------------------------------------------------*/
+
+void MCU_set_comm_timer(uint16_t period)
+{
+  uint8_t running = TIM3->CR1 & TIM3_CR1_CEN;
+
+  SET_REG16( TIM3->ARRH, TIM3->ARRL, period );
+
+  TIM3->IER |= TIM3_IER_UIE;
+  TIM3->CR1 = TIM3_CR1_ARPE | TIM3_CR1_CEN;
+
+  if (0 == running)
+  {
+    TIM3_start = Sim_ticks;
+    TIM3_period = period;
+  }
+}
+
+void MCU_stop_comm_timer(void)
+{
+  TIM3->IER &= (uint8_t)~( TIM3_IER_UIE | TIM3_IER_CC1IE | TIM3_IER_CC2IE );
+  TIM3->CR1 &= (uint8_t)~TIM3_CR1_CEN;
+}
+
+uint16_t MCU_get_comm_timer_count(void)
+{
+  return (uint16_t)(Sim_ticks - TIM3_start);
+}
+
+void MCU_restart_comm_timer(uint16_t count, uint16_t period)
+{
+  TIM3_start = Sim_ticks;
+  TIM3_period = count;
+  TIM3_cc_done = 0;
+
+  SET_REG16( TIM3->ARRH, TIM3->ARRL, period );
+}
+
+void MCU_set_comm_compare(uint8_t chan, uint16_t count)
+{
+  if (0 == chan)
+  {
+    SET_REG16( TIM3->CCR1H, TIM3->CCR1L, count );
+  }
+  else
+  {
+    SET_REG16( TIM3->CCR2H, TIM3->CCR2L, count );
+  }
+}
+
+void MCU_enable_comm_compare(uint8_t chan, uint8_t enable)
+{
+  const uint8_t mask = (0 == chan) ? TIM3_IER_CC1IE : TIM3_IER_CC2IE;
+
+  if (FALSE != enable)
+  {
+    TIM3->SR1 &= (uint8_t)~mask;
+    TIM3->IER |= mask;
+  }
+  else
+  {
+    TIM3->IER &= (uint8_t)~mask;
+  }
+}
+
+void MCU_EEPROM_read(uint8_t offs, uint8_t * pdata, uint8_t nbytes)
+{
+  memcpy(pdata, &EEPROM[offs], nbytes);
+}
+
+void MCU_EEPROM_write(uint8_t offs, const uint8_t * pdata, uint8_t nbytes)
+{
+  memcpy(&EEPROM[offs], pdata, nbytes);
+}
+
+
+/* SPL -----------------------------------------------------------------------*/
+
+void TIM2_DeInit(void)
+{
+  memset((void *)&Sim_TIM1, 0, sizeof(Sim_TIM1));
+  memset((void *)&Sim_TIM2, 0, sizeof(Sim_TIM2));
+}
+
+void TIM2_TimeBaseInit(uint8_t TIM2_Prescaler, uint16_t TIM2_Period)
+{
+  TIM2->PSCR = TIM2_Prescaler;
+  SET_REG16( TIM2->ARRH, TIM2->ARRL, TIM2_Period );
+}
+
+void TIM2_OC1Init(uint8_t OCMode, uint8_t OutputState, uint16_t Pulse, uint8_t OCPolarity)
+{
+  (void)OCMode; (void)OutputState; (void)OCPolarity;
+  TIM2->CCER1 |= TIM2_CCER1_CC1E | TIM2_CCER1_CC1P;
+  SET_REG16( TIM2->CCR1H, TIM2->CCR1L, Pulse );
+}
+
+void TIM2_OC2Init(uint8_t OCMode, uint8_t OutputState, uint16_t Pulse, uint8_t OCPolarity)
+{
+  (void)OCMode; (void)OutputState; (void)OCPolarity;
+  TIM2->CCER1 |= TIM2_CCER1_CC2E | TIM2_CCER1_CC2P;
+  SET_REG16( TIM2->CCR2H, TIM2->CCR2L, Pulse );
+}
+
+void TIM2_OC3Init(uint8_t OCMode, uint8_t OutputState, uint16_t Pulse, uint8_t OCPolarity)
+{
+  (void)OCMode; (void)OutputState; (void)OCPolarity;
+  TIM2->CCER2 |= TIM2_CCER2_CC3E | TIM2_CCER2_CC3P;
+  SET_REG16( TIM2->CCR3H, TIM2->CCR3L, Pulse );
+}
+
+void TIM2_ITConfig(uint8_t TIM2_IT, FunctionalState NewState)
+{
+  if (DISABLE != NewState)
+  {
+    TIM2->IER |= TIM2_IT;
+  }
+  else
+  {
+    TIM2->IER &= (uint8_t)~TIM2_IT;
+  }
+}
+
+void TIM2_Cmd(FunctionalState NewState)
+{
+  (void)NewState; // PWM timer is always running in the simulator
+}
+
+void TIM2_ARRPreloadConfig(FunctionalState NewState)
+{
+  (void)NewState; // the period is applied at the next PWM cycle in the simulator
+}
@@ -0,0 +1,152 @@
+/**
+  ******************************************************************************
+  * @file stm8s.h
+  * @brief Host stand-in for the SPL stm8s.h for the simulator build
+  * @author Neidermeier
+  * @version
+  * @date
+  ******************************************************************************
+  *
+  * Only what is needed by the firmware modules linked into the simulator
+  * (S105_DISCOVERY configuration: TIM2 PWM, TIM3 commutation timer).
+  * The peripheral registers are plain structs in host memory so that the
+  * firmware writes them exactly as on the target, and the simulator reads
+  * them back to drive the motor model.
+  */
+#ifndef STM8S_H
+#define STM8S_H
+
+#include <stdint.h>
+
+/* types ---------------------------------------------------------------------*/
+
+typedef enum {FALSE = 0, TRUE = !FALSE} bool;
+typedef enum {RESET = 0, SET = !RESET} FlagStatus, ITStatus, BitStatus;
+typedef enum {DISABLE = 0, ENABLE = !DISABLE} FunctionalState;
+
+#define U8_MAX     (255)
+#define S8_MAX     (127)
+#define S8_MIN     (-128)
+#define U16_MAX    (65535u)
+#define S16_MAX    (32767)
+#define S16_MIN    (-32768)
+
+#define __IO  volatile
+
+// interrupts are not preemptive in the simulator so the CS is a no-op
+#define enableInterrupts()
+#define disableInterrupts()
+
+/* peripherals ---------------------------------------------------------------*/
+
+typedef struct
+{
+  __IO uint8_t ODR, IDR, DDR, CR1, CR2;
+} GPIO_TypeDef;
+
+// the PWM timer of S105_DEV, the servo input capture of S105_DISCOVERY
+typedef struct
+{
+  __IO uint8_t CR1, CR2, SMCR, ETR, IER, SR1, SR2, EGR, CCMR1, CCMR2, CCMR3, CCMR4;
+  __IO uint8_t CCER1, CCER2, CNTRH, CNTRL, PSCRH, PSCRL, ARRH, ARRL, RCR;
+  __IO uint8_t CCR1H, CCR1L, CCR2H, CCR2L, CCR3H, CCR3L, CCR4H, CCR4L;
+} TIM1_TypeDef;
+
+typedef struct
+{
+  __IO uint8_t CR1, IER, SR1, SR2, EGR, CCMR1, CCMR2, CCMR3, CCER1, CCER2;
+  __IO uint8_t CNTRH, CNTRL, PSCR, ARRH, ARRL;
+  __IO uint8_t CCR1H, CCR1L, CCR2H, CCR2L, CCR3H, CCR3L;
+} TIM2_TypeDef;
+
+typedef struct
+{
+  __IO uint8_t CR1, IER, SR1, SR2, EGR, CCMR1, CCMR2, CCER1;
+  __IO uint8_t CNTRH, CNTRL, PSCR, ARRH, ARRL;
+  __IO uint8_t CCR1H, CCR1L, CCR2H, CCR2L;
+} TIM3_TypeDef;
+
+typedef struct
+{
+  __IO uint8_t DB0RH, DB0RL, DB1RH, DB1RL, DB2RH, DB2RL, DB3RH, DB3RL;
+  __IO uint8_t DB4RH, DB4RL, DB5RH, DB5RL, DB6RH, DB6RL, DB7RH, DB7RL;
+  __IO uint8_t DB8RH, DB8RL, DB9RH, DB9RL;
+  uint8_t RESERVED[12];
+  __IO uint8_t CSR, CR1, CR2, CR3, DRH, DRL;
+} ADC1_TypeDef;
+
+extern GPIO_TypeDef Sim_GPIOA, Sim_GPIOB, Sim_GPIOC, Sim_GPIOD, Sim_GPIOE;
+extern TIM1_TypeDef Sim_TIM1;
+extern TIM2_TypeDef Sim_TIM2;
+extern TIM3_TypeDef Sim_TIM3;
+extern ADC1_TypeDef Sim_ADC1;
+
+#define GPIOA  (&Sim_GPIOA)
+#define GPIOB  (&Sim_GPIOB)
+#define GPIOC  (&Sim_GPIOC)
+#define GPIOD  (&Sim_GPIOD)
+#define GPIOE  (&Sim_GPIOE)
+#define TIM1   (&Sim_TIM1)
+#define TIM2   (&Sim_TIM2)
+#define TIM3   (&Sim_TIM3)
+#define ADC1   (&Sim_ADC1)
+
+/* register bits -------------------------------------------------------------*/
+
+#define TIM1_SR1_UIF     ((uint8_t)0x01)
+#define TIM1_SR1_CC3IF   ((uint8_t)0x08)
+#define TIM1_SR1_CC4IF   ((uint8_t)0x10)
+
+#define TIM2_CCER1_CC1E  ((uint8_t)0x01)
+#define TIM2_CCER1_CC1P  ((uint8_t)0x02)
+#define TIM2_CCER1_CC2E  ((uint8_t)0x10)
+#define TIM2_CCER1_CC2P  ((uint8_t)0x20)
+#define TIM2_CCER2_CC3E  ((uint8_t)0x01)
+#define TIM2_CCER2_CC3P  ((uint8_t)0x02)
+
+#define TIM3_CR1_CEN     ((uint8_t)0x01)
+#define TIM3_CR1_URS     ((uint8_t)0x04)
+#define TIM3_CR1_ARPE    ((uint8_t)0x80)
+#define TIM3_IER_UIE     ((uint8_t)0x01)
+#define TIM3_IER_CC1IE   ((uint8_t)0x02)
+#define TIM3_IER_CC2IE   ((uint8_t)0x04)
+#define TIM3_SR1_UIF     ((uint8_t)0x01)
+#define TIM3_SR1_CC1IF   ((uint8_t)0x02)
+#define TIM3_SR1_CC2IF   ((uint8_t)0x04)
+#define TIM3_EGR_UG      ((uint8_t)0x01)
+
+#define ADC1_CR1_ADON    ((uint8_t)0x01)
+
+/* SPL ----------------------------------------------------------------------*/
+
+typedef enum
+{
+  GPIO_PIN_0 = 0x01, GPIO_PIN_1 = 0x02, GPIO_PIN_2 = 0x04, GPIO_PIN_3 = 0x08,
+  GPIO_PIN_4 = 0x10, GPIO_PIN_5 = 0x20, GPIO_PIN_6 = 0x40, GPIO_PIN_7 = 0x80
+} GPIO_Pin_TypeDef;
+
+typedef enum
+{
+  TIM2_CHANNEL_1 = 0, TIM2_CHANNEL_2 = 1, TIM2_CHANNEL_3 = 2
+} TIM2_Channel_TypeDef;
+
+#define TIM2_PRESCALER_4         ((uint8_t)0x02)
+#define TIM2_PRESCALER_8         ((uint8_t)0x03)
+#define TIM2_OCMODE_PWM2         ((uint8_t)0x70)
+#define TIM2_OUTPUTSTATE_ENABLE  ((uint8_t)0x11)
+#define TIM2_OCPOLARITY_LOW      ((uint8_t)0x22)
+#define TIM2_IT_UPDATE           ((uint8_t)0x01)
+
+#define CLK_PERIPHERAL_TIMER1    ((uint8_t)0x07)
+
+void TIM2_DeInit(void);
+void TIM2_TimeBaseInit(uint8_t TIM2_Prescaler, uint16_t TIM2_Period);
+void TIM2_OC1Init(uint8_t OCMode, uint8_t OutputState, uint16_t Pulse, uint8_t OCPolarity);
+void TIM2_OC2Init(uint8_t OCMode, uint8_t OutputState, uint16_t Pulse, uint8_t OCPolarity);
+void TIM2_OC3Init(uint8_t OCMode, uint8_t OutputState, uint16_t Pulse, uint8_t OCPolarity);
+void TIM2_ITConfig(uint8_t TIM2_IT, FunctionalState NewState);
+void TIM2_Cmd(FunctionalState NewState);
+void TIM2_ARRPreloadConfig(FunctionalState NewState);
+
+
+#endif // STM8S_H
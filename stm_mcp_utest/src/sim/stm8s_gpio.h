@@ -0,0 +1,4 @@
+/*
+ * simulator build: GPIO declarations are in the stm8s.h stand-in
+ */
+#include "stm8s.h"
@@ -0,0 +1,315 @@
+/**
+  ******************************************************************************
+  * @file utest.c
+  * @brief Host unit tests of the firmware modules that do not need the motor
+  *  model: the parameter record (param) and the terminal command line (cmd)
+  * @author Neidermeier
+  * @version
+  * @date
+  ******************************************************************************
+  *
+  * The modules are compiled as for the simulator, the data EEPROM is the one
+  * of sim_hal.c. The records are made by Param_save and then altered in place
+  * so the test does not depend on the layout beyond the header, the values and
+  * the CRC8 that follows them.
+  *
+  *  usage:  utest [-v]
+  *    -v  print each check
+  *
+  * Exit status is 1 if any check failed.
+  */
+#include <stdio.h>
+#include <string.h>
+
+#include "system.h"
+#include "cmd.h"
+#include "param.h"
+#include "telem.h"   // Telem_crc8
+#include "mcu_stm8s.h"
+
+#include "sim.h"
+
+
+/* defines -------------------------------------------------------------------*/
+
+// record: magic, count, the values, CRC8 (as param.c)
+#define REC_HDR_SZ     2
+#define REC_SZ( _N_ )  ( REC_HDR_SZ + (_N_) * sizeof(uint16_t) + 1 )
+
+#define CHECK( _C_ )  check( (_C_), #_C_, __LINE__ )
+
+
+/* variables -----------------------------------------------------------------*/
+
+static int Verbose;
+static unsigned Nr_checks;
+static unsigned Nr_fails;
+
+static uint8_t Rec[ REC_SZ( PARAM_NR ) ];
+
+
+/* functions -----------------------------------------------------------------*/
+
+/*
+ * host stub of the ADC input, the ISRs are not run by the unit tests
+ */
+uint16_t Sim_ADC_sample(uint8_t channel)
+{
+  (void)channel;
+  return 0;
+}
+
+static void check(int cond, const char * pexpr, int line)
+{
+  Nr_checks += 1;
+
+  if (0 == cond)
+  {
+    Nr_fails += 1;
+    fprintf(stderr, "utest.c:%d: check failed: %s\n", line, pexpr);
+  }
+  else if (0 != Verbose)
+  {
+    printf("ok %s\n", pexpr);
+  }
+}
+
+/* param ---------------------------------------------------------------------*/
+
+static uint16_t rec_val(uint8_t id)
+{
+  uint16_t val;
+
+  memcpy(&val, &Rec[ REC_HDR_SZ + id * sizeof(uint16_t) ], sizeof(val));
+  return val;
+}
+
+static void rec_set_val(uint8_t id, uint16_t val)
+{
+  memcpy(&Rec[ REC_HDR_SZ + id * sizeof(uint16_t) ], &val, sizeof(val));
+}
+
+/*
+ * Write the record of count values back to the EEPROM, with a valid CRC
+ */
+static void rec_write(uint8_t count)
+{
+  uint8_t sz = (uint8_t)REC_SZ( count );
+
+  Rec[1] = count;
+  Rec[ sz - 1 ] = Telem_crc8(Rec, (uint8_t)( sz - 1 ));
+  MCU_EEPROM_write(EE_PARAM_OFFS, Rec, sz);
+}
+
+static void rec_erase(void)
+{
+  memset(Rec, 0, sizeof(Rec));
+  MCU_EEPROM_write(EE_PARAM_OFFS, Rec, sizeof(Rec));
+}
+
+static int param_is_default(uint8_t id, uint16_t def)
+{
+  return Param_get( (param_ID_t)id ) == def;
+}
+
+static void test_param(void)
+{
+  uint16_t def[ PARAM_NR ];
+  uint16_t startup;
+  uint16_t shutoff;
+  uint8_t n;
+
+  // erased record, all defaults
+  rec_erase();
+  Param_load();
+
+  for (n = 0; n < PARAM_NR; n++)
+  {
+    def[n] = Param_get( (param_ID_t)n );
+  }
+  startup = def[ PARAM_DC_STARTUP ];
+  shutoff = def[ PARAM_DC_SHUTOFF ];
+  CHECK( shutoff < startup );
+
+  // the shutoff has to stay below the startup
+  CHECK( FALSE == Param_set( PARAM_DC_SHUTOFF, startup ) );
+  CHECK( FALSE == Param_set( PARAM_DC_SHUTOFF, startup + 1 ) );
+  CHECK( FALSE == Param_set( PARAM_DC_STARTUP, shutoff ) );
+  CHECK( param_is_default( PARAM_DC_STARTUP, startup ) );
+  CHECK( param_is_default( PARAM_DC_SHUTOFF, shutoff ) );
+  CHECK( TRUE == Param_set( PARAM_DC_SHUTOFF, startup - 1 ) );
+  CHECK( TRUE == Param_set( PARAM_DC_SHUTOFF, shutoff ) );
+
+  // out of range and invalid ID
+  CHECK( FALSE == Param_set( PARAM_BRAKE_MODE, BRAKE_COMPL + 1 ) );
+  CHECK( FALSE == Param_set( PARAM_NR, 0 ) );
+  CHECK( 0 == Param_get( PARAM_NR ) );
+
+  // round trip of a record with non-default values at both ends
+  CHECK( TRUE == Param_set( PARAM_DC_STARTUP, startup + 1 ) );
+  CHECK( TRUE == Param_set( PARAM_PI_KP, def[ PARAM_PI_KP ] + 1 ) );
+  CHECK( TRUE == Param_set( PARAM_SPI_ADDR, def[ PARAM_SPI_ADDR ] + 1 ) );
+  CHECK( FALSE == Param_save() ); // not requested
+  Param_commit();
+  CHECK( TRUE == Param_save() );
+  CHECK( FALSE == Param_save() ); // once per request
+  MCU_EEPROM_read(EE_PARAM_OFFS, Rec, sizeof(Rec));
+
+  Param_load();
+  CHECK( Param_get( PARAM_DC_STARTUP ) == startup + 1 );
+  CHECK( Param_get( PARAM_PI_KP ) == def[ PARAM_PI_KP ] + 1 );
+  CHECK( Param_get( PARAM_SPI_ADDR ) == def[ PARAM_SPI_ADDR ] + 1 );
+
+  // corrupt value, the CRC does not match and the record is discarded
+  rec_set_val( PARAM_PI_KP, rec_val( PARAM_PI_KP ) ^ 0x0001 );
+  MCU_EEPROM_write(EE_PARAM_OFFS, Rec, sizeof(Rec));
+  Param_load();
+  CHECK( param_is_default( PARAM_DC_STARTUP, startup ) );
+  CHECK( param_is_default( PARAM_PI_KP, def[ PARAM_PI_KP ] ) );
+  CHECK( param_is_default( PARAM_SPI_ADDR, def[ PARAM_SPI_ADDR ] ) );
+  rec_set_val( PARAM_PI_KP, rec_val( PARAM_PI_KP ) ^ 0x0001 );
+
+  // corrupt CRC
+  rec_write( PARAM_NR );
+  Rec[ REC_SZ( PARAM_NR ) - 1 ] ^= 0x80;
+  MCU_EEPROM_write(EE_PARAM_OFFS, Rec, sizeof(Rec));
+  Param_load();
+  CHECK( param_is_default( PARAM_PI_KP, def[ PARAM_PI_KP ] ) );
+
+  // magic of another format, with a valid CRC
+  Rec[0] ^= 0x0F;
+  rec_write( PARAM_NR );
+  Param_load();
+  CHECK( param_is_default( PARAM_PI_KP, def[ PARAM_PI_KP ] ) );
+  Rec[0] ^= 0x0F;
+
+  // more values than this build has
+  rec_write( PARAM_NR );
+  Rec[1] = PARAM_NR + 1;
+  MCU_EEPROM_write(EE_PARAM_OFFS, Rec, sizeof(Rec));
+  Param_load();
+  CHECK( param_is_default( PARAM_PI_KP, def[ PARAM_PI_KP ] ) );
+
+  // short record of a previous build, the added parameter is defaulted
+  rec_write( PARAM_SPI_ADDR );
+  Param_load();
+  CHECK( Param_get( PARAM_DC_STARTUP ) == startup + 1 );
+  CHECK( Param_get( PARAM_PI_KP ) == def[ PARAM_PI_KP ] + 1 );
+  CHECK( param_is_default( PARAM_SPI_ADDR, def[ PARAM_SPI_ADDR ] ) );
+
+  // value out of range in a valid record, only that one is defaulted
+  rec_set_val( PARAM_BRAKE_MODE, BRAKE_COMPL + 1 );
+  rec_write( PARAM_NR );
+  Param_load();
+  CHECK( param_is_default( PARAM_BRAKE_MODE, def[ PARAM_BRAKE_MODE ] ) );
+  CHECK( Param_get( PARAM_PI_KP ) == def[ PARAM_PI_KP ] + 1 );
+  rec_set_val( PARAM_BRAKE_MODE, def[ PARAM_BRAKE_MODE ] );
+
+  // duty-cycle limits in range but not valid together, both are defaulted
+  rec_set_val( PARAM_DC_SHUTOFF, rec_val( PARAM_DC_STARTUP ) );
+  rec_write( PARAM_NR );
+  Param_load();
+  CHECK( param_is_default( PARAM_DC_STARTUP, startup ) );
+  CHECK( param_is_default( PARAM_DC_SHUTOFF, shutoff ) );
+  CHECK( Param_get( PARAM_PI_KP ) == def[ PARAM_PI_KP ] + 1 );
+
+  rec_erase();
+  Param_load();
+}
+
+/* cmd -----------------------------------------------------------------------*/
+
+/*
+ * Input a string to the parser, the status is of the last character
+ */
+static cmd_status_t cmd_line(const char * pstr, cmd_t * pcmd)
+{
+  cmd_status_t status = CMD_KEY;
+
+  memset(pcmd, 0, sizeof(*pcmd));
+
+  while ('\0' != *pstr)
+  {
+    status = Cmd_input(*pstr, pcmd);
+    pstr += 1;
+  }
+  return status;
+}
+
+static void test_cmd(void)
+{
+  cmd_t cmd;
+
+  // outside of a line, a key
+  CHECK( CMD_KEY == cmd_line("a", &cmd) );
+  CHECK( CMD_BUSY == cmd_line(":", &cmd) );
+  CHECK( CMD_ERROR == cmd_line("\r", &cmd) ); // no code
+
+  // code only, the code is upper-cased
+  CHECK( CMD_READY == cmd_line(":r\n", &cmd) );
+  CHECK( 'R' == cmd.code && 0 == cmd.argc );
+
+  // decimal and hex arguments, CR or LF
+  CHECK( CMD_READY == cmd_line(":s 100\r", &cmd) );
+  CHECK( 'S' == cmd.code && 1 == cmd.argc && 100 == cmd.argv[0] );
+  CHECK( CMD_READY == cmd_line(":P 0x1f 65535\n", &cmd) );
+  CHECK( 'P' == cmd.code && 2 == cmd.argc );
+  CHECK( 0x1F == cmd.argv[0] && 65535 == cmd.argv[1] );
+  CHECK( CMD_READY == cmd_line(":p  0XFFFF  0 \r", &cmd) );
+  CHECK( 2 == cmd.argc && 0xFFFF == cmd.argv[0] && 0 == cmd.argv[1] );
+
+  // overflow of the 16-bit argument
+  CHECK( CMD_ERROR == cmd_line(":s 65536\r", &cmd) );
+  CHECK( CMD_ERROR == cmd_line(":s 0x10000\r", &cmd) );
+  CHECK( CMD_ERROR == cmd_line(":s 99999\r", &cmd) );
+
+  // not a number
+  CHECK( CMD_ERROR == cmd_line(":s 12z\r", &cmd) );
+  CHECK( CMD_ERROR == cmd_line(":s 0x\r", &cmd) );
+  CHECK( CMD_ERROR == cmd_line(":s 1f\r", &cmd) );
+  CHECK( CMD_ERROR == cmd_line(":1\r", &cmd) );
+
+  // too many arguments
+  CHECK( CMD_ERROR == cmd_line(":p 1 2 3\r", &cmd) );
+
+  // ESC cancels the line, the next character is a key again
+  CHECK( CMD_BUSY == cmd_line(":s 12\x1B", &cmd) );
+  CHECK( CMD_KEY == cmd_line("a", &cmd) );
+  CHECK( CMD_BUSY == cmd_line(":p 1 2 3\x1B", &cmd) );
+  CHECK( CMD_KEY == cmd_line("\r", &cmd) );
+
+  // after an error the parser is back out of the line
+  CHECK( CMD_READY == cmd_line(":s 7\r", &cmd) );
+  CHECK( 'S' == cmd.code && 1 == cmd.argc && 7 == cmd.argv[0] );
+}
+
+
+int main(int argc, char **argv)
+{
+  int n;
+
+  for (n = 1; n < argc; n++)
+  {
+    if ('-' == argv[n][0] && 'v' == argv[n][1])
+    {
+      Verbose = 1;
+    }
+    else
+    {
+      fprintf(stderr, "unknown option %s\n", argv[n]);
+      return 2;
+    }
+  }
+
+  Sim_hal_init();
+
+  test_param();
+  test_cmd();
+
+  n = ( 0 != Nr_fails );
+
+  fprintf(stderr, "utest checks %u  failed %u  %s\n",
+          Nr_checks, Nr_fails, n ? "FAIL" : "PASS");
+
+  return n;
+}
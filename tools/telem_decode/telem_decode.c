@@ -0,0 +1,113 @@
+/**
+  ******************************************************************************
+  * @file telem_decode.c
+  * @brief Host-side decoder for the binary telemetry frames
+  * @author Neidermeier
+  * @version
+  * @date
+  ******************************************************************************
+  *
+  * Reads the raw serial stream (file or stdin) and prints one CSV line per
+  * valid frame. Frames failing CRC are skipped and counted, and the decoder
+  * re-synchronizes on the next sync byte.
+  *
+  *  usage:  telem_decode [capture.bin]
+  *  e.g.:   stty -F /dev/ttyUSB0 115200 raw && telem_decode < /dev/ttyUSB0
+  */
+#include <stdio.h>
+#include <stdint.h>
+
+#include "telem.h"
+
+#define GET_U16( _P_ )  (uint16_t)((_P_)[0] | ((_P_)[1] << 8))
+
+
+static void print_frame(const uint8_t * pframe)
+{
+  printf("%u,%u,%u,%u,0x%02X,%u,%u,%d,%u\n",
+         pframe[1],
+         GET_U16( &pframe[2] ),
+         GET_U16( &pframe[4] ),
+         GET_U16( &pframe[6] ),
+         pframe[8],
+         GET_U16( &pframe[9] ),
+         GET_U16( &pframe[11] ),
+         (int16_t)GET_U16( &pframe[13] ),
+         GET_U16( &pframe[15] ) * 10u);
+}
+
+int main(int argc, char **argv)
+{
+  uint8_t frame[ TELEM_FRAME_SZ ];
+  int nbytes = 0;
+  int c;
+  unsigned int nr_good = 0;
+  unsigned int nr_bad = 0;
+  unsigned int nr_lost = 0;
+  int last_seq = -1;
+
+  FILE * fp = stdin;
+
+  if (argc > 1)
+  {
+    fp = fopen(argv[1], "rb");
+    if (NULL == fp)
+    {
+      perror(argv[1]);
+      return 1;
+    }
+  }
+
+  printf("seq,comm_period,pwm_dc,vsystem,faults,bemf_r,bemf_f,timing_error,erpm\n");
+
+  while (EOF != (c = fgetc(fp)))
+  {
+    if (0 == nbytes && TELEM_SYNC != c)
+    {
+      continue; // hunt for sync
+    }
+    frame[nbytes++] = (uint8_t)c;
+
+    if (TELEM_FRAME_SZ == nbytes)
+    {
+      nbytes = 0;
+
+      if (Telem_crc8(frame, TELEM_FRAME_SZ - 1) == frame[TELEM_FRAME_SZ - 1])
+      {
+        if (last_seq >= 0)
+        {
+          nr_lost += (uint8_t)(frame[1] - last_seq - 1);
+        }
+        last_seq = frame[1];
+        nr_good += 1;
+        print_frame(frame);
+      }
+      else
+      {
+        int n;
+        nr_bad += 1;
+        // re-sync: restart from the next sync byte inside the rejected frame
+        for (n = 1; n < TELEM_FRAME_SZ; n++)
+        {
+          if (TELEM_SYNC == frame[n])
+          {
+            int m;
+            for (m = n; m < TELEM_FRAME_SZ; m++)
+            {
+              frame[nbytes++] = frame[m];
+            }
+            break;
+          }
+        }
+      }
+    }
+  }
+
+  fprintf(stderr, "frames: %u  crc errors: %u  lost: %u\n", nr_good, nr_bad, nr_lost);
+
+  if (stdin != fp)
+  {
+    fclose(fp);
+  }
+  return 0;
+}